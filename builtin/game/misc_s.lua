@@ -133,6 +133,7 @@ core.protocol_versions = {
 	["5.13.0"] = 49,
 	["5.14.0"] = 50,
 	["5.15.0"] = 51,
+	["5.16.0"] = 52,
 }
 
 setmetatable(core.protocol_versions, {__newindex = function()
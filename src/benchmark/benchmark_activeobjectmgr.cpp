@@ -4,6 +4,7 @@
 #include "catch.h"
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
+#include "constants.h"
 
 namespace {
 
@@ -97,6 +98,50 @@ void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
 	mgr.clear(); // implementation expects this
 }
 
+// Keeps the objects in range of a number of players up to date while
+// a part of the objects wander around, like Server::AsyncRunStep does
+template <size_t N>
+void benchObjectsInRange(Catch::Benchmark::Chronometer &meter)
+{
+	constexpr size_t PLAYERS = 50;
+	constexpr float RADIUS = 8 * MAP_BLOCKSIZE * BS;
+	server::ActiveObjectMgr mgr;
+	fill(mgr, N);
+
+	std::vector<u16> ids;
+	for (u16 id = 1; ids.size() < N; id++) {
+		if (mgr.getActiveObject(id))
+			ids.push_back(id);
+	}
+
+	v3f player_pos[PLAYERS];
+	server::ObjectsInRange in_range[PLAYERS];
+	for (auto &pos : player_pos)
+		pos = randpos();
+
+	std::vector<u16> result;
+	meter.measure([&] {
+		for (size_t i = 0; i < N / 10; i++) {
+			u16 id = ids[myrand_range(0, N - 1)];
+			ServerActiveObject *obj = mgr.getActiveObject(id);
+			v3f pos = obj->getBasePosition() + v3f(myrand_range(-5, 5),
+					0, myrand_range(-5, 5));
+			obj->setPos(pos);
+			mgr.updateObjectPos(id, pos);
+		}
+		size_t x = 0;
+		for (size_t i = 0; i < PLAYERS; i++) {
+			result.clear();
+			mgr.getActiveObjectsInRange(player_pos[i], "singleplayer",
+					RADIUS, 0, in_range[i], result);
+			x += result.size();
+		}
+		return x;
+	});
+
+	mgr.clear(); // implementation expects this
+}
+
 #define BENCH_INSIDE_RADIUS(_count) \
 	BENCHMARK_ADVANCED("inside_radius_" #_count)(Catch::Benchmark::Chronometer meter) \
 	{ benchGetObjectsInsideRadius<_count>(meter); };
@@ -105,6 +150,10 @@ void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
 	BENCHMARK_ADVANCED("in_area_" #_count)(Catch::Benchmark::Chronometer meter) \
 	{ benchGetObjectsInArea<_count>(meter); };
 
+#define BENCH_IN_RANGE(_count) \
+	BENCHMARK_ADVANCED("objects_in_range_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchObjectsInRange<_count>(meter); };
+
 TEST_CASE("ActiveObjectMgr") {
 	BENCH_INSIDE_RADIUS(200)
 	BENCH_INSIDE_RADIUS(1450)
@@ -113,6 +162,7 @@ TEST_CASE("ActiveObjectMgr") {
 	BENCH_IN_AREA(200)
 	BENCH_IN_AREA(1450)
 	BENCH_IN_AREA(10000)
-}
 
-// TODO benchmark active object manager update costs
+	BENCH_IN_RANGE(1450)
+	BENCH_IN_RANGE(5000)
+}
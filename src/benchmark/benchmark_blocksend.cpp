@@ -0,0 +1,79 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "benchmark_throughput.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "serialization.h"
+#include "threading/worker_pool.h"
+#include <memory>
+#include <sstream>
+#include <vector>
+
+// Mimics the compression stage of Server::SendBlocks()
+
+static constexpr u32 NUM_BLOCKS = 256;
+
+static void fillBlocks(std::vector<std::unique_ptr<MapBlock>> &blocks)
+{
+	PcgRandom pr(1337);
+	for (u32 i = 0; i < NUM_BLOCKS; i++) {
+		auto block = std::make_unique<MapBlock>(v3s16(i, 0, 0), nullptr);
+		// layers with some noise, roughly like terrain
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+			content_t c = p.Y < 8 ? 10 + p.Y / 2 : CONTENT_AIR;
+			if (pr.range(0, 15) == 0)
+				c = pr.range(10, 30);
+			block->setNodeNoCheck(p, MapNode(c, pr.range(0, 15), 0));
+		}
+		blocks.push_back(std::move(block));
+	}
+}
+
+static std::vector<std::string> snapshotBlocks(
+	const std::vector<std::unique_ptr<MapBlock>> &blocks)
+{
+	std::vector<std::string> ret;
+	ret.reserve(blocks.size());
+	for (auto &block : blocks) {
+		std::ostringstream os(std::ios_base::binary);
+		block->serializeUncompressed(os, SER_FMT_VER_HIGHEST_WRITE, false);
+		ret.push_back(os.str());
+	}
+	return ret;
+}
+
+static size_t compressAll(WorkerPool &pool, const std::vector<std::string> &raw)
+{
+	std::vector<std::string> out(raw.size());
+	pool.run(raw.size(), [&] (size_t i) {
+		std::ostringstream os(std::ios_base::binary);
+		compress(raw[i], os, SER_FMT_VER_HIGHEST_WRITE);
+		out[i] = os.str();
+	});
+	size_t total = 0;
+	for (auto &s : out)
+		total += s.size();
+	return total;
+}
+
+TEST_CASE("benchmark_blocksend")
+{
+	std::vector<std::unique_ptr<MapBlock>> blocks;
+	fillBlocks(blocks);
+
+	benchmarkThroughput("snapshot_256_blocks", NUM_BLOCKS, "blocks",
+		[&] { return snapshotBlocks(blocks).size(); });
+
+	const auto raw = snapshotBlocks(blocks);
+
+	for (u32 threads : {1, 4, 16}) {
+		WorkerPool pool("BenchSend", threads - 1);
+		benchmarkThroughput("compress_" + std::to_string(threads) + "_threads",
+			NUM_BLOCKS, "blocks", [&] { return compressAll(pool, raw); });
+	}
+}
@@ -0,0 +1,70 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "benchmark_throughput.h"
+#include "emerge_queue.h"
+#include "noise.h"
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Mimics emerge threads working through a burst of requests, like when a
+// player flies into new terrain: most chunks need to be generated, the rest
+// is already on disk and cheap. Generating is approximated by the 3D noise
+// a typical mapgen computes per chunk.
+
+static constexpr u32 NUM_CHUNKS = 64;
+static constexpr u32 CHUNK_SIZE = 40;
+
+static const NoiseParams np_terrain(0, 1, v3f(250, 250, 250), 5934, 4, 0.6f, 2.0f);
+
+static u32 emergeChunks(u32 num_threads)
+{
+	EmergeQueue queue;
+	queue.setQueueCount(num_threads);
+	std::mutex queue_mutex;
+
+	// Assigned round-robin up front, priority is the distance to the player
+	for (u32 i = 0; i < NUM_CHUNKS; i++)
+		queue.push(v3s16(i, 0, 0), i / 4, i % num_threads);
+
+	std::vector<u32> generated(num_threads, 0);
+	auto work = [&] (u32 id) {
+		Noise noise(&np_terrain, 1337, CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+		while (true) {
+			v3s16 pos;
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				if (!queue.pop(id, pos))
+					break;
+			}
+			// every third chunk comes from disk
+			if (pos.X % 3 == 0)
+				continue;
+			noise.noiseMap3D(pos.X * CHUNK_SIZE, 0, 0);
+			generated[id]++;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (u32 i = 1; i < num_threads; i++)
+		threads.emplace_back(work, i);
+	work(0);
+	for (auto &thread : threads)
+		thread.join();
+
+	u32 total = 0;
+	for (u32 n : generated)
+		total += n;
+	return total;
+}
+
+TEST_CASE("benchmark_emerge")
+{
+	for (u32 threads : {1, 2, 4, 8, 16}) {
+		benchmarkThroughput("emerge_" + std::to_string(threads) + "_threads",
+			NUM_CHUNKS, "chunks", [=] { return emergeChunks(threads); });
+	}
+}
@@ -0,0 +1,135 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "benchmark_throughput.h"
+#include "dummygamedef.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "serialization.h"
+#include "server/blockmodifier.h"
+#include <memory>
+#include <sstream>
+#include <vector>
+
+// Mimics what ServerEnvironment::activateBlock() does with the blocks
+// loaded from disk: deserialize them, then apply the LBMs
+
+static constexpr u32 NUM_BLOCKS = 256;
+static constexpr u32 NUM_NODES = 40;
+
+namespace {
+struct CountingLBM : LoadingBlockModifierDef {
+	u32 &count;
+
+	CountingLBM(const std::string &name, const std::string &node, u32 &count) :
+		count(count)
+	{
+		this->name = name;
+		trigger_contents.push_back(node);
+	}
+
+	void trigger(ServerEnvironment *env, MapBlock *block,
+		const std::unordered_set<v3s16> &positions, float dtime_s) override
+	{
+		count += positions.size();
+	}
+};
+
+struct LBMWorld {
+	DummyGameDef gamedef;
+	std::vector<content_t> ids;
+
+	LBMWorld()
+	{
+		NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+		for (u32 i = 0; i < NUM_NODES; i++) {
+			ContentFeatures f;
+			f.name = "bench:node_" + std::to_string(i);
+			ids.push_back(ndef->set(f.name, f));
+		}
+		ndef->resolveCrossrefs();
+	}
+
+	// Layers with some noise, roughly like terrain
+	std::vector<std::string> makeBlocks()
+	{
+		PcgRandom pr(1337);
+		std::vector<std::string> ret;
+		for (u32 i = 0; i < NUM_BLOCKS; i++) {
+			MapBlock block(v3s16(i, 0, 0), &gamedef);
+			v3s16 p;
+			for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+			for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+			for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+				content_t c = p.Y < 8 ? ids[p.Y / 2] : CONTENT_AIR;
+				if (pr.range(0, 15) == 0)
+					c = ids[pr.range(4, 15)];
+				block.setNodeNoCheck(p, MapNode(c));
+			}
+			block.setTimestampNoChangedFlag(100);
+			std::ostringstream os(std::ios_base::binary);
+			block.serialize(os, SER_FMT_VER_HIGHEST_WRITE, true, -1);
+			ret.push_back(os.str());
+		}
+		return ret;
+	}
+};
+}
+
+// LBMs introduced at three different times, triggering on `first` and later nodes
+static void addLBMs(LBMManager &mgr, u32 first, u32 &count)
+{
+	for (u32 i = 0; i < 12; i++) {
+		mgr.addLBMDef(new CountingLBM("bench:lbm_" + std::to_string(i),
+			"bench:node_" + std::to_string(first + i), count));
+	}
+}
+
+static u32 activateBlocks(LBMWorld &world, LBMManager &mgr,
+	const std::vector<std::string> &blocks)
+{
+	u32 n = 0;
+	for (auto &data : blocks) {
+		MapBlock block(v3s16(0, 0, 0), &world.gamedef);
+		std::istringstream is(data, std::ios_base::binary);
+		block.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true);
+		mgr.applyLBMs(nullptr, &block, block.getTimestamp(), 0);
+		n += block.getContents().size();
+	}
+	return n;
+}
+
+TEST_CASE("benchmark_lbm")
+{
+	LBMWorld world;
+	const auto blocks = world.makeBlocks();
+	const std::string times = "bench:lbm_0~50;bench:lbm_1~50;bench:lbm_2~150;"
+		"bench:lbm_3~150;bench:lbm_4~200;";
+
+	{
+		LBMManager mgr;
+		mgr.loadIntroductionTimes("", &world.gamedef, 300);
+		benchmarkThroughput("activate_256_blocks_no_lbms", NUM_BLOCKS, "blocks",
+			[&] { return activateBlocks(world, mgr, blocks); });
+	}
+
+	// None of the LBMs triggers on the nodes in the blocks
+	{
+		LBMManager mgr;
+		u32 count = 0;
+		addLBMs(mgr, 20, count);
+		mgr.loadIntroductionTimes(times, &world.gamedef, 300);
+		benchmarkThroughput("activate_256_blocks_unused_lbms", NUM_BLOCKS, "blocks",
+			[&] { return activateBlocks(world, mgr, blocks); });
+	}
+
+	{
+		LBMManager mgr;
+		u32 count = 0;
+		addLBMs(mgr, 0, count);
+		mgr.loadIntroductionTimes(times, &world.gamedef, 300);
+		benchmarkThroughput("activate_256_blocks_used_lbms", NUM_BLOCKS, "blocks",
+			[&] { return activateBlocks(world, mgr, blocks) + count; });
+	}
+}
@@ -0,0 +1,109 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "benchmark_throughput.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "server/liquidtransform.h"
+#include "threading/worker_pool.h"
+#include "util/container.h"
+
+// Floods 8 floors of 128x128 nodes (~130k nodes) from a grid of sources and
+// measures how long it takes until the liquid settles. This runs the same
+// loop as ServerMap::transformLiquidsLocal(), minus the callbacks. Without
+// threads it updates one node at a time, which is the baseline.
+
+namespace {
+
+struct FloodWorld {
+	DummyGameDef gamedef;
+	content_t c_stone, c_source;
+	DummyMap map;
+
+	FloodWorld() : map(&gamedef, v3s16(-4, -1, -4), v3s16(3, 1, 3))
+	{
+		NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+		ContentFeatures f;
+		f.name = "stone";
+		c_stone = ndef->set(f.name, f);
+
+		f = ContentFeatures();
+		f.name = "water_source";
+		f.liquid_type = LIQUID_SOURCE;
+		f.liquid_alternative_source = "water_source";
+		f.liquid_alternative_flowing = "water_flowing";
+		c_source = ndef->set(f.name, f);
+
+		f.name = "water_flowing";
+		f.liquid_type = LIQUID_FLOWING;
+		f.param_type_2 = CPT2_FLOWINGLIQUID;
+		ndef->set(f.name, f);
+		ndef->resolveCrossrefs();
+	}
+
+	void reset(UniqueQueue<v3s16> &queue)
+	{
+		map.fill(v3s16(-4, -1, -4), v3s16(3, -1, 3), MapNode(c_stone));
+		map.fill(v3s16(-4, 0, -4), v3s16(3, 1, 3), MapNode(CONTENT_AIR));
+		for (s16 y = 0; y < 32; y += 4) {
+			for (s16 z = -64; z < 64; z++)
+			for (s16 x = -64; x < 64; x++)
+				map.setNode(v3s16(x, y + 3, z), MapNode(c_stone));
+			for (s16 z = -60; z < 64; z += 8)
+			for (s16 x = -60; x < 64; x += 8) {
+				map.setNode(v3s16(x, y, z), MapNode(c_source));
+				queue.push_back(v3s16(x, y, z));
+			}
+		}
+	}
+
+	u32 settle(UniqueQueue<v3s16> &queue, WorkerPool *pool)
+	{
+		LiquidTransformer transformer(gamedef.getNodeDefManager(), pool);
+		u32 changes = 0;
+		while (!queue.empty()) {
+			transformer.run(&map, queue, U32_MAX, [&] (const LiquidUpdate &u) {
+				map.setNode(u.p, u.n_new);
+				changes++;
+				return true;
+			});
+		}
+		return changes;
+	}
+};
+
+}
+
+TEST_CASE("benchmark_liquid")
+{
+	// Number of nodes changed until the flood settles
+	u32 changes;
+	{
+		FloodWorld world;
+		UniqueQueue<v3s16> queue;
+		world.reset(queue);
+		changes = world.settle(queue, nullptr);
+	}
+
+	// 1 is the serial baseline
+	for (u32 threads : {1, 2, 4, 8}) {
+		WorkerPool pool("LiquidBench", threads - 1);
+		// Every run needs a fresh flood
+		std::vector<std::unique_ptr<FloodWorld>> worlds;
+		std::vector<UniqueQueue<v3s16>> queues;
+		auto prepare = [&] (int runs) {
+			worlds.clear();
+			queues = std::vector<UniqueQueue<v3s16>>(runs);
+			for (int i = 0; i < runs; i++) {
+				worlds.push_back(std::make_unique<FloodWorld>());
+				worlds.back()->reset(queues[i]);
+			}
+		};
+		const std::string name = threads == 1 ? "liquid_flood_serial" :
+			"liquid_flood_" + std::to_string(threads) + "_threads";
+		benchmarkThroughput(name, changes, "nodes", prepare, [&] (int i) {
+			return worlds[i]->settle(queues[i], &pool);
+		});
+	}
+}
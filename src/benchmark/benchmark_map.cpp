@@ -20,7 +20,7 @@ class TestMap : public Map {
 		MapSector *sector = getSectorNoGenerate(p2d);
 		if (!sector) {
 			sector = new MapSector(this, p2d, m_gamedef);
-			m_sectors[p2d] = sector;
+			m_sectors.insert(p2d, sector);
 		}
 
 		MapBlock *block = sector->getBlockNoCreateNoEx(block_y);
@@ -89,10 +89,11 @@ static u32 workOnNodes(const MBContainer &vec)
 static u32 workOnBoth(const MBContainer &vec)
 {
 	int foo = 0;
+	std::vector<content_t> contents;
 	for (MapBlock *block : vec) {
-		block->contents.clear();
+		contents.clear();
 
-		bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
+		bool want_contents_cached = true;
 
 		v3s16 p0;
 		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
@@ -102,19 +103,17 @@ static u32 workOnBoth(const MBContainer &vec)
 			MapNode n = block->getNodeNoCheck(p0);
 			content_t c = n.getContent();
 
-			if (want_contents_cached && !CONTAINS(block->contents, c)) {
-				if (block->contents.size() >= 10) {
+			if (want_contents_cached && !CONTAINS(contents, c)) {
+				if (contents.size() >= 10) {
 					want_contents_cached = false;
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-					block->contents.shrink_to_fit();
+					contents.clear();
 				} else {
-					block->contents.push_back(c);
+					contents.push_back(c);
 				}
 			}
 		}
 
-		foo += block->contents.size();
+		foo += contents.size();
 	}
 	return foo;
 }
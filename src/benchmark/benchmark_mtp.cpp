@@ -0,0 +1,63 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "benchmark_throughput.h"
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+#include <vector>
+
+// Mimics what the send thread does with a reliable packet to one peer:
+// make the packets the datagrams are sent from. shared is set if all of them
+// are made from the buffer of the command, without allocating another one.
+static size_t packetize(NetworkPacket &pkt, size_t &copied, size_t &chunks,
+		bool &shared)
+{
+	auto c = con::ConnectionCommand::send(2, 0, &pkt, true);
+	copied += c->data->size();
+
+	std::list<con::PacketChunk> originals;
+	u16 split_seqnum = 0;
+	con::makeAutoSplitPacket(c->data, 512 - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE,
+			split_seqnum, &originals);
+	std::vector<con::BufferedPacketPtr> packets;
+	packets.reserve(originals.size());
+	size_t sent = 0;
+	u16 seqnum = 0;
+	for (auto &original : originals) {
+		auto p = con::makePacket(Address(127, 0, 0, 1, 30000), original,
+				0x4f457403, 1, 0, true, seqnum++);
+		// Only the headers are written, unless they are in the headroom
+		copied += p->tailSize() > 0 ? p->headSize() : p->size() - original.size;
+		sent += p->size();
+		packets.push_back(std::move(p));
+	}
+	chunks = originals.size();
+	// Held by the command, and by every chunk and packet
+	shared = c->data.use_count() == (long)(1 + chunks + packets.size());
+	return sent;
+}
+
+TEST_CASE("benchmark_mtp")
+{
+	for (u32 size : {400u, 16384u, 1u << 20}) {
+		NetworkPacket pkt(0x20, size);
+		pkt.putRawString(std::string(size, 'x'));
+
+		size_t copied = 0, chunks = 0;
+		bool shared = false;
+		const size_t sent = packetize(pkt, copied, chunks, shared);
+		// Bytes written per byte sent, including the headers
+		WARN("packetize_" << size << ": " << chunks << " chunks, "
+			<< (double)copied / sent << " bytes copied per byte sent");
+		CHECK(copied < sent + sent / 16);
+		// The chunks are slices of the buffer, the packets reference them
+		CHECK(shared);
+
+		benchmarkThroughput("packetize_" + std::to_string(size), size, "bytes", [&] {
+			size_t copied = 0, chunks = 0;
+			bool shared;
+			return packetize(pkt, copied, chunks, shared);
+		});
+	}
+}
@@ -0,0 +1,174 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "benchmark_throughput.h"
+#include "constants.h"
+#include "irrlichttypes.h"
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+#include "porting.h"
+#include "threading/semaphore.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// A few threads send small reliable packets to many peers through a real
+// server connection, like object updates that go out to every player. The
+// clients receive them over localhost.
+
+static constexpr u32 NUM_PEERS = 100;
+static constexpr u32 PACKETS_PER_PEER = 20;
+static constexpr u32 NUM_PRODUCERS = 4;
+static constexpr u32 NUM_PACKETS = NUM_PEERS * PACKETS_PER_PEER;
+
+static constexpr u16 CMD_HELLO = 0x4b;
+static constexpr u16 CMD_UPDATE = 0x4c;
+
+typedef std::chrono::steady_clock Clock;
+
+static u64 nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		Clock::now().time_since_epoch()).count();
+}
+
+class SendBench
+{
+public:
+	SendBench()
+	{
+		const Address server_address(127, 0, 0, 1, 30010);
+		m_server.Serve(server_address);
+		sleep_ms(50);
+
+		for (u32 i = 0; i < NUM_PEERS; i++) {
+			m_clients.push_back(std::make_unique<Client>());
+			m_clients.back()->con.Connect(server_address);
+			NetworkPacket pkt(CMD_HELLO, 0);
+			pkt << i;
+			m_clients.back()->con.Send(PEER_ID_SERVER, 0, &pkt, true);
+		}
+
+		// Learn which peer is which
+		u32 known = 0;
+		const u64 deadline = porting::getTimeMs() + 5000;
+		while (known < NUM_PEERS && porting::getTimeMs() < deadline) {
+			NetworkPacket pkt;
+			if (!m_server.ReceiveTimeoutMs(&pkt, 50) || pkt.getCommand() != CMD_HELLO)
+				continue;
+			u32 i;
+			pkt >> i;
+			m_clients.at(i)->peer_id = pkt.getPeerId();
+			known++;
+		}
+		REQUIRE(known == NUM_PEERS);
+
+		for (auto &client : m_clients)
+			client->receiver = std::thread(&SendBench::receive, this, client.get());
+	}
+
+	~SendBench()
+	{
+		m_stop = true;
+		for (auto &client : m_clients)
+			client->receiver.join();
+	}
+
+	// Sends PACKETS_PER_PEER packets to every peer, returns once all arrived
+	void sendRound()
+	{
+		const auto start = Clock::now();
+		std::vector<std::thread> producers;
+		for (u32 t = 0; t < NUM_PRODUCERS; t++) {
+			producers.emplace_back([this, t] {
+				for (u32 i = 0; i < PACKETS_PER_PEER; i++)
+				for (u32 c = t; c < NUM_PEERS; c += NUM_PRODUCERS) {
+					NetworkPacket pkt(CMD_UPDATE, 40);
+					pkt << nowUs();
+					pkt.putRawString(std::string(32, 'x'));
+					m_server.Send(m_clients[c]->peer_id, 0, &pkt, true);
+				}
+			});
+		}
+		for (auto &thread : producers)
+			thread.join();
+		m_sending += Clock::now() - start;
+
+		for (u32 c = 0; c < NUM_PEERS; c++)
+			m_round_done.wait();
+	}
+
+	// Time from Send() until the client had the packet, in microseconds.
+	// Also returns how long the producers spent sending each packet.
+	u64 measureP99Latency(u32 rounds, double &send_us)
+	{
+		m_sending = {};
+		m_record = true;
+		for (u32 i = 0; i < rounds; i++)
+			sendRound();
+		m_record = false;
+		send_us = std::chrono::duration<double, std::micro>(m_sending).count() /
+			(rounds * NUM_PACKETS);
+
+		std::vector<u32> latencies;
+		for (auto &client : m_clients) {
+			latencies.insert(latencies.end(), client->latencies.begin(),
+				client->latencies.end());
+			client->latencies.clear();
+		}
+		auto it = latencies.begin() + latencies.size() * 99 / 100;
+		std::nth_element(latencies.begin(), it, latencies.end());
+		return *it;
+	}
+
+private:
+	struct Client {
+		con::Connection con{512, CONNECTION_TIMEOUT, false, nullptr};
+		session_t peer_id = PEER_ID_INEXISTENT;
+		std::thread receiver;
+		std::vector<u32> latencies;
+	};
+
+	void receive(Client *client)
+	{
+		u32 received = 0;
+		while (!m_stop) {
+			NetworkPacket pkt;
+			if (!client->con.ReceiveTimeoutMs(&pkt, 50) ||
+					pkt.getCommand() != CMD_UPDATE)
+				continue;
+			u64 sent;
+			pkt >> sent;
+			if (m_record)
+				client->latencies.push_back(nowUs() - sent);
+			if (++received == PACKETS_PER_PEER) {
+				received = 0;
+				m_round_done.post();
+			}
+		}
+	}
+
+	con::Connection m_server{512, CONNECTION_TIMEOUT, false, nullptr};
+	std::vector<std::unique_ptr<Client>> m_clients;
+	Semaphore m_round_done;
+	Clock::duration m_sending{};
+	std::atomic<bool> m_record{false};
+	std::atomic<bool> m_stop{false};
+};
+
+TEST_CASE("benchmark_netqueue")
+{
+	SendBench bench;
+
+	benchmarkThroughput("connection_send_100_peers", NUM_PACKETS, "packets",
+		[&] { bench.sendRound(); });
+
+	double send_us;
+	const u64 p99 = bench.measureP99Latency(20, send_us);
+	WARN("with " << NUM_PEERS << " peers: p99 latency from Send() to the client "
+		<< p99 << "us, " << send_us << "us per Send() call");
+}
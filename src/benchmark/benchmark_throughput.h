@@ -0,0 +1,49 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "catch.h"
+#include "irrlichttypes.h"
+#include <chrono>
+#include <string>
+
+/*
+	Runs a Catch benchmark of fn, which gets through `items` things per call,
+	then reports how many of them it got through per second.
+
+	prepare(runs) is called before each batch of runs and not measured, for
+	benchmarks that need fresh input every run. fn may take the index of the
+	run in the batch then.
+*/
+template <typename Prepare, typename Fn>
+void benchmarkThroughput(const std::string &name, u64 items, const char *unit,
+	Prepare &&prepare, Fn &&fn)
+{
+	std::chrono::steady_clock::duration spent{};
+	u64 runs = 0;
+
+	BENCHMARK_ADVANCED(std::string(name))(Catch::Benchmark::Chronometer meter) {
+		prepare(meter.runs());
+		const auto start = std::chrono::steady_clock::now();
+		meter.measure(fn);
+		spent += std::chrono::steady_clock::now() - start;
+		runs += meter.runs();
+	};
+
+	// Not run if filtered out
+	if (runs == 0)
+		return;
+	const double seconds = std::chrono::duration<double>(spent).count();
+	// The console reporter has already padded the next row of its table
+	Catch::cout() << "\r" << name << ": " << (u64)(items * runs / seconds)
+		<< " " << unit << "/s" << std::endl;
+}
+
+template <typename Fn>
+void benchmarkThroughput(const std::string &name, u64 items, const char *unit,
+	Fn &&fn)
+{
+	benchmarkThroughput(name, items, unit, [] (int) {}, fn);
+}
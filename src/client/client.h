@@ -11,6 +11,7 @@
 #include "irrlichttypes.h"
 #include "network/address.h"
 #include "network/networkprotocol.h" // multiple enums
+#include "network/objectpositions.h"
 #include "network/peerhandler.h"
 #include "util/numeric.h"
 #include "util/string.h" // StringMap
@@ -168,6 +169,7 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_ChatMessage(NetworkPacket *pkt);
 	void handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt);
 	void handleCommand_ActiveObjectMessages(NetworkPacket* pkt);
+	void handleCommand_ActiveObjectPositions(NetworkPacket* pkt);
 	void handleCommand_Movement(NetworkPacket* pkt);
 	void handleCommand_Fov(NetworkPacket *pkt);
 	void handleCommand_HP(NetworkPacket* pkt);
@@ -534,6 +536,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	bool m_itemdef_received = false;
 	bool m_nodedef_received = false;
 	bool m_activeobjects_received = false;
+	// Keyframes of TOCLIENT_ACTIVE_OBJECT_POSITIONS
+	ObjectPositionCodec m_object_positions;
 	bool m_mods_loaded = false;
 
 	std::vector<std::string> m_remote_media_servers;
@@ -256,7 +256,7 @@ MapSector * ClientMap::emergeSector(v2s16 p2d)
 	// Create it if it does not exist yet
 	if (!sector) {
 		sector = new MapSector(this, p2d, m_gamedef);
-		m_sectors[p2d] = sector;
+		m_sectors.insert(p2d, sector);
 	}
 
 	return sector;
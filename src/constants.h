@@ -35,6 +35,10 @@
 #define LIMITED_BLOCK_SENDS_FACTOR 0.33f
 // Override for the previous one for blocks that are close by
 #define BLOCK_ALWAYS_SEND_MAX_D 1
+// Bounds of the adaptive per-client block send window, the upper one
+// relative to max_simultaneous_block_sends_per_client
+#define BLOCK_SEND_WINDOW_MIN 4
+#define BLOCK_SEND_WINDOW_MAX_FACTOR 4
 
 /*
     Client/Server
@@ -19,6 +19,7 @@
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -75,6 +76,43 @@ bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> &blocks)
+{
+	// Read everything from the same snapshot
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+
+	blocks.resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++) {
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(pos[i])), &blocks[i]);
+		if (!status.ok())
+			blocks[i].clear();
+	}
+
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
+bool Database_LevelDB::saveBlocks(
+	const std::vector<std::pair<v3s16, std::string_view>> &blocks)
+{
+	leveldb::WriteBatch batch;
+	for (auto &it : blocks) {
+		batch.Put(i64tos(getBlockAsInteger(it.first)),
+			leveldb::Slice(it.second.data(), it.second.size()));
+	}
+
+	leveldb::Status status = m_database->Write(leveldb::WriteOptions(), &batch);
+	if (!status.ok()) {
+		warningstream << "saveBlocks: LevelDB error saving "
+			<< blocks.size() << " blocks: " << status.ToString() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
 void Database_LevelDB::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	std::unique_ptr<leveldb::Iterator> it(m_database->NewIterator(leveldb::ReadOptions()));
@@ -19,7 +19,49 @@
 #include "exceptions.h"
 #include "remoteplayer.h"
 #include "server/player_sao.h"
+#include "util/serialize.h"
 #include <cstdlib>
+#include <sstream>
+
+namespace {
+
+// Type OIDs, see pg_type.dat
+constexpr u32 PG_OID_BYTEA = 17;
+constexpr u32 PG_OID_INT4 = 23;
+
+// One-dimensional array in the binary format expected by array_recv()
+class PGArrayWriter
+{
+public:
+	PGArrayWriter(u32 element_oid, size_t count) :
+		m_os(std::ios_base::binary)
+	{
+		writeS32(m_os, 1); // dimensions
+		writeS32(m_os, 0); // no NULLs
+		writeU32(m_os, element_oid);
+		writeS32(m_os, count);
+		writeS32(m_os, 1); // lower bound
+	}
+
+	void add(s32 value)
+	{
+		writeS32(m_os, sizeof(value));
+		writeS32(m_os, value);
+	}
+
+	void add(std::string_view value)
+	{
+		writeS32(m_os, value.size());
+		m_os.write(value.data(), value.size());
+	}
+
+	std::string str() const { return m_os.str(); }
+
+private:
+	std::ostringstream m_os;
+};
+
+}
 
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string,
 	const char *type) :
@@ -201,6 +243,22 @@ void MapDatabasePostgreSQL::initStatements()
 				"UPDATE SET data = $4::bytea");
 	}
 
+	// Fetches the blocks at the positions given as three int4[]. The row
+	// numbers are returned since the order of the result is unspecified.
+	prepareStatement("read_blocks",
+		"SELECT p.i::int4, b.data FROM "
+			"UNNEST($1::int4[], $2::int4[], $3::int4[]) "
+			"WITH ORDINALITY AS p(x, y, z, i) "
+			"JOIN blocks b ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
+
+	if (getPGVersion() >= 90500) {
+		prepareStatement("write_blocks",
+			"INSERT INTO blocks (posX, posY, posZ, data) "
+				"SELECT * FROM UNNEST($1::int4[], $2::int4[], $3::int4[], $4::bytea[]) "
+				"ON CONFLICT ON CONSTRAINT blocks_pkey DO "
+				"UPDATE SET data = EXCLUDED.data");
+	}
+
 	prepareStatement("delete_block", "DELETE FROM blocks WHERE "
 		"posX = $1::int4 AND posY = $2::int4 AND posZ = $3::int4");
 
@@ -264,6 +322,81 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> &blocks)
+{
+	blocks.clear();
+	blocks.resize(pos.size());
+	if (pos.empty())
+		return;
+
+	verifyDatabase();
+
+	PGArrayWriter xs(PG_OID_INT4, pos.size()), ys(PG_OID_INT4, pos.size()),
+		zs(PG_OID_INT4, pos.size());
+	for (v3s16 p : pos) {
+		xs.add(p.X);
+		ys.add(p.Y);
+		zs.add(p.Z);
+	}
+	const std::string x = xs.str(), y = ys.str(), z = zs.str();
+
+	const void *args[] = { x.data(), y.data(), z.data() };
+	const int argLen[] = { (int)x.size(), (int)y.size(), (int)z.size() };
+	const int argFmt[] = { 1, 1, 1 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		argLen, argFmt, false);
+
+	const int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		// ordinality starts at 1
+		s32 i = readS32(reinterpret_cast<const u8*>(PQgetvalue(results, row, 0))) - 1;
+		if (i >= 0 && (size_t)i < blocks.size())
+			blocks[i] = pg_to_string(results, row, 1);
+	}
+
+	PQclear(results);
+}
+
+bool MapDatabasePostgreSQL::saveBlocks(
+	const std::vector<std::pair<v3s16, std::string_view>> &blocks)
+{
+	if (blocks.empty())
+		return true;
+	// Without UPSERT there's no way to do this in one statement
+	if (getPGVersion() < 90500)
+		return MapDatabase::saveBlocks(blocks);
+
+	size_t total_size = 0;
+	for (auto &it : blocks)
+		total_size += it.second.size();
+	// too big for a single parameter
+	if (total_size > INT_MAX / 2)
+		return MapDatabase::saveBlocks(blocks);
+
+	verifyDatabase();
+
+	PGArrayWriter xs(PG_OID_INT4, blocks.size()), ys(PG_OID_INT4, blocks.size()),
+		zs(PG_OID_INT4, blocks.size()), datas(PG_OID_BYTEA, blocks.size());
+	for (auto &it : blocks) {
+		xs.add(it.first.X);
+		ys.add(it.first.Y);
+		zs.add(it.first.Z);
+		datas.add(it.second);
+	}
+	const std::string x = xs.str(), y = ys.str(), z = zs.str(), data = datas.str();
+
+	const void *args[] = { x.data(), y.data(), z.data(), data.data() };
+	const int argLen[] = {
+		(int)x.size(), (int)y.size(), (int)z.size(), (int)data.size()
+	};
+	const int argFmt[] = { 1, 1, 1, 1 };
+
+	execPrepared("write_blocks", ARRLEN(args), args, argLen, argFmt);
+	return true;
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -112,6 +112,10 @@ class MapDatabasePostgreSQL : private Database_PostgreSQL, public MapDatabase
 	bool saveBlock(const v3s16 &pos, std::string_view data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	void loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> &blocks);
+	bool saveBlocks(
+		const std::vector<std::pair<v3s16, std::string_view>> &blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 	PARENT_CLASS_FUNCS
@@ -328,6 +328,52 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> &blocks)
+{
+	verifyDatabase();
+
+	blocks.resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++) {
+		bindPos(m_stmt_read, pos[i]);
+		if (sqlite3_step(m_stmt_read) == SQLITE_ROW)
+			blocks[i].assign(sqlite_to_blob(m_stmt_read, 0));
+		else
+			blocks[i].clear();
+		sqlite3_reset(m_stmt_read);
+	}
+}
+
+bool MapDatabaseSQLite3::saveBlocks(
+	const std::vector<std::pair<v3s16, std::string_view>> &blocks)
+{
+	verifyDatabase();
+
+	// Unless the caller already did, wrap everything in one transaction
+	const bool own_transaction = sqlite3_get_autocommit(m_database) != 0;
+	if (own_transaction)
+		beginSave();
+
+	try {
+		for (auto &it : blocks) {
+			int col = bindPos(m_stmt_write, it.first);
+			blob_to_sqlite(m_stmt_write, col, it.second);
+
+			SQLRES(sqlite3_step(m_stmt_write), SQLITE_DONE, "Failed to save block")
+			sqlite3_reset(m_stmt_write);
+		}
+	} catch (DatabaseException &e) {
+		sqlite3_reset(m_stmt_write);
+		if (own_transaction)
+			sqlite3_exec(m_database, "ROLLBACK;", NULL, NULL, NULL);
+		throw;
+	}
+
+	if (own_transaction)
+		endSave();
+	return true;
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
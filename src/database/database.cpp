@@ -27,3 +27,25 @@ v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 	         (s16)(((i >> 12) & 0xFFF) - 0x800),
 	         (s16)(((i >> 24) & 0xFFF) - 0x800) };
 }
+
+
+/*
+ * Backends without a native way to batch these just do one block at a time.
+ */
+void MapDatabase::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> &blocks)
+{
+	blocks.resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++)
+		loadBlock(pos[i], &blocks[i]);
+}
+
+
+bool MapDatabase::saveBlocks(
+	const std::vector<std::pair<v3s16, std::string_view>> &blocks)
+{
+	bool success = true;
+	for (auto &it : blocks)
+		success &= saveBlock(it.first, it.second);
+	return success;
+}
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 #include "irr_v3d.h"
 #include "irrlichttypes.h"
@@ -33,6 +34,15 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	/// Loads multiple blocks at once. `blocks` receives one entry per
+	/// position, which is empty if the block does not exist.
+	virtual void loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> &blocks);
+	/// Saves multiple blocks at once, positions must be distinct.
+	/// @return false if any of them could not be saved
+	virtual bool saveBlocks(
+		const std::vector<std::pair<v3s16, std::string_view>> &blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
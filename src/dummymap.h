@@ -16,7 +16,7 @@ class DummyMap : public Map
 		for (s16 x = bpmin.X; x <= bpmax.X; x++) {
 			v2s16 p2d(x, z);
 			MapSector *sector = new MapSector(this, p2d, gamedef);
-			m_sectors[p2d] = sector;
+			m_sectors.insert(p2d, sector);
 			for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
 				sector->createBlankBlock(y);
 		}
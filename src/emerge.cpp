@@ -8,6 +8,7 @@
 
 #include <cmath>
 #include <iostream>
+#include <unordered_set>
 #include "config.h"
 #include "constants.h"
 #include "irrlicht_changes/printing.h"
@@ -29,6 +30,9 @@
 #include "settings.h"
 #include "voxel.h"
 
+// Maximum number of blocks an emerge thread reads from the database at once
+static constexpr size_t EMERGE_LOAD_BATCH_SIZE = 16;
+
 EmergeParams::~EmergeParams()
 {
 	// Delete everything that was cloned on creation of EmergeParams
@@ -222,6 +226,7 @@ void EmergeManager::initThreads(bool should_multithread)
 	FATAL_ERROR_IF(!m_threads.empty(), "Threads already initialized.");
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(m_server, i));
+	m_queue.setQueueCount(nthreads);
 
 	infostream << "EmergeManager: using " << nthreads << " thread(s)" << std::endl;
 }
@@ -276,7 +281,8 @@ bool EmergeManager::enqueueBlockEmerge(
 	session_t peer_id,
 	v3s16 blockpos,
 	bool allow_generate,
-	bool ignore_queue_limits)
+	bool ignore_queue_limits,
+	u16 priority)
 {
 	u16 flags = 0;
 	if (allow_generate)
@@ -284,7 +290,7 @@ bool EmergeManager::enqueueBlockEmerge(
 	if (ignore_queue_limits)
 		flags |= BLOCK_EMERGE_FORCE_QUEUE;
 
-	return enqueueBlockEmergeEx(blockpos, peer_id, flags, NULL, NULL);
+	return enqueueBlockEmergeEx(blockpos, peer_id, flags, NULL, NULL, priority);
 }
 
 
@@ -293,7 +299,8 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	session_t peer_id,
 	u16 flags,
 	EmergeCompletionCallback callback,
-	void *callback_param)
+	void *callback_param,
+	u16 priority)
 {
 	EmergeThread *thread = NULL;
 	bool entry_already_exists = false;
@@ -305,11 +312,14 @@ bool EmergeManager::enqueueBlockEmergeEx(
 				callback, callback_param, &entry_already_exists))
 			return false;
 
-		if (entry_already_exists)
+		if (entry_already_exists) {
+			// possibly wanted sooner now
+			m_queue.push(blockpos, priority, 0);
 			return true;
+		}
 
 		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+		m_queue.push(blockpos, priority, thread->id);
 	}
 
 	thread->signal();
@@ -441,19 +451,44 @@ EmergeThread *EmergeManager::getOptimalThread()
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	// busy threads count as having one more item
+	auto load = [&] (size_t i) {
+		return m_queue.size(i) + (m_threads[i]->m_idle ? 0 : 1);
+	};
+	size_t load_lowest = load(0);
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
-		if (nitems < nitems_lowest) {
+		size_t l = load(i);
+		if (l < load_lowest) {
 			index = i;
-			nitems_lowest = nitems;
+			load_lowest = l;
 		}
 	}
 
 	return m_threads[index];
 }
 
+void EmergeManager::processCompletedEmerges(Map *map)
+{
+	std::unordered_set<v3s16> modified_blocks;
+
+	std::unique_ptr<CompletedEmerge> completed;
+	while (m_completed.pop(completed)) {
+		for (auto &[callback, param] : completed->callbacks)
+			callback(completed->pos, completed->action, param);
+		modified_blocks.insert(completed->modified_blocks.begin(),
+			completed->modified_blocks.end());
+	}
+
+	if (modified_blocks.empty())
+		return;
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	event.modified_blocks.assign(modified_blocks.begin(), modified_blocks.end());
+	map->dispatchEvent(event);
+}
+
 void EmergeManager::reportCompletedEmerge(EmergeAction action)
 {
 	assert((size_t)action < ARRLEN(m_completed_emerge_counter));
@@ -484,45 +519,40 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(v3s16 pos)
-{
-	m_block_queue.push(pos);
-	return true;
-}
-
-
 void EmergeThread::cancelPendingItems()
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
+	std::vector<v3s16> pending;
+	m_emerge->m_queue.clear(id, pending);
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+	for (v3s16 pos : pending) {
+		BlockEmergeData bedata;
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+		completeEmerge(pos, EMERGE_CANCELLED, std::move(bedata.callbacks), {});
 	}
 }
 
 
-void EmergeThread::runCompletionCallbacks(v3s16 pos, EmergeAction action,
-	const EmergeCallbackList &callbacks)
+void EmergeThread::completeEmerge(v3s16 pos, EmergeAction action,
+	EmergeCallbackList &&callbacks,
+	const std::map<v3s16, MapBlock *> &modified_blocks)
 {
 	m_emerge->reportCompletedEmerge(action);
 
-	for (size_t i = 0; i != callbacks.size(); i++) {
-		EmergeCompletionCallback callback;
-		void *param;
-
-		callback = callbacks[i].first;
-		param    = callbacks[i].second;
+	if (callbacks.empty() && modified_blocks.empty())
+		return;
 
-		callback(pos, action, param);
-	}
+	auto completed = std::make_unique<EmergeManager::CompletedEmerge>();
+	completed->pos = pos;
+	completed->action = action;
+	completed->callbacks = std::move(callbacks);
+	completed->modified_blocks.reserve(modified_blocks.size());
+	for (auto &it : modified_blocks)
+		completed->modified_blocks.push_back(it.first);
+	m_emerge->m_completed.push(std::move(completed));
 }
 
 
@@ -530,18 +560,52 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
+	m_idle = !m_emerge->m_queue.pop(id, *pos);
+	if (m_idle)
 		return false;
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
-
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
 	return true;
 }
 
 
+void EmergeThread::loadFromDatabase(v3s16 pos, std::string &data)
+{
+	auto &m_db = *m_emerge->m_db;
+
+	auto it = m_prefetched.find(pos);
+	// Anything written since could have made the data outdated
+	if (it != m_prefetched.end() &&
+			m_db.write_counter == m_prefetch_write_counter) {
+		data = std::move(it->second);
+		m_prefetched.erase(it);
+		return;
+	}
+	m_prefetched.clear();
+
+	std::vector<v3s16> positions{pos};
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		m_emerge->m_queue.peek(id, EMERGE_LOAD_BATCH_SIZE - 1, positions);
+	}
+
+	std::vector<std::string> blocks;
+	{
+		ScopeProfiler sp(g_profiler, "EmergeThread: load block - async (sum)");
+		MutexAutoLock dblock(m_db.mutex);
+		m_prefetch_write_counter = m_db.write_counter;
+		// Note: this can throw an exception, but there isn't really
+		// a good, safe way to handle it.
+		m_db.loadBlocks(positions, blocks);
+	}
+
+	data = std::move(blocks[0]);
+	for (size_t i = 1; i < positions.size(); i++)
+		m_prefetched.emplace(positions[i], std::move(blocks[i]));
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(const v3s16 pos, bool allow_gen,
 	 const std::string *from_db, MapBlock **block, BlockMakeData *bmdata)
 {
@@ -708,18 +772,19 @@ void *EmergeThread::run()
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" << pos << " allow_gen=" << allow_gen);
 
-		action = getBlockOrStartGen(pos, allow_gen, nullptr, &block, &bmdata);
+		// Whether the block is in memory can be found out without waiting
+		// for the env lock. If it is generated already there is nothing to
+		// do, otherwise it has to be looked up in the database first.
+		if (m_map->isBlockGenerated(pos))
+			action = EMERGE_FROM_MEMORY;
+		else if (m_map->isBlockLoaded(pos))
+			action = getBlockOrStartGen(pos, allow_gen, nullptr, &block, &bmdata);
+		else
+			action = EMERGE_FROM_DISK;
 
 		/* Try to load it */
 		if (action == EMERGE_FROM_DISK) {
-			auto &m_db = *m_emerge->m_db;
-			{
-				ScopeProfiler sp(g_profiler, "EmergeThread: load block - async (sum)");
-				MutexAutoLock dblock(m_db.mutex);
-				// Note: this can throw an exception, but there isn't really
-				// a good, safe way to handle it.
-				m_db.loadBlock(pos, databuf);
-			}
+			loadFromDatabase(pos, databuf);
 			// actually load it, then decide again
 			action = getBlockOrStartGen(pos, allow_gen, &databuf, &block, &bmdata);
 			databuf.clear();
@@ -759,18 +824,12 @@ void *EmergeThread::run()
 			m_trans_liquid = nullptr;
 		}
 
-		runCompletionCallbacks(pos, action, bedata.callbacks);
-
-		if (block)
+		// Only the position is used, so a block answered from memory
+		// without the env lock is listed without its pointer
+		if (block || action == EMERGE_FROM_MEMORY)
 			modified_blocks[pos] = block;
 
-		if (!modified_blocks.empty()) {
-			MapEditEvent event;
-			event.type = MEET_OTHER;
-			event.setModifiedBlocks(modified_blocks);
-			Server::EnvAutoLock envlock(m_server);
-			m_map->dispatchEvent(event);
-		}
+		completeEmerge(pos, action, std::move(bedata.callbacks), modified_blocks);
 		modified_blocks.clear();
 	}
 	} catch (VersionMismatchException &e) {
@@ -11,10 +11,16 @@
 #include "util/metricsbackend.h"
 #include "mapgen/mapgen.h" // for MapgenParams
 #include "map.h"
+#include "emerge_queue.h"
+#include "threading/mpsc_queue.h"
 
 #define BLOCK_EMERGE_ALLOW_GEN   (1 << 0)
 #define BLOCK_EMERGE_FORCE_QUEUE (1 << 1)
 
+// Blocks with lower priority values are emerged first. Players use the
+// distance to the block, everything else comes after that.
+#define BLOCK_EMERGE_PRIORITY_DEFAULT 0xFFFF
+
 #define EMERGE_DBG_OUT(x) {                            \
 	if (enable_mapgen_debug_info)                      \
 		infostream << "EmergeThread: " x << std::endl; \
@@ -64,7 +70,7 @@ constexpr const char *emergeActionStrs[] = {
 	"generated",
 };
 
-// Callback
+// Callback, runs in the server thread with the env lock held
 typedef void (*EmergeCompletionCallback)(
 	v3s16 blockpos, EmergeAction action, void *param);
 
@@ -170,18 +176,27 @@ class EmergeManager {
 		session_t peer_id,
 		v3s16 blockpos,
 		bool allow_generate,
-		bool ignore_queue_limits=false);
+		bool ignore_queue_limits=false,
+		u16 priority=BLOCK_EMERGE_PRIORITY_DEFAULT);
 
 	bool enqueueBlockEmergeEx(
 		v3s16 blockpos,
 		session_t peer_id,
 		u16 flags,
 		EmergeCompletionCallback callback,
-		void *callback_param);
+		void *callback_param,
+		u16 priority=BLOCK_EMERGE_PRIORITY_DEFAULT);
 
 	size_t getQueueSize();
 	bool isBlockInQueue(v3s16 pos);
 
+	/**
+	 * Runs the completion callbacks of the emerges that finished since the
+	 * last call and tells the map about all blocks they changed at once.
+	 * Requires the env lock held.
+	 */
+	void processCompletedEmerges(Map *map);
+
 	Mapgen *getCurrentMapgen();
 
 	// Mapgen helpers methods
@@ -205,6 +220,17 @@ class EmergeManager {
 
 	std::mutex m_queue_mutex;
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
+	// Which thread emerges what, in which order
+	EmergeQueue m_queue;
+
+	// Handed over from the emerge threads to processCompletedEmerges()
+	struct CompletedEmerge {
+		v3s16 pos;
+		EmergeAction action;
+		EmergeCallbackList callbacks;
+		std::vector<v3s16> modified_blocks;
+	};
+	MPSCQueue<std::unique_ptr<CompletedEmerge>> m_completed;
 	std::unordered_map<u16, u32> m_peer_queue_count;
 
 	u32 m_qlimit_total;
@@ -222,6 +248,7 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	// Picks an idle thread or the one with the least work.
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
 
@@ -10,7 +10,9 @@
 
 #include "emerge.h"
 
-#include <queue>
+#include <deque>
+#include <string>
+#include <unordered_map>
 
 #include "util/thread.h"
 #include "threading/event.h"
@@ -33,9 +35,6 @@ class EmergeThread : public Thread {
 	void *run();
 	void signal();
 
-	// Requires queue mutex held
-	bool pushBlock(v3s16 pos);
-
 	void cancelPendingItems();
 
 	EmergeManager *getEmergeManager() { return m_emerge; }
@@ -43,9 +42,10 @@ class EmergeThread : public Thread {
 
 protected:
 
-	void runCompletionCallbacks(
-		v3s16 pos, EmergeAction action,
-		const EmergeCallbackList &callbacks);
+	// Hands the result over to EmergeManager::processCompletedEmerges()
+	void completeEmerge(v3s16 pos, EmergeAction action,
+		EmergeCallbackList &&callbacks,
+		const std::map<v3s16, MapBlock *> &modified_blocks);
 
 private:
 	Server *m_server;
@@ -58,12 +58,27 @@ class EmergeThread : public Thread {
 	UniqueQueue<v3s16> *m_trans_liquid; //< non-null only when generating a mapblock
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	// Whether the thread ran out of work, protected by the queue mutex
+	bool m_idle = false;
+
+	// Blocks read from the database ahead of time, see loadFromDatabase()
+	std::unordered_map<v3s16, std::string> m_prefetched;
+	// MapDatabaseAccessor::write_counter when m_prefetched was read
+	u64 m_prefetch_write_counter = 0;
 
 	bool initScripting();
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
 
+	/**
+	 * Read a block from the database. The next few blocks in the queue are
+	 * read in the same go, so they don't need another round-trip.
+	 *
+	 * @param pos block position
+	 * @param data serialized block data, empty if not in the database
+	 */
+	void loadFromDatabase(v3s16 pos, std::string &data);
+
 	/**
 	 * Try to get a block from memory and decide what to do.
 	 *
@@ -0,0 +1,80 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "emerge_queue.h"
+#include "debug.h"
+
+void EmergeQueue::setQueueCount(size_t count)
+{
+	FATAL_ERROR_IF(!m_entries.empty(), "EmergeQueue: resized while in use");
+	m_queues.resize(count);
+}
+
+bool EmergeQueue::push(v3s16 pos, u16 priority, size_t queue)
+{
+	auto it = m_entries.find(pos);
+	if (it != m_entries.end()) {
+		Location &loc = it->second;
+		if (priority < loc.priority) {
+			auto &q = m_queues[loc.queue];
+			q.erase(Item{loc.priority, loc.seq, pos});
+			q.insert(Item{priority, loc.seq, pos});
+			loc.priority = priority;
+		}
+		return false;
+	}
+
+	const u64 seq = m_next_seq++;
+	m_queues[queue].insert(Item{priority, seq, pos});
+	m_entries.emplace(pos, Location{queue, priority, seq});
+	return true;
+}
+
+bool EmergeQueue::popFrom(size_t queue, v3s16 &pos)
+{
+	auto &q = m_queues[queue];
+	if (q.empty())
+		return false;
+	pos = q.begin()->pos;
+	q.erase(q.begin());
+	m_entries.erase(pos);
+	return true;
+}
+
+bool EmergeQueue::pop(size_t queue, v3s16 &pos)
+{
+	if (popFrom(queue, pos))
+		return true;
+
+	// Steal from whoever has the most to do
+	size_t victim = queue;
+	size_t victim_size = 0;
+	for (size_t i = 0; i < m_queues.size(); i++) {
+		if (m_queues[i].size() > victim_size) {
+			victim = i;
+			victim_size = m_queues[i].size();
+		}
+	}
+	return victim_size > 0 && popFrom(victim, pos);
+}
+
+void EmergeQueue::peek(size_t queue, size_t max, std::vector<v3s16> &dst) const
+{
+	size_t n = 0;
+	for (auto &item : m_queues[queue]) {
+		if (n++ >= max)
+			break;
+		dst.push_back(item.pos);
+	}
+}
+
+void EmergeQueue::clear(size_t queue, std::vector<v3s16> &dst)
+{
+	auto &q = m_queues[queue];
+	for (auto &item : q) {
+		dst.push_back(item.pos);
+		m_entries.erase(item.pos);
+	}
+	q.clear();
+}
@@ -0,0 +1,77 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Order in which blocks are emerged, with one queue per emerge thread.
+
+	Each queue is sorted by priority (lower values first, usually the distance
+	to the requesting player in blocks) and then by insertion order.
+	A thread that runs out of work steals the most urgent block of the
+	busiest other queue, so no thread idles while others have a backlog.
+
+	Not thread-safe, EmergeManager protects it with its queue mutex.
+*/
+class EmergeQueue
+{
+public:
+	void setQueueCount(size_t count);
+	size_t getQueueCount() const { return m_queues.size(); }
+
+	size_t size() const { return m_entries.size(); }
+	size_t size(size_t queue) const { return m_queues[queue].size(); }
+
+	/**
+	 * Adds a block to a queue. If the block is queued already it stays
+	 * where it is, but its priority is raised if the new one is lower.
+	 * @return false if the block was queued already
+	 */
+	bool push(v3s16 pos, u16 priority, size_t queue);
+
+	/**
+	 * Takes the next block for a queue, or one of another queue if it is
+	 * empty.
+	 * @return false if all queues are empty
+	 */
+	bool pop(size_t queue, v3s16 &pos);
+
+	/// Appends up to `max` upcoming blocks of a queue in order.
+	void peek(size_t queue, size_t max, std::vector<v3s16> &dst) const;
+
+	/// Removes all blocks of a queue, appending them to `dst`.
+	void clear(size_t queue, std::vector<v3s16> &dst);
+
+private:
+	struct Item {
+		u16 priority;
+		u64 seq;
+		v3s16 pos;
+
+		bool operator<(const Item &other) const
+		{
+			if (priority != other.priority)
+				return priority < other.priority;
+			return seq < other.seq;
+		}
+	};
+
+	struct Location {
+		size_t queue;
+		u16 priority;
+		u64 seq;
+	};
+
+	bool popFrom(size_t queue, v3s16 &pos);
+
+	std::vector<std::set<Item>> m_queues;
+	std::unordered_map<v3s16, Location> m_entries;
+	u64 m_next_seq = 0;
+};
@@ -60,6 +60,13 @@ void Map::removeEventReceiver(MapEventReceiver *event_receiver)
 
 void Map::dispatchEvent(const MapEditEvent &event)
 {
+	// Metadata is changed in-place, so this is the earliest point where we
+	// learn about it. The receivers only mark the block as modified later.
+	if (event.type == MEET_BLOCK_NODE_METADATA_CHANGED) {
+		if (MapBlock *block = getBlockNoCreateNoEx(getNodeBlockPos(event.p)))
+			block->expireContentVersion();
+	}
+
 	for (MapEventReceiver *event_receiver : m_event_receivers) {
 		event_receiver->onMapEditEvent(event);
 	}
@@ -72,13 +79,10 @@ MapSector * Map::getSectorNoGenerateNoLock(v2s16 p)
 		return sector;
 	}
 
-	auto n = m_sectors.find(p);
-
-	if (n == m_sectors.end())
+	MapSector *sector = m_sectors.find(p);
+	if (!sector)
 		return NULL;
 
-	MapSector *sector = n->second;
-
 	// Cache the last result
 	m_sector_cache_p = p;
 	m_sector_cache = sector;
@@ -101,6 +105,30 @@ MapBlock *Map::getBlockNoCreateNoEx(v3s16 p3d)
 	return block;
 }
 
+bool Map::isBlockLoaded(v3s16 p3d) const
+{
+	v2s16 p2d(p3d.X, p3d.Z);
+	std::shared_lock lock(getRegionLock(p2d));
+	// don't use the sector cache, it is not thread-safe
+	const MapSector *sector = m_sectors.find(p2d);
+	return sector && sector->hasBlock(p3d.Y);
+}
+
+bool Map::isBlockGenerated(v3s16 p3d) const
+{
+	v2s16 p2d(p3d.X, p3d.Z);
+	std::shared_lock lock(getRegionLock(p2d));
+	const MapSector *sector = m_sectors.find(p2d);
+	const MapBlock *block = sector ? sector->findBlock(p3d.Y) : nullptr;
+	return block && block->isGenerated();
+}
+
+MapBlock *Map::findBlock(v3s16 p3d) const
+{
+	const MapSector *sector = m_sectors.find(v2s16(p3d.X, p3d.Z));
+	return sector ? sector->findBlock(p3d.Y) : nullptr;
+}
+
 MapBlock *Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -321,9 +349,10 @@ void Map::timerUpdate(float dtime, float unload_timeout, s32 max_loaded_blocks,
 					// Save if modified
 					if (block->getModified() != MOD_STATE_CLEAN
 							&& save_before_unloading) {
-						modprofiler.add(block->getModifiedReasonString(), 1);
+						const std::string reason = block->getModifiedReasonString();
 						if (!saveBlock(block))
 							continue;
+						modprofiler.add(reason, 1);
 						saved_blocks_count++;
 					}
 
@@ -431,12 +460,11 @@ void Map::unloadUnreferencedBlocks(std::vector<v3s16> *unloaded_blocks)
 void Map::deleteSectors(const std::vector<v2s16> &sectorList)
 {
 	for (v2s16 j : sectorList) {
-		MapSector *sector = m_sectors[j];
+		// Remove from map and delete
+		MapSector *sector = m_sectors.erase(j);
 		// If sector is in sector cache, remove it from there
 		if (m_sector_cache == sector)
 			m_sector_cache = nullptr;
-		// Remove from map and delete
-		m_sectors.erase(j);
 		delete sector;
 	}
 }
@@ -522,6 +550,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->expireContentVersion();
 	return true;
 }
 
@@ -537,6 +566,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->expireContentVersion();
 }
 
 NodeTimer Map::getNodeTimer(v3s16 p)
@@ -15,6 +15,7 @@
 #include "constants.h"
 #include "voxel.h"
 #include "modifiedstate.h"
+#include "mapsectortable.h"
 #include "util/numeric.h" // for forEachNodeInArea
 
 class MapSector;
@@ -125,6 +126,27 @@ class Map /*: public NodeContainer*/
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 
+	/*
+		Checks whether a block is in memory.
+		Unlike the above this does not require holding the env lock,
+		see MapSectorTable.
+	*/
+	bool isBlockLoaded(v3s16 p) const;
+	// Same, for a block that is also generated
+	bool isBlockGenerated(v3s16 p) const;
+
+	/*
+		Like getBlockNoCreateNoEx(), but it does not use the lookup caches
+		so any number of threads may call it at once, as long as nothing
+		adds or removes blocks meanwhile (e.g. because the env lock is held
+		for them). See MapSectorTable.
+	*/
+	MapBlock *findBlock(v3s16 p) const;
+
+	// Lock protecting the structure of the map region containing p2d
+	std::shared_mutex &getRegionLock(v2s16 p2d) const
+	{ return m_sectors.getLock(p2d); }
+
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
 	{ return getBlockNoCreateNoEx(p); }
@@ -278,7 +300,7 @@ class Map /*: public NodeContainer*/
 
 	std::set<MapEventReceiver*> m_event_receivers;
 
-	std::unordered_map<v2s16, MapSector*> m_sectors;
+	MapSectorTable m_sectors;
 
 	// Be sure to set this to NULL when the cached sector is deleted
 	MapSector *m_sector_cache = nullptr;
@@ -4,6 +4,8 @@
 
 #include "mapblock.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <sstream>
 #include "map.h"
@@ -124,6 +126,15 @@ MapBlock::~MapBlock()
 		porting::TrackFreedMemory(sizeof(MapNode) * nodecount);
 }
 
+u64 MapBlock::getContentVersion()
+{
+	static std::atomic<u64> next_version{1};
+
+	if (m_content_version == 0)
+		m_content_version = next_version.fetch_add(1, std::memory_order_relaxed);
+	return m_content_version;
+}
+
 static inline size_t get_max_objects_per_block()
 {
 	u16 ret = g_settings->getU16("max_objects_per_block");
@@ -231,6 +242,8 @@ void MapBlock::copyFrom(const VoxelManipulator &src)
 	src.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
 	tryShrinkNodes();
+	expireContentVersion();
+	m_contents_expired = true;
 }
 
 void MapBlock::reallocate(u32 count, MapNode n)
@@ -310,6 +323,28 @@ void MapBlock::expireIsAirCache()
 	m_is_air_expired = true;
 }
 
+void MapBlock::updateContents()
+{
+	m_contents_expired = false;
+	m_contents.clear();
+
+	if (m_is_mono_block) {
+		m_contents.push_back(data[0].getContent());
+		return;
+	}
+	// Runs of the same content are common, and there are few different ones
+	content_t previous_c = CONTENT_IGNORE;
+	for (u32 i = 0; i < nodecount; i++) {
+		const content_t c = data[i].getContent();
+		if (c == previous_c)
+			continue;
+		previous_c = c;
+		if (!CONTAINS(m_contents, c))
+			m_contents.push_back(c);
+	}
+	std::sort(m_contents.begin(), m_contents.end());
+}
+
 /*
 	Serialization
 */
@@ -349,7 +384,7 @@ void MapBlock::getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 // Unknown ones are added to nodedef.
 // Will not update itself to match id-name pairs in nodedef.
 void MapBlock::correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-		IGameDef *gamedef)
+		IGameDef *gamedef, std::vector<content_t> *contents)
 {
 	const NodeDefManager *nodedef = gamedef->ndef();
 
@@ -382,16 +417,35 @@ void MapBlock::correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 
 		// Save previous node local_id & global_id result
 		mapping_cache.set(local_id, global_id);
+		if (contents)
+			contents->push_back(global_id);
 	}
+
+	if (contents)
+		SORT_AND_UNIQUE(*contents);
 }
 
 void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level)
+{
+	serializeInternal(os_compressed, version, disk, compression_level, true);
+}
+
+void MapBlock::serializeUncompressed(std::ostream &os, u8 version, bool disk)
+{
+	if (version < 29)
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	serializeInternal(os, version, disk, 0, false);
+}
+
+void MapBlock::serializeInternal(std::ostream &os_compressed, u8 version, bool disk,
+	int compression_level, bool compress_result)
 {
 	if (!ser_ver_supported_write(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
 	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
+	std::ostream &os = (version >= 29 && compress_result) ? os_raw : os_compressed;
 
 	// First byte
 	u8 flags = 0;
@@ -488,7 +542,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 		}
 	}
 
-	if (version >= 29) {
+	if (version >= 29 && compress_result) {
 		// now compress the whole thing
 		compress(os_raw.str(), os_compressed, version, compression_level);
 	}
@@ -507,6 +561,9 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()<<std::endl);
 
 	m_is_air_expired = true;
+	m_contents_expired = true;
+	abm_index.valid = false;
+	expireContentVersion();
 	expandNodesIfNeeded();
 
 	if(version <= 21)
@@ -628,7 +685,9 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 
 		// Dynamically re-set ids based on node names
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		m_contents.clear();
+		correctBlockNodeIds(&nimap, data, m_gamedef, &m_contents);
+		m_contents_expired = false;
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
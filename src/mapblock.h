@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -50,6 +51,19 @@ enum ModReason : u32 {
 	MOD_REASON_UNKNOWN                    = 1 << 18,
 };
 
+// Modifications that don't change what is sent to clients
+constexpr u32 MOD_REASONS_DISK_ONLY =
+	MOD_REASON_SET_TIMESTAMP |
+	MOD_REASON_CLEAR_ALL_OBJECTS |
+	MOD_REASON_BLOCK_EXPIRED |
+	MOD_REASON_ADD_ACTIVE_OBJECT_RAW |
+	MOD_REASON_REMOVE_OBJECTS_REMOVE |
+	MOD_REASON_REMOVE_OBJECTS_DEACTIVATE |
+	MOD_REASON_TOO_MANY_OBJECTS |
+	MOD_REASON_STATIC_DATA_ADDED |
+	MOD_REASON_STATIC_DATA_REMOVED |
+	MOD_REASON_STATIC_DATA_CHANGED;
+
 ////
 //// MapBlock itself
 ////
@@ -86,8 +100,13 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents.clear();
+		if (reason & ~MOD_REASONS_DISK_ONLY) {
+			expireContentVersion();
+			if (mod == MOD_STATE_WRITE_NEEDED) {
+				abm_index.valid = false;
+				m_contents_expired = true;
+			}
+		}
 	}
 
 	inline u32 getModified()
@@ -102,6 +121,24 @@ class MapBlock
 
 	std::string getModifiedReasonString();
 
+	////
+	//// Content version
+	////
+
+	/*
+		Returns a number that changes whenever something that is sent to
+		clients changes. It is unique among all blocks that ever existed
+		in this process, so (pos, content version) identifies the contents.
+	*/
+	u64 getContentVersion();
+
+	// Called on any modification that could be visible to clients.
+	// Done implicitly by raiseModified() and the node setters.
+	inline void expireContentVersion()
+	{
+		m_content_version = 0;
+	}
+
 	inline void resetModified()
 	{
 		m_modified = MOD_STATE_CLEAN;
@@ -162,7 +199,7 @@ class MapBlock
 		return (m_lighting_complete & (1 << direction)) != 0;
 	}
 
-	inline bool isGenerated()
+	inline bool isGenerated() const
 	{
 		return m_generated;
 	}
@@ -302,6 +339,17 @@ class MapBlock
 		return m_is_air;
 	}
 
+	/*
+		The contents found in the block, sorted.
+		Cached until a node changes, loading from disk sets it as a by-product.
+	*/
+	const std::vector<content_t> &getContents()
+	{
+		if (m_contents_expired)
+			updateContents();
+		return m_contents;
+	}
+
 	bool onObjectsActivation();
 	bool saveStaticObject(u16 id, const StaticObject &obj, u32 reason);
 
@@ -400,6 +448,22 @@ class MapBlock
 		m_node_timers.clear();
 	}
 
+	/// @note This method is only for Server, see NodeTimerList::attach
+	inline void attachNodeTimers(NodeTimerClock *clock)
+	{
+		m_node_timers.attach(clock, getPos());
+	}
+
+	inline void detachNodeTimers()
+	{
+		m_node_timers.detach();
+	}
+
+	inline bool nodeTimersAttachedTo(const NodeTimerClock *clock) const
+	{
+		return m_node_timers.isAttached(clock);
+	}
+
 	////
 	//// Serialization
 	///
@@ -408,6 +472,11 @@ class MapBlock
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
 	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
+	// Same as serialize() but without the final compression step. Passing the
+	// result to compress() yields the output of serialize(), this part can be
+	// done without holding any lock on the map.
+	// Precondition: version >= 29
+	void serializeUncompressed(std::ostream &result, u8 version, bool disk);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
@@ -420,6 +489,9 @@ class MapBlock
 	u32 clearObjects();
 
 private:
+	void serializeInternal(std::ostream &result, u8 version, bool disk,
+		int compression_level, bool compress_result);
+
 	static const u32 ystride = MAP_BLOCKSIZE;
 	static const u32 zstride = MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
@@ -444,8 +516,11 @@ class MapBlock
 
 	static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 		u32 count, const NodeDefManager *nodedef);
+	// Optionally lists the (corrected) contents in `contents`
 	static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-			IGameDef *gamedef);
+			IGameDef *gamedef, std::vector<content_t> *contents = nullptr);
+
+	void updateContents();
 
 	/*
 	 * PLEASE NOTE: When adding something here be mindful of position and size
@@ -502,19 +577,28 @@ class MapBlock
 	bool m_is_mono_block;
 public:
 	//// ABM optimizations ////
-	// True if we never want to cache content types for this block
-	bool do_not_cache_contents = false;
-	// Cache of content types
-	// This is actually a set but for the small sizes we have a vector should be
-	// more efficient.
-	// Can be empty, in which case nothing was cached yet.
-	std::vector<content_t> contents;
+	/*
+		The nodes ABMs can trigger on, grouped by content, so that
+		ABMHandler::apply() does not have to look at every node.
+		Built when first needed and invalidated by any node change.
+	*/
+	struct ABMNodeIndex {
+		// (content, offset of its first node in `nodes`), sorted by content
+		std::vector<std::pair<content_t, u16>> contents;
+		// Node indices (z * zstride + y * ystride + x)
+		std::vector<u16> nodes;
+		bool valid = false;
+	} abm_index;
 
 private:
 	// Whether day and night lighting differs
 	bool m_is_air = false;
 	bool m_is_air_expired = true;
 
+	// see getContents()
+	bool m_contents_expired = true;
+	std::vector<content_t> m_contents;
+
 	/*
 		- On the server, this is used for telling whether the
 		  block has been modified from the one on disk.
@@ -523,6 +607,9 @@ class MapBlock
 	u16 m_modified = MOD_STATE_CLEAN;
 	u32 m_modified_reason = 0;
 
+	// see getContentVersion(), 0 = needs a new one
+	u64 m_content_version = 0;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
@@ -541,8 +628,9 @@ class MapBlock
 	*/
 	u16 m_lighting_complete = 0xFFFF;
 
-	// Whether mapgen has generated the content of this block (persisted)
-	bool m_generated = false;
+	// Whether mapgen has generated the content of this block (persisted).
+	// Written with the env lock held, see Map::isBlockGenerated().
+	std::atomic<bool> m_generated{false};
 
 	/*
 		When propagating sunlight and the above block doesn't exist,
@@ -5,10 +5,13 @@
 #include "mapsector.h"
 #include "exceptions.h"
 #include "mapblock.h"
+#include "map.h"
+#include <mutex>
 
 MapSector::MapSector(Map *parent, v2s16 pos, IGameDef *gamedef):
 		m_parent(parent),
 		m_pos(pos),
+		m_lock(parent->getRegionLock(pos)),
 		m_gamedef(gamedef)
 {
 }
@@ -22,15 +25,20 @@ void MapSector::deleteBlocks(size_t *used_count)
 {
 	m_block_cache = nullptr;
 
+	decltype(m_blocks) blocks;
+	{
+		std::unique_lock lock(m_lock);
+		blocks.swap(m_blocks);
+	}
+
 	size_t u = 0;
-	for (auto &it : m_blocks) {
+	for (auto &it : blocks) {
 		if (it.second->refGet() > 0)
 			u++;
 		it.second.reset();
 	}
 	if (used_count)
 		*used_count += u;
-	m_blocks.clear();
 }
 
 MapBlock *MapSector::getBlockBuffered(s16 y)
@@ -73,6 +81,7 @@ MapBlock *MapSector::createBlankBlock(s16 y)
 {
 	std::unique_ptr<MapBlock> block_u = createBlankBlockNoInsert(y);
 	MapBlock *block = block_u.get();
+	std::unique_lock lock(m_lock);
 
 	m_blocks[y] = std::move(block_u);
 
@@ -92,6 +101,7 @@ void MapSector::insertBlock(std::unique_ptr<MapBlock> block)
 	assert(p2d == m_pos);
 
 	// Insert into container
+	std::unique_lock lock(m_lock);
 	m_blocks[block_y] = std::move(block);
 }
 
@@ -109,11 +119,15 @@ std::unique_ptr<MapBlock> MapSector::detachBlock(MapBlock *block)
 	m_block_cache = nullptr;
 
 	// Remove from container
-	auto it = m_blocks.find(block_y);
-	assert(it != m_blocks.end());
-	std::unique_ptr<MapBlock> ret = std::move(it->second);
-	assert(ret.get() == block);
-	m_blocks.erase(it);
+	std::unique_ptr<MapBlock> ret;
+	{
+		std::unique_lock lock(m_lock);
+		auto it = m_blocks.find(block_y);
+		assert(it != m_blocks.end());
+		ret = std::move(it->second);
+		assert(ret.get() == block);
+		m_blocks.erase(it);
+	}
 
 	// Mark as removed
 	block->makeOrphan();
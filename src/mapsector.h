@@ -8,6 +8,7 @@
 #include "irr_v2d.h"
 #include "mapblock.h"
 #include <memory>
+#include <shared_mutex>
 
 class Map;
 class IGameDef;
@@ -36,6 +37,13 @@ class MapSector
 	}
 
 	MapBlock *getBlockNoCreateNoEx(s16 y);
+	// Thread-safe variants of the above, see MapSectorTable
+	bool hasBlock(s16 y) const { return m_blocks.find(y) != m_blocks.end(); }
+	MapBlock *findBlock(s16 y) const
+	{
+		auto it = m_blocks.find(y);
+		return it != m_blocks.end() ? it->second.get() : nullptr;
+	}
 	std::unique_ptr<MapBlock> createBlankBlockNoInsert(s16 y);
 	MapBlock *createBlankBlock(s16 y);
 
@@ -70,6 +78,9 @@ class MapSector
 	// Position on parent (in MapBlock widths)
 	v2s16 m_pos;
 
+	// Region lock of the parent, to be taken when changing m_blocks
+	std::shared_mutex &m_lock;
+
 	IGameDef *m_gamedef;
 
 	// Last-used block is cached here for quicker access.
@@ -0,0 +1,49 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "mapsectortable.h"
+#include <cassert>
+#include <mutex>
+
+MapSector *MapSectorTable::find(v2s16 p) const
+{
+	const Shard &shard = m_shards[shardIndex(p)];
+	auto it = shard.sectors.find(p);
+	return it != shard.sectors.end() ? it->second : nullptr;
+}
+
+void MapSectorTable::insert(v2s16 p, MapSector *sector)
+{
+	Shard &shard = m_shards[shardIndex(p)];
+	std::unique_lock lock(shard.mutex);
+	auto inserted = shard.sectors.emplace(p, sector).second;
+	assert(inserted);
+	(void)inserted;
+}
+
+MapSector *MapSectorTable::erase(v2s16 p)
+{
+	Shard &shard = m_shards[shardIndex(p)];
+	std::unique_lock lock(shard.mutex);
+	auto it = shard.sectors.find(p);
+	if (it == shard.sectors.end())
+		return nullptr;
+	MapSector *sector = it->second;
+	shard.sectors.erase(it);
+	return sector;
+}
+
+void MapSectorTable::clear()
+{
+	for (auto &shard : m_shards)
+		shard.sectors.clear();
+}
+
+size_t MapSectorTable::size() const
+{
+	size_t ret = 0;
+	for (auto &shard : m_shards)
+		ret += shard.sectors.size();
+	return ret;
+}
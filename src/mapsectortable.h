@@ -0,0 +1,135 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "irr_v2d.h"
+#include "util/basic_macros.h"
+#include <array>
+#include <shared_mutex>
+#include <type_traits>
+#include <unordered_map>
+
+class MapSector;
+
+/*
+	The sector table of a Map.
+
+	Sectors are grouped into regions of REGION_SIZE x REGION_SIZE sectors,
+	which are spread over a fixed number of shards with a lock each.
+	The locks protect the structure of the map, i.e. which sectors and blocks
+	exist, but not the contents of blocks:
+
+	- Adding or removing sectors or blocks requires holding the env lock
+	  and the region lock in exclusive mode (insert() and erase() as well as
+	  the MapSector methods take the latter on their own).
+	- Looking up sectors or blocks requires holding either the env lock or
+	  the region lock in shared mode.
+
+	This way other threads can check which blocks are loaded without having
+	to wait for the server step.
+*/
+class MapSectorTable
+{
+	typedef std::unordered_map<v2s16, MapSector*> Container;
+
+	struct Shard {
+		mutable std::shared_mutex mutex;
+		Container sectors;
+	};
+
+public:
+	// in sectors
+	static constexpr s16 REGION_SIZE = 16;
+	static constexpr size_t SHARD_COUNT = 64;
+
+	template <bool Const>
+	class Iterator
+	{
+		typedef std::conditional_t<Const, const MapSectorTable, MapSectorTable> Table;
+		typedef std::conditional_t<Const, Container::const_iterator,
+			Container::iterator> Inner;
+
+	public:
+		typedef std::conditional_t<Const, const Container::value_type,
+			Container::value_type> value_type;
+
+		Iterator(Table *table, size_t shard) : m_table(table), m_shard(shard)
+		{
+			if (m_shard < SHARD_COUNT) {
+				m_it = m_table->m_shards[m_shard].sectors.begin();
+				skipEmpty();
+			}
+		}
+
+		value_type &operator*() const { return *m_it; }
+		value_type *operator->() const { return &*m_it; }
+
+		Iterator &operator++()
+		{
+			++m_it;
+			skipEmpty();
+			return *this;
+		}
+
+		bool operator==(const Iterator &other) const
+		{
+			return m_shard == other.m_shard &&
+				(m_shard == SHARD_COUNT || m_it == other.m_it);
+		}
+		bool operator!=(const Iterator &other) const { return !(*this == other); }
+
+	private:
+		void skipEmpty()
+		{
+			while (m_it == m_table->m_shards[m_shard].sectors.end()) {
+				if (++m_shard == SHARD_COUNT)
+					return;
+				m_it = m_table->m_shards[m_shard].sectors.begin();
+			}
+		}
+
+		Table *m_table;
+		size_t m_shard;
+		Inner m_it;
+	};
+
+	typedef Iterator<false> iterator;
+	typedef Iterator<true> const_iterator;
+
+	MapSectorTable() = default;
+	DISABLE_CLASS_COPY(MapSectorTable)
+
+	std::shared_mutex &getLock(v2s16 p) const { return m_shards[shardIndex(p)].mutex; }
+
+	/// @return nullptr if the sector does not exist
+	MapSector *find(v2s16 p) const;
+	/// Adds a sector, taking the region lock.
+	void insert(v2s16 p, MapSector *sector);
+	/// Removes a sector without deleting it, taking the region lock.
+	/// @return the removed sector or nullptr
+	MapSector *erase(v2s16 p);
+	/// Forgets all sectors, without locking.
+	void clear();
+
+	size_t size() const;
+	bool empty() const { return size() == 0; }
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, SHARD_COUNT); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, SHARD_COUNT); }
+
+private:
+	static size_t shardIndex(v2s16 p)
+	{
+		static_assert(REGION_SIZE == 16 && SHARD_COUNT == 64);
+		// Tile the shards 8x8, so neighbouring regions never share one
+		const u32 rx = (p.X >> 4) & 7, rz = (p.Y >> 4) & 7;
+		return rx | (rz << 3);
+	}
+
+	std::array<Shard, SHARD_COUNT> m_shards;
+};
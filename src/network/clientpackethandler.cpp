@@ -440,6 +440,7 @@ void Client::handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt)
 		for (u16 i = 0; i < removed_count; i++) {
 			*pkt >> id;
 			m_env.removeActiveObject(id);
+			m_object_positions.forget(id);
 			// Object-attached sounds MUST NOT be removed here because they might
 			// have started to play immediately before the entity was removed.
 		}
@@ -480,6 +481,20 @@ void Client::handleCommand_ActiveObjectMessages(NetworkPacket* pkt)
 	}
 }
 
+void Client::handleCommand_ActiveObjectPositions(NetworkPacket* pkt)
+{
+	std::string datastring(pkt->getString(0), pkt->getSize());
+	std::istringstream is(datastring, std::ios_base::binary);
+
+	u16 id;
+	ObjectPositionUpdate update;
+	while (canRead(is)) {
+		// Updates relative to a keyframe that did not arrive yet are dropped
+		if (m_object_positions.read(is, id, update))
+			m_env.processActiveObjectMessage(id, update.toMessage());
+	}
+}
+
 void Client::handleCommand_Movement(NetworkPacket* pkt)
 {
 	LocalPlayer *player = m_env.getLocalPlayer();
@@ -64,6 +64,8 @@ class IConnection
 	virtual session_t GetPeerID() const = 0;
 	virtual Address GetPeerAddress(session_t peer_id) = 0;
 	virtual float getPeerStat(session_t peer_id, rtt_stat_type type) = 0;
+	// in KB/s, returns -1 if the peer does not exist
+	virtual float getPeerRateStat(session_t peer_id, rate_stat_type type) = 0;
 	virtual float getLocalStat(rate_stat_type type) = 0;
 };
 
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <thread>
 #include "network/mtp/internal.h"
 #include "log.h"
 #include "porting.h"
@@ -40,7 +41,20 @@ namespace con
 // (it's okay to start out quick)
 #define RESEND_TIMEOUT_MIN 0.1f
 #define RESEND_TIMEOUT_MAX 2.0f
-#define RESEND_TIMEOUT_FACTOR 2
+// clock granularity in the resend timeout calculation
+#define RESEND_TIMEOUT_GRANULARITY 0.01f
+
+// window reduction on loss and growth rate (in packets/s^3) of the
+// window size, as in CUBIC (RFC 8312)
+#define CUBIC_BETA 0.7f
+#define CUBIC_C 4.0f
+
+// pacing rate relative to window size per round trip, so that pacing
+// does not limit below the window
+#define PACING_GAIN 1.25f
+// reliables that may be sent in a burst, in seconds of pacing rate
+#define PACING_BURST_TIME 0.1f
+#define PACING_BURST_MIN 16.0f
 
 u16 BufferedPacket::getSeqnum() const
 {
@@ -59,6 +73,25 @@ void BufferedPacket::setSenderPeerId(session_t id)
 	writeU16(&data[4], id);
 }
 
+PacketBuffer::PacketBuffer(const u8 *data, u32 size) :
+	PacketBuffer(size)
+{
+	if (size > 0)
+		memcpy(this->data(), data, size);
+}
+
+u8 *PacketBuffer::claimHeadroom(u32 n)
+{
+	if (m_headroom_taken || n > HEADROOM)
+		return nullptr;
+	m_headroom_taken = true;
+	return &m_data[HEADROOM - n];
+}
+
+PacketChunk::PacketChunk(const SharedBuffer<u8> &data) :
+	PacketChunk(std::make_shared<PacketBuffer>(*data, data.getSize()))
+{}
+
 BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
@@ -76,84 +109,80 @@ BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &dat
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
-{
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
-
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
-	return b;
-}
-
-// Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
+BufferedPacketPtr makePacket(const Address &address, const PacketChunk &chunk,
+		u32 protocol_id, session_t sender_peer_id, u8 channel,
+		bool reliable, u16 seqnum)
 {
-	// Chunk packets, containing the TYPE_SPLIT header
-	const u32 chunk_header_size = 7;
-	const u32 maximum_data_size = chunksize_max - chunk_header_size;
-	u32 start = 0, end = 0;
-	u16 chunk_num = 0;
-	do {
-		end = start + maximum_data_size - 1;
-		if (end > data.getSize() - 1)
-			end = data.getSize() - 1;
+	const u32 header_size = BASE_HEADER_SIZE +
+			(reliable ? RELIABLE_HEADER_SIZE : 0) + chunk.header_size;
 
-		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
+	// Only a packet made of all of the buffer can be contiguous
+	u8 *headroom = nullptr;
+	if (chunk.offset == 0 && chunk.size == chunk.buffer->size())
+		headroom = chunk.buffer->claimHeadroom(header_size);
 
-		SharedBuffer<u8> chunk(packet_size);
+	BufferedPacketPtr p;
+	if (headroom) {
+		p = std::make_shared<BufferedPacket>(chunk.buffer, headroom,
+				header_size + chunk.size);
+	} else {
+		p = std::make_shared<BufferedPacket>(chunk.buffer, header_size,
+				chunk.offset, chunk.size);
+	}
+	p->address = address;
 
-		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
-		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+	u8 *header = p->data;
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
+	header += BASE_HEADER_SIZE;
+	if (reliable) {
+		writeU8(&header[0], PACKET_TYPE_RELIABLE);
+		writeU16(&header[1], seqnum);
+		header += RELIABLE_HEADER_SIZE;
+	}
+	memcpy(header, chunk.header, chunk.header_size);
 
-		chunks->push_back(chunk);
+	return p;
+}
 
-		start = end + 1;
-		sanity_check(chunk_num < 0xFFFF); // overflow
-		chunk_num++;
-	}
-	while (end != data.getSize() - 1);
+// Split data in chunks with TYPE_SPLIT headers, referencing slices of it
+static void makeSplitPacket(const PacketBufferPtr &data, u32 chunksize_max,
+		u16 seqnum, std::list<PacketChunk> *chunks)
+{
+	const u32 maximum_data_size = chunksize_max - SPLIT_HEADER_SIZE;
+	const u32 chunk_count = (data->size() + maximum_data_size - 1) / maximum_data_size;
+	sanity_check(chunk_count <= 0xFFFF); // overflow
 
-	for (auto &chunk : *chunks) {
-		// Write chunk_count
-		writeU16(&chunk[3], chunk_num);
+	for (u32 chunk_num = 0; chunk_num < chunk_count; chunk_num++) {
+		chunks->emplace_back();
+		PacketChunk &chunk = chunks->back();
+		chunk.buffer = data;
+		chunk.offset = chunk_num * maximum_data_size;
+		chunk.size = MYMIN(maximum_data_size, data->size() - chunk.offset);
+		chunk.header_size = SPLIT_HEADER_SIZE;
+		writeU8(&chunk.header[0], PACKET_TYPE_SPLIT);
+		writeU16(&chunk.header[1], seqnum);
+		writeU16(&chunk.header[3], chunk_count);
+		writeU16(&chunk.header[5], chunk_num);
 	}
 }
 
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
+void makeAutoSplitPacket(const PacketBufferPtr &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketChunk> *list)
 {
-	u32 original_header_size = 1;
-
-	if (data.getSize() + original_header_size > chunksize_max) {
+	if (data->size() + ORIGINAL_HEADER_SIZE > chunksize_max) {
 		makeSplitPacket(data, chunksize_max, split_seqnum, list);
 		split_seqnum++;
 		return;
 	}
 
-	list->push_back(makeOriginalPacket(data));
-}
-
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
-{
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
-
-	writeU8(&b[0], PACKET_TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
-
-	memcpy(&b[header_size], *data, data.getSize());
-
-	return b;
+	list->emplace_back();
+	PacketChunk &chunk = list->back();
+	chunk.buffer = data;
+	chunk.size = data->size();
+	chunk.header_size = ORIGINAL_HEADER_SIZE;
+	writeU8(&chunk.header[0], PACKET_TYPE_ORIGINAL);
 }
 
 /*
@@ -394,6 +423,255 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 	return timed_outs;
 }
 
+void ReliablePacketBuffer::getRanges(std::vector<std::pair<u16, u16>> &ranges,
+		size_t max_ranges)
+{
+	MutexAutoLock listlock(m_list_mutex);
+	for (auto &packet : m_list) {
+		const u16 seqnum = packet->getSeqnum();
+		if (!ranges.empty() && (u16)(ranges.back().second + 1) == seqnum)
+			ranges.back().second = seqnum;
+		else if (ranges.size() < max_ranges)
+			ranges.emplace_back(seqnum, seqnum);
+		else
+			break;
+	}
+}
+
+/*
+	ReliableSendWindow
+*/
+
+bool ReliableSendWindow::empty()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_count == 0;
+}
+
+u32 ReliableSendWindow::size()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_count;
+}
+
+bool ReliableSendWindow::getFirstSeqnum(u16 &result)
+{
+	MutexAutoLock lock(m_mutex);
+	if (m_count == 0)
+		return false;
+	result = m_first;
+	return true;
+}
+
+void ReliableSendWindow::grow(u32 span)
+{
+	size_t capacity = MYMAX(m_slots.size(), 64);
+	while (capacity < span)
+		capacity *= 2;
+	if (capacity == m_slots.size())
+		return;
+
+	std::vector<BufferedPacketPtr> slots(capacity);
+	for (auto &packet : m_slots) {
+		if (packet)
+			slots[packet->getSeqnum() & (capacity - 1)] = std::move(packet);
+	}
+	m_slots = std::move(slots);
+}
+
+void ReliableSendWindow::insert(const BufferedPacketPtr &p_ptr)
+{
+	MutexAutoLock lock(m_mutex);
+	const u16 seqnum = p_ptr->getSeqnum();
+
+	u16 first = seqnum;
+	u32 span = 1;
+	if (m_count > 0) {
+		const u16 ahead = seqnum - m_first;
+		if (ahead < MAX_RELIABLE_WINDOW_SIZE) {
+			first = m_first;
+			span = MYMAX(m_span, (u32)ahead + 1);
+		} else {
+			// Sent after packets with higher seqnums
+			span = m_span + (u16)(m_first - seqnum);
+		}
+	}
+	sanity_check(span <= MAX_RELIABLE_WINDOW_SIZE);
+
+	grow(span);
+	BufferedPacketPtr &p = slot(seqnum);
+	if (p)
+		throw AlreadyExistsException("seqnum already in send window");
+	p = p_ptr;
+	m_first = first;
+	m_span = span;
+	m_count++;
+	if (!m_sent_any || (u16)(seqnum - m_next) < MAX_RELIABLE_WINDOW_SIZE)
+		m_next = seqnum + 1;
+	m_sent_any = true;
+}
+
+bool ReliableSendWindow::wasAcked(u16 seqnum)
+{
+	MutexAutoLock lock(m_mutex);
+	// Packets leave the window only once acknowledged
+	if (!m_sent_any || (u16)(m_next - 1 - seqnum) >= MAX_RELIABLE_WINDOW_SIZE)
+		return false;
+	const u16 offset = seqnum - m_first;
+	return m_count == 0 || offset >= m_span || !slot(seqnum);
+}
+
+void ReliableSendWindow::takeNoLock(u32 offset, std::vector<BufferedPacketPtr> &taken)
+{
+	BufferedPacketPtr &p = slot(m_first + offset);
+	if (!p)
+		return;
+	taken.push_back(std::move(p));
+	p.reset();
+	m_count--;
+}
+
+void ReliableSendWindow::trimNoLock()
+{
+	if (m_count == 0) {
+		m_span = 0;
+		return;
+	}
+	while (!slot(m_first)) {
+		m_first++;
+		m_span--;
+	}
+	while (!slot(m_first + m_span - 1))
+		m_span--;
+}
+
+BufferedPacketPtr ReliableSendWindow::popSeqnum(u16 seqnum)
+{
+	MutexAutoLock lock(m_mutex);
+	const u16 offset = seqnum - m_first;
+	if (offset >= m_span || !slot(seqnum)) {
+		LOG(dout_con<<"Sequence number: " << seqnum
+				<< " not found in send window"<<std::endl);
+		throw NotFoundException("seqnum not found in send window");
+	}
+
+	BufferedPacketPtr p = std::move(slot(seqnum));
+	slot(seqnum).reset();
+	m_count--;
+	trimNoLock();
+	return p;
+}
+
+u32 ReliableSendWindow::popAcked(u16 next_expected,
+		const std::vector<std::pair<u16, u16>> &ranges,
+		std::vector<BufferedPacketPtr> &acked)
+{
+	MutexAutoLock lock(m_mutex);
+	if (m_count == 0)
+		return 0;
+
+	// Everything before next_expected, unless the ACK is outdated
+	u32 cumulative = (u16)(next_expected - m_first);
+	if (cumulative >= MAX_RELIABLE_WINDOW_SIZE)
+		cumulative = 0;
+	cumulative = MYMIN(cumulative, m_span);
+	for (u32 offset = 0; offset < cumulative; offset++)
+		takeNoLock(offset, acked);
+
+	// Offsets of the ranges, cut to the window
+	std::vector<std::pair<u32, u32>> offsets;
+	for (auto &range : ranges) {
+		const u16 begin = range.first - m_first;
+		const u16 end = range.second - m_first;
+		if (begin > end || begin >= m_span)
+			continue;
+		offsets.emplace_back(begin, MYMIN((u32)end, m_span - 1));
+	}
+	std::sort(offsets.begin(), offsets.end());
+	for (auto &range : offsets) {
+		for (u32 offset = range.first; offset <= range.second; offset++)
+			takeNoLock(offset, acked);
+	}
+
+	// Mark the holes, each packet only for its first resend
+	u32 marked = 0;
+	u32 received_after = 0;
+	for (size_t i = offsets.size(); i-- > 0;) {
+		received_after += offsets[i].second - offsets[i].first + 1;
+		if (received_after < FAST_RESEND_THRESHOLD)
+			continue;
+		const u32 hole_begin = i > 0 ? offsets[i - 1].second + 1 : cumulative;
+		for (u32 offset = hole_begin; offset < offsets[i].first; offset++) {
+			BufferedPacketPtr &p = slot(m_first + offset);
+			if (p && p->resend_count == 0 && !p->resend_now) {
+				p->resend_now = true;
+				marked++;
+			}
+		}
+	}
+
+	trimNoLock();
+	return marked;
+}
+
+void ReliableSendWindow::fixPeerId(session_t new_id)
+{
+	MutexAutoLock lock(m_mutex);
+	for (u32 offset = 0; offset < m_span; offset++) {
+		if (BufferedPacketPtr &p = slot(m_first + offset))
+			p->setSenderPeerId(new_id);
+	}
+}
+
+void ReliableSendWindow::incrementTimeouts(float dtime)
+{
+	MutexAutoLock lock(m_mutex);
+	for (u32 offset = 0; offset < m_span; offset++) {
+		if (BufferedPacketPtr &p = slot(m_first + offset)) {
+			p->time += dtime;
+			p->totaltime += dtime;
+		}
+	}
+}
+
+u32 ReliableSendWindow::getTimedOuts(float timeout)
+{
+	MutexAutoLock lock(m_mutex);
+	u32 count = 0;
+	for (u32 offset = 0; offset < m_span; offset++) {
+		BufferedPacketPtr &p = slot(m_first + offset);
+		if (p && p->totaltime >= timeout)
+			count++;
+	}
+	return count;
+}
+
+std::vector<ConstSharedPtr<BufferedPacket>>
+	ReliableSendWindow::getResend(float timeout, u32 max_packets)
+{
+	MutexAutoLock lock(m_mutex);
+	std::vector<ConstSharedPtr<BufferedPacket>> timed_outs;
+	for (u32 offset = 0; offset < m_span && timed_outs.size() < max_packets; offset++) {
+		BufferedPacketPtr &packet = slot(m_first + offset);
+		if (!packet)
+			continue;
+
+		// resend time scales exponentially with each cycle
+		const float pkt_timeout = timeout * powf(RESEND_SCALE_BASE, packet->resend_count);
+
+		if (packet->time < pkt_timeout && !packet->resend_now)
+			continue;
+
+		// caller will resend packet so reset time and increase counter
+		packet->time = 0.0f;
+		packet->resend_count++;
+		packet->resend_now = false;
+
+		timed_outs.emplace_back(packet);
+	}
+	return timed_outs;
+}
+
 /*
 	IncomingSplitPacket
 */
@@ -596,7 +874,8 @@ ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = std::make_shared<PacketBuffer>(pkt->getForgedSize());
+	pkt->forgePacket(c->data->data());
 	return c;
 }
 
@@ -606,7 +885,7 @@ ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, co
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = false;
-	data.copyTo(c->data);
+	c->data = std::make_shared<PacketBuffer>(*data, data.getSize());
 	return c;
 }
 
@@ -617,7 +896,7 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	c->channelnum = 0;
 	c->reliable = true;
 	c->raw = true;
-	data.copyTo(c->data);
+	c->data = std::make_shared<PacketBuffer>(*data, data.getSize());
 	return c;
 }
 
@@ -707,33 +986,28 @@ bool Channel::putBackSequenceNumber(u16 seqnum)
 
 void Channel::UpdateBytesSent(unsigned int bytes, unsigned int packets)
 {
-	MutexAutoLock internal(m_internal_mutex);
-	current_bytes_transfered += bytes;
-	current_packet_successful += packets;
+	current_bytes_transfered.fetch_add(bytes, std::memory_order_relaxed);
+	current_packet_successful.fetch_add(packets, std::memory_order_relaxed);
 }
 
 void Channel::UpdateBytesReceived(unsigned int bytes) {
-	MutexAutoLock internal(m_internal_mutex);
-	current_bytes_received += bytes;
+	current_bytes_received.fetch_add(bytes, std::memory_order_relaxed);
 }
 
 void Channel::UpdateBytesLost(unsigned int bytes)
 {
-	MutexAutoLock internal(m_internal_mutex);
-	current_bytes_lost += bytes;
+	current_bytes_lost.fetch_add(bytes, std::memory_order_relaxed);
 }
 
 
 void Channel::UpdatePacketLossCounter(unsigned int count)
 {
-	MutexAutoLock internal(m_internal_mutex);
-	current_packet_loss += count;
+	current_packet_loss.fetch_add(count, std::memory_order_relaxed);
 }
 
 void Channel::UpdatePacketTooLateCounter()
 {
-	MutexAutoLock internal(m_internal_mutex);
-	current_packet_too_late++;
+	current_packet_too_late.fetch_add(1, std::memory_order_relaxed);
 }
 
 void Channel::UpdateTimers(float dtime)
@@ -744,26 +1018,13 @@ void Channel::UpdateTimers(float dtime)
 	if (packet_loss_counter > 1.0f) {
 		packet_loss_counter -= 1.0f;
 
-		unsigned int packet_loss;
-		unsigned int packets_successful;
-		unsigned int packet_too_late;
-
-		bool reasonable_amount_of_data_transmitted = false;
+		unsigned int packet_loss = current_packet_loss.exchange(0);
+		unsigned int packets_successful = current_packet_successful.exchange(0);
+		unsigned int packet_too_late = current_packet_too_late.exchange(0);
 
-		{
-			MutexAutoLock internal(m_internal_mutex);
-			packet_loss = current_packet_loss;
-			packet_too_late = current_packet_too_late;
-			packets_successful = current_packet_successful;
-
-			// has half the window even been used?
-			if (current_bytes_transfered > (unsigned int) (m_window_size*512/2)) {
-				reasonable_amount_of_data_transmitted = true;
-			}
-			current_packet_loss = 0;
-			current_packet_too_late = 0;
-			current_packet_successful = 0;
-		}
+		// has half the window even been used?
+		bool reasonable_amount_of_data_transmitted =
+				current_bytes_transfered > (unsigned int) (m_window_size*512/2);
 
 		// Packets too late means either packet duplication along the way
 		// or we were too fast in resending it (which should be self-regulating).
@@ -771,60 +1032,43 @@ void Channel::UpdateTimers(float dtime)
 		packet_loss = std::min(packet_loss + packet_too_late, packets_successful);
 
 		/* dynamic window size */
-		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
-
-		if (packets_successful > 0) {
-			successful_to_lost_ratio = packet_loss/packets_successful;
-		} else if (packet_loss > 0) {
-			setWindowSize(m_window_size - 10);
-			done = true;
-		}
-
-		if (!done) {
-			if (successful_to_lost_ratio < 0.01f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 100);
-			} else if (successful_to_lost_ratio < 0.05f) {
-				/* don't even think about increasing if we didn't even
-				 * use major parts of our window */
-				if (reasonable_amount_of_data_transmitted)
-					setWindowSize(m_window_size + 50);
-			} else if (successful_to_lost_ratio > 0.15f) {
-				setWindowSize(m_window_size - 100);
-			} else if (successful_to_lost_ratio > 0.1f) {
-				setWindowSize(m_window_size - 50);
-			}
+		if (packet_loss > 0 && (packets_successful == 0 ||
+				(float)packet_loss / packets_successful >= 0.01f)) {
+			m_window_max = m_window_size;
+			m_cubic_epoch = 0.0f;
+			setWindowSize(m_window_size * CUBIC_BETA);
+		} else if (reasonable_amount_of_data_transmitted) {
+			/* don't even think about increasing if we didn't even
+			 * use major parts of our window */
+			m_cubic_epoch += 1.0f;
+			// Concave up to the window size at the last loss, convex beyond
+			const float k = std::cbrt(m_window_max * (1.0f - CUBIC_BETA) / CUBIC_C);
+			const float t = m_cubic_epoch - k;
+			const float target = m_window_max + CUBIC_C * t * t * t;
+			if (target > m_window_size)
+				setWindowSize(target);
 		}
 	}
 
 	if (bpm_counter > 10.0f) {
-		{
-			MutexAutoLock internal(m_internal_mutex);
-			cur_kbps                 =
-					(((float) current_bytes_transfered)/bpm_counter)/1024.0f;
-			current_bytes_transfered = 0;
-			cur_kbps_lost            =
-					(((float) current_bytes_lost)/bpm_counter)/1024.0f;
-			current_bytes_lost       = 0;
-			cur_incoming_kbps        =
-					(((float) current_bytes_received)/bpm_counter)/1024.0f;
-			current_bytes_received   = 0;
-			bpm_counter              = 0.0f;
-		}
+		cur_kbps                 =
+				(((float) current_bytes_transfered.exchange(0))/bpm_counter)/1024.0f;
+		cur_kbps_lost            =
+				(((float) current_bytes_lost.exchange(0))/bpm_counter)/1024.0f;
+		cur_incoming_kbps        =
+				(((float) current_bytes_received.exchange(0))/bpm_counter)/1024.0f;
+		bpm_counter              = 0.0f;
 
 		if (cur_kbps > max_kbps) {
-			max_kbps = cur_kbps;
+			max_kbps = cur_kbps.load();
 		}
 
 		if (cur_kbps_lost > max_kbps_lost) {
-			max_kbps_lost = cur_kbps_lost;
+			max_kbps_lost = cur_kbps_lost.load();
 		}
 
 		if (cur_incoming_kbps > max_incoming_kbps) {
-			max_incoming_kbps = cur_incoming_kbps;
+			max_incoming_kbps = cur_incoming_kbps.load();
 		}
 
 		rate_samples       = MYMIN(rate_samples+1,10);
@@ -839,6 +1083,26 @@ void Channel::UpdateTimers(float dtime)
 }
 
 
+void Channel::refillPacingTokens(float dtime, float rtt)
+{
+	m_pacing = rtt > 0;
+	if (!m_pacing)
+		return;
+	const float rate = PACING_GAIN * m_window_size / rtt;
+	m_pacing_tokens = MYMIN(m_pacing_tokens + rate * dtime,
+			MYMAX(rate * PACING_BURST_TIME, PACING_BURST_MIN));
+}
+
+bool Channel::takePacingToken()
+{
+	if (!m_pacing)
+		return true;
+	if (m_pacing_tokens < 1.0f)
+		return false;
+	m_pacing_tokens -= 1.0f;
+	return true;
+}
+
 /*
 	Peer
 */
@@ -863,27 +1127,22 @@ PeerHelper& PeerHelper::operator=(Peer* peer)
 
 bool Peer::IncUseCount()
 {
-	MutexAutoLock lock(m_exclusive_access_mutex);
-
-	if (!m_pending_deletion) {
-		this->m_usage++;
-		return true;
-	}
-
-	return false;
+	u32 usage = m_usage.load();
+	do {
+		if (usage & USAGE_PENDING_DELETION)
+			return false;
+	} while (!m_usage.compare_exchange_weak(usage, usage + 1));
+	return true;
 }
 
 void Peer::DecUseCount()
 {
-	{
-		MutexAutoLock lock(m_exclusive_access_mutex);
-		sanity_check(m_usage > 0);
-		m_usage--;
+	const u32 usage = m_usage.fetch_sub(1);
+	sanity_check((usage & ~USAGE_PENDING_DELETION) > 0);
 
-		if (!((m_pending_deletion) && (m_usage == 0)))
-			return;
-	}
-	delete this;
+	// The last user of a dropped peer deletes it
+	if (usage - 1 == USAGE_PENDING_DELETION)
+		delete this;
 }
 
 void Peer::RTTStatistics(float rtt, const std::string &profiler_id,
@@ -936,7 +1195,8 @@ void Peer::RTTStatistics(float rtt, const std::string &profiler_id,
 
 bool Peer::isTimedOut(float timeout, std::string &reason)
 {
-	MutexAutoLock lock(m_exclusive_access_mutex);
+	if (m_timeout_reset.exchange(false, std::memory_order_relaxed))
+		m_timeout_counter = 0.0f;
 
 	{
 		u64 current_time = porting::getTimeMs();
@@ -954,12 +1214,9 @@ bool Peer::isTimedOut(float timeout, std::string &reason)
 
 void Peer::Drop()
 {
-	{
-		MutexAutoLock usage_lock(m_exclusive_access_mutex);
-		m_pending_deletion = true;
-		if (m_usage != 0)
-			return;
-	}
+	// Otherwise the last PeerHelper deletes it
+	if (m_usage.fetch_or(USAGE_PENDING_DELETION) != 0)
+		return;
 
 	PROFILE(std::stringstream peerIdentifier1);
 	PROFILE(peerIdentifier1 << "runTimeouts[" << m_connection->getDesc()
@@ -1004,22 +1261,28 @@ void UDPPeer::reportRTT(float rtt)
 		return;
 	RTTStatistics(rtt, "network", MAX_RELIABLE_WINDOW_SIZE*10);
 
-	// use this value to decide the resend timeout
-	const float rtt_stat = getStat(AVG_RTT);
-	if (rtt_stat < 0)
-		return;
-	float timeout = rtt_stat * RESEND_TIMEOUT_FACTOR;
-	if (timeout < RESEND_TIMEOUT_MIN)
-		timeout = RESEND_TIMEOUT_MIN;
-	if (timeout > RESEND_TIMEOUT_MAX)
-		timeout = RESEND_TIMEOUT_MAX;
+	// use the smoothed rtt and its variation to decide the resend timeout
+	float timeout, srtt;
+	{
+		MutexAutoLock lock(m_exclusive_access_mutex);
+		if (m_srtt < 0) {
+			m_srtt = rtt;
+			m_rttvar = rtt / 2;
+		} else {
+			m_rttvar = 0.75f * m_rttvar + 0.25f * std::abs(m_srtt - rtt);
+			m_srtt = 0.875f * m_srtt + 0.125f * rtt;
+		}
+		srtt = m_srtt;
+		timeout = m_srtt + MYMAX(RESEND_TIMEOUT_GRANULARITY, 4 * m_rttvar);
+	}
+	timeout = rangelim(timeout, RESEND_TIMEOUT_MIN, RESEND_TIMEOUT_MAX);
 
 	float timeout_old = getResendTimeout();
 	setResendTimeout(timeout);
 
 	if (std::abs(timeout - timeout_old) >= 0.001f) {
 		dout_con << m_connection->getDesc() << " set resend timeout " << timeout
-			<< " (rtt=" << rtt_stat << ") for peer id: " << id << std::endl;
+			<< " (srtt=" << srtt << ") for peer id: " << id << std::endl;
 	}
 }
 
@@ -1050,13 +1313,13 @@ void UDPPeer::PutReliableSendCommand(ConnectionCommandPtr &c,
 			(chan.queued_reliables.size() + 1 < chan.getWindowSize() / 2)) {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" processing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() << std::endl);
+				<<" data size: " << c->data->size() << std::endl);
 		if (processReliableSendCommand(c, max_packet_size))
 			return;
 	} else {
 		LOG(dout_con<<m_connection->getDesc()
 				<<" Queueing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() <<std::endl);
+				<<" data size: " << c->data->size() <<std::endl);
 
 		if (chan.queued_commands.size() + 1 >= chan.getWindowSize() / 2) {
 			LOG(derr_con << m_connection->getDesc()
@@ -1082,7 +1345,7 @@ bool UDPPeer::processReliableSendCommand(
 							- BASE_HEADER_SIZE
 							- RELIABLE_HEADER_SIZE;
 
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketChunk> originals;
 
 	if (c.raw) {
 		originals.emplace_back(c.data);
@@ -1099,7 +1362,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacketPtr> toadd;
 	u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (const PacketChunk &original : originals) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1112,12 +1375,10 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
-
-		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
+		// Add base and reliable headers and make a packet
+		BufferedPacketPtr p = con::makePacket(address, original,
 				m_connection->GetProtocolID(), m_connection->GetPeerID(),
-				c.channelnum);
+				c.channelnum, true, seqnum);
 
 		toadd.push(p);
 	}
@@ -1159,7 +1420,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	LOG(dout_con<<m_connection->getDesc()
 			<< " Windowsize exceeded on reliable sending "
-			<< c.data.getSize() << " bytes"
+			<< c.data->size() << " bytes"
 			<< std::endl << "\t\tinitial_sequence_number: "
 			<< initial_sequence_number
 			<< std::endl << "\t\tgot at most            : "
@@ -1178,7 +1439,9 @@ void UDPPeer::RunCommandQueues(
 
 	for (Channel &channel : channels) {
 
-		if ((!channel.queued_commands.empty()) &&
+		// The window and pacing limit what is sent, so take as many
+		// commands as there is room for
+		while ((!channel.queued_commands.empty()) &&
 				(channel.queued_reliables.size() < maxtransfer)) {
 			try {
 				ConnectionCommandPtr c = channel.queued_commands.front();
@@ -1192,12 +1455,14 @@ void UDPPeer::RunCommandQueues(
 				} else {
 					LOG(dout_con << m_connection->getDesc()
 							<< " Failed to queue packets for peer_id: " << c->peer_id
-							<< ", delaying sending of " << c->data.getSize()
+							<< ", delaying sending of " << c->data->size()
 							<< " bytes" << std::endl);
+					break;
 				}
 			}
 			catch (ItemNotFoundException &e) {
 				// intentionally empty
+				break;
 			}
 		}
 	}
@@ -1287,6 +1552,7 @@ Connection::Connection(u32 max_packet_size, float timeout,
 		bool ipv6, PeerHandler *peerhandler) :
 	m_udpSocket(ipv6),
 	m_protocol_id(PROTOCOL_ID),
+	m_peer_table(new PeerTable()),
 	m_sendThread(new ConnectionSendThread(max_packet_size, timeout)),
 	m_receiveThread(new ConnectionReceiveThread()),
 	m_bc_peerhandler(peerhandler)
@@ -1313,12 +1579,20 @@ Connection::~Connection()
 
 	// wait for threads to finish
 	m_sendThread->wait();
+	// The shards cannot be started anymore
+	for (auto &shard : m_receive_shards)
+		shard.thread->stop();
 	m_receiveThread->wait();
+	for (auto &shard : m_receive_shards)
+		shard.thread->wait();
 
 	// Delete peers
-	for (auto &peer : m_peers) {
+	reclaimPeers();
+	const PeerTable *table = m_peer_table.load();
+	for (auto &peer : table->peers) {
 		delete peer.second;
 	}
+	delete table;
 }
 
 /* Internal stuff */
@@ -1326,7 +1600,8 @@ Connection::~Connection()
 void Connection::putEvent(ConnectionEventPtr e)
 {
 	assert(e->type != CONNEVENT_NONE); // Pre-condition
-	m_event_queue.push_back(e);
+	m_event_queue.push(std::move(e));
+	m_event_semaphore.post();
 }
 
 void Connection::TriggerSend()
@@ -1334,12 +1609,85 @@ void Connection::TriggerSend()
 	m_sendThread->Trigger();
 }
 
-PeerHelper Connection::getPeerNoEx(session_t peer_id)
+Connection::PeerTableReader::PeerTableReader(Connection *connection) :
+	m_connection(connection)
+{
+	// Must be counted before loading the table, see reclaimPeersNoLock()
+	connection->m_peer_table_readers.fetch_add(1);
+	m_table = connection->m_peer_table.load();
+}
+
+Connection::PeerTableReader::~PeerTableReader()
 {
+	m_connection->m_peer_table_readers.fetch_sub(1);
+}
+
+void Connection::publishPeerTable(PeerTable *table, Peer *removed)
+{
+	const PeerTable *old = m_peer_table.exchange(table);
+	m_retired_peers.emplace_back(old, removed);
+	m_have_retired_peers = true;
+	reclaimPeersNoLock();
+}
+
+void Connection::reclaimPeers()
+{
+	if (!m_have_retired_peers)
+		return;
 	MutexAutoLock peerlock(m_peers_mutex);
-	std::map<session_t, Peer *>::iterator node = m_peers.find(peer_id);
+	reclaimPeersNoLock();
+}
 
-	if (node == m_peers.end()) {
+void Connection::startReceiveShards(const Address &bind_address, u16 count)
+{
+	for (u16 i = 0; i < count; i++) {
+		ReceiveShard shard;
+		shard.socket = std::make_unique<UDPSocket>(bind_address.isIPv6());
+		try {
+			if (!shard.socket->setReusePort())
+				throw SocketException("SO_REUSEPORT is not supported");
+			shard.socket->Bind(bind_address);
+		} catch (SocketException &e) {
+			warningstream << getDesc() << " Could not start receive thread "
+				<< (i + 1) << ": " << e.what() << std::endl;
+			return;
+		}
+		// Amount of time Receive() will wait for data, as for m_udpSocket
+		shard.socket->setTimeoutMs(500);
+
+		shard.thread = std::make_unique<ConnectionReceiveThread>();
+		shard.thread->setParent(this);
+		shard.thread->setSocket(shard.socket.get(), i + 1);
+		shard.thread->start();
+		m_receive_shards.push_back(std::move(shard));
+	}
+}
+
+void Connection::reclaimPeersNoLock()
+{
+	/*
+		A reader counted from now on loads a table published before, so if
+		there is none right now none can see the retired tables anymore.
+		Otherwise this is retried later by the send thread.
+	*/
+	if (m_peer_table_readers.load() != 0)
+		return;
+
+	for (auto &it : m_retired_peers) {
+		delete it.first;
+		if (it.second)
+			it.second->Drop();
+	}
+	m_retired_peers.clear();
+	m_have_retired_peers = false;
+}
+
+PeerHelper Connection::getPeerNoEx(session_t peer_id)
+{
+	PeerTableReader table(this);
+	auto node = table->peers.find(peer_id);
+
+	if (node == table->peers.end()) {
 		return PeerHelper(NULL);
 	}
 
@@ -1349,11 +1697,17 @@ PeerHelper Connection::getPeerNoEx(session_t peer_id)
 	return PeerHelper(node->second);
 }
 
+std::vector<session_t> Connection::getPeerIDs()
+{
+	PeerTableReader table(this);
+	return table->ids;
+}
+
 /* find peer_id for address */
 session_t Connection::lookupPeer(const Address& sender)
 {
-	MutexAutoLock peerlock(m_peers_mutex);
-	for (auto &it: m_peers) {
+	PeerTableReader table(this);
+	for (auto &it : table->peers) {
 		Peer *peer = it.second;
 		if (peer->isPendingDeletion())
 			continue;
@@ -1367,9 +1721,9 @@ session_t Connection::lookupPeer(const Address& sender)
 
 u32 Connection::getActiveCount()
 {
-	MutexAutoLock peerlock(m_peers_mutex);
+	PeerTableReader table(this);
 	u32 count = 0;
-	for (auto &it : m_peers) {
+	for (auto &it : table->peers) {
 		Peer *peer = it.second;
 		if (peer->isPendingDeletion())
 			continue;
@@ -1387,18 +1741,21 @@ bool Connection::deletePeer(session_t peer_id, bool timeout)
 	/* lock list as short as possible */
 	{
 		MutexAutoLock peerlock(m_peers_mutex);
-		if (m_peers.find(peer_id) == m_peers.end())
+		const PeerTable *old = m_peer_table.load();
+		auto node = old->peers.find(peer_id);
+		if (node == old->peers.end())
 			return false;
-		peer = m_peers[peer_id];
-		m_peers.erase(peer_id);
-		auto it = std::find(m_peer_ids.begin(), m_peer_ids.end(), peer_id);
-		m_peer_ids.erase(it);
-	}
+		peer = node->second;
 
-	// Create event
-	putEvent(ConnectionEvent::peerRemoved(peer_id, timeout, peer->getAddress()));
+		auto *table = new PeerTable(*old);
+		table->peers.erase(peer_id);
+		auto it = std::find(table->ids.begin(), table->ids.end(), peer_id);
+		table->ids.erase(it);
+		// Create event before the peer can be dropped
+		putEvent(ConnectionEvent::peerRemoved(peer_id, timeout, peer->getAddress()));
+		publishPeerTable(table, peer);
+	}
 
-	peer->Drop();
 	return true;
 }
 
@@ -1406,17 +1763,24 @@ bool Connection::deletePeer(session_t peer_id, bool timeout)
 
 ConnectionEventPtr Connection::waitEvent(u32 timeout_ms)
 {
-	try {
-		return m_event_queue.pop_front(timeout_ms);
-	} catch(ItemNotFoundException &ex) {
+	if (!m_event_semaphore.wait(timeout_ms))
 		return ConnectionEvent::create(CONNEVENT_NONE);
-	}
+
+	/*
+		Each post follows a push, but with several threads pushing, the event
+		counted may be queued behind one whose push has not completed yet.
+		It is on its way then, and leaving the count unused would strand it.
+	*/
+	ConnectionEventPtr e;
+	while (!m_event_queue.pop(e))
+		std::this_thread::yield();
+	return e;
 }
 
 void Connection::putCommand(ConnectionCommandPtr c)
 {
 	if (!m_shutting_down) {
-		m_command_queue.push_back(c);
+		m_command_queue.push(std::move(c));
 		m_sendThread->Trigger();
 	}
 }
@@ -1433,13 +1797,12 @@ void Connection::Connect(Address address)
 
 bool Connection::Connected()
 {
-	MutexAutoLock peerlock(m_peers_mutex);
+	PeerTableReader table(this);
 
-	if (m_peers.size() != 1)
+	if (table->peers.size() != 1)
 		return false;
 
-	std::map<session_t, Peer *>::iterator node = m_peers.find(PEER_ID_SERVER);
-	if (node == m_peers.end())
+	if (table->peers.find(PEER_ID_SERVER) == table->peers.end())
 		return false;
 
 	if (m_peer_id == PEER_ID_INEXISTENT)
@@ -1534,15 +1897,11 @@ float Connection::getPeerStat(session_t peer_id, rtt_stat_type type)
 	return peer->getStat(type);
 }
 
-float Connection::getLocalStat(rate_stat_type type)
+float Connection::getChannelRateStat(UDPPeer *peer, rate_stat_type type)
 {
-	PeerHelper peer = getPeerNoEx(PEER_ID_SERVER);
-
-	FATAL_ERROR_IF(!peer, "Connection::getLocalStat we couldn't get our own peer? are you serious???");
-
 	float retval = 0;
 
-	for (Channel &channel : dynamic_cast<UDPPeer *>(&peer)->channels) {
+	for (Channel &channel : peer->channels) {
 		switch(type) {
 			case CUR_DL_RATE:
 				retval += channel.getCurrentDownloadRateKB();
@@ -1563,13 +1922,33 @@ float Connection::getLocalStat(rate_stat_type type)
 				retval += channel.getCurrentLossRateKB();
 				break;
 		default:
-			FATAL_ERROR("Connection::getLocalStat Invalid stat type");
+			FATAL_ERROR("Connection: Invalid rate stat type");
 		}
 	}
 	return retval;
 }
 
-session_t Connection::createPeer(const Address &sender, int fd)
+float Connection::getPeerRateStat(session_t peer_id, rate_stat_type type)
+{
+	PeerHelper peer = getPeerNoEx(peer_id);
+	if (!peer)
+		return -1;
+	UDPPeer *udp_peer = dynamic_cast<UDPPeer *>(&peer);
+	if (!udp_peer)
+		return -1;
+	return getChannelRateStat(udp_peer, type);
+}
+
+float Connection::getLocalStat(rate_stat_type type)
+{
+	PeerHelper peer = getPeerNoEx(PEER_ID_SERVER);
+
+	FATAL_ERROR_IF(!peer, "Connection::getLocalStat we couldn't get our own peer? are you serious???");
+
+	return getChannelRateStat(dynamic_cast<UDPPeer *>(&peer), type);
+}
+
+session_t Connection::createPeer(const Address &sender, u8 receive_shard)
 {
 	// Somebody wants to make a new connection
 
@@ -1582,23 +1961,26 @@ session_t Connection::createPeer(const Address &sender, int fd)
 	*/
 
 	MutexAutoLock lock(m_peers_mutex);
+	const PeerTable *old = m_peer_table.load();
 	session_t peer_id_new;
 	for (int tries = 0; tries < 100; tries++) {
 		peer_id_new = myrand_range(minimum, overflow - 1);
-		if (m_peers.find(peer_id_new) == m_peers.end())
+		if (old->peers.find(peer_id_new) == old->peers.end())
 			break;
 	}
-	if (m_peers.find(peer_id_new) != m_peers.end()) {
+	if (old->peers.find(peer_id_new) != old->peers.end()) {
 		errorstream << getDesc() << " ran out of peer ids" << std::endl;
 		return PEER_ID_INEXISTENT;
 	}
 
 	// Create a peer
-	Peer *peer = 0;
-	peer = new UDPPeer(peer_id_new, sender, this);
+	auto *peer = new UDPPeer(peer_id_new, sender, this);
+	peer->receive_shard = receive_shard;
 
-	m_peers[peer->id] = peer;
-	m_peer_ids.push_back(peer->id);
+	auto *table = new PeerTable(*old);
+	table->peers[peer->id] = peer;
+	table->ids.push_back(peer->id);
+	publishPeerTable(table, nullptr);
 
 	LOG(dout_con << getDesc()
 			<< "createPeer(): giving peer_id=" << peer_id_new << std::endl);
@@ -1644,7 +2026,8 @@ void Connection::doResendOne(session_t peer_id)
 	putCommand(ConnectionCommand::resend_one(peer_id));
 }
 
-void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
+void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum,
+		Channel &channel)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -1653,10 +2036,20 @@ void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
 			" channel: " << (channelnum & 0xFF) <<
 			" seqnum: " << seqnum << std::endl);
 
-	SharedBuffer<u8> ack(4);
+	// Selective part: what was received besides this packet
+	std::vector<std::pair<u16, u16>> ranges;
+	channel.incoming_reliables.getRanges(ranges, SACK_RANGES_MAX);
+
+	SharedBuffer<u8> ack(7 + 4 * ranges.size());
 	writeU8(&ack[0], PACKET_TYPE_CONTROL);
 	writeU8(&ack[1], CONTROLTYPE_ACK);
 	writeU16(&ack[2], seqnum);
+	writeU16(&ack[4], channel.readNextIncomingSeqNum());
+	writeU8(&ack[6], ranges.size());
+	for (size_t i = 0; i < ranges.size(); i++) {
+		writeU16(&ack[7 + 4 * i], ranges[i].first);
+		writeU16(&ack[9 + 4 * i], ranges[i].second);
+	}
 
 	putCommand(ConnectionCommand::ack(peer_id, channelnum, ack));
 	m_sendThread->Trigger();
@@ -1672,8 +2065,10 @@ UDPPeer* Connection::createServerPeer(const Address &address)
 
 	{
 		MutexAutoLock lock(m_peers_mutex);
-		m_peers[peer->id] = peer;
-		m_peer_ids.push_back(peer->id);
+		auto *table = new PeerTable(*m_peer_table.load());
+		table->peers[peer->id] = peer;
+		table->ids.push_back(peer->id);
+		publishPeerTable(table, nullptr);
 	}
 
 	return peer;
@@ -9,6 +9,8 @@
 #include "constants.h"
 #include "util/pointer.h"
 #include "util/container.h"
+#include "threading/mpsc_queue.h"
+#include "threading/semaphore.h"
 #include "porting.h"
 #include "network/address.h"
 #include "network/networkprotocol.h"
@@ -90,6 +92,9 @@ typedef std::shared_ptr<ConnectionCommand> ConnectionCommandPtr;
 struct BufferedPacket;
 typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
 
+class PacketBuffer;
+typedef std::shared_ptr<PacketBuffer> PacketBufferPtr;
+
 class Connection;
 class PeerHandler;
 
@@ -98,8 +103,8 @@ class Peer : public IPeer {
 		friend class PeerHelper;
 
 		virtual ~Peer() {
-			MutexAutoLock usage_lock(m_exclusive_access_mutex);
-			FATAL_ERROR_IF(m_usage != 0, "Reference counting failure");
+			FATAL_ERROR_IF((m_usage & ~USAGE_PENDING_DELETION) != 0,
+					"Reference counting failure");
 		}
 
 		void Drop();
@@ -108,21 +113,18 @@ class Peer : public IPeer {
 						unsigned int max_packet_size) {};
 
 		bool isPendingDeletion() const {
-			MutexAutoLock lock(m_exclusive_access_mutex);
-			return m_pending_deletion;
+			return m_usage & USAGE_PENDING_DELETION;
 		}
+		// Called for every packet received, so it takes no lock
 		void ResetTimeout() {
-			MutexAutoLock lock(m_exclusive_access_mutex);
-			m_timeout_counter = 0;
+			m_timeout_reset.store(true, std::memory_order_relaxed);
 		}
 
 		bool isHalfOpen() const {
-			MutexAutoLock lock(m_exclusive_access_mutex);
-			return m_half_open;
+			return m_half_open.load(std::memory_order_relaxed);
 		}
 		void SetFullyOpen() {
-			MutexAutoLock lock(m_exclusive_access_mutex);
-			m_half_open = false;
+			m_half_open.store(false, std::memory_order_relaxed);
 		}
 
 		virtual bool isTimedOut(float timeout, std::string &reason);
@@ -177,8 +179,6 @@ class Peer : public IPeer {
 
 		mutable std::mutex m_exclusive_access_mutex;
 
-		bool m_pending_deletion = false;
-
 		Connection *m_connection;
 
 		// Address of the peer
@@ -207,18 +207,34 @@ class Peer : public IPeer {
 			is to avoid spending too many resources on a potential DoS attack
 			and to make sure Minetest servers are not useful for UDP amplificiation.
 		*/
-		bool m_half_open = true;
+		std::atomic<bool> m_half_open{true};
 
-		// current usage count
-		unsigned int m_usage = 0;
+		// Set in m_usage once the peer is to be deleted
+		static constexpr u32 USAGE_PENDING_DELETION = 0x80000000;
+		// Current usage count, changed without locking by every PeerHelper
+		std::atomic<u32> m_usage{0};
 
-		// Seconds from last receive
+		// Seconds from last receive, only used by isTimedOut()
 		float m_timeout_counter = 0.0f;
+		std::atomic<bool> m_timeout_reset{false};
 
 		u64 m_last_timeout_check;
 };
 
 class UDPPeer;
+class Channel;
+
+/*
+	The peers of a connection. A table is never changed once published:
+	adding or removing a peer publishes a changed copy, so that the peers
+	can be looked up without locking.
+*/
+struct PeerTable
+{
+	std::map<session_t, Peer *> peers;
+	// In the order they were added
+	std::vector<session_t> ids;
+};
 
 class Connection final : public IConnection
 {
@@ -244,36 +260,47 @@ class Connection final : public IConnection
 	session_t GetPeerID() const { return m_peer_id; }
 	Address GetPeerAddress(session_t peer_id);
 	float getPeerStat(session_t peer_id, rtt_stat_type type);
+	float getPeerRateStat(session_t peer_id, rate_stat_type type);
 	float getLocalStat(rate_stat_type type);
 	u32 GetProtocolID() const { return m_protocol_id; };
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
+	// Sockets the server receives from, see startReceiveShards()
+	u32 getReceiveSocketCount() const { return 1 + m_receive_shards.size(); }
 
 protected:
 	PeerHelper getPeerNoEx(session_t peer_id);
 	session_t   lookupPeer(const Address& sender);
 
-	session_t createPeer(const Address& sender, int fd);
+	session_t createPeer(const Address& sender, u8 receive_shard);
 	UDPPeer*  createServerPeer(const Address& sender);
 	bool deletePeer(session_t peer_id, bool timeout);
 
 	void SetPeerID(session_t id);
 
+	// Sums up a rate over all channels of the peer
+	static float getChannelRateStat(UDPPeer *peer, rate_stat_type type);
+
 	void doResendOne(session_t peer_id);
 
-	void sendAck(session_t peer_id, u8 channelnum, u16 seqnum);
+	void sendAck(session_t peer_id, u8 channelnum, u16 seqnum, Channel &channel);
 
-	std::vector<session_t> getPeerIDs()
-	{
-		MutexAutoLock peerlock(m_peers_mutex);
-		return m_peer_ids;
-	}
+	std::vector<session_t> getPeerIDs();
 
 	u32 getActiveCount();
 
+	// Frees the peer tables replaced, and the peers removed, if no reader
+	// can see them anymore
+	void reclaimPeers();
+
+	// Binds count more sockets to the server address, each with its own
+	// receive thread. m_udpSocket must be bound with SO_REUSEPORT already.
+	void startReceiveShards(const Address &bind_address, u16 count);
+
 	UDPSocket m_udpSocket;
-	// Command queue: user -> SendThread
-	MutexedQueue<ConnectionCommandPtr> m_command_queue;
+	// Command queue: user -> SendThread, lock-free so that sending never
+	// waits for the send thread
+	MPSCQueue<ConnectionCommandPtr> m_command_queue;
 
 	void putEvent(ConnectionEventPtr e);
 
@@ -284,19 +311,56 @@ class Connection final : public IConnection
 		return getPeerNoEx(PEER_ID_SERVER) != nullptr;
 	}
 private:
-	// Event queue: ReceiveThread -> user
-	MutexedQueue<ConnectionEventPtr> m_event_queue;
+	// Keeps the peer table current when constructed from being freed
+	class PeerTableReader
+	{
+	public:
+		PeerTableReader(Connection *connection);
+		~PeerTableReader();
+
+		DISABLE_CLASS_COPY(PeerTableReader)
+
+		const PeerTable *operator->() const { return m_table; }
+
+	private:
+		Connection *m_connection;
+		const PeerTable *m_table;
+	};
+
+	// Publishes table and retires the current one, with removed if any.
+	// m_peers_mutex must be locked.
+	void publishPeerTable(PeerTable *table, Peer *removed);
+	void reclaimPeersNoLock();
+
+	// Event queue: connection threads -> user, lock-free. Only one thread
+	// may wait for events at a time.
+	MPSCQueue<ConnectionEventPtr> m_event_queue;
+	// Posted once for each event queued
+	Semaphore m_event_semaphore;
 
 	session_t m_peer_id = 0;
 	u32 m_protocol_id;
 
-	std::map<session_t, Peer *> m_peers;
-	std::vector<session_t> m_peer_ids;
+	std::atomic<const PeerTable *> m_peer_table;
+	// Number of PeerTableReaders around
+	std::atomic<u32> m_peer_table_readers{0};
+	// Locked to publish a new table
 	std::mutex m_peers_mutex;
+	// Tables replaced and peers removed, waiting for the readers to be done
+	std::vector<std::pair<const PeerTable *, Peer *>> m_retired_peers;
+	std::atomic<bool> m_have_retired_peers{false};
 
 	std::unique_ptr<ConnectionSendThread> m_sendThread;
 	std::unique_ptr<ConnectionReceiveThread> m_receiveThread;
 
+	// Additional sockets sharing the server port, the kernel hashing the
+	// clients to them. Only received from, everything is sent by m_udpSocket.
+	struct ReceiveShard {
+		std::unique_ptr<UDPSocket> socket;
+		std::unique_ptr<ConnectionReceiveThread> thread;
+	};
+	std::vector<ReceiveShard> m_receive_shards;
+
 	mutable std::mutex m_info_mutex;
 
 	// Backwards compatibility
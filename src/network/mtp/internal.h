@@ -43,6 +43,14 @@ PACKET_TYPE_CONTROL: This is a packet used by the protocol.
 controltype and data description:
 	CONTROLTYPE_ACK
 		[2] u16 seqnum
+		optionally followed by a selective acknowledgement
+		(older peers ignore it):
+		[4] u16 next_expected
+		[6] u8 range_count
+		[7] range_count * (u16 first, u16 last)
+	- next_expected: all seqnums before it have been received
+	- the ranges list further received seqnums in ascending order,
+	  the holes between them are reported missing
 	CONTROLTYPE_SET_PEER_ID
 		[2] session_t peer_id_new
 	CONTROLTYPE_PING
@@ -75,6 +83,7 @@ data.
 	[3] u16 chunk_count
 	[5] u16 chunk_num
 */
+#define SPLIT_HEADER_SIZE 7
 
 /*
 PACKET_TYPE_RELIABLE: Delivery of all RELIABLE packets shall be forced by ACKs,
@@ -187,16 +196,88 @@ class IncomingDataCorruption : public BaseException
 };
 
 
+/*
+	Refcounted data of outgoing packets, with room reserved in front of it
+	for the headers of a packet made of all of it. The packets made of it
+	reference it instead of copying it.
+*/
+class PacketBuffer
+{
+public:
+	static constexpr u32 HEADROOM = BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE +
+			SPLIT_HEADER_SIZE;
+
+	PacketBuffer(u32 size) :
+		m_data(new u8[HEADROOM + size]), m_size(size)
+	{}
+	PacketBuffer(const u8 *data, u32 size);
+
+	DISABLE_CLASS_COPY(PacketBuffer)
+
+	u8 *data() { return &m_data[HEADROOM]; }
+	const u8 *data() const { return &m_data[HEADROOM]; }
+	u32 size() const { return m_size; }
+
+	// Returns the n bytes right before data(), or nullptr if already taken
+	u8 *claimHeadroom(u32 n);
+
+private:
+	std::unique_ptr<u8[]> m_data;
+	u32 m_size;
+	bool m_headroom_taken = false;
+};
+
+/*
+	A TYPE_ORIGINAL or TYPE_SPLIT packet, or a control packet: a header and
+	a slice of the buffer following it.
+*/
+struct PacketChunk
+{
+	PacketChunk() = default;
+	// All of the buffer, which contains its header
+	explicit PacketChunk(const PacketBufferPtr &buffer) :
+		buffer(buffer), size(buffer->size())
+	{}
+	// Copies the data, which contains its header
+	explicit PacketChunk(const SharedBuffer<u8> &data);
+
+	inline u32 totalSize() const { return header_size + size; }
+
+	PacketBufferPtr buffer;
+	u32 offset = 0;
+	u32 size = 0;
+	u8 header[SPLIT_HEADER_SIZE];
+	u8 header_size = 0;
+};
+
 /*
 	Struct for all kinds of packets. Includes following data:
 		BASE_HEADER
-		u8[] packet data (usually copied from SharedBuffer<u8>)
+		u8[] packet data
+	Received packets own their data. Sent ones reference the PacketBuffer
+	they are made of: either all of the packet is in its headroom, or the
+	headers are stored here and followed by a slice of it, the tail.
 */
 struct BufferedPacket {
 	BufferedPacket(u32 a_size)
 	{
 		m_data.resize(a_size);
 		data = &m_data[0];
+		m_head_size = a_size;
+	}
+
+	// All of the packet is at a_data, in the headroom of buffer
+	BufferedPacket(const PacketBufferPtr &buffer, u8 *a_data, u32 a_size) :
+		data(a_data), m_head_size(a_size), m_buffer(buffer)
+	{}
+
+	// header_size bytes of headers, followed by a slice of buffer
+	BufferedPacket(const PacketBufferPtr &buffer, u32 header_size,
+			u32 offset, u32 size) :
+		data(m_header), m_head_size(header_size), m_buffer(buffer),
+		m_tail(buffer->data() + offset), m_tail_size(size)
+	{
+		assert(header_size <= sizeof(m_header));
 	}
 
 	DISABLE_CLASS_COPY(BufferedPacket)
@@ -204,7 +285,11 @@ struct BufferedPacket {
 	u16 getSeqnum() const;
 	void setSenderPeerId(session_t id);
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_head_size + m_tail_size; }
+	// The contiguous part at data, which contains all of the headers
+	inline size_t headSize() const { return m_head_size; }
+	inline const u8 *tail() const { return m_tail; }
+	inline size_t tailSize() const { return m_tail_size; }
 
 	u8 *data; // Direct memory access
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
@@ -212,23 +297,34 @@ struct BufferedPacket {
 	u64 absolute_send_time = -1;
 	Address address; // Sender or destination
 	unsigned int resend_count = 0;
+	bool resend_now = false; // Reported missing by a selective ACK
 
 private:
-	std::vector<u8> m_data; // Data of the packet, including headers
+	u32 m_head_size = 0;
+	std::vector<u8> m_data; // Data of a received packet, including headers
+	PacketBufferPtr m_buffer;
+	u8 m_header[PacketBuffer::HEADROOM];
+	const u8 *m_tail = nullptr;
+	u32 m_tail_size = 0;
 };
 
 
-// This adds the base headers to the data and makes a packet out of it
+// This adds the base headers to a copy of the data and makes a packet out of it
 BufferedPacketPtr makePacket(const Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
-// Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
-// Increments split_seqnum if a split packet is made
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
+/*
+	This adds the base headers, and the TYPE_RELIABLE header if reliable,
+	to the chunk and makes a packet out of it. The payload is not copied.
+*/
+BufferedPacketPtr makePacket(const Address &address, const PacketChunk &chunk,
+		u32 protocol_id, session_t sender_peer_id, u8 channel,
+		bool reliable = false, u16 seqnum = 0);
 
-// Add the TYPE_RELIABLE header to the data
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
+// Depending on size, make a TYPE_ORIGINAL chunk or TYPE_SPLIT chunks
+// Increments split_seqnum if a split packet is made
+void makeAutoSplitPacket(const PacketBufferPtr &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketChunk> *list);
 
 struct IncomingSplitPacket
 {
@@ -266,6 +362,8 @@ class ReliablePacketBuffer
 	BufferedPacketPtr popFirst();
 	BufferedPacketPtr popSeqnum(u16 seqnum);
 	void insert(BufferedPacketPtr &p_ptr, u16 next_expected);
+	// Appends the runs of consecutive seqnums, in order, up to max_ranges
+	void getRanges(std::vector<std::pair<u16, u16>> &ranges, size_t max_ranges);
 	/// Adjusts the sender peer ID for all packets
 	void fixPeerId(session_t id);
 
@@ -291,6 +389,61 @@ class ReliablePacketBuffer
 	std::mutex m_list_mutex;
 };
 
+/*
+	The reliable packets which were sent but not acknowledged yet.
+	Packets are kept in a ring indexed by seqnum, which grows as needed.
+*/
+
+class ReliableSendWindow
+{
+public:
+	bool getFirstSeqnum(u16 &result);
+
+	BufferedPacketPtr popSeqnum(u16 seqnum);
+	/*
+		Pops the packets acknowledged by a selective ACK into `acked`.
+		Packets in the holes before at least FAST_RESEND_THRESHOLD received
+		ones are marked to be resent right away, returns how many.
+	*/
+	u32 popAcked(u16 next_expected, const std::vector<std::pair<u16, u16>> &ranges,
+			std::vector<BufferedPacketPtr> &acked);
+	void insert(const BufferedPacketPtr &p_ptr);
+	/// Whether the packet was sent and has been acknowledged since
+	bool wasAcked(u16 seqnum);
+	/// Adjusts the sender peer ID for all packets
+	void fixPeerId(session_t id);
+
+	void incrementTimeouts(float dtime);
+	u32 getTimedOuts(float timeout);
+	// timeout relative to last resend, packets marked by popAcked() are
+	// returned regardless
+	std::vector<ConstSharedPtr<BufferedPacket>> getResend(float timeout, u32 max_packets);
+
+	bool empty();
+	u32 size();
+
+private:
+	BufferedPacketPtr &slot(u16 seqnum)
+		{ return m_slots[seqnum & (m_slots.size() - 1)]; }
+	void grow(u32 span);
+	// Removes the packet at the given offset from m_first, if any
+	void takeNoLock(u32 offset, std::vector<BufferedPacketPtr> &taken);
+	// Skips the empty slots at both ends of the window
+	void trimNoLock();
+
+	// size is a power of two
+	std::vector<BufferedPacketPtr> m_slots;
+	// Oldest seqnum and number of seqnums covered, sent or not
+	u16 m_first = 0;
+	u32 m_span = 0;
+	u32 m_count = 0;
+	// Seqnum after the latest one sent
+	u16 m_next = 0;
+	bool m_sent_any = false;
+
+	std::mutex m_mutex;
+};
+
 /*
 	A buffer for reconstructing split packets
 */
@@ -336,7 +489,7 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	PacketBufferPtr data;
 	bool reliable = false;
 	bool raw = false;
 
@@ -378,6 +531,11 @@ struct ConnectionCommand
 /* minimum value for window size */
 #define MIN_RELIABLE_WINDOW_SIZE 32
 
+/* ranges sent at most in a selective ACK */
+#define SACK_RANGES_MAX 8
+/* received packets after a hole before the hole is resent */
+#define FAST_RESEND_THRESHOLD 3
+
 class Channel
 {
 
@@ -397,7 +555,7 @@ class Channel
 	ReliablePacketBuffer incoming_reliables;
 	// This is for buffering the sent packets so that the sender can
 	// re-send them if no ACK is received
-	ReliablePacketBuffer outgoing_reliables_sent;
+	ReliableSendWindow outgoing_reliables_sent;
 
 	//queued reliable packets
 	std::queue<BufferedPacketPtr> queued_reliables;
@@ -418,27 +576,27 @@ class Channel
 
 	void UpdateTimers(float dtime);
 
-	float getCurrentDownloadRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return cur_kbps; };
-	float getMaxDownloadRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return max_kbps; };
+	/*
+		Pacing of reliable packets: a token is needed for each one sent,
+		tokens come at a rate of the window size per round trip.
+		rtt < 0 (unknown) disables pacing.
+	*/
+	void refillPacingTokens(float dtime, float rtt);
+	bool takePacingToken();
+
+	// The rates are updated by UpdateTimers(), and read without locking
+	float getCurrentDownloadRateKB() const { return cur_kbps; };
+	float getMaxDownloadRateKB() const { return max_kbps; };
 
-	float getCurrentLossRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return cur_kbps_lost; };
-	float getMaxLossRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return max_kbps_lost; };
+	float getCurrentLossRateKB() const { return cur_kbps_lost; };
+	float getMaxLossRateKB() const { return max_kbps_lost; };
 
-	float getCurrentIncomingRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return cur_incoming_kbps; };
-	float getMaxIncomingRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return max_incoming_kbps; };
+	float getCurrentIncomingRateKB() const { return cur_incoming_kbps; };
+	float getMaxIncomingRateKB() const { return max_incoming_kbps; };
 
-	float getAvgDownloadRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return avg_kbps; };
-	float getAvgLossRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return avg_kbps_lost; };
-	float getAvgIncomingRateKB()
-		{ MutexAutoLock lock(m_internal_mutex); return avg_incoming_kbps; };
+	float getAvgDownloadRateKB() const { return avg_kbps; };
+	float getAvgLossRateKB() const { return avg_kbps_lost; };
+	float getAvgIncomingRateKB() const { return avg_incoming_kbps; };
 
 	u16 getWindowSize() const { return m_window_size; };
 
@@ -456,26 +614,35 @@ class Channel
 	u16 next_outgoing_seqnum = SEQNUM_INITIAL;
 	u16 next_outgoing_split_seqnum = SEQNUM_INITIAL;
 
-	unsigned int current_packet_loss = 0;
-	unsigned int current_packet_too_late = 0;
-	unsigned int current_packet_successful = 0;
+	// Counted by both connection threads
+	std::atomic<unsigned int> current_packet_loss{0};
+	std::atomic<unsigned int> current_packet_too_late{0};
+	std::atomic<unsigned int> current_packet_successful{0};
 	float packet_loss_counter = 0.0f;
 
-	unsigned int current_bytes_transfered = 0;
-	unsigned int current_bytes_received = 0;
-	unsigned int current_bytes_lost = 0;
-	float max_kbps = 0.0f;
-	float cur_kbps = 0.0f;
-	float avg_kbps = 0.0f;
-	float max_incoming_kbps = 0.0f;
-	float cur_incoming_kbps = 0.0f;
-	float avg_incoming_kbps = 0.0f;
-	float max_kbps_lost = 0.0f;
-	float cur_kbps_lost = 0.0f;
-	float avg_kbps_lost = 0.0f;
+	std::atomic<unsigned int> current_bytes_transfered{0};
+	std::atomic<unsigned int> current_bytes_received{0};
+	std::atomic<unsigned int> current_bytes_lost{0};
+	std::atomic<float> max_kbps{0.0f};
+	std::atomic<float> cur_kbps{0.0f};
+	std::atomic<float> avg_kbps{0.0f};
+	std::atomic<float> max_incoming_kbps{0.0f};
+	std::atomic<float> cur_incoming_kbps{0.0f};
+	std::atomic<float> avg_incoming_kbps{0.0f};
+	std::atomic<float> max_kbps_lost{0.0f};
+	std::atomic<float> cur_kbps_lost{0.0f};
+	std::atomic<float> avg_kbps_lost{0.0f};
 	float bpm_counter = 0.0f;
 
 	unsigned int rate_samples = 0;
+
+	// CUBIC-like window growth: window size at the last loss and
+	// seconds of growth since
+	float m_window_max = START_RELIABLE_WINDOW_SIZE;
+	float m_cubic_epoch = 0.0f;
+
+	float m_pacing_tokens = 0.0f;
+	bool m_pacing = false;
 };
 
 
@@ -508,8 +675,8 @@ class UDPPeer final : public Peer
 
 protected:
 	/*
-		Calculates avg_rtt and resend_timeout.
-		rtt=-1 only recalculates resend_timeout
+		Updates the RTT statistics and the resend timeout
+		(Jacobson/Karels, RFC 6298). rtt < 0 is ignored.
 	*/
 	void reportRTT(float rtt) override;
 
@@ -523,13 +690,22 @@ class UDPPeer final : public Peer
 	void setResendTimeout(float timeout)
 		{ MutexAutoLock lock(m_exclusive_access_mutex); resend_timeout = timeout; }
 
+	// Smoothed round trip time, -1 until known
+	float getSmoothedRTT()
+		{ MutexAutoLock lock(m_exclusive_access_mutex); return m_srtt; }
+
 	bool Ping(float dtime, SharedBuffer<u8>& data) override;
 
 	Channel channels[CHANNEL_COUNT];
 	bool m_pending_disconnect = false;
+	// Receive thread the datagrams of the peer arrive at, see
+	// Connection::startReceiveShards()
+	u8 receive_shard = 0;
 private:
 	// This is changed dynamically
 	float resend_timeout = 0.5;
+	float m_srtt = -1.0f;
+	float m_rttvar = 0.0f;
 
 	bool processReliableSendCommand(
 					ConnectionCommandPtr &c_ptr,
@@ -89,6 +89,8 @@ void *ConnectionSendThread::run()
 		/* remove all triggers */
 		while (m_send_sleep_semaphore.wait(0)) {
 		}
+		/* anything queued from now on needs a new one */
+		m_triggered.store(false);
 
 		lasttime = curtime;
 		curtime = porting::getTimeMs();
@@ -111,19 +113,24 @@ void *ConnectionSendThread::run()
 		}
 
 		/* translate commands to packets */
-		auto c = m_connection->m_command_queue.pop_frontNoEx(0);
-		while (c && c->type != CONNCMD_NONE) {
+		ConnectionCommandPtr c;
+		while (m_connection->m_command_queue.pop(c)) {
+			if (!c || c->type == CONNCMD_NONE)
+				continue;
 			if (c->reliable)
 				processReliableCommand(c);
 			else
 				processNonReliableCommand(c);
-
-			c = m_connection->m_command_queue.pop_frontNoEx(0);
 		}
 
 		/* send queued packets */
 		sendPackets(dtime, calculate_quota());
 
+		flushSends();
+
+		/* free the peers removed meanwhile */
+		m_connection->reclaimPeers();
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -133,7 +140,8 @@ void *ConnectionSendThread::run()
 
 void ConnectionSendThread::Trigger()
 {
-	m_send_sleep_semaphore.post();
+	if (!m_triggered.exchange(true))
+		m_send_sleep_semaphore.post();
 }
 
 bool ConnectionSendThread::packetsQueued()
@@ -214,6 +222,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 
 			// Increment reliable packet times
 			channel.outgoing_reliables_sent.incrementTimeouts(dtime);
+			channel.refillPacingTokens(dtime, udpPeer->getSmoothedRTT());
 
 			// Re-send timed out outgoing reliables
 			auto timed_outs = channel.outgoing_reliables_sent.getResend(
@@ -241,7 +250,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 				m_iteration_packets_avaialble = 0;
 
 			for (const auto &k : timed_outs)
-				resendReliable(channel, k.get(), resend_timeout);
+				resendReliable(channel, k, resend_timeout);
 
 			auto ws_old = channel.getWindowSize();
 			channel.UpdateTimers(dtime);
@@ -257,7 +266,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 		if (udpPeer->Ping(dtime, data)) {
 			LOG(dout_con << m_connection->getDesc()
 				<< "Sending ping for peer_id: " << udpPeer->id << std::endl);
-			rawSendAsPacket(udpPeer->id, 0, data, true);
+			rawSendAsPacket(udpPeer->id, 0, PacketChunk(data), true);
 		}
 
 		udpPeer->RunCommandQueues(m_max_packet_size, m_max_packets_requeued);
@@ -271,9 +280,10 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 	}
 }
 
-void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout)
+void ConnectionSendThread::resendReliable(Channel &channel,
+	const ConstSharedPtr<BufferedPacket> &k, float resend_timeout)
 {
-	assert(k);
+	assert(k.get());
 	u8 channelnum = readChannel(k->data);
 	u16 seqnum = k->getSeqnum();
 
@@ -298,18 +308,39 @@ void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket
 	// lost or really takes more time to transmit
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	assert(p);
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		//LOG(dout_con << m_connection->getDesc()
-		//	<< " rawSend: " << p->size()
-		//	<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+	assert(p.get());
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= UDPSocket::BATCH_MAX)
+		flushSends();
+}
+
+void ConnectionSendThread::flushSends()
+{
+	if (m_send_batch.empty())
+		return;
+
+	UDPSocket::Datagram datagrams[UDPSocket::BATCH_MAX];
+	int count = 0;
+	for (const auto &p : m_send_batch) {
+		UDPSocket::Datagram &d = datagrams[count++];
+		d.address = p->address;
+		// the socket does not write to it
+		d.data = const_cast<u8 *>(p->data);
+		d.size = p->headSize();
+		// a slice of the original data, gathered by the kernel
+		d.tail = p->tail();
+		d.tail_size = p->tailSize();
+	}
+
+	int failed = m_connection->m_udpSocket.SendBatch(datagrams, count);
+	// may hold the last reference to the packets
+	m_send_batch.clear();
+	if (failed > 0) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "SendFailedException: " << e.what() << " to "
-			<< p->address.serializeString() << std::endl);
+			<< "Failed to send " << failed << " of " << count
+			<< " packets" << std::endl);
 	}
 }
 
@@ -318,10 +349,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	try {
 		p->absolute_send_time = porting::getTimeMs();
 		// Buffer the packet
-		channel->outgoing_reliables_sent.insert(p,
-			(channel->readOutgoingSequenceNumber() - MAX_RELIABLE_WINDOW_SIZE)
-				% (MAX_RELIABLE_WINDOW_SIZE + 1));
-		// wtf is this calculation?? ^
+		channel->outgoing_reliables_sent.insert(p);
 	}
 	catch (AlreadyExistsException &e) {
 		LOG(derr_con << m_connection->getDesc()
@@ -330,11 +358,11 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool reliable)
+	const PacketChunk &data, bool reliable)
 {
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 	if (!peer) {
@@ -352,15 +380,14 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		if (!have_seqnum)
 			return false;
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
-
-		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(peer->getAddress(), reliable,
+		// Add base and reliable headers and make a packet
+		BufferedPacketPtr p = con::makePacket(peer->getAddress(), data,
 			m_connection->GetProtocolID(), m_connection->GetPeerID(),
-			channelnum);
+			channelnum, true, seqnum);
 
 		// first check if our send window is already maxed out
-		if (channel->outgoing_reliables_sent.size() < channel->getWindowSize()) {
+		if (channel->outgoing_reliables_sent.size() < channel->getWindowSize() &&
+				channel->takePacingToken()) {
 			LOG(dout_con << m_connection->getDesc()
 				<< " INFO: sending a reliable packet to peer_id " << peer_id
 				<< " channel: " << (u32)channelnum
@@ -383,7 +410,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		channelnum);
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 	return true;
 }
 
@@ -412,7 +439,8 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 		case CONCMD_CREATE_PEER:
 			LOG(dout_con << m_connection->getDesc()
 				<< "UDP processing reliable CONCMD_CREATE_PEER" << std::endl);
-			if (!rawSendAsPacket(c->peer_id, c->channelnum, c->data, c->reliable)) {
+			if (!rawSendAsPacket(c->peer_id, c->channelnum, PacketChunk(c->data),
+					c->reliable)) {
 				/* put to queue if we couldn't send it immediately */
 				sendReliable(c);
 			}
@@ -430,7 +458,7 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 			auto list = channel.outgoing_reliables_sent.getResend(0, 1);
 
 			if (!list.empty())
-				resendReliable(channel, list.front().get(), -1);
+				resendReliable(channel, list.front(), -1);
 
 			return;
 		}
@@ -496,7 +524,7 @@ void ConnectionSendThread::processNonReliableCommand(ConnectionCommandPtr &c_ptr
 		case CONCMD_ACK:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONCMD_ACK" << std::endl);
-			sendAsPacket(c.peer_id, c.channelnum, c.data, true);
+			sendAsPacket(c.peer_id, c.channelnum, PacketChunk(c.data), true);
 			return;
 		case CONCMD_CREATE_PEER:
 		case CONNCMD_RESEND_ONE:
@@ -511,9 +539,15 @@ void ConnectionSendThread::serve(Address bind_address)
 {
 	LOG(dout_con << m_connection->getDesc()
 		<< "UDP serving at port " << bind_address.serializeString() << std::endl);
+	const u16 receive_threads = rangelim(g_settings->getU16("server_receive_threads"), 1, 16);
 	try {
+		// Without SO_REUSEPORT the clients are all served by one thread
+		const bool shard = receive_threads > 1 &&
+			m_connection->m_udpSocket.setReusePort();
 		m_connection->m_udpSocket.Bind(bind_address);
 		m_connection->SetPeerID(PEER_ID_SERVER);
+		if (shard)
+			m_connection->startReceiveShards(bind_address, receive_threads - 1);
 	}
 	catch (SocketException &e) {
 		// Create event
@@ -551,9 +585,10 @@ void ConnectionSendThread::disconnect()
 	LOG(dout_con << m_connection->getDesc() << " disconnecting" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
-	writeU8(&data[0], PACKET_TYPE_CONTROL);
-	writeU8(&data[1], CONTROLTYPE_DISCO);
+	SharedBuffer<u8> buf(2);
+	writeU8(&buf[0], PACKET_TYPE_CONTROL);
+	writeU8(&buf[1], CONTROLTYPE_DISCO);
+	const PacketChunk data(buf);
 
 
 	// Send to all
@@ -569,9 +604,10 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 	LOG(dout_con << m_connection->getDesc() << " disconnecting peer" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
-	writeU8(&data[0], PACKET_TYPE_CONTROL);
-	writeU8(&data[1], CONTROLTYPE_DISCO);
+	SharedBuffer<u8> buf(2);
+	writeU8(&buf[0], PACKET_TYPE_CONTROL);
+	writeU8(&buf[1], CONTROLTYPE_DISCO);
+	const PacketChunk data(buf);
 	sendAsPacket(peer_id, 0, data, false);
 
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
@@ -607,7 +643,7 @@ void ConnectionSendThread::fix_peer_id(session_t own_peer_id)
 }
 
 void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data)
+	const PacketBufferPtr &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -616,24 +652,24 @@ void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
 		LOG(dout_con << m_connection->getDesc() << " peer: peer_id=" << peer_id
 			<< ">>>NOT<<< found on sending packet"
 			<< ", channel " << (channelnum % 0xFF)
-			<< ", size: " << data.getSize() << std::endl);
+			<< ", size: " << data->size() << std::endl);
 		return;
 	}
 
 	LOG(dout_con << m_connection->getDesc() << " sending to peer_id=" << peer_id
 		<< ", channel " << (channelnum % 0xFF)
-		<< ", size: " << data.getSize() << std::endl);
+		<< ", size: " << data->size() << std::endl);
 
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketChunk> originals;
 
 	makeAutoSplitPacket(data, chunksize_max, split_sequence_number, &originals);
 
 	peer->setNextSplitSequenceNumber(channelnum, split_sequence_number);
 
-	for (const SharedBuffer<u8> &original : originals) {
+	for (const PacketChunk &original : originals) {
 		sendAsPacket(peer_id, channelnum, original);
 	}
 }
@@ -647,7 +683,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 	peer->PutReliableSendCommand(c, m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const PacketBufferPtr &data)
 {
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
@@ -746,7 +782,8 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 			while (!channel.queued_reliables.empty() &&
 					channel.outgoing_reliables_sent.size()
 					< channel.getWindowSize() &&
-					peer->m_increment_packets_remaining > 0) {
+					peer->m_increment_packets_remaining > 0 &&
+					channel.takePacingToken()) {
 				BufferedPacketPtr p = channel.queued_reliables.front();
 				channel.queued_reliables.pop();
 
@@ -783,7 +820,7 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 				<< " Outgoing queue: peer_id=" << packet.peer_id
 				<< ">>>NOT<<< found on sending packet"
 				<< ", channel " << (packet.channelnum % 0xFF)
-				<< ", size: " << packet.data.getSize() << std::endl);
+				<< ", size: " << packet.data.totalSize() << std::endl);
 			continue;
 		}
 
@@ -820,7 +857,7 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 }
 
 void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool ack)
+	const PacketChunk &data, bool ack)
 {
 	OutgoingPacket packet(peer_id, channelnum, data, false, ack);
 	m_outgoing_queue.push(packet);
@@ -829,11 +866,20 @@ void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
 ConnectionReceiveThread::ConnectionReceiveThread() :
 	Thread("ConnectionReceive")
 {
+	// use IPv6 minimum allowed MTU as receive buffer size as this is
+	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
+	// infrastructure
+	const unsigned int packet_maxsize = 1500;
+
+	m_receive_buffer.resize(packet_maxsize * UDPSocket::BATCH_MAX);
+	m_received.resize(UDPSocket::BATCH_MAX);
 }
 
 void *ConnectionReceiveThread::run()
 {
 	assert(m_connection);
+	if (!m_socket)
+		m_socket = &m_connection->m_udpSocket;
 
 	LOG(dout_con << m_connection->getDesc()
 		<< "ConnectionReceive thread started" << std::endl);
@@ -842,12 +888,6 @@ void *ConnectionReceiveThread::run()
 	ThreadIdentifier);
 	PROFILE(ThreadIdentifier << "ConnectionReceive: [" << m_connection->getDesc() << "]");
 
-	// use IPv6 minimum allowed MTU as receive buffer size as this is
-	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
-	// infrastructure
-	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
-
 	bool packet_queued = true;
 
 #ifdef DEBUG_CONNECTION_KBPS
@@ -868,7 +908,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -928,8 +968,7 @@ void *ConnectionReceiveThread::run()
 }
 
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
-		bool &packet_queued)
+void ConnectionReceiveThread::receive(bool &packet_queued)
 {
 	try {
 		// First, see if there any buffered packets we can process now
@@ -949,138 +988,162 @@ void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 			}
 			packet_queued = false;
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
+	// Wait for incoming data, then take everything that is there
+	const size_t packet_maxsize = m_receive_buffer.size() / m_received.size();
+	for (size_t i = 0; i < m_received.size(); i++) {
+		m_received[i].data = &m_receive_buffer[i * packet_maxsize];
+		m_received[i].size = packet_maxsize;
+	}
+	int count = m_socket->ReceiveBatch(m_received.data(),
+		m_received.size());
 
-		if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid incoming packet, "
-				<< "size: " << received_size
-				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-				<< std::endl);
-			return;
+	for (int i = 0; i < count; i++) {
+		const UDPSocket::Datagram &d = m_received[i];
+		try {
+			processDatagram(d.address, (const u8 *)d.data, d.size, packet_queued);
 		}
+		catch (InvalidIncomingDataException &e) {
+		}
+	}
+}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+void ConnectionReceiveThread::processDatagram(const Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid incoming packet, "
+			<< "size: " << received_size
+			<< ", protocol: "
+			<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+			<< std::endl);
+		return;
+	}
 
-		if (channelnum >= CHANNEL_COUNT) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
-			return;
-		}
+	session_t peer_id = readPeerId(packetdata);
+	u8 channelnum = readChannel(packetdata);
 
-		const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
-
-		if (!m_connection->ConnectedToServer()) {
-			// Try to identify peer by sender address
-			if (peer_id == PEER_ID_INEXISTENT) {
-				peer_id = m_connection->lookupPeer(sender);
-				if (peer_id != PEER_ID_INEXISTENT) {
-					/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
-					 * packet is lost. Since resends are not active at this stage
-					 * we need to remind the peer manually. */
-					m_connection->doResendOne(peer_id);
-				}
-			}
+	if (channelnum >= CHANNEL_COUNT) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
+		return;
+	}
 
-			// Someone new is trying to talk to us. Add them.
-			if (peer_id == PEER_ID_INEXISTENT) {
-				auto &l = m_new_peer_ratelimit;
-				l.tick();
-				if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
-					if (!l.logged) {
-						warningstream << m_connection->getDesc()
-							<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
-							<< " new clients within 1s. Throttling." << std::endl;
-					}
-					l.logged = true;
-					// We simply drop the packet, the client can try again.
-				} else {
-					peer_id = m_connection->createPeer(sender, 0);
-				}
+	const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
+
+	if (!m_connection->ConnectedToServer()) {
+		// Try to identify peer by sender address
+		if (peer_id == PEER_ID_INEXISTENT) {
+			peer_id = m_connection->lookupPeer(sender);
+			if (peer_id != PEER_ID_INEXISTENT) {
+				/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
+				 * packet is lost. Since resends are not active at this stage
+				 * we need to remind the peer manually. */
+				m_connection->doResendOne(peer_id);
 			}
 		}
 
-		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
-		if (!peer) {
-			LOG(dout_con << m_connection->getDesc()
-				<< " got packet from unknown peer_id: "
-				<< peer_id << " Ignoring." << std::endl);
-			return;
+		// Someone new is trying to talk to us. Add them.
+		if (peer_id == PEER_ID_INEXISTENT) {
+			auto &l = m_new_peer_ratelimit;
+			l.tick();
+			if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
+				if (!l.logged) {
+					warningstream << m_connection->getDesc()
+						<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
+						<< " new clients within 1s. Throttling." << std::endl;
+				}
+				l.logged = true;
+				// We simply drop the packet, the client can try again.
+			} else {
+				peer_id = m_connection->createPeer(sender, m_shard);
+			}
 		}
+	}
 
-		// Validate peer address
+	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+	if (!peer) {
+		LOG(dout_con << m_connection->getDesc()
+			<< " got packet from unknown peer_id: "
+			<< peer_id << " Ignoring." << std::endl);
+		return;
+	}
 
-		if (sender != peer->getAddress()) {
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending from different address."
-				" Ignoring." << std::endl);
-			return;
-		}
+	// Validate peer address
 
-		if (knew_peer_id) {
-			peer->SetFullyOpen();
-			// Setup phase has a fixed timeout
-			peer->ResetTimeout();
-		} else if (!peer->isHalfOpen()) {
-			// If the peer talks to us without a peer ID when it has done so
-			// before something is definitely fishy.
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending without peer id?!"
-				" Ignoring." << std::endl);
-			return;
-		}
+	if (sender != peer->getAddress()) {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending from different address."
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
-		if (!udpPeer) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
-				" Ignoring." << std::endl);
-			return;
-		}
-		Channel *channel = &udpPeer->channels[channelnum];
+	if (knew_peer_id) {
+		peer->SetFullyOpen();
+		// Setup phase has a fixed timeout
+		peer->ResetTimeout();
+	} else if (!peer->isHalfOpen()) {
+		// If the peer talks to us without a peer ID when it has done so
+		// before something is definitely fishy.
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending without peer id?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		channel->UpdateBytesReceived(received_size);
+	auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+	if (!udpPeer) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+			" Ignoring." << std::endl);
+		return;
+	}
+	// The state of a peer is only touched by the thread that created it.
+	// The kernel keeps sending a client to the same socket, so this only
+	// drops stray datagrams.
+	if (udpPeer->receive_shard != m_shard) {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending to another socket."
+			" Ignoring." << std::endl);
+		return;
+	}
+	Channel *channel = &udpPeer->channels[channelnum];
 
-		// Throw the received packet to channel->processPacket()
+	channel->UpdateBytesReceived(received_size);
 
-		// Make a new SharedBuffer from the data without the base headers
-		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-			strippeddata.getSize());
+	// Throw the received packet to channel->processPacket()
 
-		try {
-			// Process it (the result is some data with no headers made by us)
-			SharedBuffer<u8> resultdata = processPacket
-				(channel, strippeddata, peer_id, channelnum, false);
+	// Make a new SharedBuffer from the data without the base headers
+	SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+	memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+		strippeddata.getSize());
 
-			LOG(dout_con << m_connection->getDesc()
-				<< " ProcessPacket from peer_id: " << peer_id
-				<< ", channel: " << (u32)channelnum << ", returned "
-				<< resultdata.getSize() << " bytes" << std::endl);
+	try {
+		// Process it (the result is some data with no headers made by us)
+		SharedBuffer<u8> resultdata = processPacket
+			(channel, strippeddata, peer_id, channelnum, false);
 
-			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-		}
-		catch (ProcessedSilentlyException &e) {
-		}
-		catch (ProcessedQueued &e) {
-			// we set it to true anyway (see below)
-		}
+		LOG(dout_con << m_connection->getDesc()
+			<< " ProcessPacket from peer_id: " << peer_id
+			<< ", channel: " << (u32)channelnum << ", returned "
+			<< resultdata.getSize() << " bytes" << std::endl);
 
-		/* Every time we receive a packet it can happen that a previously
-		 * buffered packet is now ready to process. */
-		packet_queued = true;
+		m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
 	}
-	catch (InvalidIncomingDataException &e) {
+	catch (ProcessedSilentlyException &e) {
+	}
+	catch (ProcessedQueued &e) {
+		// we set it to true anyway (see below)
 	}
+
+	/* Every time we receive a packet it can happen that a previously
+	 * buffered packet is now ready to process. */
+	packet_queued = true;
 }
 
 bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8> &dst)
@@ -1093,7 +1156,7 @@ bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8
 			continue;
 
 		UDPPeer *p = dynamic_cast<UDPPeer *>(&peer);
-		if (!p)
+		if (!p || p->receive_shard != m_shard)
 			continue;
 
 		for (Channel &channel : p->channels) {
@@ -1202,8 +1265,8 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 		try {
 			BufferedPacketPtr p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
-			// the rtt calculation will be a bit off for re-sent packets but that's okay
-			{
+			// the ACK may be for any of the copies of a re-sent packet (Karn)
+			if (p->resend_count == 0) {
 				// Get round trip time
 				u64 current_time = porting::getTimeMs();
 
@@ -1226,15 +1289,52 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 
 			// put bytes for max bandwidth calculation
 			channel->UpdateBytesSent(p->size(), 1);
-			if (channel->outgoing_reliables_sent.size() == 0)
-				m_connection->TriggerSend();
 		} catch (NotFoundException &e) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "WARNING: ACKed packet not in outgoing queue"
-				<< " seqnum=" << seqnum << std::endl);
-			channel->UpdatePacketTooLateCounter();
+			// Normal if a selective or a later ACK covered it already
+			if (!channel->outgoing_reliables_sent.wasAcked(seqnum)) {
+				LOG(derr_con << m_connection->getDesc()
+					<< "WARNING: ACKed packet not in outgoing queue"
+					<< " seqnum=" << seqnum << std::endl);
+				channel->UpdatePacketTooLateCounter();
+			}
 		}
 
+		// Selective acknowledgement
+		if (packetdata.getSize() >= 7) {
+			const u16 next_expected = readU16(&packetdata[4]);
+			const u8 range_count = readU8(&packetdata[6]);
+			if (packetdata.getSize() < 7 + 4 * (u32)range_count) {
+				throw InvalidIncomingDataException(
+					"packetdata.getSize() too small for ACK ranges");
+			}
+			// The acknowledged packet counts as received for the holes
+			std::vector<std::pair<u16, u16>> ranges;
+			ranges.reserve(range_count + 1);
+			ranges.emplace_back(seqnum, seqnum);
+			for (u8 i = 0; i < range_count; i++) {
+				ranges.emplace_back(readU16(&packetdata[7 + 4 * i]),
+					readU16(&packetdata[9 + 4 * i]));
+			}
+
+			std::vector<BufferedPacketPtr> acked;
+			u32 marked = channel->outgoing_reliables_sent.popAcked(
+				next_expected, ranges, acked);
+			u32 bytes = 0;
+			for (auto &p : acked)
+				bytes += p->size();
+			if (!acked.empty())
+				channel->UpdateBytesSent(bytes, acked.size());
+			if (marked > 0) {
+				LOG(dout_con << m_connection->getDesc()
+					<< "Fast resend of " << marked << " packets, channel="
+					<< ((int) channelnum & 0xff) << std::endl);
+				m_connection->TriggerSend();
+			}
+		}
+
+		if (channel->outgoing_reliables_sent.empty())
+			m_connection->TriggerSend();
+
 		throw ProcessedSilentlyException("Got an ACK");
 	} else if (controltype == CONTROLTYPE_SET_PEER_ID) {
 		// Got a packet to set our peer id
@@ -1336,7 +1436,7 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Reliable(Channel *cha
 	/* packet is within our receive window send ack */
 	if (seqnum_in_window(seqnum,
 		channel->readNextIncomingSeqNum(), MAX_RELIABLE_WINDOW_SIZE)) {
-		m_connection->sendAck(peer->id, channelnum, seqnum);
+		m_connection->sendAck(peer->id, channelnum, seqnum, *channel);
 	} else {
 		is_future_packet = seqnum_higher(seqnum, channel->readNextIncomingSeqNum());
 		is_old_packet = seqnum_higher(channel->readNextIncomingSeqNum(), seqnum);
@@ -1353,7 +1453,7 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Reliable(Channel *cha
 				<< "RE-SENDING ACK: peer_id: " << peer->id
 				<< ", channel: " << (channelnum & 0xFF)
 				<< ", seqnum: " << seqnum << std::endl;)
-			m_connection->sendAck(peer->id, channelnum, seqnum);
+			m_connection->sendAck(peer->id, channelnum, seqnum, *channel);
 
 			throw ProcessedSilentlyException("Retransmitting ack for old packet");
 		}
@@ -9,6 +9,7 @@
 /* may only be included from in src/network */
 /********************************************/
 
+#include <atomic>
 #include <cassert>
 #include "threading/thread.h"
 #include "network/mtp/internal.h"
@@ -22,11 +23,11 @@ struct OutgoingPacket
 {
 	session_t peer_id;
 	u8 channelnum;
-	SharedBuffer<u8> data;
+	PacketChunk data;
 	bool reliable;
 	bool ack;
 
-	OutgoingPacket(session_t peer_id_, u8 channelnum_, const SharedBuffer<u8> &data_,
+	OutgoingPacket(session_t peer_id_, u8 channelnum_, const PacketChunk &data_,
 			bool reliable_,bool ack_=false):
 		peer_id(peer_id_),
 		channelnum(channelnum_),
@@ -59,10 +60,14 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime, u32 peer_packet_quota);
-	void resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout);
-	void rawSend(const BufferedPacket *p);
+	void resendReliable(Channel &channel, const ConstSharedPtr<BufferedPacket> &k,
+			float resend_timeout);
+	// Queues the packet to be sent by flushSends()
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	// Sends the packets queued by rawSend()
+	void flushSends();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
-			const SharedBuffer<u8> &data, bool reliable);
+			const PacketChunk &data, bool reliable);
 
 	void processReliableCommand(ConnectionCommandPtr &c);
 	void processNonReliableCommand(ConnectionCommandPtr &c);
@@ -71,14 +76,14 @@ class ConnectionSendThread : public Thread
 	void disconnect();
 	void disconnect_peer(session_t peer_id);
 	void fix_peer_id(session_t own_peer_id);
-	void send(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data);
+	void send(session_t peer_id, u8 channelnum, const PacketBufferPtr &data);
 	void sendReliable(ConnectionCommandPtr &c);
-	void sendToAll(u8 channelnum, const SharedBuffer<u8> &data);
+	void sendToAll(u8 channelnum, const PacketBufferPtr &data);
 	void sendToAllReliable(ConnectionCommandPtr &c);
 
 	void sendPackets(float dtime, u32 peer_packet_quota);
 
-	void sendAsPacket(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data,
+	void sendAsPacket(session_t peer_id, u8 channelnum, const PacketChunk &data,
 			bool ack = false);
 
 	void sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel);
@@ -89,7 +94,12 @@ class ConnectionSendThread : public Thread
 	unsigned int m_max_packet_size;
 	float m_timeout;
 	std::queue<OutgoingPacket> m_outgoing_queue;
+	// Sent together at the end of each iteration, or when it is full
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
 	Semaphore m_send_sleep_semaphore;
+	// Set while a wakeup is pending, so that queueing many commands at once
+	// doesn't post the semaphore for every single one
+	std::atomic<bool> m_triggered{false};
 
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_data_packets_per_iteration;
@@ -109,8 +119,18 @@ class ConnectionReceiveThread : public Thread
 		m_connection = parent;
 	}
 
+	// Receives from another socket than the one of the connection, bound
+	// to the server port. Only the peers created by this thread are served.
+	void setSocket(UDPSocket *socket, u8 shard)
+	{
+		m_socket = socket;
+		m_shard = shard;
+	}
+
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(bool &packet_queued);
+	void processDatagram(const Address &sender, const u8 *data, s32 size,
+			bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -170,6 +190,12 @@ class ConnectionReceiveThread : public Thread
 	static const PacketTypeHandler packetTypeRouter[PACKET_TYPE_MAX];
 
 	Connection *m_connection = nullptr;
+	UDPSocket *m_socket = nullptr;
+	u8 m_shard = 0;
+
+	// Buffers for UDPSocket::ReceiveBatch()
+	std::vector<u8> m_receive_buffer;
+	std::vector<UDPSocket::Datagram> m_received;
 
 	RateLimitHelper m_new_peer_ratelimit;
 };
@@ -510,17 +510,21 @@ NetworkPacket& NetworkPacket::operator<<(video::SColor src)
 }
 
 Buffer<u8> NetworkPacket::oldForgePacket()
+{
+	Buffer<u8> sb(getForgedSize());
+	forgePacket(*sb);
+	return sb;
+}
+
+void NetworkPacket::forgePacket(u8 *to) const
 {
 	// this is the dummy packet used to first contact the server
 	if (m_command == 0) {
 		assert(m_datasize == 0);
-		return Buffer<u8>();
+		return;
 	}
 
-	Buffer<u8> sb(m_datasize + 2);
-	writeU16(&sb[0], m_command);
+	writeU16(&to[0], m_command);
 	if (m_datasize > 0)
-		memcpy(&sb[2], m_data.data(), m_datasize);
-
-	return sb;
+		memcpy(&to[2], m_data.data(), m_datasize);
 }
@@ -126,6 +126,9 @@ class NetworkPacket
 	// Temp, we remove SharedBuffer when migration finished
 	// ^ this comment has been here for 7 years
 	Buffer<u8> oldForgePacket();
+	// Same as oldForgePacket(), but into the given getForgedSize() bytes
+	u32 getForgedSize() const { return m_command == 0 ? 0 : m_datasize + 2; }
+	void forgePacket(u8 *to) const;
 
 private:
 	void checkReadOffset(u32 from_offset, u32 field_size) const;
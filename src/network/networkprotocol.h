@@ -701,7 +701,24 @@ enum ToClientCommand : u16
 			u8[len] serialized ParticleParameters
 	*/
 
-	TOCLIENT_NUM_MSG_TYPES = 0x65,
+	TOCLIENT_ACTIVE_OBJECT_POSITIONS = 0x65,
+	/*
+		Replaces the unreliable AO_CMD_UPDATE_POSITION messages of
+		TOCLIENT_ACTIVE_OBJECT_MESSAGES, see ObjectPositionCodec.
+		for all updates
+		{
+			u16 id
+			u8 flags
+			u16 keyframe sequence number, counted per object
+			v3s32 position (keyframe) or v3s16 position relative to the keyframe
+			[v3s16 velocity]
+			[v3s16 acceleration]
+			[v3s16 rotation]
+			[u16 update interval in ms]
+		}
+	*/
+
+	TOCLIENT_NUM_MSG_TYPES = 0x66,
 };
 
 enum ToServerCommand : u16
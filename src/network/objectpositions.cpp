@@ -0,0 +1,238 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "objectpositions.h"
+#include "activeobject.h"
+#include "constants.h"
+#include "exceptions.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <cmath>
+#include <sstream>
+
+enum ObjectPositionFlags : u8
+{
+	OPF_KEYFRAME        = 0x01,
+	OPF_VELOCITY        = 0x02,
+	OPF_ACCELERATION    = 0x04,
+	OPF_ROTATION        = 0x08,
+	OPF_UPDATE_INTERVAL = 0x10,
+	OPF_DO_INTERPOLATE  = 0x20,
+	OPF_MOVEMENT_END    = 0x40,
+};
+
+// Steps per node
+static constexpr f32 POS_SCALE = 64.0f / BS;
+// Steps per degree
+static constexpr f32 ROT_SCALE = 65536.0f / 360.0f;
+
+static inline s32 quantizeS32(f32 f)
+{
+	return std::lround(f * POS_SCALE);
+}
+
+static inline s16 quantizeS16(f32 f)
+{
+	return rangelim(std::lround(f * POS_SCALE), S16_MIN, S16_MAX);
+}
+
+static inline v3s16 quantizeV3S16(v3f v)
+{
+	return v3s16(quantizeS16(v.X), quantizeS16(v.Y), quantizeS16(v.Z));
+}
+
+static inline v3s16 quantizeRotation(v3f v)
+{
+	// Stored as u16 bit patterns
+	auto q = [] (f32 f) {
+		return (s16)(u16)(std::lround(wrapDegrees_0_360(f) * ROT_SCALE) & 0xFFFF);
+	};
+	return v3s16(q(v.X), q(v.Y), q(v.Z));
+}
+
+static inline v3f dequantize(v3s32 v)
+{
+	return v3f(v.X, v.Y, v.Z) / POS_SCALE;
+}
+
+static inline v3f dequantize(v3s16 v)
+{
+	return v3f(v.X, v.Y, v.Z) / POS_SCALE;
+}
+
+static inline v3f dequantizeRotation(v3s16 v)
+{
+	return v3f((u16)v.X, (u16)v.Y, (u16)v.Z) / ROT_SCALE;
+}
+
+static inline bool fitsS16(s32 i)
+{
+	return i >= S16_MIN && i <= S16_MAX;
+}
+
+bool ObjectPositionUpdate::parse(const std::string &message)
+{
+	if (message.size() != 1 + 4 * 12 + 2 + 4 ||
+			(u8)message[0] != AO_CMD_UPDATE_POSITION)
+		return false;
+
+	const u8 *data = (const u8 *)message.data() + 1;
+	position = readV3F32(data);
+	velocity = readV3F32(data + 12);
+	acceleration = readV3F32(data + 24);
+	rotation = readV3F32(data + 36);
+	do_interpolate = readU8(data + 48);
+	is_movement_end = readU8(data + 49);
+	update_interval = readF32(data + 50);
+	return true;
+}
+
+std::string ObjectPositionUpdate::toMessage() const
+{
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_UPDATE_POSITION);
+	writeV3F32(os, position);
+	writeV3F32(os, velocity);
+	writeV3F32(os, acceleration);
+	writeV3F32(os, rotation);
+	writeU8(os, do_interpolate);
+	writeU8(os, is_movement_end);
+	writeF32(os, update_interval);
+	return os.str();
+}
+
+void ObjectPositionCodec::write(std::string &reliable, std::string &unreliable,
+		u16 id, const ObjectPositionUpdate &update)
+{
+	const v3s32 position(quantizeS32(update.position.X),
+			quantizeS32(update.position.Y), quantizeS32(update.position.Z));
+	const v3s16 velocity = quantizeV3S16(update.velocity);
+	const v3s16 acceleration = quantizeV3S16(update.acceleration);
+	const v3s16 rotation = quantizeRotation(update.rotation);
+	const u16 update_interval = rangelim(
+			std::lround(update.update_interval * 1000.0f), 0, U16_MAX);
+
+	u8 flags = (update.do_interpolate ? OPF_DO_INTERPOLATE : 0) |
+			(update.is_movement_end ? OPF_MOVEMENT_END : 0);
+
+	auto it = m_keyframes.find(id);
+	v3s32 delta;
+	if (it != m_keyframes.end()) {
+		const Keyframe &kf = it->second;
+		delta = position - kf.position;
+		if (velocity != kf.velocity)
+			flags |= OPF_VELOCITY;
+		if (acceleration != kf.acceleration)
+			flags |= OPF_ACCELERATION;
+		if (rotation != kf.rotation)
+			flags |= OPF_ROTATION;
+		if (update_interval != kf.update_interval)
+			flags |= OPF_UPDATE_INTERVAL;
+	}
+
+	// Start over when the position is too far from the keyframe, or when
+	// the keyframe has been outdated for a while
+	const bool keyframe = it == m_keyframes.end() ||
+			!fitsS16(delta.X) || !fitsS16(delta.Y) || !fitsS16(delta.Z) ||
+			(it->second.updates >= KEYFRAME_UPDATES_MAX &&
+			(flags & (OPF_VELOCITY | OPF_ACCELERATION | OPF_ROTATION | OPF_UPDATE_INTERVAL)));
+
+	u8 buf[2 + 1 + 2 + 12 + 3 * 6 + 2];
+	u8 *p = buf;
+	u16 seq;
+	if (keyframe) {
+		flags |= OPF_KEYFRAME | OPF_VELOCITY | OPF_ACCELERATION |
+				OPF_ROTATION | OPF_UPDATE_INTERVAL;
+		seq = m_next_seq[id]++;
+		m_keyframes[id] = Keyframe{seq, position, velocity, acceleration,
+				rotation, update_interval};
+	} else {
+		seq = it->second.seq;
+		it->second.updates++;
+	}
+
+	writeU16(p, id);
+	writeU8(p + 2, flags);
+	writeU16(p + 3, seq);
+	p += 5;
+	if (keyframe) {
+		writeV3S32(p, position);
+		p += 12;
+	} else {
+		writeV3S16(p, v3s16(delta.X, delta.Y, delta.Z));
+		p += 6;
+	}
+	if (flags & OPF_VELOCITY) {
+		writeV3S16(p, velocity);
+		p += 6;
+	}
+	if (flags & OPF_ACCELERATION) {
+		writeV3S16(p, acceleration);
+		p += 6;
+	}
+	if (flags & OPF_ROTATION) {
+		writeV3S16(p, rotation);
+		p += 6;
+	}
+	if (flags & OPF_UPDATE_INTERVAL) {
+		writeU16(p, update_interval);
+		p += 2;
+	}
+
+	std::string &buffer = keyframe ? reliable : unreliable;
+	buffer.append((const char *)buf, p - buf);
+}
+
+bool ObjectPositionCodec::read(std::istream &is, u16 &id, ObjectPositionUpdate &update)
+{
+	id = readU16(is);
+	const u8 flags = readU8(is);
+	const u16 seq = readU16(is);
+
+	v3s32 position;
+	if (flags & OPF_KEYFRAME) {
+		position = readV3S32(is);
+	} else {
+		v3s16 delta = readV3S16(is);
+		position = v3s32(delta.X, delta.Y, delta.Z);
+	}
+	v3s16 velocity, acceleration, rotation;
+	u16 update_interval = 0;
+	if (flags & OPF_VELOCITY)
+		velocity = readV3S16(is);
+	if (flags & OPF_ACCELERATION)
+		acceleration = readV3S16(is);
+	if (flags & OPF_ROTATION)
+		rotation = readV3S16(is);
+	if (flags & OPF_UPDATE_INTERVAL)
+		update_interval = readU16(is);
+
+	if (flags & OPF_KEYFRAME) {
+		m_keyframes[id] = Keyframe{seq, position, velocity, acceleration,
+				rotation, update_interval};
+	} else {
+		auto it = m_keyframes.find(id);
+		if (it == m_keyframes.end() || it->second.seq != seq)
+			return false;
+		const Keyframe &kf = it->second;
+		position += kf.position;
+		if (!(flags & OPF_VELOCITY))
+			velocity = kf.velocity;
+		if (!(flags & OPF_ACCELERATION))
+			acceleration = kf.acceleration;
+		if (!(flags & OPF_ROTATION))
+			rotation = kf.rotation;
+		if (!(flags & OPF_UPDATE_INTERVAL))
+			update_interval = kf.update_interval;
+	}
+
+	update.position = dequantize(position);
+	update.velocity = dequantize(velocity);
+	update.acceleration = dequantize(acceleration);
+	update.rotation = dequantizeRotation(rotation);
+	update.do_interpolate = flags & OPF_DO_INTERPOLATE;
+	update.is_movement_end = flags & OPF_MOVEMENT_END;
+	update.update_interval = update_interval / 1000.0f;
+	return true;
+}
@@ -0,0 +1,87 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include <istream>
+#include <string>
+#include <unordered_map>
+
+/*
+	Compact encoding of the AO_CMD_UPDATE_POSITION messages of active objects
+	for TOCLIENT_ACTIVE_OBJECT_POSITIONS (protocol version 52).
+
+	Positions, velocities and accelerations are quantized to 1/64 node,
+	rotations to 1/65536 of a turn. For every object the encoder first sends
+	a keyframe over the reliable channel. Later updates, sent unreliably, only
+	carry the position relative to that keyframe and the fields that differ
+	from it. Each update names the keyframe it is relative to, so the client
+	drops updates whose keyframe has not arrived (yet).
+*/
+
+struct ObjectPositionUpdate
+{
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	v3f rotation;
+	bool do_interpolate = false;
+	bool is_movement_end = false;
+	f32 update_interval = 0.0f;
+
+	// Reads an AO_CMD_UPDATE_POSITION message, returns false for other messages
+	bool parse(const std::string &message);
+	// Produces the AO_CMD_UPDATE_POSITION message
+	std::string toMessage() const;
+};
+
+class ObjectPositionCodec
+{
+public:
+	// Updates relative to the same keyframe before a new one is sent
+	static constexpr u16 KEYFRAME_UPDATES_MAX = 64;
+
+	/*
+		Appends the update for object id to one of the buffers.
+		Keyframes go to `reliable`, other updates to `unreliable`.
+	*/
+	void write(std::string &reliable, std::string &unreliable,
+			u16 id, const ObjectPositionUpdate &update);
+
+	/*
+		Reads one update. Returns false if it can not be applied because the
+		keyframe it refers to is not known.
+		Throws SerializationError on truncated data.
+	*/
+	bool read(std::istream &is, u16 &id, ObjectPositionUpdate &update);
+
+	// Forgets the keyframe of an object that is no longer known to the client
+	void forget(u16 id) { m_keyframes.erase(id); }
+
+	void clear()
+	{
+		m_keyframes.clear();
+		m_next_seq.clear();
+	}
+
+private:
+	struct Keyframe
+	{
+		u16 seq;
+		v3s32 position;
+		v3s16 velocity;
+		v3s16 acceleration;
+		v3s16 rotation;
+		u16 update_interval;
+		// Updates sent relative to this keyframe
+		u16 updates = 0;
+	};
+
+	std::unordered_map<u16, Keyframe> m_keyframes;
+	// Sequence number of the next keyframe per object. Counted per object so
+	// that keyframes of others can not make it wrap around, and kept when an
+	// object is forgotten since its id may be reused.
+	std::unordered_map<u16, u16> m_next_seq;
+};
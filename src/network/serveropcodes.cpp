@@ -213,4 +213,5 @@ const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
 	{ "TOCLIENT_MINIMAP_MODES",            0, true }, // 0x62
 	{ "TOCLIENT_SET_LIGHTING",             0, true }, // 0x63
 	{ "TOCLIENT_SPAWN_PARTICLE_BATCH",     0, true }, // 0x64
+	{ "TOCLIENT_ACTIVE_OBJECT_POSITIONS",  0, true }, // 0x65 (may be sent as unrel over channel 1 too)
 };
@@ -1037,7 +1037,7 @@ void Server::handleCommand_Interact(NetworkPacket *pkt)
 				infostream << "Server: Not punching: Node not found. "
 					"Adding block to emerge queue." << std::endl;
 				m_emerge->enqueueBlockEmerge(peer_id,
-					getNodeBlockPos(pointed.node_abovesurface), false);
+					getNodeBlockPos(pointed.node_abovesurface), false, false, 0);
 			}
 
 			if (n.getContent() != CONTENT_IGNORE)
@@ -1090,7 +1090,7 @@ void Server::handleCommand_Interact(NetworkPacket *pkt)
 			infostream << "Server: Not finishing digging: Node not found. "
 				"Adding block to emerge queue." << std::endl;
 			m_emerge->enqueueBlockEmerge(peer_id,
-				getNodeBlockPos(pointed.node_abovesurface), false);
+				getNodeBlockPos(pointed.node_abovesurface), false, false, 0);
 		}
 
 		/* Cheat prevention */
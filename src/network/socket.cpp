@@ -24,6 +24,7 @@ typedef int socklen_t;
 #include <cerrno>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -33,6 +34,11 @@ typedef int socklen_t;
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
 
+#if defined(__linux__)
+// Batched I/O with one system call
+#define HAVE_MMSG
+#endif
+
 static bool g_sockets_initialized = false;
 
 // Initialize sockets
@@ -109,6 +115,20 @@ UDPSocket::~UDPSocket()
 	}
 }
 
+bool UDPSocket::setReusePort()
+{
+	// Elsewhere SO_REUSEPORT hands all datagrams to one of the sockets
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	int value = 1;
+	if (setsockopt(m_handle, SOL_SOCKET, SO_REUSEPORT,
+			reinterpret_cast<char *>(&value), sizeof(value)) == 0)
+		return true;
+	verbosestream << "Failed to set SO_REUSEPORT: "
+		<< SOCKET_ERR_STR(LAST_SOCKET_ERR()) << std::endl;
+#endif
+	return false;
+}
+
 void UDPSocket::Bind(Address addr)
 {
 	if (addr.getFamily() != m_addr_family) {
@@ -163,44 +183,107 @@ void UDPSocket::Bind(Address addr)
 	}
 }
 
-void UDPSocket::Send(const Address &destination, const void *data, int size)
+// Fills in the socket address, returns its length
+static socklen_t to_sockaddr(const Address &addr, struct sockaddr_storage &ss)
 {
-	bool dumping_packet = false; // for INTERNET_SIMULATOR
+	memset(&ss, 0, sizeof(ss));
+	if (addr.getFamily() == AF_INET6) {
+		auto *address = reinterpret_cast<struct sockaddr_in6 *>(&ss);
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
 
-	if (INTERNET_SIMULATOR)
-		dumping_packet = myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0;
+	auto *address = reinterpret_cast<struct sockaddr_in *>(&ss);
+	address->sin_family = AF_INET;
+	address->sin_addr = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
 
-	if (dumping_packet) {
+static Address from_sockaddr(const struct sockaddr_storage &ss, unsigned short family)
+{
+	if (family == AF_INET6) {
+		const auto *address = reinterpret_cast<const struct sockaddr_in6 *>(&ss);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(address->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(address->sin6_port));
+	}
+
+	const auto *address = reinterpret_cast<const struct sockaddr_in *>(&ss);
+	return Address(ntohl(address->sin_addr.s_addr), ntohs(address->sin_port));
+}
+
+static bool simulate_packet_loss()
+{
+	if (INTERNET_SIMULATOR && myrand() % INTERNET_SIMULATOR_PACKET_LOSS == 0) {
 		// Lol let's forget it
-		tracestream << "UDPSocket::Send(): INTERNET_SIMULATOR: dumping packet."
+		tracestream << "UDPSocket: INTERNET_SIMULATOR: dumping packet."
 			<< std::endl;
-		return;
+		return true;
 	}
+	return false;
+}
+
+void UDPSocket::Send(const Address &destination, const void *data, int size)
+{
+	if (simulate_packet_loss())
+		return;
 
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
+	struct sockaddr_storage address;
+	socklen_t address_len = to_sockaddr(destination, address);
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
+	if (sent != size)
+		throw SendFailedException("Failed to send packet");
+}
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
+void UDPSocket::sendDatagram(const Datagram &d)
+{
+	if (!d.tail || d.tail_size <= 0) {
+		Send(d.address, d.data, d.size);
+		return;
 	}
 
-	if (sent != size)
+	if (simulate_packet_loss())
+		return;
+
+	if (d.address.getFamily() != m_addr_family)
+		throw SendFailedException("Address family mismatch");
+
+	struct sockaddr_storage address;
+	socklen_t address_len = to_sockaddr(d.address, address);
+	const int size = MYMAX(d.size, 0) + d.tail_size;
+#ifdef _WIN32
+	WSABUF bufs[2];
+	bufs[0].buf = (CHAR *)d.data;
+	bufs[0].len = MYMAX(d.size, 0);
+	bufs[1].buf = (CHAR *)d.tail;
+	bufs[1].len = d.tail_size;
+	DWORD sent = 0;
+	if (WSASendTo(m_handle, bufs, 2, &sent, 0, (struct sockaddr *)&address,
+			address_len, nullptr, nullptr) != 0 || (int)sent != size)
 		throw SendFailedException("Failed to send packet");
+#else
+	struct iovec iov[2];
+	iov[0].iov_base = d.data;
+	iov[0].iov_len = MYMAX(d.size, 0);
+	iov[1].iov_base = const_cast<void *>(d.tail);
+	iov[1].iov_len = d.tail_size;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &address;
+	msg.msg_namelen = address_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	if (sendmsg(m_handle, &msg, 0) != size)
+		throw SendFailedException("Failed to send packet");
+#endif
 }
 
 int UDPSocket::Receive(Address &sender, void *data, int size)
@@ -210,45 +293,142 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
+	return receiveNoWait(sender, data, size);
+}
+
+int UDPSocket::receiveNoWait(Address &sender, void *data, int size)
+{
 	size = MYMAX(size, 0);
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	socklen_t address_len = sizeof(address);
+
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	if (received < 0)
+		return -1;
 
-		if (received < 0)
-			return -1;
+	sender = from_sockaddr(address, m_addr_family);
+	return received;
+}
 
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+#ifdef HAVE_MMSG
+
+int UDPSocket::SendBatch(const Datagram *datagrams, int count)
+{
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovecs[BATCH_MAX][2];
+	struct sockaddr_storage addresses[BATCH_MAX];
+
+	int failed = 0;
+	int i = 0;
+	while (i < count) {
+		int n = 0;
+		for (; i < count && n < BATCH_MAX; i++) {
+			const Datagram &d = datagrams[i];
+			if (simulate_packet_loss())
+				continue;
+			if (d.address.getFamily() != m_addr_family) {
+				failed++;
+				continue;
+			}
+			iovecs[n][0].iov_base = d.data;
+			iovecs[n][0].iov_len = MYMAX(d.size, 0);
+			iovecs[n][1].iov_base = const_cast<void *>(d.tail);
+			iovecs[n][1].iov_len = d.tail ? MYMAX(d.tail_size, 0) : 0;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = &addresses[n];
+			msgs[n].msg_hdr.msg_namelen = to_sockaddr(d.address, addresses[n]);
+			msgs[n].msg_hdr.msg_iov = iovecs[n];
+			msgs[n].msg_hdr.msg_iovlen = iovecs[n][1].iov_len > 0 ? 2 : 1;
+			n++;
+		}
 
-		socklen_t address_len = sizeof(address);
+		// sendmmsg() stops at the first datagram that fails
+		int done = 0;
+		while (done < n) {
+			int sent = sendmmsg(m_handle, msgs + done, n - done, 0);
+			if (sent <= 0) {
+				failed++;
+				done++;
+				continue;
+			}
+			done += sent;
+		}
+	}
+	return failed;
+}
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+int UDPSocket::ReceiveBatch(Datagram *datagrams, int count)
+{
+	assert(m_timeout_ms >= 0);
+	count = MYMIN(count, BATCH_MAX);
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovecs[BATCH_MAX];
+	struct sockaddr_storage addresses[BATCH_MAX];
+
+	for (int i = 0; i < count; i++) {
+		iovecs[i].iov_base = datagrams[i].data;
+		iovecs[i].iov_len = MYMAX(datagrams[i].size, 0);
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &addresses[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int received = recvmmsg(m_handle, msgs, count, MSG_DONTWAIT, nullptr);
+	if (received < 0)
+		return 0;
 
-		if (received < 0)
-			return -1;
+	for (int i = 0; i < received; i++) {
+		datagrams[i].address = from_sockaddr(addresses[i], m_addr_family);
+		datagrams[i].size = msgs[i].msg_len;
+	}
+	return received;
+}
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+#else
 
-		sender = Address(address_ip, address_port);
+int UDPSocket::SendBatch(const Datagram *datagrams, int count)
+{
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		try {
+			sendDatagram(datagrams[i]);
+		} catch (SendFailedException &e) {
+			failed++;
+		}
 	}
+	return failed;
+}
 
+int UDPSocket::ReceiveBatch(Datagram *datagrams, int count)
+{
+	assert(m_timeout_ms >= 0);
+	count = MYMIN(count, BATCH_MAX);
+	if (count <= 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+	int received = 0;
+	do {
+		Datagram &d = datagrams[received];
+		int size = receiveNoWait(d.address, d.data, d.size);
+		if (size < 0)
+			break;
+		d.size = size;
+		received++;
+	} while (received < count && WaitData(0));
 	return received;
 }
 
+#endif
+
 void UDPSocket::setTimeoutMs(int timeout_ms)
 {
 	m_timeout_ms = timeout_ms;
@@ -5,8 +5,7 @@
 #pragma once
 
 #include "irrlichttypes.h"
-
-class Address;
+#include "address.h"
 
 void sockets_init();
 void sockets_cleanup();
@@ -20,10 +19,43 @@ class UDPSocket
 	bool init(bool ipv6, bool noExceptions = false);
 
 	void Bind(Address addr);
+	/*
+		Lets more sockets bind to the same address, the kernel spreading the
+		datagrams among them by sender. Must be called before Bind().
+		Returns false where the datagrams would not be spread.
+	*/
+	bool setReusePort();
 
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	// A datagram for SendBatch() and ReceiveBatch()
+	struct Datagram {
+		Address address; // destination or sender
+		void *data = nullptr;
+		// Size of the data to send, or of the buffer to receive into.
+		// ReceiveBatch() sets it to the size received.
+		int size = 0;
+		// Sent right after data, without joining them. Unused when receiving.
+		const void *tail = nullptr;
+		int tail_size = 0;
+	};
+
+	// Most datagrams handled per system call
+	static constexpr int BATCH_MAX = 64;
+
+	/*
+		Sends the datagrams, using sendmmsg() where available.
+		Returns the number of datagrams that failed to send.
+	*/
+	int SendBatch(const Datagram *datagrams, int count);
+	/*
+		Waits for data like Receive(), then receives as many of the datagrams
+		already there as fit, using recvmmsg() where available.
+		Returns the number received, 0 if there was no data.
+	*/
+	int ReceiveBatch(Datagram *datagrams, int count);
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
@@ -32,6 +64,9 @@ class UDPSocket
 	int GetHandle() const { return m_handle; };
 
 private:
+	int receiveNoWait(Address &sender, void *data, int size);
+	void sendDatagram(const Datagram &d);
+
 	int m_handle = -1;
 	int m_timeout_ms = -1;
 	unsigned short m_addr_family = 0;
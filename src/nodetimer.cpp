@@ -47,7 +47,7 @@ void NodeTimerList::serialize(std::ostream &os, u8 map_format_version) const
 	for (const auto &timer : m_timers) {
 		NodeTimer t = timer.second;
 		NodeTimer nt = NodeTimer(t.timeout,
-			t.timeout - (f32)(timer.first - m_time), t.position);
+			t.timeout - (f32)(timer.first - now()), t.position);
 		v3s16 p = t.position;
 
 		u16 p16 = p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
@@ -109,26 +109,66 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 	}
 }
 
+void NodeTimerList::attach(NodeTimerClock *clock, v3s16 blockpos)
+{
+	if (m_clock)
+		detach();
+
+	const double offset = clock->getTime() - m_time;
+	if (offset != 0.0 && !m_timers.empty()) {
+		std::multimap<double, NodeTimer> timers;
+		timers.swap(m_timers);
+		m_iterators.clear();
+		for (auto &it : timers)
+			m_iterators.emplace(it.second.position,
+				m_timers.emplace(it.first + offset, it.second));
+		m_next_trigger_time = m_timers.begin()->first;
+	}
+
+	m_clock = clock;
+	m_blockpos = blockpos;
+	if (m_next_trigger_time != -1.)
+		m_clock->schedule(m_blockpos, m_next_trigger_time);
+}
+
+void NodeTimerList::detach()
+{
+	if (!m_clock)
+		return;
+	m_time = m_clock->getTime();
+	m_clock = nullptr;
+}
+
 std::vector<NodeTimer> NodeTimerList::step(float dtime)
 {
 	std::vector<NodeTimer> elapsed_timers;
-	m_time += dtime;
-	if (m_next_trigger_time == -1. || m_time < m_next_trigger_time) {
+	if (!m_clock)
+		m_time += dtime;
+	const double time = now();
+	if (m_next_trigger_time == -1.)
+		return elapsed_timers;
+	if (time < m_next_trigger_time) {
+		// Woken up for a timer that was removed or moved since
+		if (m_clock)
+			m_clock->schedule(m_blockpos, m_next_trigger_time);
 		return elapsed_timers;
 	}
 	auto i = m_timers.begin();
 	// Process timers
-	for (; i != m_timers.end() && i->first <= m_time; ++i) {
+	for (; i != m_timers.end() && i->first <= time; ++i) {
 		NodeTimer t = i->second;
-		t.elapsed = t.timeout + (f32)(m_time - i->first);
+		t.elapsed = t.timeout + (f32)(time - i->first);
 		elapsed_timers.push_back(t);
 		m_iterators.erase(t.position);
 	}
 	// Delete elapsed timers
 	m_timers.erase(m_timers.begin(), i);
-	if (m_timers.empty())
+	if (m_timers.empty()) {
 		m_next_trigger_time = -1.;
-	else
+	} else {
 		m_next_trigger_time = m_timers.begin()->first;
+		if (m_clock)
+			m_clock->schedule(m_blockpos, m_next_trigger_time);
+	}
 	return elapsed_timers;
 }
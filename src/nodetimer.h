@@ -35,6 +35,22 @@ class NodeTimer
 	v3s16 position;
 };
 
+/*
+	Game time shared by the timer lists of many blocks, so that only the
+	blocks with due timers need to be stepped.
+*/
+
+class NodeTimerClock
+{
+public:
+	virtual double getTime() const = 0;
+	// Requests the timers of the block to be stepped once `time` is reached
+	virtual void schedule(v3s16 blockpos, double time) = 0;
+
+protected:
+	~NodeTimerClock() = default;
+};
+
 /*
 	List of timers of all the nodes of a block
 */
@@ -54,7 +70,7 @@ class NodeTimerList
 		if (n == m_iterators.end())
 			return NodeTimer();
 		NodeTimer t = n->second->second;
-		t.elapsed = t.timeout - (n->second->first - m_time);
+		t.elapsed = t.timeout - (n->second->first - now());
 		return t;
 	}
 	// Deletes timer
@@ -78,11 +94,14 @@ class NodeTimerList
 	// Undefined behavior if there already is a timer
 	void insert(const NodeTimer &timer) {
 		v3s16 p = timer.position;
-		double trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
+		double trigger_time = now() + (double)(timer.timeout - timer.elapsed);
 		auto it = m_timers.emplace(trigger_time, timer);
 		m_iterators.emplace(p, it);
-		if (m_next_trigger_time == -1. || trigger_time < m_next_trigger_time)
+		if (m_next_trigger_time == -1. || trigger_time < m_next_trigger_time) {
 			m_next_trigger_time = trigger_time;
+			if (m_clock)
+				m_clock->schedule(m_blockpos, trigger_time);
+		}
 	}
 	// Deletes old timer and sets a new one
 	inline void set(const NodeTimer &timer) {
@@ -96,12 +115,27 @@ class NodeTimerList
 		m_next_trigger_time = -1.;
 	}
 
-	// Move forward in time, returns elapsed timers
+	/*
+		Makes the timers follow the time of `clock` instead of the own time,
+		keeping the time left on them.
+		The clock is told about the next trigger of the block from now on.
+	*/
+	void attach(NodeTimerClock *clock, v3s16 blockpos);
+	// Continues with the own time from where the clock is
+	void detach();
+	bool isAttached(const NodeTimerClock *clock) const { return m_clock == clock; }
+
+	// Move forward in time, returns elapsed timers.
+	// If attached, the time is taken from the clock and dtime is ignored.
 	std::vector<NodeTimer> step(float dtime);
 
 private:
+	double now() const { return m_clock ? m_clock->getTime() : m_time; }
+
 	std::multimap<double, NodeTimer> m_timers;
 	std::map<v3s16, std::multimap<double, NodeTimer>::iterator> m_iterators;
 	double m_next_trigger_time = -1.0;
 	double m_time = 0.0;
+	NodeTimerClock *m_clock = nullptr;
+	v3s16 m_blockpos;
 };
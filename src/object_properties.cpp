@@ -81,6 +81,7 @@ std::string ObjectProperties::dump() const
 	os << ", rotate_selectionbox=" << rotate_selectionbox;
 	os << ", pointable=" << Pointabilities::toStringPointabilityType(pointable);
 	os << ", static_save=" << static_save;
+	os << ", position_update_lod=" << position_update_lod;
 	os << ", eye_height=" << eye_height;
 	os << ", zoom_fov=" << zoom_fov;
 	os << ", node=(" << (int)node.getContent() << ", " << (int)node.getParam1()
@@ -103,6 +104,7 @@ static inline auto tie(const ObjectProperties &o)
 	o.initial_sprite_basepos,
 	o.stepheight, o.automatic_rotate, o.automatic_face_movement_dir_offset,
 	o.automatic_face_movement_max_rotation_per_sec, o.eye_height, o.zoom_fov,
+	o.position_update_lod,
 	o.node, o.hp_max, o.breath_max, o.glow, o.pointable, o.physical,
 	o.collideWithObjects, o.rotate_selectionbox, o.is_visible, o.makes_footstep_sound,
 	o.automatic_face_movement_dir, o.backface_culling, o.static_save, o.use_texture_alpha,
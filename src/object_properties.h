@@ -56,6 +56,9 @@ struct ObjectProperties
 	f32 automatic_face_movement_max_rotation_per_sec = -1.0f;
 	float eye_height = 1.625f;
 	float zoom_fov = 0.0f;
+	// Server-only: scales the distance used to lower the rate of position
+	// updates sent to far away players, 0 sends all of them
+	float position_update_lod = 1.0f;
 	std::optional<u32> nametag_fontsize;
 	MapNode node = MapNode(CONTENT_IGNORE);
 	u16 hp_max = 1;
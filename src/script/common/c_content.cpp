@@ -282,7 +282,7 @@ void push_item_definition_full(lua_State *L, const ItemDefinition &i)
 }
 
 /******************************************************************************/
-const std::array<const char *, 35> object_property_keys = {
+const std::array<const char *, 36> object_property_keys = {
 	"hp_max",
 	"breath_max",
 	"physical",
@@ -310,6 +310,7 @@ const std::array<const char *, 35> object_property_keys = {
 	"automatic_face_movement_max_rotation_per_sec",
 	"infotext",
 	"static_save",
+	"position_update_lod",
 	"wield_item",
 	"zoom_fov",
 	"use_texture_alpha",
@@ -506,6 +507,8 @@ void read_object_properties(lua_State *L, int index,
 
 	getstringfield(L, -1, "infotext", prop->infotext);
 	getboolfield(L, -1, "static_save", prop->static_save);
+	getfloatfield(L, -1, "position_update_lod", prop->position_update_lod);
+	prop->position_update_lod = std::max(prop->position_update_lod, 0.0f);
 
 	lua_getfield(L, -1, "wield_item");
 	if (!lua_isnil(L, -1))
@@ -613,6 +616,8 @@ void push_object_properties(lua_State *L, const ObjectProperties *prop)
 	lua_setfield(L, -2, "infotext");
 	lua_pushboolean(L, prop->static_save);
 	lua_setfield(L, -2, "static_save");
+	lua_pushnumber(L, prop->position_update_lod);
+	lua_setfield(L, -2, "position_update_lod");
 	lua_pushlstring(L, prop->wield_item.c_str(), prop->wield_item.size());
 	lua_setfield(L, -2, "wield_item");
 	lua_pushnumber(L, prop->zoom_fov);
@@ -144,10 +144,7 @@ void LuaEmergeAreaCallback(v3s16 blockpos, EmergeAction action, void *param)
 	assert(state->script != NULL);
 	assert(state->refcount > 0);
 
-	// state must be protected by envlock
-	Server *server = state->script->getServer();
-	Server::EnvAutoLock envlock(server);
-
+	// state is protected by the envlock, which the caller holds
 	state->refcount--;
 
 	state->script->on_emerge_area_completion(blockpos, action, state);
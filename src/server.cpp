@@ -30,6 +30,7 @@
 #include "server/serveractiveobject.h"
 #include "server/serverinventorymgr.h"
 #include "server/serverlist.h"
+#include "server/serializedblockcache.h"
 #include "settings.h"
 #include "translation.h"
 #include "util/base64.h"
@@ -39,6 +40,7 @@
 #include "util/string.h"
 #include "util/thread.h"
 #include "util/tracy_wrapper.h"
+#include "threading/worker_pool.h"
 #include "version.h"
 
 // Mapgen
@@ -384,6 +386,10 @@ Server::~Server()
 	if (m_env) {
 		EnvAutoLock envlock(this);
 
+		// Callbacks of the emerges that finished or were cancelled above
+		if (m_emerge)
+			m_emerge->processCompletedEmerges(&m_env->getMap());
+
 		infostream << "Server: Executing shutdown hooks" << std::endl;
 		try {
 			m_script->on_shutdown();
@@ -480,6 +486,22 @@ void Server::init()
 	// Create emerge manager
 	m_emerge = std::make_unique<EmergeManager>(this, m_metrics_backend.get());
 
+	{
+		s16 nthreads = g_settings->getS16("num_block_send_threads");
+		if (nthreads <= 0)
+			nthreads = std::min(4U, Thread::getNumberOfProcessors() / 4);
+		// the server thread also does work, so it is counted
+		nthreads = std::max<s16>(1, nthreads);
+		m_block_send_pool = std::make_unique<WorkerPool>("BlockSend", nthreads - 1);
+		infostream << "Server: compressing blocks with " << nthreads
+			<< " thread(s)" << std::endl;
+	}
+
+	if (u32 cache_mb = g_settings->getU32("block_send_cache_size")) {
+		m_block_send_cache = std::make_unique<SerializedBlockCache>(
+			(size_t)cache_mb * 1024 * 1024, m_metrics_backend.get());
+	}
+
 	// Create ban manager
 	std::string ban_path = m_path_world + DIR_DELIM "ipban.txt";
 	m_banmanager = new BanManager(ban_path);
@@ -588,6 +610,10 @@ void Server::init()
 	m_max_chatmessage_length = g_settings->getU16("chat_message_max_size");
 	m_csm_restriction_flags = g_settings->getU64("csm_restriction_flags");
 	m_csm_restriction_noderange = g_settings->getU32("csm_restriction_noderange");
+	m_active_object_send_range = g_settings->getS16("active_object_send_range_blocks") *
+			MAP_BLOCKSIZE * BS;
+	m_active_object_lod_distance = g_settings->getFloat("active_object_lod_distance") * BS;
+	m_active_object_lod_max_interval = g_settings->getFloat("active_object_lod_max_interval");
 }
 
 void Server::start()
@@ -655,6 +681,51 @@ void Server::step()
 	}
 }
 
+namespace {
+
+// What a player sees, for lowering the rate of position updates
+struct ObjectLodView {
+	v3f eye_pos;
+	v3f camera_dir;
+	f32 fov = 0;
+	f32 lod_distance = 0;
+	f32 max_distance = 0;
+	f32 max_interval = 0;
+};
+
+/*
+	Time between two position updates of an entity sent to a player.
+	Grows from 0 at lod_distance to max_interval at the edge of the active
+	object send range. Entities out of sight count as twice as far away.
+*/
+f32 getPositionUpdateInterval(ServerActiveObject *sao,
+		const ObjectPositionUpdate &update, const ObjectLodView &view)
+{
+	// Never hold back teleports or the final position of a movement
+	if (view.lod_distance <= 0 || !update.do_interpolate || update.is_movement_end)
+		return 0;
+	if (sao->getType() != ACTIVEOBJECT_TYPE_LUAENTITY)
+		return 0;
+	const f32 lod = sao->accessObjectProperties()->position_update_lod;
+	if (lod <= 0)
+		return 0;
+
+	v3f rel = update.position - view.eye_pos;
+	f32 d = rel.getLength();
+	if (view.fov > 0 && d > 0 &&
+			rel.dotProduct(view.camera_dir) < d * std::cos(view.fov / 2))
+		d *= 2;
+	d *= lod;
+	if (d <= view.lod_distance)
+		return 0;
+	if (view.max_distance <= view.lod_distance)
+		return view.max_interval;
+	return view.max_interval * std::min(1.0f,
+			(d - view.lod_distance) / (view.max_distance - view.lod_distance));
+}
+
+}
+
 void Server::AsyncRunStep(float dtime, bool initial_step)
 {
 	ZoneScoped;
@@ -918,22 +989,76 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		m_aom_buffer_counter[0]->increment(count_reliable);
 		m_aom_buffer_counter[1]->increment(count_unreliable);
 
+		// Unreliable position updates, decoded once for all clients. They
+		// are throttled per client and packed into
+		// TOCLIENT_ACTIVE_OBJECT_POSITIONS for clients that support it.
+		std::unordered_map<const ActiveObjectMessage *, ObjectPositionUpdate> position_updates;
+		for (const auto &buffered_message : buffered_messages) {
+			for (const ActiveObjectMessage &aom : *buffered_message.second) {
+				ObjectPositionUpdate update;
+				if (!aom.reliable && update.parse(aom.datastring))
+					position_updates.emplace(&aom, update);
+			}
+		}
+
+		const f32 lod_distance = m_active_object_lod_distance;
+		const f32 lod_max_interval = m_active_object_lod_max_interval;
+		const f32 send_range = m_active_object_send_range;
+		const double now = getUptime();
+
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
 			const RemoteClientMap &clients = m_clients.getClientList();
 			// Route data to every client
 			std::string reliable_data, unreliable_data;
+			std::string reliable_positions, unreliable_positions;
+			std::vector<std::pair<u16, ObjectPositionUpdate>> due_positions;
 			for (const auto &client_it : clients) {
 				reliable_data.clear();
 				unreliable_data.clear();
+				reliable_positions.clear();
+				unreliable_positions.clear();
 				RemoteClient *client = client_it.second;
+				const bool packed_positions = client->net_proto_version >= 52;
 				PlayerSAO *player = getPlayerSAO(client->peer_id);
+
+				ObjectLodView view;
+				if (player && lod_distance > 0) {
+					view.eye_pos = player->getEyePosition();
+					view.camera_dir = v3f(0, 0, 1);
+					view.camera_dir.rotateYZBy(player->getLookPitch());
+					view.camera_dir.rotateXZBy(player->getRotation().Y);
+					if (player->getCameraInverted())
+						view.camera_dir = -view.camera_dir;
+					view.fov = player->getFov();
+					view.lod_distance = lod_distance;
+					view.max_distance = send_range;
+					view.max_interval = lod_max_interval;
+				}
+
+				auto append_message = [] (std::string &buffer, u16 id,
+						const std::string &datastring) {
+					char idbuf[2];
+					writeU16((u8*) idbuf, id);
+					// u16 id
+					// std::string data
+					buffer.append(idbuf, sizeof(idbuf));
+					buffer.append(serializeString16(datastring));
+				};
+				auto append_position = [&] (u16 id, const ObjectPositionUpdate &update) {
+					if (packed_positions)
+						client->m_object_positions.write(reliable_positions,
+							unreliable_positions, id, update);
+					else
+						append_message(unreliable_data, id, update.toMessage());
+				};
+
 				// Go through all objects in message buffer
 				for (const auto &buffered_message : buffered_messages) {
 					// If object does not exist or is not known by client, skip it
 					u16 id = buffered_message.first;
 					ServerActiveObject *sao = m_env->getActiveObject(id);
-					if (!sao || client->m_known_objects.find(id) == client->m_known_objects.end())
+					if (!sao || !client->knowsObject(id))
 						continue;
 
 					// Get message list of object
@@ -948,21 +1073,36 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 							// Do not send position updates for attached players
 							// as long the parent is known to the client
 							ServerActiveObject *parent = sao->getParent();
-							if (parent && client->m_known_objects.find(parent->getId()) !=
-									client->m_known_objects.end())
+							if (parent && client->knowsObject(parent->getId()))
 								continue;
 						}
 
+						auto it = position_updates.find(&aom);
+						if (it != position_updates.end()) {
+							ObjectPositionUpdate update = it->second;
+							f32 interval = getPositionUpdateInterval(sao, update, view);
+							if (!client->m_update_throttle.push(aom.id, now, interval, update))
+								continue;
+							if (packed_positions || update.update_interval != it->second.update_interval)
+								append_position(aom.id, update);
+							else
+								append_message(unreliable_data, aom.id, aom.datastring);
+							continue;
+						}
+
 						// Add full new data to appropriate buffer
-						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
-						char idbuf[2];
-						writeU16((u8*) idbuf, aom.id);
-						// u16 id
-						// std::string data
-						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
+						append_message(aom.reliable ? reliable_data : unreliable_data,
+							aom.id, aom.datastring);
 					}
 				}
+
+				// Updates held back in earlier steps that are due now
+				due_positions.clear();
+				client->m_update_throttle.popDue(now, due_positions);
+				for (const auto &[id, update] : due_positions) {
+					if (client->knowsObject(id))
+						append_position(id, update);
+				}
 				/*
 					reliable_data and unreliable_data are now ready.
 					Send them.
@@ -974,6 +1114,14 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 				if (!unreliable_data.empty()) {
 					SendActiveObjectMessages(client->peer_id, unreliable_data, false);
 				}
+
+				if (!reliable_positions.empty()) {
+					SendActiveObjectPositions(client->peer_id, reliable_positions);
+				}
+
+				if (!unreliable_positions.empty()) {
+					SendActiveObjectPositions(client->peer_id, unreliable_positions, false);
+				}
 			}
 		}
 
@@ -990,6 +1138,13 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		// We will be accessing the environment
 		EnvAutoLock lock(this);
 
+		// Integrate what the emerge threads finished since the last step,
+		// so the changed blocks are handled below
+		{
+			ScopeProfiler sp(g_profiler, "Server: process completed emerges");
+			m_emerge->processCompletedEmerges(&m_env->getMap());
+		}
+
 		// Single change sending is disabled if queue size is big
 		bool disable_single_change_sending = false;
 		if(m_unsent_map_edit_queue.size() >= 4)
@@ -2185,10 +2340,9 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 
 	std::vector<std::pair<bool, u16>> removed_objects;
 	std::vector<u16> added_objects;
-	m_env->getRemovedActiveObjects(playersao, my_radius, player_radius,
-		client->m_known_objects, removed_objects);
-	m_env->getAddedActiveObjects(playersao, my_radius, player_radius,
-		client->m_known_objects, added_objects);
+	m_env->getActiveObjectChanges(playersao, my_radius, player_radius,
+		client->m_objects_in_range, client->m_known_objects,
+		removed_objects, added_objects);
 
 	if (removed_objects.empty() && added_objects.empty())
 		return;
@@ -2204,9 +2358,9 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		ServerActiveObject *obj = m_env->getActiveObject(id);
 
 		pkt << id;
+		client->m_object_positions.forget(id);
+		client->m_update_throttle.forget(id);
 
-		// Remove from known objects
-		client->m_known_objects.erase(id);
 		if (obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
 	}
@@ -2219,6 +2373,8 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 	// Added objects
 	pkt << static_cast<u16>(added_objects.size());
 
+	std::vector<u16> known_added;
+	known_added.reserve(added_objects.size());
 	for (u16 id : added_objects) {
 		ServerActiveObject *obj = m_env->getActiveObject(id);
 		if (!obj) {
@@ -2232,11 +2388,27 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		pkt << id << type;
 		pkt.putLongString(obj->getClientInitializationData(client->net_proto_version));
 
-		// Add to known objects
-		client->m_known_objects.insert(id);
+		known_added.push_back(id);
 		obj->m_known_by_count++;
 	}
 
+	// Update known objects; removed_objects and added_objects are sorted by id
+	std::vector<u16> known;
+	known.reserve(client->m_known_objects.size() + known_added.size());
+	auto removed_it = removed_objects.begin();
+	auto added_it = known_added.begin();
+	for (u16 id : client->m_known_objects) {
+		if (removed_it != removed_objects.end() && removed_it->second == id) {
+			++removed_it;
+			continue;
+		}
+		for (; added_it != known_added.end() && *added_it < id; ++added_it)
+			known.push_back(*added_it);
+		known.push_back(id);
+	}
+	known.insert(known.end(), added_it, known_added.end());
+	client->m_known_objects = std::move(known);
+
 	Send(&pkt);
 }
 
@@ -2252,6 +2424,18 @@ void Server::SendActiveObjectMessages(session_t peer_id, const std::string &data
 	m_clients.sendCustom(pkt.getPeerId(), reliable ? ccf.channel : 1, &pkt, reliable);
 }
 
+void Server::SendActiveObjectPositions(session_t peer_id, const std::string &datas,
+		bool reliable)
+{
+	NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_POSITIONS,
+			datas.size(), peer_id);
+
+	pkt.putRawString(datas);
+
+	auto &ccf = clientCommandFactoryTable[pkt.getCommand()];
+	m_clients.sendCustom(pkt.getPeerId(), reliable ? ccf.channel : 1, &pkt, reliable);
+}
+
 void Server::SendCSMRestrictionFlags(session_t peer_id)
 {
 	NetworkPacket pkt(TOCLIENT_CSM_RESTRICTION_FLAGS,
@@ -2500,103 +2684,226 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 }
 
 void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+		u16 net_proto_version)
 {
 	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
-	}
+	const v3s16 pos = block->getPos();
+	const u64 content_version = block->getContentVersion();
+	SerializedBlockCache::Data data;
+	if (m_block_send_cache)
+		data = m_block_send_cache->get(pos, ver, content_version);
 
 	// Serialize the block in the right format
-	if (!sptr) {
+	if (!data) {
 		std::ostringstream os(std::ios_base::binary);
 		block->serialize(os, ver, false, net_compression_level);
 		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
+		data = std::make_shared<const std::string>(os.str());
+		if (m_block_send_cache)
+			m_block_send_cache->put(pos, ver, content_version, data);
 	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data->size(), peer_id);
+	pkt << pos;
+	pkt.putRawString(*data);
 	Send(&pkt);
+}
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+namespace {
+	// A block chosen by SendBlocks() that may go to several clients
+	struct BlockSendJob {
+		v3s16 pos;
+		u8 ser_ver;
+		u64 content_version;
+		// Ready to send, either from the cache or after compression
+		SerializedBlockCache::Data data;
+		bool from_cache = false;
+		// Taken under the envlock if not cached. Uncompressed unless the
+		// format requires compression to be interleaved (ser_ver < 29).
+		std::string raw;
+		bool raw_compressed;
+		std::string network_specific;
+
+		NetworkPacket pkt;
+	};
 }
 
 void Server::SendBlocks(float dtime)
 {
-	EnvAutoLock envlock(this);
-
-	std::vector<PrioritySortedBlockTransfer> queue;
+	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
 
-	u32 total_sending = 0, unique_clients = 0;
+	std::vector<BlockSendJob> jobs;
+	// (index into jobs, peer) in the order the packets should go out
+	std::vector<std::pair<size_t, session_t>> sends;
 
 	{
-		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+		EnvAutoLock envlock(this);
 
-		std::vector<session_t> clients = m_clients.getClientIDs();
+		u32 total_sending = 0;
+
+		// The connection measures rates over several seconds, so there is
+		// no point in asking more often
+		m_send_window_timer += dtime;
+		const bool update_windows = m_send_window_timer >= 1.0f;
+		if (update_windows)
+			m_send_window_timer = 0.0f;
 
+		std::vector<session_t> clients = m_clients.getClientIDs();
 		ClientInterface::AutoLock clientlock(m_clients);
-		for (const session_t client_id : clients) {
-			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
 
-			if (!client)
-				continue;
+		/*
+			The clients keep what they found in their send queues, so this
+			only looks at what changed since the last step. The queues are
+			then merged, most important block first.
+		*/
+		std::vector<std::pair<float, RemoteClient *>> heads;
+		{
+			ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
 
-			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env, m_emerge.get(), dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
-		}
-	}
+			for (const session_t client_id : clients) {
+				RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
 
-	// Sort.
-	// Lowest priority number comes first.
-	// Lowest is most important.
-	std::sort(queue.begin(), queue.end());
+				if (!client)
+					continue;
 
-	ClientInterface::AutoLock clientlock(m_clients);
+				if (update_windows) {
+					client->updateSendWindow(
+						m_con->getPeerRateStat(client_id, con::CUR_DL_RATE) * 1024.0f,
+						m_con->getPeerStat(client_id, con::MIN_RTT),
+						m_avg_block_packet_size);
+				}
 
-	// Maximal total count calculation
-	// The per-client block sends is halved with the maximal online users
-	u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
-		g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
+				total_sending += client->getSendingCount();
+				client->GetNextBlocks(m_env, m_emerge.get(), dtime);
+				if (auto *next = client->peekQueuedBlock())
+					heads.emplace_back(next->priority, client);
+			}
+		}
+
+		// Lowest priority number comes first.
+		// Lowest is most important.
+		const auto heap_cmp = [] (const std::pair<float, RemoteClient *> &a,
+				const std::pair<float, RemoteClient *> &b) {
+			return b.first < a.first;
+		};
+		std::make_heap(heads.begin(), heads.end(), heap_cmp);
+
+		// Maximal total count calculation
+		// The per-client block sends is halved with the maximal online users
+		u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
+			g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
+
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Snapshot blocks");
+		Map &map = m_env->getMap();
+
+		// Every block is only serialized once per format, no matter how
+		// many clients it goes to
+		std::unordered_map<std::pair<v3s16, u16>, size_t, SBCHash> job_index;
+
+		while (!heads.empty() && total_sending < max_blocks_to_send) {
+			std::pop_heap(heads.begin(), heads.end(), heap_cmp);
+			RemoteClient *client = heads.back().second;
+			heads.pop_back();
+
+			const PrioritySortedBlockTransfer block_to_send = *client->peekQueuedBlock();
+			MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
+			// Unloaded in the meantime, it is loaded again when found
+			client->popQueuedBlock(!block);
+			if (auto *next = client->peekQueuedBlock()) {
+				heads.emplace_back(next->priority, client);
+				std::push_heap(heads.begin(), heads.end(), heap_cmp);
+			}
+			if (!block)
+				continue;
 
-	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
-	Map &map = m_env->getMap();
+			const u8 ver = client->serialization_version;
+			auto it = job_index.find({block_to_send.pos, ver});
+			if (it == job_index.end()) {
+				it = job_index.emplace(std::make_pair(block_to_send.pos, ver),
+						jobs.size()).first;
+				BlockSendJob &job = jobs.emplace_back();
+				job.pos = block_to_send.pos;
+				job.ser_ver = ver;
+				job.content_version = block->getContentVersion();
+
+				if (m_block_send_cache)
+					job.data = m_block_send_cache->get(job.pos, ver, job.content_version);
+				job.from_cache = !!job.data;
+
+				if (!job.from_cache) {
+					std::ostringstream os(std::ios_base::binary);
+					job.raw_compressed = ver < 29;
+					if (job.raw_compressed)
+						block->serialize(os, ver, false, net_compression_level);
+					else
+						block->serializeUncompressed(os, ver, false);
+					job.raw = os.str();
+
+					os.str("");
+					block->serializeNetworkSpecific(os);
+					job.network_specific = os.str();
+				}
+			}
+			sends.emplace_back(it->second, block_to_send.peer_id);
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
+			client->SentBlock(block_to_send.pos);
+			total_sending++;
+		}
 	}
 
-	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
-		if (total_sending >= max_blocks_to_send)
-			break;
+	if (jobs.empty())
+		return;
 
-		MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
-		if (!block)
-			continue;
+	{
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Compress");
 
-		RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
-				CS_Active);
-		if (!client)
-			continue;
+		// (thread_local, so it must be copied for the workers)
+		const int compression_level = net_compression_level;
+		m_block_send_pool->run(jobs.size(), [&] (size_t i) {
+			BlockSendJob &job = jobs[i];
+			if (!job.data) {
+				std::ostringstream os(std::ios_base::binary);
+				if (job.raw_compressed)
+					os << job.raw;
+				else
+					compress(job.raw, os, job.ser_ver, compression_level);
+				os << job.network_specific;
+				job.data = std::make_shared<const std::string>(os.str());
+				job.raw = std::string();
+			}
+
+			job.pkt = NetworkPacket(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + job.data->size());
+			job.pkt << job.pos;
+			job.pkt.putRawString(*job.data);
+		});
+	}
+
+	{
+		size_t total_size = 0;
+		for (auto &[job_i, peer_id] : sends)
+			total_size += jobs[job_i].pkt.getSize();
+		m_avg_block_packet_size = 0.9f * m_avg_block_packet_size +
+			0.1f * ((float)total_size / sends.size());
+	}
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+	{
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
+		for (auto &[job_i, peer_id] : sends)
+			Send(peer_id, &jobs[job_i].pkt);
+	}
 
-		client->SentBlock(block_to_send.pos);
-		total_sending++;
+	if (m_block_send_cache) {
+		// Only used by the server thread, so this is fine without the envlock
+		for (auto &job : jobs) {
+			if (!job.from_cache) {
+				m_block_send_cache->put(job.pos, job.ser_ver, job.content_version,
+					std::move(job.data));
+			}
+		}
 	}
+
+	g_profiler->avg("Server::SendBlocks(): blocks sent [#]", sends.size());
 }
 
 bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
@@ -4484,6 +4791,178 @@ bool Server::migrateModStorageDatabase(const GameParams &game_params, const Sett
 	return succeeded;
 }
 
+bool Server::parsePregenArea(const std::string &value, v3s16 &minp, v3s16 &maxp)
+{
+	if (is_number(value)) {
+		// Saturates on overflow, which is far outside the map anyway
+		const unsigned long long radius = strtoull(value.c_str(), nullptr, 10);
+		const s16 r = std::min<unsigned long long>(radius, MAX_MAP_GENERATION_LIMIT);
+		minp = v3s16(-r, -r, -r);
+		maxp = v3s16(r, r, r);
+		return true;
+	}
+
+	size_t split = value.find(')');
+	if (split == std::string::npos)
+		return false;
+	auto p1 = str_to_v3f(std::string_view(value).substr(0, split + 1));
+	auto p2 = str_to_v3f(std::string_view(value).substr(split + 1));
+	if (!p1 || !p2)
+		return false;
+	// Nothing is generated past the limit, and v3s16 could not hold it
+	const auto clamp = [] (v3f p) -> std::optional<v3s16> {
+		if (!std::isfinite(p.X) || !std::isfinite(p.Y) || !std::isfinite(p.Z))
+			return std::nullopt;
+		constexpr f32 limit = MAX_MAP_GENERATION_LIMIT;
+		return floatToInt(v3f(rangelim(p.X, -limit, limit),
+			rangelim(p.Y, -limit, limit), rangelim(p.Z, -limit, limit)), 1);
+	};
+	auto c1 = clamp(*p1);
+	auto c2 = clamp(*p2);
+	if (!c1 || !c2)
+		return false;
+	minp = *c1;
+	maxp = *c2;
+	sortBoxVerticies(minp, maxp);
+	return true;
+}
+
+struct PregenProgress {
+	u32 done = 0;
+	u32 generated = 0;
+	u32 failed = 0;
+};
+
+static void pregen_chunk_done(v3s16 blockpos, EmergeAction action, void *param)
+{
+	auto *progress = reinterpret_cast<PregenProgress *>(param);
+	progress->done++;
+	if (action == EMERGE_GENERATED)
+		progress->generated++;
+	else if (action == EMERGE_CANCELLED || action == EMERGE_ERRORED)
+		progress->failed++;
+}
+
+bool Server::pregenerateMap(const GameParams &game_params, const Settings &cmd_args)
+{
+	v3s16 minp, maxp;
+	if (!parsePregenArea(cmd_args.get("pregen"), minp, maxp)) {
+		errorstream << "Invalid area for --pregen, expected a radius or "
+			"\"(x1,y1,z1) (x2,y2,z2)\"" << std::endl;
+		return false;
+	}
+
+	// Has to outlive the server, which may still run the callbacks
+	PregenProgress progress;
+
+	// Nothing is bound or listened to, but mods are loaded since they take
+	// part in map generation
+	Server server(game_params.world_path, game_params.game_spec, false, Address(), false);
+	server.init();
+
+	EmergeManager *emerge = server.m_emerge.get();
+	ServerMap &map = server.m_env->getServerMap();
+	const v3s16 chunksize = map.getMapgenParams()->chunksize;
+
+	// Generating any block generates its whole chunk, so one per chunk is
+	// enough. Chunks that reach past the mapgen limit are never generated.
+	const v3s16 cmin = EmergeManager::getContainingChunk(getNodeBlockPos(minp), chunksize);
+	const v3s16 cmax = EmergeManager::getContainingChunk(getNodeBlockPos(maxp), chunksize);
+	std::vector<v3s16> chunks;
+	v3s16 c;
+	for (c.X = cmin.X; c.X <= cmax.X; c.X += chunksize.X)
+	for (c.Z = cmin.Z; c.Z <= cmax.Z; c.Z += chunksize.Z)
+	for (c.Y = cmin.Y; c.Y <= cmax.Y; c.Y += chunksize.Y) {
+		if (!map.blockpos_over_mapgen_limit(c) &&
+				!map.blockpos_over_mapgen_limit(c + chunksize - 1))
+			chunks.push_back(c);
+	}
+
+	// Closest to the center first, so an interrupted run leaves a usable area
+	const v3s16 center = (cmin + cmax) / 2;
+	std::sort(chunks.begin(), chunks.end(), [&] (v3s16 a, v3s16 b) {
+		return a.getDistanceFromSQ(center) < b.getDistanceFromSQ(center);
+	});
+
+	actionstream << "Generating " << chunks.size() << " chunks between "
+		<< minp << " and " << maxp << std::endl;
+
+	// Keeping the queue short bounds memory use and the work lost on abort
+	constexpr u32 max_in_flight = 64;
+	const float unload_timeout =
+		std::max(g_settings->getFloat("server_unload_unused_data_timeout"), 0.0f);
+	constexpr float unload_interval = 2.92f;
+	constexpr float progress_interval = 10.0f;
+
+	volatile auto &kill = *porting::signal_handler_killstatus();
+	const u64 start_time = porting::getTimeMs();
+	u64 last_unload_time = start_time;
+	u64 last_update_time = 0;
+	u32 queued = 0;
+
+	emerge->startThreads();
+	while (!kill && progress.done < chunks.size()) {
+		while (queued < chunks.size() && queued - progress.done < max_in_flight) {
+			if (emerge->enqueueBlockEmergeEx(chunks[queued], PEER_ID_INEXISTENT,
+					BLOCK_EMERGE_ALLOW_GEN | BLOCK_EMERGE_FORCE_QUEUE,
+					pregen_chunk_done, &progress)) {
+				queued++;
+			} else {
+				// should not happen, but never hang on it
+				progress.done++;
+				progress.failed++;
+				queued++;
+			}
+		}
+
+		const u64 now = porting::getTimeMs();
+		{
+			EnvAutoLock envlock(&server);
+			emerge->processCompletedEmerges(&map);
+
+			// Save and unload what is not needed anymore
+			if (now - last_unload_time >= unload_interval * 1000) {
+				map.timerUpdate((now - last_unload_time) / 1000.0f,
+					unload_timeout, -1);
+				last_unload_time = now;
+			}
+		}
+		map.step();
+
+		if (now - last_update_time >= progress_interval * 1000) {
+			const float elapsed = std::max(now - start_time, (u64)1) / 1000.0f;
+			const float rate = progress.done / elapsed;
+			const std::string eta = rate > 0 ?
+				std::to_string((u32)((chunks.size() - progress.done) / rate)) + "s" : "?";
+			actionstream << "Generated " << progress.done << "/" << chunks.size()
+				<< " chunks, " << rate << " chunks/s, "
+				<< map.getBytesWritten() / (1024.0f * 1024.0f) << " MiB written, ETA "
+				<< eta << std::endl;
+			last_update_time = now;
+		}
+
+		sleep_ms(10);
+	}
+
+	// Finish up and write everything
+	emerge->stopThreads();
+	{
+		EnvAutoLock envlock(&server);
+		emerge->processCompletedEmerges(&map);
+		map.unloadUnreferencedBlocks();
+	}
+	map.flushSaves();
+
+	const float elapsed = std::max(porting::getTimeMs() - start_time, (u64)1) / 1000.0f;
+	actionstream << "Pregeneration " << (kill ? "aborted" : "finished")
+		<< " after " << elapsed << "s: " << progress.done << " chunks ("
+		<< progress.generated << " generated, " << progress.failed
+		<< " failed), " << (progress.done / elapsed) << " chunks/s, "
+		<< map.getBytesWritten() << " bytes written" << std::endl;
+
+	return !kill && progress.failed == 0;
+}
+
 u16 Server::getProtocolVersionMin()
 {
 	u16 min_proto = g_settings->getU16("protocol_version_min");
@@ -47,8 +47,10 @@ class ServerEnvironment;
 class ServerInventoryManager;
 class ServerModManager;
 class ServerScripting;
+class SerializedBlockCache;
 class ServerThread;
 class Settings;
+class WorkerPool;
 
 struct ChatEventChat;
 struct ChatInterface;
@@ -454,6 +456,12 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	static bool migrateModStorageDatabase(const GameParams &game_params,
 			const Settings &cmd_args);
 
+	// Generates an area of the map without starting the server (--pregen)
+	static bool pregenerateMap(const GameParams &game_params,
+			const Settings &cmd_args);
+	// Parses the area given to --pregen: a radius or two corners
+	static bool parsePregenArea(const std::string &value, v3s16 &minp, v3s16 &maxp);
+
 	static u16 getProtocolVersionMin();
 	static u16 getProtocolVersionMax();
 
@@ -524,8 +532,6 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		}
 	};
 
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
 	void init();
 
 	void SendMovement(session_t peer_id);
@@ -583,9 +589,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -617,6 +622,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao);
 	void SendActiveObjectMessages(session_t peer_id, const std::string &datas,
 		bool reliable = true);
+	void SendActiveObjectPositions(session_t peer_id, const std::string &datas,
+		bool reliable = true);
 	void SendCSMRestrictionFlags(session_t peer_id);
 
 	/*
@@ -731,6 +738,14 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// The server mainly operates in this thread
 	ServerThread *m_thread = nullptr;
 
+	// Compresses blocks for SendBlocks() outside of the envlock
+	std::unique_ptr<WorkerPool> m_block_send_pool;
+	// Serialized blocks shared between clients and server steps
+	std::unique_ptr<SerializedBlockCache> m_block_send_cache;
+	// Running average of block packet sizes, for the client send windows
+	float m_avg_block_packet_size = 2048.0f;
+	float m_send_window_timer = 0.0f;
+
 	/*
 	 	Client interface
 	*/
@@ -794,6 +809,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	u64 m_csm_restriction_flags = CSMRestrictionFlags::CSM_RF_NONE;
 	u32 m_csm_restriction_noderange = 8;
 
+	// Range and level of detail of active object messages
+	f32 m_active_object_send_range = 0.0f;
+	f32 m_active_object_lod_distance = 0.0f;
+	f32 m_active_object_lod_max_interval = 0.0f;
+
 	// ModChannel manager
 	std::unique_ptr<ModChannelMgr> m_modchannel_mgr;
 
@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2010-2018 nerzhul, Loic BLOT <loic.blot@unix-experience.fr>
 
+#include <algorithm>
+#include <iterator>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
@@ -10,6 +12,37 @@
 namespace server
 {
 
+// Newly occupied blocks remembered before ObjectsInRange has to be rebuilt
+static constexpr size_t CELL_JOURNAL_MAX = 4096;
+
+static inline v3s16 getObjectCell(v3f pos)
+{
+	return getNodeBlockPos(floatToInt(pos, BS));
+}
+
+static inline aabb3f getCellBox(v3s16 cell)
+{
+	v3f min = intToFloat(cell * MAP_BLOCKSIZE, BS) - v3f(BS / 2);
+	return aabb3f(min, min + v3f(MAP_BLOCKSIZE * BS));
+}
+
+enum CellRange { CELL_OUT, CELL_BOUNDARY, CELL_INNER };
+
+// Whether the points of b are in range of all, some or none of the points of a
+static CellRange getCellRange(const aabb3f &a, const aabb3f &b, f32 radius)
+{
+	v3f closest, farthest;
+	for (int i = 0; i < 3; i++) {
+		closest[i] = std::max({0.0f, a.MinEdge[i] - b.MaxEdge[i], b.MinEdge[i] - a.MaxEdge[i]});
+		farthest[i] = std::max(a.MaxEdge[i] - b.MinEdge[i], b.MaxEdge[i] - a.MinEdge[i]);
+	}
+	if (closest.getLengthSQ() > radius * radius)
+		return CELL_OUT;
+	if (farthest.getLengthSQ() <= radius * radius)
+		return CELL_INNER;
+	return CELL_BOUNDARY;
+}
+
 ActiveObjectMgr::~ActiveObjectMgr()
 {
 	if (!m_active_objects.empty()) {
@@ -34,13 +67,40 @@ void ActiveObjectMgr::clearIf(const std::function<bool(ServerActiveObject *, u16
 void ActiveObjectMgr::step(
 		float dtime, const std::function<void(ServerActiveObject *)> &f)
 {
-	size_t count = 0;
-
-	for (auto &ao_it : m_active_objects.iter()) {
+	// Objects are stepped block by block so that the collision queries of
+	// neighbouring objects hit the same parts of the map one after another.
+	// Attached objects come last, in id order, so that they see where their
+	// parents went in this step (#10985).
+	m_step_order.clear();
+	std::vector<u16> attached;
+	auto iter = m_active_objects.iter();
+	for (auto &ao_it : iter) {
 		if (!ao_it.second)
 			continue;
+		if (ao_it.second->getParent())
+			attached.push_back(ao_it.first);
+		else
+			m_step_order.emplace_back(
+				getNodeBlockPos(floatToInt(ao_it.second->getBasePosition(), BS)),
+				ao_it.first);
+	}
+	std::sort(m_step_order.begin(), m_step_order.end(),
+		[] (const std::pair<v3s16, u16> &a, const std::pair<v3s16, u16> &b) {
+			if (a.first != b.first)
+				return a.first < b.first;
+			return a.second < b.second;
+		});
+	for (u16 id : attached)
+		m_step_order.emplace_back(v3s16(), id);
+
+	size_t count = 0;
+	for (const auto &it : m_step_order) {
+		// May have been removed by one of the objects stepped before
+		ServerActiveObject *obj = m_active_objects.get(it.second).get();
+		if (!obj)
+			continue;
 		count++;
-		f(ao_it.second.get());
+		f(obj);
 	}
 
 	g_profiler->avg("ActiveObjectMgr: SAO count [#]", count);
@@ -77,6 +137,9 @@ bool ActiveObjectMgr::registerObject(std::unique_ptr<ServerActiveObject> obj)
 	}
 
 	auto obj_id = obj->getId();
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.push_back(obj_id);
+	setObjectCell(obj_id, obj.get(), getObjectCell(pos));
 	m_active_objects.put(obj_id, std::move(obj));
 	m_spatial_index.insert(pos.toArray(), obj_id);
 
@@ -103,7 +166,55 @@ void ActiveObjectMgr::removeObject(u16 id)
 				<< "id=" << id << " not found" << std::endl;
 	} else {
 		m_spatial_index.remove(id);
+		unsetObjectCell(id);
+		auto it = std::find(m_player_ids.begin(), m_player_ids.end(), id);
+		if (it != m_player_ids.end()) {
+			*it = m_player_ids.back();
+			m_player_ids.pop_back();
+		}
+	}
+}
+
+void ActiveObjectMgr::setObjectCell(u16 id, ServerActiveObject *obj, v3s16 cell)
+{
+	auto it = m_object_cells.find(id);
+	if (it != m_object_cells.end()) {
+		if (it->second == cell)
+			return;
+		unsetObjectCell(id);
+	}
+	m_object_cells[id] = cell;
+
+	auto &objects = m_cells[cell];
+	if (objects.empty()) {
+		if (m_cell_journal.size() >= CELL_JOURNAL_MAX) {
+			m_cell_journal_base += m_cell_journal.size();
+			m_cell_journal.clear();
+		}
+		m_cell_journal.push_back(cell);
+	}
+	objects.emplace_back(id, obj);
+}
+
+void ActiveObjectMgr::unsetObjectCell(u16 id)
+{
+	auto it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+	auto cell_it = m_cells.find(it->second);
+	m_object_cells.erase(it);
+	if (cell_it == m_cells.end())
+		return;
+
+	auto &objects = cell_it->second;
+	auto obj_it = std::find_if(objects.begin(), objects.end(),
+		[id] (const auto &it) { return it.first == id; });
+	if (obj_it != objects.end()) {
+		*obj_it = objects.back();
+		objects.pop_back();
 	}
+	if (objects.empty())
+		m_cells.erase(cell_it);
 }
 
 void ActiveObjectMgr::invalidateActiveObjectObserverCaches()
@@ -121,8 +232,10 @@ void ActiveObjectMgr::updateObjectPos(u16 id, v3f pos)
 	// HACK defensively only update if we already know the object,
 	// otherwise we're still waiting to be inserted into the index
 	// (or have already been removed).
-	if (m_active_objects.get(id))
+	if (auto &obj = m_active_objects.get(id)) {
 		m_spatial_index.update(pos.toArray(), id);
+		setObjectCell(id, obj.get(), getObjectCell(pos));
+	}
 }
 
 void ActiveObjectMgr::getObjectsInsideRadius(v3f pos, float radius,
@@ -155,49 +268,118 @@ void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 	});
 }
 
-void ActiveObjectMgr::getAddedActiveObjectsAroundPos(
+void ActiveObjectMgr::updateCellsInRange(v3f player_pos, f32 radius,
+		ObjectsInRange &state)
+{
+	const v3s16 center = getObjectCell(player_pos);
+	const u64 journal_end = m_cell_journal_base + m_cell_journal.size();
+
+	auto classify = [&] (v3s16 cell, const aabb3f &center_box) {
+		switch (getCellRange(center_box, getCellBox(cell), radius)) {
+		case CELL_INNER:
+			state.inner_cells.push_back(cell);
+			break;
+		case CELL_BOUNDARY:
+			state.boundary_cells.push_back(cell);
+			break;
+		default:
+			break;
+		}
+	};
+
+	if (center != state.center || radius != state.radius ||
+			state.journal_pos < m_cell_journal_base) {
+		// Moved to another block or missed part of the journal, start over
+		state.center = center;
+		state.radius = radius;
+		state.inner_cells.clear();
+		state.boundary_cells.clear();
+		const aabb3f center_box = getCellBox(center);
+		for (auto &it : m_cells)
+			classify(it.first, center_box);
+		state.journal_pos = journal_end;
+		return;
+	}
+
+	if (state.journal_pos == journal_end)
+		return;
+
+	// Blocks that emptied and filled up again would be listed twice
+	const aabb3f center_box = getCellBox(center);
+	for (size_t i = state.journal_pos - m_cell_journal_base; i < m_cell_journal.size(); i++)
+		classify(m_cell_journal[i], center_box);
+	state.journal_pos = journal_end;
+	for (auto *cells : {&state.inner_cells, &state.boundary_cells}) {
+		std::sort(cells->begin(), cells->end());
+		cells->erase(std::unique(cells->begin(), cells->end()), cells->end());
+	}
+}
+
+void ActiveObjectMgr::getActiveObjectsInRange(
 		v3f player_pos, const std::string &player_name,
 		f32 radius, f32 player_radius,
-		const std::set<u16> &current_objects,
-		std::vector<u16> &added_objects)
+		ObjectsInRange &state, std::vector<u16> &result)
 {
-	/*
-		Go through the object list,
-		- discard removed/deactivated objects,
-		- discard objects that are too far away,
-		- discard objects that are found in current_objects,
-		- discard objects that are not observed by the player.
-		- add remaining objects to added_objects
-	*/
-	for (auto &ao_it : m_active_objects.iter()) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second.get();
-		if (!object)
-			continue;
+	updateCellsInRange(player_pos, radius, state);
 
-		if (object->isGone())
-			continue;
+	const f32 radius_sq = radius * radius;
+	auto is_visible = [&] (ServerActiveObject *object) {
+		return object && !object->isGone() &&
+				object->isEffectivelyObservedBy(player_name);
+	};
 
-		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
-		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
-			// Discard if too far
-			if (distance_f > player_radius && player_radius != 0)
+	auto add_from_cells = [&] (std::vector<v3s16> &cells, bool check_distance) {
+		for (size_t i = 0; i < cells.size();) {
+			auto it = m_cells.find(cells[i]);
+			if (it == m_cells.end()) {
+				// Emptied, the journal brings it back once it is occupied again
+				cells[i] = cells.back();
+				cells.pop_back();
 				continue;
-		} else if (distance_f > radius)
-			continue;
+			}
+			for (auto [id, object] : it->second) {
+				if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+					continue;
+				if (check_distance &&
+						object->getBasePosition().getDistanceFromSQ(player_pos) > radius_sq)
+					continue;
+				if (is_visible(object))
+					result.push_back(id);
+			}
+			i++;
+		}
+	};
 
-		if (!object->isEffectivelyObservedBy(player_name))
-			continue;
+	add_from_cells(state.inner_cells, false);
+	add_from_cells(state.boundary_cells, true);
 
-		// Discard if already on current_objects
-		auto n = current_objects.find(id);
-		if (n != current_objects.end())
+	for (u16 id : m_player_ids) {
+		ServerActiveObject *object = m_active_objects.get(id).get();
+		if (!object)
 			continue;
-		// Add to added_objects
-		added_objects.push_back(id);
+		if (player_radius != 0 && object->getBasePosition()
+				.getDistanceFromSQ(player_pos) > player_radius * player_radius)
+			continue;
+		if (is_visible(object))
+			result.push_back(id);
 	}
+
+	std::sort(result.begin(), result.end());
+}
+
+void ActiveObjectMgr::getAddedActiveObjectsAroundPos(
+		v3f player_pos, const std::string &player_name,
+		f32 radius, f32 player_radius,
+		const std::vector<u16> &current_objects,
+		std::vector<u16> &added_objects)
+{
+	ObjectsInRange state;
+	std::vector<u16> in_range;
+	getActiveObjectsInRange(player_pos, player_name, radius, player_radius,
+			state, in_range);
+	std::set_difference(in_range.begin(), in_range.end(),
+			current_objects.begin(), current_objects.end(),
+			std::back_inserter(added_objects));
 }
 
 } // namespace server
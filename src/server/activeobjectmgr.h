@@ -5,14 +5,34 @@
 #pragma once
 
 #include <functional>
+#include <unordered_map>
 #include <vector>
-#include <set>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
 #include "util/k_d_tree.h"
 
 namespace server
 {
+
+/*
+	The mapblocks around a player that contain objects, as found by
+	ActiveObjectMgr::getActiveObjectsInRange(). Kept by the caller from one
+	call to the next so that only blocks which became occupied in between
+	have to be looked at again while the player stays in the same block.
+*/
+struct ObjectsInRange
+{
+	// Block the player was in and radius used when the lists were built
+	v3s16 center;
+	f32 radius = -1.0f;
+	// Position in the manager's journal of newly occupied blocks
+	u64 journal_pos = 0;
+	// Blocks that are in range from anywhere inside the center block
+	std::vector<v3s16> inner_cells;
+	// Blocks that are only partly in range, their objects are checked one by one
+	std::vector<v3s16> boundary_cells;
+};
+
 class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 {
 public:
@@ -35,13 +55,34 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 	void getObjectsInArea(const aabb3f &box,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
+	// Returns the ids of the objects a player at player_pos can see, sorted
+	void getActiveObjectsInRange(
+			v3f player_pos, const std::string &player_name,
+			f32 radius, f32 player_radius,
+			ObjectsInRange &state, std::vector<u16> &result);
+	// current_objects must be sorted
 	void getAddedActiveObjectsAroundPos(
 			v3f player_pos, const std::string &player_name,
 			f32 radius, f32 player_radius,
-			const std::set<u16> &current_objects,
+			const std::vector<u16> &current_objects,
 			std::vector<u16> &added_objects);
 
 private:
+	void setObjectCell(u16 id, ServerActiveObject *obj, v3s16 cell);
+	void unsetObjectCell(u16 id);
+	void updateCellsInRange(v3f player_pos, f32 radius, ObjectsInRange &state);
+
+	// Objects by the mapblock they are in; only occupied blocks are kept
+	std::unordered_map<v3s16, std::vector<std::pair<u16, ServerActiveObject *>>> m_cells;
+	std::unordered_map<u16, v3s16> m_object_cells;
+	// Blocks that became occupied, for updating ObjectsInRange incrementally
+	std::vector<v3s16> m_cell_journal;
+	u64 m_cell_journal_base = 0;
+	// Players are looked up separately, they have their own send range
+	std::vector<u16> m_player_ids;
+
 	k_d_tree::DynamicKdTrees<3, f32, u16> m_spatial_index;
+	// (block, id) of the objects in the order step() visits them
+	std::vector<std::pair<v3s16, u16>> m_step_order;
 };
 } // namespace server
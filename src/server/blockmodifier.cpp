@@ -10,6 +10,7 @@
 #include "mapblock.h"
 #include "nodedef.h"
 #include "gamedef.h"
+#include "noise.h"
 
 /*
 	ABMs
@@ -29,13 +30,42 @@ ABMWithState::ABMWithState(ActiveBlockModifier *abm_):
 struct ActiveABM
 {
 	ActiveBlockModifier *abm;
-	std::vector<content_t> required_neighbors;
-	std::vector<content_t> without_neighbors;
+	// nullptr = do not check
+	const std::vector<bool> *required_neighbors;
+	const std::vector<bool> *without_neighbors;
 	int chance;
 	s16 min_y, max_y;
 };
 
-#define CONTENT_TYPE_CACHE_MAX 64
+static inline bool has_content(const std::vector<bool> &set, content_t c)
+{
+	return c < set.size() && set[c];
+}
+
+static void resolve_ids(ABMWithState &abmws, const NodeDefManager *ndef)
+{
+	ActiveBlockModifier *abm = abmws.abm;
+
+	std::vector<content_t> ids;
+	auto to_set = [&] (const std::vector<std::string> &names, std::vector<bool> &dst) {
+		ids.clear();
+		for (const auto &s : names)
+			ndef->getIds(s, ids);
+		for (content_t c : ids) {
+			if (c >= dst.size())
+				dst.resize(c + 1, false);
+			dst[c] = true;
+		}
+	};
+	to_set(abm->getRequiredNeighbors(), abmws.required_neighbors);
+	to_set(abm->getWithoutNeighbors(), abmws.without_neighbors);
+
+	for (const auto &s : abm->getTriggerContents())
+		ndef->getIds(s, abmws.trigger_ids);
+	SORT_AND_UNIQUE(abmws.trigger_ids);
+
+	abmws.ids_resolved = true;
+}
 
 ABMHandler::ABMHandler(std::vector<ABMWithState> &abms,
 	float dtime_s, ServerEnvironment *env,
@@ -46,6 +76,14 @@ ABMHandler::ABMHandler(std::vector<ABMWithState> &abms,
 		return;
 	const NodeDefManager *ndef = env->getGameDef()->ndef();
 	for (ABMWithState &abmws : abms) {
+		if (!abmws.ids_resolved)
+			resolve_ids(abmws, ndef);
+		for (content_t c : abmws.trigger_ids) {
+			if (c >= m_indexed.size())
+				m_indexed.resize(c + 1, false);
+			m_indexed[c] = true;
+		}
+
 		ActiveBlockModifier *abm = abmws.abm;
 		float trigger_interval = abm->getTriggerInterval();
 		if (trigger_interval < 0.001f)
@@ -79,20 +117,13 @@ ABMHandler::ABMHandler(std::vector<ABMWithState> &abms,
 		aabm.max_y = abm->getMaxY();
 
 		// Trigger neighbors
-		for (const auto &s : abm->getRequiredNeighbors())
-			ndef->getIds(s, aabm.required_neighbors);
-		SORT_AND_UNIQUE(aabm.required_neighbors);
-
-		for (const auto &s : abm->getWithoutNeighbors())
-			ndef->getIds(s, aabm.without_neighbors);
-		SORT_AND_UNIQUE(aabm.without_neighbors);
+		aabm.required_neighbors = abmws.required_neighbors.empty() ?
+			nullptr : &abmws.required_neighbors;
+		aabm.without_neighbors = abmws.without_neighbors.empty() ?
+			nullptr : &abmws.without_neighbors;
 
 		// Trigger contents
-		std::vector<content_t> ids;
-		for (const auto &s : abm->getTriggerContents())
-			ndef->getIds(s, ids);
-		SORT_AND_UNIQUE(ids);
-		for (content_t c : ids) {
+		for (content_t c : abmws.trigger_ids) {
 			if (c >= m_aabms.size())
 				m_aabms.resize(c + 256, nullptr);
 			if (!m_aabms[c])
@@ -131,132 +162,203 @@ u32 ABMHandler::countObjects(MapBlock *block, ServerMap *map, u32 &wider)
 	return active_object_count;
 }
 
-void ABMHandler::apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+void ABMHandler::indexBlock(MapBlock *block, const std::vector<bool> &contents)
 {
-	if (m_aabms.empty())
-		return;
+	auto &index = block->abm_index;
+	index.contents.clear();
+	index.nodes.clear();
 
-	// Check the content type cache first
-	// to see whether there are any ABMs
-	// to be run at all for this block.
-	if (!block->contents.empty()) {
-		assert(!block->do_not_cache_contents); // invariant
-		blocks_cached++;
-		bool run_abms = false;
-		for (content_t c : block->contents) {
-			if (c < m_aabms.size() && m_aabms[c]) {
-				run_abms = true;
-				break;
-			}
-		}
-		if (!run_abms)
-			return;
-	}
-	blocks_scanned++;
+	thread_local std::vector<std::pair<content_t, u16>> found;
+	found.clear();
 
-	ServerMap *map = &m_env->getServerMap();
+	v3s16 p0;
+	u16 i = 0;
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++, i++) {
+		content_t c = block->getNodeNoCheck(p0).getContent();
+		if (has_content(contents, c))
+			found.emplace_back(c, i);
+	}
 
-	u32 active_object_count_wider;
-	u32 active_object_count = countObjects(block, map, active_object_count_wider);
-	m_env->m_added_objects = 0;
+	// Sorts by content, nodes stay in the order of the data
+	std::sort(found.begin(), found.end());
+	index.nodes.reserve(found.size());
+	for (auto &it : found) {
+		if (index.contents.empty() || index.contents.back().first != it.first)
+			index.contents.emplace_back(it.first, index.nodes.size());
+		index.nodes.push_back(it.second);
+	}
+	index.valid = true;
+}
 
-	bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
+struct NearBlocks
+{
+	MapBlock *blocks[27];
+	bool fetched[27] = {};
+};
 
-	v3s16 p0;
-	for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-	for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-	for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-	{
-		MapNode n = block->getNodeNoCheck(p0);
-		content_t c = n.getContent();
-
-		// Cache content types as we go
-		if (want_contents_cached && !CONTAINS(block->contents, c)) {
-			if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
-				// Too many different nodes... don't try to cache
-				want_contents_cached = false;
-				block->do_not_cache_contents = true;
-				decltype(block->contents) empty;
-				std::swap(block->contents, empty);
-			} else {
-				block->contents.push_back(c);
-			}
+// Reads the contents of the 3x3x3 nodes around p0 (relative to the block)
+static void read_near_contents(const Map *map, MapBlock *block,
+	NearBlocks &near_blocks, v3s16 p0, content_t near_contents[27])
+{
+	const v3s16 block_pos = block->getPos();
+	u32 k = 0;
+	v3s16 p1;
+	for (p1.Z = p0.Z - 1; p1.Z <= p0.Z + 1; p1.Z++)
+	for (p1.Y = p0.Y - 1; p1.Y <= p0.Y + 1; p1.Y++)
+	for (p1.X = p0.X - 1; p1.X <= p0.X + 1; p1.X++, k++) {
+		if (block->isValidPosition(p1)) {
+			near_contents[k] = block->getNodeNoCheck(p1).getContent();
+			continue;
+		}
+		v3s16 bp = getContainerPos(p1, MAP_BLOCKSIZE);
+		u32 b = (bp.Z + 1) * 9 + (bp.Y + 1) * 3 + (bp.X + 1);
+		if (!near_blocks.fetched[b]) {
+			near_blocks.blocks[b] = map->findBlock(block_pos + bp);
+			near_blocks.fetched[b] = true;
 		}
+		near_contents[k] = near_blocks.blocks[b] ?
+			near_blocks.blocks[b]->getNodeNoCheck(p1 - bp * MAP_BLOCKSIZE).getContent() :
+			CONTENT_IGNORE;
+	}
+}
 
-		if (c >= m_aabms.size() || !m_aabms[c])
+static bool check_neighbors(const ActiveABM &aabm, const content_t near_contents[27])
+{
+	bool have_required = !aabm.required_neighbors;
+	for (u32 k = 0; k < 27; k++) {
+		if (k == 13) // the node itself
 			continue;
+		content_t c = near_contents[k];
+		if (aabm.without_neighbors && has_content(*aabm.without_neighbors, c))
+			return false;
+		if (!have_required && has_content(*aabm.required_neighbors, c)) {
+			if (!aabm.without_neighbors)
+				return true;
+			have_required = true;
+		}
+	}
+	return have_required;
+}
 
-		v3s16 p = p0 + block->getPosRelative();
-		for (ActiveABM &aabm : *m_aabms[c]) {
-			if (p.Y < aabm.min_y || p.Y > aabm.max_y)
-				continue;
+bool ABMHandler::findTriggers(MapBlock *block, u64 seed,
+	std::vector<ABMTrigger> &dst, bool &cached) const
+{
+	if (m_aabms.empty())
+		return false;
+
+	auto &index = block->abm_index;
+	cached = index.valid;
+	if (!index.valid)
+		indexBlock(block, m_indexed);
+
+	// Check whether there are any ABMs to be run at all for this block
+	bool run_abms = false;
+	for (auto &it : index.contents) {
+		if (it.first < m_aabms.size() && m_aabms[it.first]) {
+			run_abms = true;
+			break;
+		}
+	}
+	if (!run_abms)
+		return false;
 
-			if (myrand() % aabm.chance != 0)
-				continue;
+	const Map *map = &m_env->getServerMap();
+	PcgRandom rand(seed);
 
-			// Check neighbors
-			const bool check_required_neighbors = !aabm.required_neighbors.empty();
-			const bool check_without_neighbors = !aabm.without_neighbors.empty();
-			if (check_required_neighbors || check_without_neighbors) {
-				v3s16 p1;
-				bool have_required = false;
-				for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-				for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-				for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-				{
-					if (p1 == p0)
-						continue;
-					content_t c;
-					if (block->isValidPosition(p1)) {
-						// if the neighbor is found on the same map block
-						// get it straight from there
-						const MapNode &n = block->getNodeNoCheck(p1);
-						c = n.getContent();
-					} else {
-						// otherwise consult the map
-						MapNode n = map->getNode(p1 + block->getPosRelative());
-						c = n.getContent();
-					}
-					if (check_required_neighbors && !have_required) {
-						if (CONTAINS(aabm.required_neighbors, c)) {
-							if (!check_without_neighbors)
-								goto neighbor_found;
-							have_required = true;
-						}
-					}
-					if (check_without_neighbors) {
-						if (CONTAINS(aabm.without_neighbors, c))
-							goto neighbor_invalid;
+	// The blocks around this one, looked up when a neighbor check first
+	// needs them
+	NearBlocks near_blocks;
+
+	// Contents of the 3x3x3 nodes around the current node, read once for
+	// all ABMs that check neighbors
+	content_t near_contents[27];
+
+	for (size_t i = 0; i < index.contents.size(); i++) {
+		const content_t c = index.contents[i].first;
+		if (c >= m_aabms.size() || !m_aabms[c])
+			continue;
+		const size_t end = i + 1 < index.contents.size() ?
+			index.contents[i + 1].second : index.nodes.size();
+
+		for (size_t j = index.contents[i].second; j < end; j++) {
+			const u16 node_index = index.nodes[j];
+			const v3s16 p0(node_index % MAP_BLOCKSIZE,
+				(node_index / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+				node_index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+			const MapNode n = block->getNodeNoCheck(p0);
+			const s16 y = p0.Y + block->getPosRelative().Y;
+
+			bool have_near_contents = false;
+			for (const ActiveABM &aabm : *m_aabms[c]) {
+				if (y < aabm.min_y || y > aabm.max_y)
+					continue;
+
+				if (rand.next() % aabm.chance != 0)
+					continue;
+
+				// Check neighbors
+				if (aabm.required_neighbors || aabm.without_neighbors) {
+					if (!have_near_contents) {
+						read_near_contents(map, block, near_blocks, p0,
+							near_contents);
+						have_near_contents = true;
 					}
+					if (!check_neighbors(aabm, near_contents))
+						continue;
 				}
-				if (have_required || !check_required_neighbors)
-					goto neighbor_found;
-				// No required neighbor found
-neighbor_invalid:
-				continue;
+
+				dst.push_back(ABMTrigger{&aabm, p0, n});
 			}
+		}
+	}
+	return true;
+}
+
+void ABMHandler::runTriggers(MapBlock *block, const std::vector<ABMTrigger> &triggers,
+	int &abms_run)
+{
+	if (triggers.empty())
+		return;
 
-neighbor_found:
+	ServerMap *map = &m_env->getServerMap();
 
-			abms_run++;
-			// Call all the trigger variations
-			aabm.abm->trigger(m_env, p, n);
-			aabm.abm->trigger(m_env, p, n,
-				active_object_count, active_object_count_wider);
+	u32 active_object_count_wider;
+	u32 active_object_count = countObjects(block, map, active_object_count_wider);
+	m_env->m_added_objects = 0;
 
-			if (block->isOrphan())
-				return;
+	for (const ABMTrigger &trigger : triggers) {
+		// An earlier trigger may have changed it or its neighbors
+		MapNode n = block->getNodeNoCheck(trigger.p0);
+		if (n.getContent() != trigger.n.getContent())
+			continue;
+		const ActiveABM &aabm = *trigger.aabm;
+		if (aabm.required_neighbors || aabm.without_neighbors) {
+			// Blocks may have been loaded or unloaded by the callbacks
+			NearBlocks near_blocks;
+			content_t near_contents[27];
+			read_near_contents(map, block, near_blocks, trigger.p0, near_contents);
+			if (!check_neighbors(aabm, near_contents))
+				continue;
+		}
 
-			// Count surrounding objects again if the abms added any
-			if (m_env->m_added_objects > 0) {
-				active_object_count = countObjects(block, map, active_object_count_wider);
-				m_env->m_added_objects = 0;
-			}
+		v3s16 p = trigger.p0 + block->getPosRelative();
+		ActiveBlockModifier *abm = aabm.abm;
 
-			// Update and check node after possible modification
-			n = block->getNodeNoCheck(p0);
-			if (n.getContent() != c)
-				break;
+		abms_run++;
+		// Call all the trigger variations
+		abm->trigger(m_env, p, n);
+		abm->trigger(m_env, p, n,
+			active_object_count, active_object_count_wider);
+
+		if (block->isOrphan())
+			return;
+
+		// Count surrounding objects again if the abms added any
+		if (m_env->m_added_objects > 0) {
+			active_object_count = countObjects(block, map, active_object_count_wider);
+			m_env->m_added_objects = 0;
 		}
 	}
 }
@@ -395,10 +497,44 @@ void LBMManager::loadIntroductionTimes(const std::string &times,
 	if (lbms_running_always.empty())
 		m_lbm_lookup.erase(U32_MAX);
 
+	buildTimeRanges();
+
 	infostream << "LBMManager: " << m_lbm_lookup.size() <<
 		" unique times in lookup table" << std::endl;
 }
 
+void LBMManager::buildTimeRanges()
+{
+	m_lbm_ranges.clear();
+	m_lbm_ranges.reserve(m_lbm_lookup.size());
+
+	// A block also gets the LBMs of all later ranges, so go backwards
+	// and prepend the LBMs introduced at each time
+	for (auto it = m_lbm_lookup.rbegin(); it != m_lbm_lookup.rend(); ++it) {
+		LBMTimeRange range;
+		range.time = it->first;
+		if (!m_lbm_ranges.empty())
+			range.lbms = m_lbm_ranges.back().lbms;
+		for (auto &[c, lbms] : it->second.getMap()) {
+			if (c >= range.lbms.size())
+				range.lbms.resize(c + 1);
+			auto &dst = range.lbms[c];
+			dst.insert(dst.begin(), lbms.begin(), lbms.end());
+		}
+		m_lbm_ranges.push_back(std::move(range));
+	}
+	std::reverse(m_lbm_ranges.begin(), m_lbm_ranges.end());
+}
+
+const LBMManager::LBMTimeRange *LBMManager::getLBMsIntroducedAfter(u32 time) const
+{
+	auto it = std::lower_bound(m_lbm_ranges.begin(), m_lbm_ranges.end(), time,
+		[] (const LBMTimeRange &range, u32 time) {
+			return range.time < time;
+		});
+	return it == m_lbm_ranges.end() ? nullptr : &*it;
+}
+
 std::string LBMManager::createIntroductionTimesString()
 {
 	// Precondition, we must be in query mode
@@ -449,81 +585,73 @@ std::unordered_map<std::string, u32>
 
 namespace {
 	struct LBMToRun {
+		content_t c;
+		const LBMContentMapping::lbm_vector *l; // ordered list of LBMs
 		std::unordered_set<v3s16> p; // node positions
-		std::vector<LoadingBlockModifierDef*> l; // ordered list of LBMs
-
-		template <typename C>
-		void insertLBMs(const C &container) {
-			for (auto &it : container) {
-				if (!CONTAINS(l, it))
-					l.push_back(it);
-			}
-		}
 	};
 }
 
 void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 		const u32 stamp, const float dtime_s)
 {
-	// Precondition, we need m_lbm_lookup to be initialized
+	// Precondition, we need m_lbm_ranges to be initialized
 	FATAL_ERROR_IF(!m_query_mode,
 		"attempted to query on non fully set up LBMManager");
 
-	// Collect a list of all LBMs and associated positions
-	std::unordered_map<content_t, LBMToRun> to_run;
-
-	// Note: the iteration count of this outer loop is typically very low, so it's ok.
-	for (auto it = getLBMsIntroducedAfter(stamp); it != m_lbm_lookup.end(); ++it) {
-		v3s16 pos;
-		content_t c;
-
-		// Cache previous lookups since it has a high performance penalty.
-		content_t previous_c = CONTENT_IGNORE;
-		const LBMContentMapping::lbm_vector *lbm_list = nullptr;
-		LBMToRun *batch = nullptr;
-
-		for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++)
-		for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
-		for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++) {
-			c = block->getNodeNoCheck(pos).getContent();
-
-			bool c_changed = false;
-			if (previous_c != c) {
-				c_changed = true;
-				lbm_list = it->second.lookup(c);
-				if (lbm_list)
-					batch = &to_run[c]; // creates entry
-				previous_c = c;
-			}
+	const LBMTimeRange *range = getLBMsIntroducedAfter(stamp);
+	if (!range)
+		return;
+	const auto &lbms = range->lbms;
+
+	// Look at the contents of the block first, which is usually cached
+	// since loading it, and skip scanning the nodes if none has LBMs
+	std::vector<LBMToRun> to_run;
+	for (content_t c : block->getContents()) {
+		if (c < lbms.size() && !lbms[c].empty())
+			to_run.push_back(LBMToRun{c, &lbms[c], {}});
+	}
+	if (to_run.empty())
+		return;
 
-			if (!lbm_list)
-				continue;
-			batch->p.insert(pos);
-			if (c_changed) {
-				batch->insertLBMs(*lbm_list);
-			} else {
-				// we were here before so the list must be filled
-				assert(!batch->l.empty());
-			}
+	// Collect the positions in a single pass over the nodes
+	auto find_batch = [&] (content_t c) -> LBMToRun * {
+		for (auto &batch : to_run) {
+			if (batch.c == c)
+				return &batch;
 		}
+		return nullptr;
+	};
+	content_t previous_c = block->getNodeNoCheck(0, 0, 0).getContent();
+	LBMToRun *batch = find_batch(previous_c);
+	v3s16 pos;
+	for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++)
+	for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
+	for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++) {
+		const content_t c = block->getNodeNoCheck(pos).getContent();
+		if (c != previous_c) {
+			previous_c = c;
+			batch = find_batch(c);
+		}
+		if (batch)
+			batch->p.insert(pos);
 	}
 
 	// Actually run them
 	bool first = true;
-	for (auto &[c, batch] : to_run) {
+	for (auto &batch : to_run) {
 		if (tracestream) {
-			tracestream << "Running " << batch.l.size() << " LBMs for node "
-				<< env->getGameDef()->ndef()->get(c).name << " ("
+			tracestream << "Running " << batch.l->size() << " LBMs for node "
+				<< env->getGameDef()->ndef()->get(batch.c).name << " ("
 				<< batch.p.size() << "x) in block " << block->getPos() << std::endl;
 		}
-		for (auto &lbm_def : batch.l) {
+		for (auto &lbm_def : *batch.l) {
 			if (!first) {
 				// The fun part: since any LBM call can change the nodes inside of he
 				// block, we have to recheck the positions to see if the wanted node
 				// is still there.
 				// Note that we don't rescan the whole block, we don't want to include new changes.
 				for (auto it2 = batch.p.begin(); it2 != batch.p.end(); ) {
-					if (block->getNodeNoCheck(*it2).getContent() != c)
+					if (block->getNodeNoCheck(*it2).getContent() != batch.c)
 						it2 = batch.p.erase(it2);
 					else
 						++it2;
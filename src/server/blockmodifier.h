@@ -57,16 +57,34 @@ struct ABMWithState
 	ActiveBlockModifier *abm;
 	float timer = 0.0f;
 
+	// Content ids of the node names, resolved by ABMHandler on first use
+	bool ids_resolved = false;
+	std::vector<content_t> trigger_ids;
+	// Indexed by content id, empty = do not check
+	std::vector<bool> required_neighbors;
+	std::vector<bool> without_neighbors;
+
 	ABMWithState(ActiveBlockModifier *abm_);
 };
 
 struct ActiveABM; // hidden
 
+// An ABM due to be triggered on a node
+struct ABMTrigger
+{
+	const ActiveABM *aabm;
+	// relative to the block
+	v3s16 p0;
+	MapNode n;
+};
+
 class ABMHandler
 {
 	ServerEnvironment *m_env;
 	// vector index = content_t
 	std::vector<std::vector<ActiveABM>*> m_aabms;
+	// Contents any ABM triggers on, whether it runs this time or not
+	std::vector<bool> m_indexed;
 
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
@@ -80,7 +98,25 @@ class ABMHandler
 	// may be an estimate if any neighbors are unloaded.
 	static u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider);
 
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached);
+	// (Re)builds MapBlock::abm_index for the given contents
+	static void indexBlock(MapBlock *block, const std::vector<bool> &contents);
+
+	/**
+	 * Finds the nodes of a block that ABMs are to be triggered on, rolling
+	 * the chances and checking the neighbors.
+	 * This only reads the map (and the index of this block), so it may run
+	 * for different blocks in parallel as long as the map is not modified.
+	 * @param seed for the chance rolls
+	 * @param cached set to whether the index of the block was still valid
+	 * @return false if there are no ABMs due for the contents of the block
+	 */
+	bool findTriggers(MapBlock *block, u64 seed, std::vector<ABMTrigger> &dst,
+		bool &cached) const;
+
+	/// Runs the triggers found for a block, skipping nodes that changed since
+	/// or whose neighbors no longer match.
+	void runTriggers(MapBlock *block, const std::vector<ABMTrigger> &triggers,
+		int &abms_run);
 };
 
 /*
@@ -117,6 +153,7 @@ class LBMContentMapping
 	void addLBM(LoadingBlockModifierDef *lbm_def, IGameDef *gamedef);
 	const lbm_map::mapped_type *lookup(content_t c) const;
 	const lbm_vector &getList() const { return lbm_list; }
+	const lbm_map &getMap() const { return map; }
 	bool empty() const { return lbm_list.empty(); }
 
 	// This struct owns the LBM pointers.
@@ -165,13 +202,25 @@ class LBMManager
 	// The key of the map is the LBM def's first introduction time.
 	lbm_lookup_map m_lbm_lookup;
 
+	// The LBMs to run on a block, precompiled from m_lbm_lookup for each
+	// range of block timestamps
+	struct LBMTimeRange {
+		// Applies to blocks with timestamps in (previous time, time]
+		u32 time;
+		// Indexed by content, empty = none.
+		// Ordered by introduction time, like m_lbm_lookup.
+		std::vector<LBMContentMapping::lbm_vector> lbms;
+	};
+	// Sorted by time
+	std::vector<LBMTimeRange> m_lbm_ranges;
+
+	void buildTimeRanges();
+
 	/// @return map of LBM name -> timestamp
 	static std::unordered_map<std::string, u32>
 	parseIntroductionTimesString(const std::string &times);
 
-	// Returns an iterator to the LBMs that were introduced
-	// after the given time. This is guaranteed to return
-	// valid values for everything
-	lbm_lookup_map::const_iterator getLBMsIntroducedAfter(u32 time)
-	{ return m_lbm_lookup.lower_bound(time); }
+	// Returns the LBMs introduced at or after the given time,
+	// or nullptr if there are none
+	const LBMTimeRange *getLBMsIntroducedAfter(u32 time) const;
 };
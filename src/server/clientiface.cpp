@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2010-2014 celeron55, Perttu Ahola <celeron55@gmail.com>
 
+#include <cfloat>
 #include <sstream>
 #include "clientiface.h"
 #include "debug.h"
@@ -68,6 +69,7 @@ RemoteClient::RemoteClient() :
 	m_occ_cull(g_settings->getBool("server_side_occlusion_culling")),
 	m_connection_time(porting::getTimeS())
 {
+	m_send_window = m_max_simul_sends;
 }
 
 void RemoteClient::ResendBlockIfOnWire(v3s16 p)
@@ -87,11 +89,17 @@ static LuaEntitySAO *getAttachedObject(PlayerSAO *sao, ServerEnvironment *env)
 	return ao == sao ? nullptr : dynamic_cast<LuaEntitySAO*>(ao);
 }
 
+// Puts the lowest priority value on top of a heap
+static bool send_queue_cmp(const PrioritySortedBlockTransfer &a,
+		const PrioritySortedBlockTransfer &b)
+{
+	return b < a;
+}
+
 void RemoteClient::GetNextBlocks (
 		ServerEnvironment *env,
 		EmergeManager * emerge,
-		float dtime,
-		std::vector<PrioritySortedBlockTransfer> &dest)
+		float dtime)
 {
 	// Increment timers
 	m_nothing_to_send_pause_timer -= dtime;
@@ -104,7 +112,7 @@ void RemoteClient::GetNextBlocks (
 				<< "s), restarting to avoid visible blocks being unloaded."
 				<< std::endl;
 		m_map_send_completion_timer = 0.0f;
-		m_nearest_unsent_d = 0;
+		restartBlockSearch();
 	}
 
 	if (m_nothing_to_send_pause_timer >= 0)
@@ -120,10 +128,14 @@ void RemoteClient::GetNextBlocks (
 		return;
 
 	// Won't send anything if already sending
-	if (m_blocks_sending.size() >= m_max_simul_sends) {
+	if (m_blocks_sending.size() >= m_send_window) {
 		//infostream<<"Not sending any blocks, Queue full."<<std::endl;
+		m_send_window_full = true;
 		return;
 	}
+	// Nor look for more if enough is waiting to be sent
+	if (m_blocks_sending.size() + m_send_queue.size() >= m_send_window)
+		return;
 
 	v3f playerpos = sao->getBasePosition();
 	// if the player is attached, get the velocity from the attached object
@@ -148,7 +160,7 @@ void RemoteClient::GetNextBlocks (
 	if (sao->getCameraInverted())
 		camera_dir = -camera_dir;
 
-	u16 max_simul_sends_usually = m_max_simul_sends;
+	u16 max_simul_sends_usually = m_send_window;
 
 	/*
 		Decrease send rate if player is building stuff.
@@ -165,14 +177,13 @@ void RemoteClient::GetNextBlocks (
 	/*
 		Number of blocks sending + number of blocks selected for sending
 	*/
-	u32 num_blocks_selected = m_blocks_sending.size();
+	u32 num_blocks_selected = m_blocks_sending.size() + m_send_queue.size();
 
 	/*
-		next time d will be continued from the d from which the nearest
-		unsent block was found this time.
+		next time d will be continued from where the search stopped this
+		time, or from the nearest block that had to be emerged first.
 
-		This is because not necessarily any of the blocks found this
-		time are actually sent.
+		The blocks found but not sent yet stay in the send queue.
 	*/
 	s32 new_nearest_unsent_d = -1;
 
@@ -189,14 +200,14 @@ void RemoteClient::GetNextBlocks (
 		Get the starting value of the block finder radius.
 	*/
 	if (m_last_center != center) {
-		m_nearest_unsent_d = 0;
+		restartBlockSearch();
 		m_last_center = center;
 		m_map_send_completion_timer = 0.0f;
 	}
 	// reset the unsent distance if the view angle has changed more that 10% of the fov
 	// (this matches isBlockInSight which allows for an extra 10%)
 	if (camera_dir.dotProduct(m_last_camera_dir) < std::cos(camera_fov * 0.1f)) {
-		m_nearest_unsent_d = 0;
+		restartBlockSearch();
 		m_last_camera_dir = camera_dir;
 		m_map_send_completion_timer = 0.0f;
 	}
@@ -244,7 +255,6 @@ void RemoteClient::GetNextBlocks (
 	}
 
 	s32 nearest_emerged_d = -1;
-	s32 nearest_sent_d = -1;
 	//bool queue_is_full = false;
 
 	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
@@ -271,7 +281,7 @@ void RemoteClient::GetNextBlocks (
 			u16 max_simul_dynamic = max_simul_sends_usually;
 			// If block is very close, allow full maximum
 			if (d <= BLOCK_ALWAYS_SEND_MAX_D)
-				max_simul_dynamic = m_max_simul_sends;
+				max_simul_dynamic = m_send_window;
 
 			/*
 				Do not go over max mapgen limit
@@ -315,7 +325,9 @@ void RemoteClient::GetNextBlocks (
 			}
 
 			// Don't send blocks that are currently being transferred
-			if (m_blocks_sending.find(p) != m_blocks_sending.end())
+			// or waiting for it
+			if (m_blocks_sending.find(p) != m_blocks_sending.end() ||
+					m_blocks_queued.find(p) != m_blocks_queued.end())
 				continue;
 
 			/*
@@ -366,19 +378,16 @@ void RemoteClient::GetNextBlocks (
 			if (want_emerge) {
 				if (nearest_emerged_d == -1)
 					nearest_emerged_d = d;
-				if (emerge->enqueueBlockEmerge(peer_id, p, generate))
+				if (emerge->enqueueBlockEmerge(peer_id, p, generate, false, d))
 					continue;
 				else
 					goto queue_full_break;
 			}
 
-			if (nearest_sent_d == -1)
-				nearest_sent_d = d;
-
 			/*
 				Add block to send queue
 			*/
-			dest.emplace_back((float)dist, p, peer_id);
+			queueBlock(dist, p);
 
 			num_blocks_selected += 1;
 		}
@@ -398,10 +407,7 @@ void RemoteClient::GetNextBlocks (
 				<< m_map_send_completion_timer << "s, restarting" << std::endl;
 			m_map_send_completion_timer = 0.0f;
 		} else {
-			if (nearest_sent_d != -1)
-				new_nearest_unsent_d = nearest_sent_d;
-			else
-				new_nearest_unsent_d = d;
+			new_nearest_unsent_d = d;
 		}
 	}
 
@@ -412,6 +418,68 @@ void RemoteClient::GetNextBlocks (
 	}
 }
 
+const PrioritySortedBlockTransfer *RemoteClient::peekQueuedBlock()
+{
+	// Blocks sent by other means in the meantime are dropped
+	while (!m_send_queue.empty()) {
+		const v3s16 p = m_send_queue.front().pos;
+		if (m_blocks_sending.find(p) == m_blocks_sending.end() &&
+				m_blocks_sent.find(p) == m_blocks_sent.end())
+			return &m_send_queue.front();
+		popQueuedBlock();
+	}
+	return nullptr;
+}
+
+void RemoteClient::queueBlock(float priority, v3s16 p)
+{
+	m_send_queue.emplace_back(priority, p, peer_id);
+	std::push_heap(m_send_queue.begin(), m_send_queue.end(), send_queue_cmp);
+	m_blocks_queued.insert(p);
+}
+
+void RemoteClient::popQueuedBlock(bool retry)
+{
+	std::pop_heap(m_send_queue.begin(), m_send_queue.end(), send_queue_cmp);
+	const v3s16 p = m_send_queue.back().pos;
+	m_blocks_queued.erase(p);
+	m_send_queue.pop_back();
+	if (retry)
+		rewindBlockSearch(p);
+}
+
+void RemoteClient::restartBlockSearch()
+{
+	m_nearest_unsent_d = 0;
+	m_send_queue.clear();
+	m_blocks_queued.clear();
+}
+
+void RemoteClient::updateSendWindow(float rate, float min_rtt, float block_size)
+{
+	// Nothing measured yet
+	if (rate <= 0 || min_rtt <= 0 || min_rtt >= FLT_MAX || block_size <= 0)
+		return;
+
+	// If the window was not the limit the rate only tells how much there
+	// was to send, so keep it as it is
+	if (!m_send_window_full)
+		return;
+	m_send_window_full = false;
+
+	/*
+		Keep twice the bandwidth-delay product on the wire: Once the link is
+		saturated this keeps it busy without piling up packets in the
+		connection, while below that the window doubles with every new
+		measurement. The minimum RTT is used since queueing inflates the
+		current one.
+	*/
+	const float bdp = rate * min_rtt / block_size;
+	const u32 max_window = (u32)m_max_simul_sends * BLOCK_SEND_WINDOW_MAX_FACTOR;
+	m_send_window = (u16)rangelim(std::ceil(2 * bdp), BLOCK_SEND_WINDOW_MIN,
+		std::min<u32>(max_window, U16_MAX));
+}
+
 void RemoteClient::GotBlock(v3s16 p)
 {
 	if (m_blocks_sending.erase(p) > 0) {
@@ -428,6 +496,8 @@ void RemoteClient::SentBlock(v3s16 p)
 	if (!m_blocks_sending.insert(p).second)
 		infostream<<"RemoteClient::SentBlock(): Sent block"
 				" already in m_blocks_sending"<<std::endl;
+	if (m_blocks_sending.size() >= m_send_window)
+		m_send_window_full = true;
 }
 
 void RemoteClient::SetBlockNotSent(v3s16 p)
@@ -436,18 +506,22 @@ void RemoteClient::SetBlockNotSent(v3s16 p)
 
 	// remove the block from sending and sent sets,
 	// and reset the scan loop if found
-	if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0) {
-		// Note that we do NOT use the euclidean distance here.
-		// getNextBlocks builds successive cube-surfaces in the send loop.
-		// This resets the distance to the maximum cube size that
-		// still guarantees that this block will be scanned again right away.
-		//
-		// Using m_last_center is OK, as a change in center
-		// will reset m_nearest_unsent_d to 0 anyway (see getNextBlocks).
-		p -= m_last_center;
-		s16 this_d = std::max({std::abs(p.X), std::abs(p.Y), std::abs(p.Z)});
-		m_nearest_unsent_d = std::min(m_nearest_unsent_d, this_d);
-	}
+	if (m_blocks_sending.erase(p) + m_blocks_sent.erase(p) > 0)
+		rewindBlockSearch(p);
+}
+
+void RemoteClient::rewindBlockSearch(v3s16 p)
+{
+	// Note that we do NOT use the euclidean distance here.
+	// getNextBlocks builds successive cube-surfaces in the send loop.
+	// This resets the distance to the maximum cube size that
+	// still guarantees that this block will be scanned again right away.
+	//
+	// Using m_last_center is OK, as a change in center
+	// will reset m_nearest_unsent_d to 0 anyway (see getNextBlocks).
+	p -= m_last_center;
+	s16 this_d = std::max({std::abs(p.X), std::abs(p.Y), std::abs(p.Z)});
+	m_nearest_unsent_d = std::min(m_nearest_unsent_d, this_d);
 }
 
 void RemoteClient::SetBlocksNotSent(const std::vector<v3s16> &blocks)
@@ -777,11 +851,21 @@ void ClientInterface::sendToAll(NetworkPacket *pkt, ClientState state_min)
 {
 	auto &ccf = clientCommandFactoryTable[pkt->getCommand()];
 	FATAL_ERROR_IF(!ccf.name, "packet type missing in table");
-	RecursiveMutexAutoLock clientslock(m_clients_mutex);
-	for (auto &[peer_id, client] : m_clients) {
-		if (client->getState() >= state_min)
-			m_con->Send(peer_id, ccf.channel, pkt, ccf.reliable);
+
+	// Only hold the lock to pick the recipients, queueing the packets
+	// doesn't need it
+	std::vector<session_t> peer_ids;
+	{
+		RecursiveMutexAutoLock clientslock(m_clients_mutex);
+		peer_ids.reserve(m_clients.size());
+		for (auto &[peer_id, client] : m_clients) {
+			if (client->getState() >= state_min)
+				peer_ids.push_back(peer_id);
+		}
 	}
+
+	for (session_t peer_id : peer_ids)
+		m_con->Send(peer_id, ccf.channel, pkt, ccf.reliable);
 }
 
 RemoteClient* ClientInterface::getClientNoEx(session_t peer_id, ClientState state_min)
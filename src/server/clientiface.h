@@ -8,10 +8,14 @@
 
 #include "network/address.h"
 #include "network/networkprotocol.h" // session_t
+#include "network/objectpositions.h"
+#include "server/objectupdatethrottle.h"
 #include "threading/mutex_auto_lock.h"
 #include "clientdynamicinfo.h"
 #include "constants.h" // PEER_ID_INEXISTENT
+#include "server/activeobjectmgr.h" // ObjectsInRange
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -210,6 +214,7 @@ struct PrioritySortedBlockTransfer
 
 class RemoteClient
 {
+	friend class TestRemoteClient;
 public:
 	// peer_id=0 means this client has no associated peer
 	// NOTE: If client is made allowed to exist while peer doesn't,
@@ -239,12 +244,23 @@ class RemoteClient
 	~RemoteClient() = default;
 
 	/*
-		Finds block that should be sent next to the client.
+		Finds blocks that should be sent next to the client and adds them
+		to its send queue, see peekQueuedBlock().
 		Environment should be locked when this is called.
 		dtime is used for resetting send radius at slow interval
 	*/
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+			float dtime);
+
+	/*
+		The most important block waiting to be sent, or nullptr.
+		Blocks queued are kept until taken by popQueuedBlock(), or until the
+		camera moves and the queue is found again.
+	*/
+	const PrioritySortedBlockTransfer *peekQueuedBlock();
+	// retry: the block could not be sent now, so it has to be found again
+	void popQueuedBlock(bool retry = false);
+	u32 getQueuedCount() const { return m_send_queue.size(); }
 
 	void GotBlock(v3s16 p);
 
@@ -263,6 +279,16 @@ class RemoteClient
 
 	u32 getSendingCount() const { return m_blocks_sending.size(); }
 
+	/*
+		Adapts the number of blocks that may be on the wire at once to the
+		link of the client, as measured by the connection.
+		rate: acknowledged bytes per second
+		min_rtt: lowest round trip time in seconds
+		block_size: average size of a block packet in bytes
+	*/
+	void updateSendWindow(float rate, float min_rtt, float block_size);
+	u16 getSendWindow() const { return m_send_window; }
+
 	bool isBlockSent(v3s16 p) const
 	{
 		return m_blocks_sent.find(p) != m_blocks_sent.end();
@@ -278,6 +304,7 @@ class RemoteClient
 		o << "RemoteClient " << peer_id << ": "
 			<<"blocks_sent=" << m_blocks_sent.size()
 			<<", blocks_sending=" << m_blocks_sending.size()
+			<<", send_window=" << m_send_window
 			<<", nearest_unsent_d=" << m_nearest_unsent_d
 			<<", map_send_completion_timer=" << (int)(m_map_send_completion_timer + 0.5f)
 			<<", excess_gotblocks=" << m_excess_gotblocks;
@@ -288,9 +315,20 @@ class RemoteClient
 	float m_time_from_building = 9999;
 
 	/*
-		List of active objects that the client knows of.
+		List of active objects that the client knows of, sorted.
 	*/
-	std::set<u16> m_known_objects;
+	std::vector<u16> m_known_objects;
+	// Blocks with objects around the player, see ServerEnvironment::getActiveObjectChanges
+	server::ObjectsInRange m_objects_in_range;
+	// Keyframes of TOCLIENT_ACTIVE_OBJECT_POSITIONS
+	ObjectPositionCodec m_object_positions;
+	// Position updates of far away objects held back
+	ObjectUpdateThrottle m_update_throttle;
+
+	bool knowsObject(u16 id) const
+	{
+		return std::binary_search(m_known_objects.begin(), m_known_objects.end(), id);
+	}
 
 	ClientState getState() const { return m_state; }
 
@@ -363,6 +401,21 @@ class RemoteClient
 	 */
 	std::unordered_set<v3s16> m_blocks_occ;
 
+	/*
+		Blocks found by GetNextBlocks() that wait to be sent, as a heap with
+		the lowest priority value on top, and the same as a set.
+		GetNextBlocks() continues the search where it left off instead of
+		finding these again every step.
+	*/
+	std::vector<PrioritySortedBlockTransfer> m_send_queue;
+	std::unordered_set<v3s16> m_blocks_queued;
+
+	void queueBlock(float priority, v3s16 p);
+	// Forgets the send queue and searches from the center again
+	void restartBlockSearch();
+	// Makes the next search start early enough to find block p
+	void rewindBlockSearch(v3s16 p);
+
 	s16 m_nearest_unsent_d = 0;
 	v3s16 m_last_center;
 	v3f m_last_camera_dir;
@@ -390,6 +443,14 @@ class RemoteClient
 	*/
 	std::unordered_set<v3s16> m_blocks_sending;
 
+	/*
+		Current limit for m_blocks_sending, starts at m_max_simul_sends.
+		m_send_window_full tells whether the limit was hit since the last
+		update, only then the measured rate says something about the link.
+	*/
+	u16 m_send_window;
+	bool m_send_window_full = false;
+
 	/*
 		Count of excess GotBlocks().
 		There is an excess amount because the client sometimes
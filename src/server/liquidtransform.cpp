@@ -0,0 +1,469 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "liquidtransform.h"
+#include <algorithm>
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "threading/worker_pool.h"
+
+#define WATER_DROP_BOOST 4
+
+// Below this the threads are not worth waking up
+static constexpr size_t MIN_PARALLEL_BATCH = 1024;
+
+const static v3s16 liquid_6dirs[6] = {
+	// order: upper before same level before lower
+	v3s16( 0, 1, 0),
+	v3s16( 0, 0, 1),
+	v3s16( 1, 0, 0),
+	v3s16( 0, 0,-1),
+	v3s16(-1, 0, 0),
+	v3s16( 0,-1, 0)
+};
+
+enum NeighborType : u8 {
+	NEIGHBOR_UPPER,
+	NEIGHBOR_SAME_LEVEL,
+	NEIGHBOR_LOWER
+};
+
+struct NodeNeighbor {
+	MapNode n;
+	NeighborType t;
+	v3s16 p;
+
+	NodeNeighbor()
+		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
+	{ }
+
+	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
+		: n(node),
+		  t(n_type),
+		  p(pos)
+	{ }
+};
+
+static s8 get_max_liquid_level(NodeNeighbor nb, s8 current_max_node_level)
+{
+	s8 max_node_level = current_max_node_level;
+	u8 nb_liquid_level = (nb.n.param2 & LIQUID_LEVEL_MASK);
+	switch (nb.t) {
+		case NEIGHBOR_UPPER:
+			if (nb_liquid_level + WATER_DROP_BOOST > current_max_node_level) {
+				max_node_level = LIQUID_LEVEL_MAX;
+				if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+					max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+			} else if (nb_liquid_level > current_max_node_level) {
+				max_node_level = nb_liquid_level;
+			}
+			break;
+		case NEIGHBOR_LOWER:
+			break;
+		case NEIGHBOR_SAME_LEVEL:
+			if ((nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+					nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+				max_node_level = nb_liquid_level - 1;
+			break;
+	}
+	return max_node_level;
+}
+
+// Reads nodes without the lookup caches of the map, so that several threads
+// can read at once. Remembers the last block since neighbors mostly share it.
+class LiquidTransformer::NodeReader
+{
+public:
+	NodeReader(Map *map) : m_map(map) {}
+
+	MapNode get(v3s16 p)
+	{
+		v3s16 blockpos = getNodeBlockPos(p);
+		if (!m_has_block || blockpos != m_blockpos) {
+			m_block = m_map->findBlock(blockpos);
+			m_blockpos = blockpos;
+			m_has_block = true;
+		}
+		if (!m_block)
+			return {CONTENT_IGNORE};
+		return m_block->getNodeNoCheck(p - blockpos * MAP_BLOCKSIZE);
+	}
+
+private:
+	Map *m_map;
+	MapBlock *m_block = nullptr;
+	v3s16 m_blockpos;
+	bool m_has_block = false;
+};
+
+void LiquidTransformer::evaluate(Map *map, const std::vector<v3s16> &batch,
+	std::vector<LiquidUpdate> &updates) const
+{
+	updates.clear();
+	updates.resize(batch.size());
+
+	if (!m_pool || m_pool->getThreadCount() == 0 || batch.size() < MIN_PARALLEL_BATCH) {
+		NodeReader reader(map);
+		for (size_t i = 0; i < batch.size(); i++)
+			evaluateNode(reader, batch[i], updates[i]);
+		return;
+	}
+
+	// Group the batch by mapblock
+	std::vector<std::pair<v3s16, u32>> order;
+	order.reserve(batch.size());
+	for (size_t i = 0; i < batch.size(); i++)
+		order.emplace_back(getNodeBlockPos(batch[i]), i);
+	std::sort(order.begin(), order.end(), [] (const auto &a, const auto &b) {
+		if (a.first != b.first)
+			return std::tie(a.first.Z, a.first.Y, a.first.X) <
+				std::tie(b.first.Z, b.first.Y, b.first.X);
+		return a.second < b.second;
+	});
+
+	// Cut into regions of whole blocks, a few per thread for balance
+	const size_t target = std::max<size_t>(1,
+		batch.size() / ((m_pool->getThreadCount() + 1) * 4));
+	std::vector<size_t> region_start;
+	for (size_t i = 0; i < order.size(); i++) {
+		if (region_start.empty() || (i - region_start.back() >= target &&
+				order[i].first != order[i - 1].first))
+			region_start.push_back(i);
+	}
+	region_start.push_back(order.size());
+
+	m_pool->run(region_start.size() - 1, [&] (size_t r) {
+		NodeReader reader(map);
+		for (size_t i = region_start[r]; i < region_start[r + 1]; i++) {
+			const u32 idx = order[i].second;
+			evaluateNode(reader, batch[idx], updates[idx]);
+		}
+	});
+}
+
+void LiquidTransformer::run(Map *map, UniqueQueue<v3s16> &queue, u32 loop_max,
+	const std::function<bool(const LiquidUpdate &)> &apply) const
+{
+	const bool parallel = m_pool && m_pool->getThreadCount() > 0;
+	u32 loopcount = 0;
+
+	// list of nodes that due to viscosity have not reached their max level height
+	std::vector<v3s16> must_reflow;
+
+	std::vector<v3s16> batch;
+	std::vector<LiquidUpdate> updates;
+	while (!queue.empty() && loopcount < loop_max) {
+		batch.clear();
+		while (!queue.empty() && loopcount < loop_max &&
+				(parallel || batch.empty())) {
+			batch.push_back(queue.front());
+			queue.pop_front();
+			loopcount++;
+		}
+
+		evaluate(map, batch, updates);
+
+		for (const LiquidUpdate &u : updates) {
+			// Earlier updates of the batch or their callbacks may have
+			// changed what this one was decided on
+			if (batch.size() > 1 && !isCurrent(map, u)) {
+				queue.push_back(u.p);
+				continue;
+			}
+
+			for (u8 i = 0; i < u.num_queue_always; i++)
+				queue.push_back(u.queue_always[i]);
+			if (u.reflow)
+				must_reflow.push_back(u.p);
+			if (!u.changed || !apply(u))
+				continue;
+
+			/*
+				enqueue neighbors for update if necessary
+			 */
+			for (u8 i = 0; i < u.num_queue_changed; i++)
+				queue.push_back(u.queue_changed[i]);
+		}
+	}
+
+	for (const v3s16 &p : must_reflow)
+		queue.push_back(p);
+}
+
+bool LiquidTransformer::isCurrent(Map *map, const LiquidUpdate &u)
+{
+	auto same = [] (MapNode a, MapNode b) {
+		return a.getContent() == b.getContent() && a.param2 == b.param2;
+	};
+	if (!same(map->getNode(u.p), u.n_old))
+		return false;
+	if (u.has_near) {
+		for (u16 i = 0; i < 6; i++) {
+			if (!same(map->getNode(u.p + liquid_6dirs[i]), u.n_near[i]))
+				return false;
+		}
+	}
+	return true;
+}
+
+void LiquidTransformer::evaluateNode(NodeReader &reader, v3s16 p0,
+	LiquidUpdate &u) const
+{
+	u.p = p0;
+	MapNode n0 = reader.get(p0);
+	u.n_old = n0;
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = m_ndef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = cf.liquid_alternative_flowing_id;
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+		case LiquidType_END:
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	bool floating_node_above = false;
+	u.has_near = true;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 0:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 5:
+				nt = NEIGHBOR_LOWER;
+				break;
+			default:
+				break;
+		}
+		v3s16 npos = p0 + liquid_6dirs[i];
+		NodeNeighbor nb(reader.get(npos), nt, npos);
+		u.n_near[i] = nb.n;
+		const ContentFeatures &cfnb = m_ndef->get(nb.n);
+		if (nt == NEIGHBOR_UPPER && cfnb.floats)
+			floating_node_above = true;
+		switch (cfnb.liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						u.queue_always[u.num_queue_always++] = npos;
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
+						if (nb.t == NEIGHBOR_LOWER)
+							flowing_down = true;
+						else
+							ignored_sources = true;
+					}
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = cfnb.liquid_alternative_flowing_id;
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(nt != NEIGHBOR_LOWER)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				if (nb.t != NEIGHBOR_SAME_LEVEL ||
+					(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
+					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+					// but exclude falling liquids on the same level, they cannot flow here anyway
+
+					// used to determine if the neighbor can even flow into this node
+					s8 max_level_from_neighbor = get_max_liquid_level(nb, -1);
+					u8 range = m_ndef->get(cfnb.liquid_alternative_flowing_id).liquid_range;
+
+					if (liquid_kind == CONTENT_AIR &&
+							max_level_from_neighbor >= (LIQUID_LEVEL_MAX + 1 - range))
+						liquid_kind = cfnb.liquid_alternative_flowing_id;
+				}
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+			case LiquidType_END:
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = m_ndef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && m_ndef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = m_ndef->get(liquid_kind).liquid_alternative_source_id;
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighboring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			max_node_level = get_max_liquid_level(flows[i], max_node_level);
+		}
+
+		u8 viscosity = m_ndef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				u.reflow = true;
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(m_ndef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return;
+
+	u.changed = true;
+
+	/*
+		check if there is a floating node above that needs to be updated.
+	 */
+	if (floating_node_above && new_node_content == CONTENT_AIR)
+		u.check_falling = true;
+
+	/*
+		update the current node
+	 */
+	const ContentFeatures &cf_new = m_ndef->get(new_node_content);
+	if (cf_new.liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bits to 0
+		n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+
+	// change the node.
+	n0.setContent(new_node_content);
+
+	u.floods = floodable_node != CONTENT_AIR;
+
+	// Ignore light (because calling voxalgo::update_lighting_nodes)
+	ContentLightingFlags f0 = m_ndef->getLightingFlags(n0);
+	n0.setLight(LIGHTBANK_DAY, 0, f0);
+	n0.setLight(LIGHTBANK_NIGHT, 0, f0);
+	u.n_new = n0;
+
+	/*
+		enqueue neighbors for update if necessary
+	 */
+	switch (cf_new.liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					u.queue_changed[u.num_queue_changed++] = flows[i].p;
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					u.queue_changed[u.num_queue_changed++] = airs[i].p;
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				u.queue_changed[u.num_queue_changed++] = flows[i].p;
+			break;
+		case LiquidType_END:
+			break;
+	}
+}
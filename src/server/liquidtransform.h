@@ -0,0 +1,91 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "irr_v3d.h"
+#include "mapnode.h"
+#include "util/container.h"
+
+class Map;
+class NodeDefManager;
+class WorkerPool;
+
+/*
+	Outcome of the liquid transformation of one queued node
+*/
+struct LiquidUpdate
+{
+	v3s16 p;
+	MapNode n_old;
+	// The neighbors it was decided on, if they were looked at
+	bool has_near = false;
+	MapNode n_near[6];
+	// Light is left at 0, lighting is updated for all changed nodes at once
+	MapNode n_new;
+	bool changed = false;
+	// A floodable node that is not air is flooded, on_flood() decides
+	bool floods = false;
+	// Viscosity has kept the node from reaching its level, look at it again
+	bool reflow = false;
+	// Turns into air below a floating node
+	bool check_falling = false;
+
+	// Neighbors to queue whether the node changes or not
+	u8 num_queue_always = 0;
+	v3s16 queue_always[6];
+	// Neighbors to queue if the node changes
+	u8 num_queue_changed = 0;
+	v3s16 queue_changed[6];
+};
+
+/*
+	Decides what happens to the nodes in the liquid transformation queue.
+
+	The outcome for a node only depends on its six neighbors, so a batch of
+	queued nodes is decided on against the map as it is, without writing to
+	it. The batch is split into regions of whole mapblocks which are handled
+	by the threads of a pool in parallel.
+	The updates are then applied in the order of the batch. One that was
+	decided on with nodes that changed meanwhile is not applied but queued
+	again, so nothing is changed based on outdated neighbors.
+*/
+class LiquidTransformer
+{
+public:
+	LiquidTransformer(const NodeDefManager *ndef, WorkerPool *pool = nullptr) :
+		m_ndef(ndef), m_pool(pool)
+	{}
+
+	/**
+	 * Works through the queue until it is empty or `loop_max` nodes were
+	 * looked at. Without threads in the pool the nodes are done one at a
+	 * time, each against the map as the previous one left it.
+	 * @param apply writes a changed node to the map, returns false if it
+	 *        did not (because a callback prevented it)
+	 */
+	void run(Map *map, UniqueQueue<v3s16> &queue, u32 loop_max,
+		const std::function<bool(const LiquidUpdate &)> &apply) const;
+
+	/**
+	 * Decides on the nodes of a batch. Only reads the map via Map::findBlock().
+	 * @param batch positions, each at most once
+	 * @param updates filled with one entry per position of `batch`, in order
+	 */
+	void evaluate(Map *map, const std::vector<v3s16> &batch,
+		std::vector<LiquidUpdate> &updates) const;
+
+	/// Whether the nodes an update was decided on are still the same
+	static bool isCurrent(Map *map, const LiquidUpdate &u);
+
+private:
+	class NodeReader;
+
+	void evaluateNode(NodeReader &reader, v3s16 p0, LiquidUpdate &u) const;
+
+	const NodeDefManager *m_ndef;
+	WorkerPool *m_pool;
+};
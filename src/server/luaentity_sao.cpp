@@ -163,29 +163,51 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
+	m_resting = false;
 	if (auto *parent = getParent()) {
 		setBasePosition(parent->getBasePosition());
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
+		m_rest_valid = false;
 	} else {
 		if(m_prop.physical){
 			aabb3f box = m_prop.collisionbox;
 			box.MinEdge *= BS;
 			box.MaxEdge *= BS;
-			v3f p_pos = getBasePosition();
-			v3f p_velocity = m_velocity;
-			v3f p_acceleration = m_acceleration;
-			moveresult = collisionMoveSimple(m_env, m_env->getGameDef(),
-					box, m_prop.stepheight, dtime,
-					&p_pos, &p_velocity, p_acceleration,
-					this, m_prop.collideWithObjects);
-			moveresult_p = &moveresult;
-
-			// Apply results
-			setBasePosition(p_pos);
-			m_velocity = p_velocity;
-			m_acceleration = p_acceleration;
+			if (canKeepResting(box)) {
+				// Moving would give the same result as in the last step
+				m_resting = true;
+				moveresult = m_rest_result;
+				moveresult_p = &moveresult;
+			} else {
+				v3f p_pos = getBasePosition();
+				v3f p_velocity = m_velocity;
+				v3f p_acceleration = m_acceleration;
+				moveresult = collisionMoveSimple(m_env, m_env->getGameDef(),
+						box, m_prop.stepheight, dtime,
+						&p_pos, &p_velocity, p_acceleration,
+						this, m_prop.collideWithObjects);
+				moveresult_p = &moveresult;
+
+				// Objects that stand still and touch nothing come to rest.
+				// Other objects could push them around, so they can't.
+				m_rest_valid = !m_prop.collideWithObjects &&
+						m_velocity == v3f() && m_acceleration == v3f() &&
+						p_pos == getBasePosition() && !moveresult.collides &&
+						!moveresult.standing_on_object;
+				if (m_rest_valid) {
+					m_rest_pos = p_pos;
+					m_rest_box = box;
+					m_rest_result = moveresult;
+				}
+
+				// Apply results
+				setBasePosition(p_pos);
+				m_velocity = p_velocity;
+				m_acceleration = p_acceleration;
+			}
 		} else {
+			m_rest_valid = false;
 			addPos((m_velocity + m_acceleration * 0.5f * dtime) * dtime);
 			m_velocity += dtime * m_acceleration;
 		}
@@ -244,6 +266,21 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	sendOutdatedData();
 }
 
+bool LuaEntitySAO::canKeepResting(const aabb3f &box) const
+{
+	if (!m_rest_valid || m_prop.collideWithObjects)
+		return false;
+	if (m_velocity != v3f() || m_acceleration != v3f() ||
+			getBasePosition() != m_rest_pos || box != m_rest_box)
+		return false;
+
+	// Node boxes reach up to a node into the neighbours
+	const v3f pos = getBasePosition();
+	v3s16 minp = floatToInt(pos + box.MinEdge, BS) - v3s16(2, 2, 2);
+	v3s16 maxp = floatToInt(pos + box.MaxEdge, BS) + v3s16(2, 2, 2);
+	return !m_env->wereBlocksModified(getNodeBlockPos(minp), getNodeBlockPos(maxp));
+}
+
 std::string LuaEntitySAO::getClientInitializationData(u16 protocol_version)
 {
 	std::ostringstream os(std::ios::binary);
@@ -510,11 +547,6 @@ void LuaEntitySAO::setSprite(v2s16 p, int num_frames, float framelength,
 	m_messages_out.emplace(getId(), true, str);
 }
 
-std::string LuaEntitySAO::getName()
-{
-	return m_init_name;
-}
-
 std::string LuaEntitySAO::getPropertyPacket()
 {
 	return generateSetPropertiesCommand(m_prop);
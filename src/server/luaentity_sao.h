@@ -6,6 +6,7 @@
 #pragma once
 
 #include "unit_sao.h"
+#include "collision.h"
 #include "util/guid.h"
 
 class LuaEntitySAO : public UnitSAO
@@ -57,10 +58,12 @@ class LuaEntitySAO : public UnitSAO
 	std::string getTextureMod() const;
 	void setSprite(v2s16 p, int num_frames, float framelength,
 			bool select_horiz_by_yawpitch);
-	std::string getName();
+	const std::string &getName() const { return m_init_name; }
 	bool getCollisionBox(aabb3f *toset) const;
 	bool getSelectionBox(aabb3f *toset) const;
 	bool collideWithObjects() const;
+	// Whether the physics were skipped in the last step
+	bool isResting() const { return m_resting; }
 
 protected:
 	void dispatchScriptDeactivate(bool removal);
@@ -77,6 +80,7 @@ class LuaEntitySAO : public UnitSAO
 	std::string getPropertyPacket();
 	void sendPosition(bool do_interpolate, bool is_movement_end);
 	std::string generateSetTextureModCommand() const;
+	bool canKeepResting(const aabb3f &box) const;
 	static std::string generateSetSpriteCommand(v2s16 p, u16 num_frames,
 			f32 framelength, bool select_horiz_by_yawpitch);
 
@@ -89,6 +93,14 @@ class LuaEntitySAO : public UnitSAO
 	v3f m_velocity;
 	v3f m_acceleration;
 
+	// The physics of an object at rest are not stepped again until something
+	// about it or the nodes around it change
+	bool m_resting = false;
+	bool m_rest_valid = false;
+	v3f m_rest_pos;
+	aabb3f m_rest_box{{0, 0, 0}, {0, 0, 0}};
+	collisionMoveResult m_rest_result;
+
 	v3f m_last_sent_position;
 	v3f m_last_sent_velocity;
 	v3f m_last_sent_rotation;
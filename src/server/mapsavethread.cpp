@@ -0,0 +1,298 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "mapsavethread.h"
+#include "database/database.h"
+#include "debug.h"
+#include "log.h"
+#include "serialization.h"
+#include "servermap.h"
+#include <sstream>
+
+// Upper limit of blocks per transaction
+static constexpr size_t MAX_BATCH_SIZE = 512;
+// How long to wait before retrying after the database failed
+static constexpr auto RETRY_DELAY = std::chrono::seconds(2);
+
+MapSaveThread::MapSaveThread(MapDatabaseAccessor *db, int compression_level,
+		unsigned int compress_threads, size_t max_pending_bytes,
+		MetricsBackend *mb) :
+	Thread("MapSave"),
+	m_db(db),
+	m_compression_level(compression_level),
+	m_max_pending_bytes(max_pending_bytes),
+	m_compress_pool("MapSaveCompress", compress_threads)
+{
+	m_pending_gauge = mb->addGauge(
+		"minetest_map_save_pending_blocks", "Number of blocks waiting to be saved");
+	m_written_counter = mb->addCounter(
+		"minetest_map_save_written_blocks",
+		"Number of blocks written by the background saver");
+}
+
+MapSaveThread::~MapSaveThread()
+{
+	finish();
+}
+
+std::string MapSaveThread::compressBlock(const std::string &raw, int level)
+{
+	const u8 version = SER_FMT_VER_HIGHEST_WRITE;
+
+	/*
+		[0] u8 serialization version
+		[1] data
+	*/
+	std::ostringstream os(std::ios_base::binary);
+	os.write((char*) &version, 1);
+	compress(raw, os, version, level);
+	return os.str();
+}
+
+bool MapSaveThread::enqueue(v3s16 pos, std::string raw, bool wait)
+{
+	std::unique_lock lock(m_mutex);
+
+	// Backpressure: let the writer catch up, unless it is failing anyway
+	if (wait) {
+		m_progress_cv.wait(lock, [&] {
+			return m_pending_bytes < m_max_pending_bytes || m_last_write_failed ||
+				m_stop;
+		});
+	} else if (m_pending_bytes >= m_max_pending_bytes) {
+		return false;
+	}
+
+	auto it = m_pending.find(pos);
+	if (it != m_pending.end())
+		eraseEntry(it);
+
+	const u64 seq = m_next_seq++;
+	m_pending_bytes += raw.size();
+	m_pending.emplace(pos, Entry{
+		std::make_shared<const std::string>(std::move(raw)), seq});
+	m_queue.emplace_back(pos, seq);
+	m_pending_gauge->set(m_pending.size());
+
+	lock.unlock();
+	m_work_cv.notify_one();
+	return true;
+}
+
+bool MapSaveThread::getBlock(v3s16 pos, std::string &ret)
+{
+	std::shared_ptr<const std::string> raw;
+	{
+		std::unique_lock lock(m_mutex);
+		auto it = m_pending.find(pos);
+		if (it == m_pending.end())
+			return false;
+		raw = it->second.raw;
+	}
+
+	ret = compressBlock(*raw, m_compression_level);
+	return true;
+}
+
+void MapSaveThread::discard(v3s16 pos)
+{
+	{
+		std::unique_lock lock(m_mutex);
+		auto it = m_pending.find(pos);
+		if (it == m_pending.end())
+			return;
+		eraseEntry(it);
+		m_pending_gauge->set(m_pending.size());
+	}
+	m_progress_cv.notify_all();
+}
+
+void MapSaveThread::listPending(std::vector<v3s16> &dst)
+{
+	std::unique_lock lock(m_mutex);
+	dst.reserve(dst.size() + m_pending.size());
+	for (auto &it : m_pending)
+		dst.push_back(it.first);
+}
+
+void MapSaveThread::flush()
+{
+	std::unique_lock lock(m_mutex);
+	const u64 batches_before = m_batches_done;
+	m_progress_cv.wait(lock, [&] {
+		return m_pending.empty() ||
+			(m_last_write_failed && m_batches_done > batches_before) ||
+			!isRunning();
+	});
+}
+
+void MapSaveThread::finish()
+{
+	{
+		std::unique_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_work_cv.notify_all();
+	m_progress_cv.notify_all();
+
+	stop();
+	wait();
+}
+
+size_t MapSaveThread::getPendingCount()
+{
+	std::unique_lock lock(m_mutex);
+	return m_pending.size();
+}
+
+void MapSaveThread::eraseEntry(std::unordered_map<v3s16, Entry>::iterator it)
+{
+	m_pending_bytes -= it->second.raw->size();
+	m_pending.erase(it);
+}
+
+void MapSaveThread::takeBatch(std::vector<Item> &batch)
+{
+	while (!m_queue.empty() && batch.size() < MAX_BATCH_SIZE) {
+		auto [pos, seq] = m_queue.front();
+		m_queue.pop_front();
+
+		auto it = m_pending.find(pos);
+		if (it == m_pending.end() || it->second.seq != seq)
+			continue; // superseded or discarded
+
+		Item item;
+		item.pos = pos;
+		item.seq = seq;
+		item.raw = it->second.raw;
+		batch.push_back(std::move(item));
+	}
+}
+
+bool MapSaveThread::writeBatch(std::vector<Item> &batch)
+{
+	MutexAutoLock dblock(m_db->mutex);
+
+	// Blocks deleted in the meantime must not be written. Since discard()
+	// happens with the database mutex held this check can't go stale.
+	size_t count = 0;
+	{
+		std::unique_lock lock(m_mutex);
+		for (auto &item : batch) {
+			auto it = m_pending.find(item.pos);
+			item.current = it != m_pending.end() && it->second.seq == item.seq;
+			count += item.current ? 1 : 0;
+		}
+	}
+	if (count == 0)
+		return true;
+
+	std::vector<std::pair<v3s16, std::string_view>> blocks;
+	blocks.reserve(count);
+	size_t size = 0;
+	for (auto &item : batch) {
+		if (item.current) {
+			blocks.emplace_back(item.pos, item.blob);
+			size += item.blob.size();
+		}
+	}
+
+	bool success;
+	try {
+		m_db->dbase->beginSave();
+		success = m_db->dbase->saveBlocks(blocks);
+		m_db->dbase->endSave();
+	} catch (std::exception &e) {
+		errorstream << "MapSaveThread: Failed to write " << count
+			<< " blocks: " << e.what() << std::endl;
+		// Make sure the transaction is closed, the whole batch is retried
+		// so committing a part of it does no harm.
+		try {
+			m_db->dbase->endSave();
+		} catch (std::exception &) {
+		}
+		return false;
+	}
+
+	if (!success) {
+		errorstream << "MapSaveThread: Failed to write " << count
+			<< " blocks" << std::endl;
+		return false;
+	}
+
+	for (auto &item : batch)
+		item.written = item.current;
+	m_db->bytes_written += size;
+	return true;
+}
+
+void *MapSaveThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	std::vector<Item> batch;
+	while (true) {
+		batch.clear();
+		{
+			std::unique_lock lock(m_mutex);
+			m_work_cv.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+			if (m_queue.empty())
+				break;
+			takeBatch(batch);
+		}
+		if (batch.empty())
+			continue;
+
+		m_compress_pool.run(batch.size(), [&] (size_t i) {
+			batch[i].blob = compressBlock(*batch[i].raw, m_compression_level);
+		});
+
+		const bool success = writeBatch(batch);
+
+		size_t written = 0;
+		bool give_up;
+		{
+			std::unique_lock lock(m_mutex);
+			// Requeue what failed at the front, keeping the original order
+			for (auto it = batch.rbegin(); it != batch.rend(); ++it) {
+				auto pit = m_pending.find(it->pos);
+				if (pit == m_pending.end() || pit->second.seq != it->seq)
+					continue;
+				if (it->written) {
+					eraseEntry(pit);
+					written++;
+				} else {
+					m_queue.emplace_front(it->pos, it->seq);
+				}
+			}
+
+			// There is nobody left to retry for when shutting down
+			give_up = !success && m_stop;
+			if (give_up) {
+				errorstream << "MapSaveThread: Discarding " << m_pending.size()
+					<< " unsaved blocks" << std::endl;
+				m_pending.clear();
+				m_queue.clear();
+				m_pending_bytes = 0;
+			}
+
+			m_last_write_failed = !success;
+			m_batches_done++;
+			m_pending_gauge->set(m_pending.size());
+		}
+		m_written_counter->increment(written);
+		m_progress_cv.notify_all();
+
+		if (give_up)
+			break;
+		if (!success) {
+			std::unique_lock lock(m_mutex);
+			m_work_cv.wait_for(lock, RETRY_DELAY, [&] { return m_stop; });
+		}
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
@@ -0,0 +1,119 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "threading/thread.h"
+#include "threading/worker_pool.h"
+#include "util/metricsbackend.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct MapDatabaseAccessor;
+
+/*
+	Writes blocks to the map database in the background.
+
+	The server thread hands over uncompressed snapshots of blocks (see
+	MapBlock::serializeUncompressed()), which are compressed on a worker pool
+	and committed from this thread in batches wrapped in beginSave()/endSave().
+
+	Until a block is committed its newest snapshot is kept here, so loads have
+	to check getBlock() before asking the database and deleting a block has to
+	discard() it.
+*/
+class MapSaveThread : public Thread
+{
+public:
+	MapSaveThread(MapDatabaseAccessor *db, int compression_level,
+		unsigned int compress_threads, size_t max_pending_bytes,
+		MetricsBackend *mb);
+	~MapSaveThread();
+
+	/// Queues a block for writing, replacing any older snapshot of it.
+	/// While too much data is pending the block is refused, or with `wait`
+	/// the caller is blocked until the writer caught up.
+	/// @return false if refused
+	bool enqueue(v3s16 pos, std::string raw, bool wait = false);
+
+	/// Gets the pending data of a block in database format.
+	/// @note call with the database mutex held
+	/// @return false if nothing is pending for this block
+	bool getBlock(v3s16 pos, std::string &ret);
+
+	/// Forgets the pending data of a block.
+	/// @note call with the database mutex held
+	void discard(v3s16 pos);
+
+	/// Appends the positions of all pending blocks.
+	void listPending(std::vector<v3s16> &dst);
+
+	/// Waits until everything queued so far was written (or failed to).
+	void flush();
+
+	/// Writes out all pending blocks and stops the thread.
+	void finish();
+
+	size_t getPendingCount();
+
+protected:
+	void *run() override;
+
+private:
+	struct Entry {
+		std::shared_ptr<const std::string> raw;
+		u64 seq;
+	};
+
+	struct Item {
+		v3s16 pos;
+		u64 seq;
+		std::shared_ptr<const std::string> raw;
+		std::string blob;
+		bool current = false;
+		bool written = false;
+	};
+
+	static std::string compressBlock(const std::string &raw, int level);
+
+	// Takes the next batch off the queue. Requires m_mutex held.
+	void takeBatch(std::vector<Item> &batch);
+	// Commits the batch to the database, returns false on failure
+	bool writeBatch(std::vector<Item> &batch);
+	// Requires m_mutex held
+	void eraseEntry(std::unordered_map<v3s16, Entry>::iterator it);
+
+	MapDatabaseAccessor *m_db;
+	const int m_compression_level;
+	const size_t m_max_pending_bytes;
+
+	WorkerPool m_compress_pool;
+
+	std::mutex m_mutex;
+	// Signalled when there is something to write or the thread should stop
+	std::condition_variable m_work_cv;
+	// Signalled whenever a batch was processed
+	std::condition_variable m_progress_cv;
+
+	// Newest snapshot of every block that is not committed yet
+	std::unordered_map<v3s16, Entry> m_pending;
+	// Write order. Entries with an outdated seq are skipped.
+	std::deque<std::pair<v3s16, u64>> m_queue;
+	size_t m_pending_bytes = 0;
+	u64 m_next_seq = 1;
+	// Number of processed batches, for flush()
+	u64 m_batches_done = 0;
+	bool m_last_write_failed = false;
+	bool m_stop = false;
+
+	MetricGaugePtr m_pending_gauge;
+	MetricCounterPtr m_written_counter;
+};
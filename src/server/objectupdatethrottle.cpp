@@ -0,0 +1,60 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "objectupdatethrottle.h"
+#include <algorithm>
+
+bool ObjectUpdateThrottle::push(u16 id, double now, f32 interval,
+		ObjectPositionUpdate &update)
+{
+	Entry &e = m_entries[id];
+	if (interval > 0 && now - e.last_sent < interval) {
+		if (!e.pending) {
+			e.pending = true;
+			m_pending.push_back(id);
+		}
+		e.interval = interval;
+		e.update = update;
+		return false;
+	}
+
+	// Let the client interpolate over the updates it did not get
+	if (e.pending) {
+		update.update_interval = std::max<f32>(update.update_interval,
+				std::min<double>(now - e.last_sent, e.interval));
+		e.pending = false;
+	}
+	e.last_sent = now;
+	e.interval = interval;
+	return true;
+}
+
+void ObjectUpdateThrottle::popDue(double now,
+		std::vector<std::pair<u16, ObjectPositionUpdate>> &due)
+{
+	for (size_t i = 0; i < m_pending.size();) {
+		auto it = m_entries.find(m_pending[i]);
+		if (it != m_entries.end() && it->second.pending) {
+			Entry &e = it->second;
+			if (now - e.last_sent < e.interval) {
+				i++;
+				continue;
+			}
+			e.update.update_interval = std::max<f32>(e.update.update_interval,
+					std::min<double>(now - e.last_sent, e.interval));
+			e.pending = false;
+			e.last_sent = now;
+			due.emplace_back(it->first, e.update);
+		}
+		// Sent, forgotten or listed twice
+		m_pending[i] = m_pending.back();
+		m_pending.pop_back();
+	}
+}
+
+void ObjectUpdateThrottle::forget(u16 id)
+{
+	// m_pending is cleaned up by popDue()
+	m_entries.erase(id);
+}
@@ -0,0 +1,47 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include "network/objectpositions.h"
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+	Limits the rate of position updates of far away objects sent to one client.
+	An update that comes too soon is held back, and replaced by later ones,
+	until its object is due again.
+*/
+class ObjectUpdateThrottle
+{
+public:
+	/*
+		Returns whether the update of object id can be sent now, given the
+		wanted interval between two updates. Otherwise it is kept to be
+		returned by popDue(). The update interval used for interpolation is
+		stretched to the time since the previous update sent.
+	*/
+	bool push(u16 id, double now, f32 interval, ObjectPositionUpdate &update);
+
+	// Moves updates that have become due to `due`
+	void popDue(double now, std::vector<std::pair<u16, ObjectPositionUpdate>> &due);
+
+	void forget(u16 id);
+
+private:
+	struct Entry
+	{
+		double last_sent = -std::numeric_limits<double>::infinity();
+		f32 interval = 0;
+		bool pending = false;
+		ObjectPositionUpdate update;
+	};
+
+	std::unordered_map<u16, Entry> m_entries;
+	// Objects with an update held back
+	std::vector<u16> m_pending;
+};
@@ -0,0 +1,82 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "serializedblockcache.h"
+#include <cassert>
+
+SerializedBlockCache::SerializedBlockCache(size_t max_bytes, MetricsBackend *mb) :
+	m_max_bytes(max_bytes)
+{
+	m_hit_counter = mb->addCounter(
+		"minetest_core_block_send_cache", "Lookups in the serialized block cache",
+		{{"result", "hit"}});
+	m_miss_counter = mb->addCounter(
+		"minetest_core_block_send_cache", "Lookups in the serialized block cache",
+		{{"result", "miss"}});
+	m_size_gauge = mb->addGauge(
+		"minetest_core_block_send_cache_bytes",
+		"Memory used by the serialized block cache");
+}
+
+SerializedBlockCache::Data SerializedBlockCache::get(v3s16 pos, u8 ser_ver,
+	u64 content_version)
+{
+	auto it = m_entries.find({pos, ser_ver});
+	if (it == m_entries.end()) {
+		m_miss_counter->increment();
+		return nullptr;
+	}
+
+	if (it->second->content_version != content_version) {
+		// the block was modified since
+		erase(it->second);
+		m_miss_counter->increment();
+		return nullptr;
+	}
+
+	// move to front
+	m_lru.splice(m_lru.begin(), m_lru, it->second);
+	m_hit_counter->increment();
+	return m_lru.front().data;
+}
+
+void SerializedBlockCache::put(v3s16 pos, u8 ser_ver, u64 content_version,
+	Data data)
+{
+	assert(data);
+	const Key key{pos, ser_ver};
+
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		erase(it->second);
+
+	Entry entry{key, content_version, std::move(data)};
+	const size_t size = entrySize(entry);
+	if (size > m_max_bytes)
+		return;
+
+	while (m_bytes + size > m_max_bytes)
+		erase(std::prev(m_lru.end()));
+
+	m_lru.push_front(std::move(entry));
+	m_entries.emplace(key, m_lru.begin());
+	m_bytes += size;
+	m_size_gauge->set(m_bytes);
+}
+
+void SerializedBlockCache::clear()
+{
+	m_entries.clear();
+	m_lru.clear();
+	m_bytes = 0;
+	m_size_gauge->set(0);
+}
+
+void SerializedBlockCache::erase(EntryList::iterator it)
+{
+	m_bytes -= entrySize(*it);
+	m_entries.erase(it->key);
+	m_lru.erase(it);
+	m_size_gauge->set(m_bytes);
+}
@@ -0,0 +1,87 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "util/metricsbackend.h"
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/*
+	Keeps the network representation of recently sent blocks, so blocks that
+	did not change can be sent to further clients without serializing and
+	compressing them again.
+
+	Entries are tagged with MapBlock::getContentVersion(), so outdated data
+	is never returned. Memory use is bounded, least recently used entries
+	are evicted first.
+
+	Not thread-safe, must only be used from the server thread.
+*/
+class SerializedBlockCache
+{
+public:
+	typedef std::shared_ptr<const std::string> Data;
+
+	SerializedBlockCache(size_t max_bytes, MetricsBackend *mb);
+
+	// Returns nullptr if there is no data for this content version
+	Data get(v3s16 pos, u8 ser_ver, u64 content_version);
+
+	// Replaces any older data for this block and version
+	void put(v3s16 pos, u8 ser_ver, u64 content_version, Data data);
+
+	void clear();
+
+	size_t size() const { return m_entries.size(); }
+	size_t getMemoryUsage() const { return m_bytes; }
+
+private:
+	struct Key {
+		v3s16 pos;
+		u8 ser_ver;
+
+		bool operator==(const Key &other) const
+		{
+			return pos == other.pos && ser_ver == other.ser_ver;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &k) const
+		{
+			return std::hash<v3s16>()(k.pos) ^ k.ser_ver;
+		}
+	};
+
+	struct Entry {
+		Key key;
+		u64 content_version;
+		Data data;
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	static size_t entrySize(const Entry &e)
+	{
+		return e.data->size() + sizeof(Entry);
+	}
+
+	void erase(EntryList::iterator it);
+
+	size_t m_max_bytes;
+	size_t m_bytes = 0;
+
+	// most recently used first
+	EntryList m_lru;
+	std::unordered_map<Key, EntryList::iterator, KeyHash> m_entries;
+
+	MetricCounterPtr m_hit_counter;
+	MetricCounterPtr m_miss_counter;
+	MetricGaugePtr m_size_gauge;
+};
@@ -20,6 +20,7 @@
 #include "scripting_server.h"
 #include "server.h"
 #include "servermap.h"
+#include "threading/worker_pool.h"
 #include "util/numeric.h"
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
@@ -49,17 +50,27 @@ static constexpr u32 BLOCK_RESAVE_TIMESTAMP_DIFF = 60; // in units of game time
 	ActiveBlockList
 */
 
-static void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
+// Gets the blocks of a column within `r` of `c`, like
+// `p.getDistanceFrom(c) <= r` would (the distance is rounded down).
+// The range is empty (y1 < y0) if the column misses the sphere.
+static bool sphere_column(v3s16 c, s16 r, s16 x, s16 z, s16 &y0, s16 &y1)
 {
-	v3s16 p;
-	for(p.X=p0.X-r; p.X<=p0.X+r; p.X++)
-	for(p.Y=p0.Y-r; p.Y<=p0.Y+r; p.Y++)
-	for(p.Z=p0.Z-r; p.Z<=p0.Z+r; p.Z++) {
-		// limit to a sphere
-		if (p.getDistanceFrom(p0) <= r) {
-			list.insert(p);
-		}
-	}
+	y0 = 0;
+	y1 = -1;
+	if (r < 0)
+		return false;
+	const s32 dx = x - c.X, dz = z - c.Z;
+	const s32 rest = (r + 1) * (r + 1) - 1 - dx * dx - dz * dz;
+	if (rest < 0)
+		return false;
+	s32 h = std::sqrt((float)rest);
+	while (h * h > rest)
+		h--;
+	while ((h + 1) * (h + 1) <= rest)
+		h++;
+	y0 = c.Y - h;
+	y1 = c.Y + h;
+	return true;
 }
 
 static void fillViewConeBlock(v3s16 p0,
@@ -67,7 +78,7 @@ static void fillViewConeBlock(v3s16 p0,
 	const v3f camera_pos,
 	const v3f camera_dir,
 	const float camera_fov,
-	std::set<v3s16> &list)
+	std::vector<v3s16> &list)
 {
 	v3s16 p;
 	const s16 r_nodes = r * BS * MAP_BLOCKSIZE;
@@ -75,11 +86,78 @@ static void fillViewConeBlock(v3s16 p0,
 	for (p.Y = p0.Y - r; p.Y <= p0.Y+r; p.Y++)
 	for (p.Z = p0.Z - r; p.Z <= p0.Z+r; p.Z++) {
 		if (isBlockInSight(p, camera_pos, camera_dir, camera_fov, r_nodes)) {
-			list.insert(p);
+			list.push_back(p);
 		}
 	}
 }
 
+void ActiveBlockList::addRef(RefMap &refs, v3s16 p)
+{
+	if (refs[p]++ == 0)
+		m_touched.insert(p);
+}
+
+void ActiveBlockList::removeRef(RefMap &refs, v3s16 p)
+{
+	auto it = refs.find(p);
+	assert(it != refs.end());
+	if (--it->second == 0) {
+		refs.erase(it);
+		m_touched.insert(p);
+	}
+}
+
+void ActiveBlockList::moveSphere(v3s16 c0, s16 r0, v3s16 c1, s16 r1)
+{
+	// Walk the columns of each sphere, only the parts of a column that are
+	// not in the other sphere change
+	v3s16 p;
+	s16 a0, a1, b0, b1;
+	if (r1 >= 0)
+	for (p.Z = c1.Z - r1; p.Z <= c1.Z + r1; p.Z++)
+	for (p.X = c1.X - r1; p.X <= c1.X + r1; p.X++) {
+		if (!sphere_column(c1, r1, p.X, p.Z, b0, b1))
+			continue;
+		sphere_column(c0, r0, p.X, p.Z, a0, a1);
+		for (p.Y = b0; p.Y <= b1; p.Y++) {
+			if (p.Y < a0 || p.Y > a1)
+				addRef(m_refs, p);
+		}
+	}
+	if (r0 >= 0)
+	for (p.Z = c0.Z - r0; p.Z <= c0.Z + r0; p.Z++)
+	for (p.X = c0.X - r0; p.X <= c0.X + r0; p.X++) {
+		if (!sphere_column(c0, r0, p.X, p.Z, a0, a1))
+			continue;
+		sphere_column(c1, r1, p.X, p.Z, b0, b1);
+		for (p.Y = a0; p.Y <= a1; p.Y++) {
+			if (p.Y < b0 || p.Y > b1)
+				removeRef(m_refs, p);
+		}
+	}
+}
+
+void ActiveBlockList::setCone(TrackedPlayer &player, const PlayerView &view)
+{
+	const PlayerView &old = player.cone_view;
+	if (old.cone_range == view.cone_range && (view.cone_range == 0 ||
+			(old.blockpos == view.blockpos && old.camera_pos == view.camera_pos &&
+			old.camera_dir == view.camera_dir && old.fov == view.fov)))
+		return;
+
+	std::vector<v3s16> cone;
+	if (view.cone_range > 0) {
+		fillViewConeBlock(view.blockpos, view.cone_range, view.camera_pos,
+			view.camera_dir, view.fov, cone);
+	}
+	for (v3s16 p : cone)
+		addRef(m_extra_refs, p);
+	for (v3s16 p : player.cone)
+		removeRef(m_extra_refs, p);
+	player.cone = std::move(cone);
+	player.cone_view = view;
+}
+
 void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	s16 active_block_range,
 	s16 active_object_range,
@@ -87,14 +165,12 @@ void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	std::set<v3s16> &blocks_added,
 	std::set<v3s16> &extra_blocks_added)
 {
-	/*
-		Create the new list
-	*/
-	std::set<v3s16> newlist = m_forceloaded_list;
-	std::set<v3s16> extralist;
+	std::vector<PlayerView> views;
+	views.reserve(active_players.size());
 	for (const PlayerSAO *playersao : active_players) {
-		v3s16 pos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
-		fillRadiusBlock(pos, active_block_range, newlist);
+		PlayerView &view = views.emplace_back();
+		view.id = playersao->getId();
+		view.blockpos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
 
 		s16 player_ao_range = std::min(active_object_range, playersao->getWantedRange());
 		// only do this if this would add blocks
@@ -104,60 +180,94 @@ void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 			camera_dir.rotateXZBy(playersao->getRotation().Y);
 			if (playersao->getCameraInverted())
 				camera_dir = -camera_dir;
-			fillViewConeBlock(pos,
-				player_ao_range,
-				playersao->getEyePosition(),
-				camera_dir,
-				playersao->getFov(),
-				extralist);
+			view.cone_range = player_ao_range;
+			view.camera_pos = playersao->getEyePosition();
+			view.camera_dir = camera_dir;
+			view.fov = playersao->getFov();
 		}
 	}
 
-	m_abm_list = newlist;
-
-	// 1. Find out which blocks on the new list are not on the old list
-	std::set_difference(newlist.begin(), newlist.end(), m_list.begin(), m_list.end(),
-			std::inserter(blocks_added, blocks_added.end()));
+	update(views, active_block_range, blocks_removed, blocks_added,
+		extra_blocks_added);
+}
 
-	// 2. remove duplicate blocks from the extra list
-	for (v3s16 p : newlist) {
-		extralist.erase(p);
+void ActiveBlockList::update(const std::vector<PlayerView> &players,
+	s16 active_block_range,
+	std::set<v3s16> &blocks_removed,
+	std::set<v3s16> &blocks_added,
+	std::set<v3s16> &extra_blocks_added)
+{
+	/*
+		Update the reference counts
+	*/
+	if (m_forceloaded_list != m_forceloaded_applied) {
+		for (v3s16 p : m_forceloaded_list) {
+			if (m_forceloaded_applied.count(p) == 0)
+				addRef(m_refs, p);
+		}
+		for (v3s16 p : m_forceloaded_applied) {
+			if (m_forceloaded_list.count(p) == 0)
+				removeRef(m_refs, p);
+		}
+		m_forceloaded_applied = m_forceloaded_list;
 	}
 
-	// 3. Find out which blocks on the extra list are not on the old list
-	std::set_difference(extralist.begin(), extralist.end(), m_list.begin(), m_list.end(),
-			std::inserter(extra_blocks_added, extra_blocks_added.end()));
+	for (auto &it : m_players)
+		it.second.seen = false;
 
-	// 4. make sure newlist has all new block
-	newlist.insert(extralist.begin(), extralist.end());
+	for (const PlayerView &view : players) {
+		TrackedPlayer &player = m_players[view.id];
+		if (player.seen)
+			continue; // listed twice
+		player.seen = true;
+		if (player.radius != active_block_range || player.blockpos != view.blockpos) {
+			moveSphere(player.blockpos, player.radius, view.blockpos, active_block_range);
+			player.blockpos = view.blockpos;
+			player.radius = active_block_range;
+		}
+		setCone(player, view);
+	}
 
-	// 5. Find out which blocks on the old list are not on the new + extra list
-	std::set_difference(m_list.begin(), m_list.end(), newlist.begin(), newlist.end(),
-			std::inserter(blocks_removed, blocks_removed.end()));
+	for (auto it = m_players.begin(); it != m_players.end(); ) {
+		TrackedPlayer &player = it->second;
+		if (player.seen) {
+			++it;
+			continue;
+		}
+		moveSphere(player.blockpos, player.radius, player.blockpos, -1);
+		setCone(player, PlayerView());
+		it = m_players.erase(it);
+	}
+
+	/*
+		Add and remove the blocks that changed
+	*/
+	for (v3s16 p : m_touched) {
+		const bool wanted = m_refs.count(p) > 0;
+		const bool extra = !wanted && m_extra_refs.count(p) > 0;
+		const bool active = m_list.count(p) > 0;
+		if (wanted || extra) {
+			if (!active) {
+				(wanted ? blocks_added : extra_blocks_added).insert(p);
+				m_list.insert(p);
+			}
+			if (wanted)
+				m_abm_list.insert(p);
+			else
+				m_abm_list.erase(p);
+		} else if (active) {
+			blocks_removed.insert(p);
+			m_list.erase(p);
+			m_abm_list.erase(p);
+		}
+	}
+	m_touched.clear();
 
 	/*
 		Do some least-effort sanity checks to hopefully catch code bugs.
 	*/
-	assert(newlist.size() >= extralist.size());
-	assert(newlist.size() >= m_abm_list.size());
-	assert(blocks_removed.size() <= m_list.size());
-	if (!blocks_added.empty()) {
-		assert(newlist.count(*blocks_added.begin()) > 0);
-		assert(blocks_removed.count(*blocks_added.begin()) == 0);
-	}
-	if (!extra_blocks_added.empty()) {
-		assert(newlist.count(*extra_blocks_added.begin()) > 0);
-		assert(extralist.count(*extra_blocks_added.begin()) > 0);
-		assert(blocks_added.count(*extra_blocks_added.begin()) == 0);
-	}
-	if (!blocks_removed.empty()) {
-		assert(newlist.count(*blocks_removed.begin()) == 0);
-		assert(extralist.count(*blocks_removed.begin()) == 0);
-		assert(m_list.count(*blocks_removed.begin()) > 0);
-	}
-
-	// Update m_list
-	m_list = std::move(newlist);
+	assert(m_list.size() >= m_abm_list.size());
+	assert(m_abm_list.size() <= m_refs.size());
 }
 
 /*
@@ -186,8 +296,23 @@ ServerEnvironment::ServerEnvironment(std::unique_ptr<ServerMap> map,
 	m_cache_active_block_mgmt_interval = g_settings->getFloat("active_block_mgmt_interval");
 	m_cache_abm_interval = rangelim(g_settings->getFloat("abm_interval"), 0.1f, 30);
 	m_cache_nodetimer_interval = rangelim(g_settings->getFloat("nodetimer_interval"), 0.1f, 1);
+	m_node_timer_scheduler = std::make_unique<NodeTimerScheduler>(m_cache_nodetimer_interval);
 	m_cache_abm_time_budget = g_settings->getFloat("abm_time_budget");
 
+	if (m_map) {
+		m_map->addEventReceiver(&m_sao_changes_receiver);
+		m_sao_changes_receiver.receiving = true;
+	}
+
+	{
+		s16 nthreads = g_settings->getS16("num_abm_threads");
+		if (nthreads <= 0)
+			nthreads = std::min(4U, Thread::getNumberOfProcessors() / 2);
+		// the server thread also does work, so it is counted
+		nthreads = std::max<s16>(1, nthreads);
+		m_abm_pool = std::make_unique<WorkerPool>("ABM", nthreads - 1);
+	}
+
 	m_step_time_counter = mb->addCounter(
 		"minetest_env_step_time", "Time spent in environment step (in microseconds)");
 
@@ -280,6 +405,12 @@ void ServerEnvironment::deactivateBlocksAndObjects()
 	// try to add new objects.
 	m_shutting_down = true;
 
+	// Node timers of the blocks that stay loaded go on without the scheduler
+	for (const v3s16 &p : m_active_blocks.m_list) {
+		if (MapBlock *block = m_map->getBlockNoCreateNoEx(p))
+			block->detachNodeTimers();
+	}
+
 	// Clear active block list.
 	// This makes the next code delete all active objects.
 	m_active_blocks.clear();
@@ -581,6 +712,11 @@ void ServerEnvironment::activateBlock(MapBlock *block)
 	block->step((float)dtime_s, [&](v3s16 p, MapNode n, NodeTimer t) -> bool {
 		return m_script->node_on_timer(p, n, t.elapsed, t.timeout);
 	});
+	if (block->isOrphan())
+		return;
+
+	// From now on the timers are stepped when due
+	block->attachNodeTimers(m_node_timer_scheduler.get());
 }
 
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
@@ -936,6 +1072,7 @@ void ServerEnvironment::step(float dtime)
 
 			// Set current time as timestamp (and let it set ChangedFlag)
 			block->setTimestamp(m_game_time);
+			block->detachNodeTimers();
 		}
 
 		/*
@@ -970,21 +1107,9 @@ void ServerEnvironment::step(float dtime)
 		// Some blocks may be removed again by the code above so do this here
 		m_active_block_gauge->set(m_active_blocks.size());
 
-		if (m_fast_active_block_divider > 1)
-			--m_fast_active_block_divider;
-	}
-
-	/*
-		Mess around in active blocks
-	*/
-	if (m_active_blocks_nodemetadata_interval.step(dtime, m_cache_nodetimer_interval)) {
-		ScopeProfiler sp(g_profiler, "ServerEnv: Run node timers", SPT_AVG);
-
-		// FIXME: this is not actually correct, because the block may have been
-		// activated just moments ago. In practice the intervnal is very small
-		// so this doesn't really matter.
-		const float dtime = m_cache_nodetimer_interval;
-
+		/*
+			Keep the active blocks from being unloaded
+		*/
 		for (const v3s16 &p: m_active_blocks.m_list) {
 			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
 			if (!block)
@@ -1004,11 +1129,37 @@ void ServerEnvironment::step(float dtime)
 					MOD_REASON_BLOCK_EXPIRED);
 			}
 
+			// The block was replaced while active (e.g. by a reload)
+			if (!block->nodeTimersAttachedTo(m_node_timer_scheduler.get()))
+				block->attachNodeTimers(m_node_timer_scheduler.get());
+		}
+
+		if (m_fast_active_block_divider > 1)
+			--m_fast_active_block_divider;
+	}
+
+	/*
+		Mess around in active blocks
+	*/
+	if (m_active_blocks_nodemetadata_interval.step(dtime, m_cache_nodetimer_interval)) {
+		ScopeProfiler sp(g_profiler, "ServerEnv: Run node timers", SPT_AVG);
+
+		// Only the blocks with timers due are visited
+		std::vector<v3s16> due;
+		m_node_timer_scheduler->step(due);
+
+		for (const v3s16 &p: due) {
+			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+			// Skip blocks that were deactivated or replaced meanwhile
+			if (!block || !block->nodeTimersAttachedTo(m_node_timer_scheduler.get()))
+				continue;
+
 			// Run node timers
-			block->step(dtime, [&](v3s16 p, MapNode n, NodeTimer t) -> bool {
+			block->step(0, [&](v3s16 p, MapNode n, NodeTimer t) -> bool {
 				return m_script->node_on_timer(p, n, t.elapsed, t.timeout);
 			});
 		}
+		g_profiler->avg("ServerEnv: blocks with node timers due", due.size());
 	}
 
 	if (m_active_block_modifier_interval.step(dtime, m_cache_abm_interval)) {
@@ -1033,34 +1184,71 @@ void ServerEnvironment::step(float dtime)
 		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
 		std::shuffle(output.begin(), output.end(), MyRandGenerator());
 
-		int i = 0;
-		// determine the time budget for ABMs
-		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
+		struct BlockTriggers {
+			MapBlock *block = nullptr;
+			u64 seed = 0;
+			bool cached = false;
+			bool scanned = false;
+			std::vector<ABMTrigger> triggers;
+		};
+		std::vector<BlockTriggers> blocks;
+		blocks.reserve(output.size());
 		for (const v3s16 &p : output) {
 			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
 			if (!block)
 				continue;
 
-			i++;
-
 			// Set current time as timestamp
 			block->setTimestampNoChangedFlag(m_game_time);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			BlockTriggers &it = blocks.emplace_back();
+			it.block = block;
+			it.seed = ((u64)myrand() << 32) | myrand();
+		}
 
-			u32 time_ms = timer.getTimerTime();
+		// Find what to trigger in parallel, the map doesn't change meanwhile
+		size_t triggers_found = 0;
+		{
+			ScopeProfiler sp2(g_profiler, "SEnv: ABM find triggers avg per interval", SPT_AVG);
+			m_abm_pool->run(blocks.size(), [&] (size_t i) {
+				auto &it = blocks[i];
+				it.scanned = abmhandler.findTriggers(it.block, it.seed,
+					it.triggers, it.cached);
+			});
+			for (auto &it : blocks) {
+				blocks_cached += it.cached ? 1 : 0;
+				blocks_scanned += it.scanned ? 1 : 0;
+				triggers_found += it.triggers.size();
+			}
+		}
 
-			if (time_ms > max_time_ms) {
-				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
-				break;
+		// Then run the callbacks, within the time budget
+		{
+			ScopeProfiler sp2(g_profiler, "SEnv: ABM run triggers avg per interval", SPT_AVG);
+			int i = 0;
+			u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
+			for (auto &it : blocks) {
+				i++;
+				// Earlier triggers may have removed the block
+				if (it.block->isOrphan())
+					continue;
+
+				abmhandler.runTriggers(it.block, it.triggers, abms_run);
+
+				u32 time_ms = timer.getTimerTime();
+
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << i << " of "
+						  << blocks.size() << " active blocks)" << std::endl;
+					break;
+				}
 			}
 		}
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
 		g_profiler->avg("ServerEnv: active blocks cached", blocks_cached);
 		g_profiler->avg("ServerEnv: active blocks scanned for ABMs", blocks_scanned);
+		g_profiler->avg("ServerEnv: ABM triggers found", triggers_found);
 		g_profiler->avg("ServerEnv: ABMs run", abms_run);
 
 		timer.stop(true);
@@ -1087,7 +1275,14 @@ void ServerEnvironment::step(float dtime)
 			send_recommended = true;
 		}
 
-		u32 object_count = 0;
+		// Changes made from here on are seen in this and the next step
+		m_sao_changes_previous.clear();
+		std::swap(m_sao_changes_previous, m_sao_changes_receiver.modified_blocks);
+
+		u32 object_count = 0, resting_count = 0;
+		// Time spent per entity name [ns]
+		std::map<std::string, u64> step_times;
+		static const std::string player_name = "(player)";
 
 		auto cb_state = [&](ServerActiveObject *obj) {
 			if (obj->isGone())
@@ -1095,13 +1290,25 @@ void ServerEnvironment::step(float dtime)
 			object_count++;
 
 			// Step object
+			const u64 t0 = porting::getTimeNs();
 			obj->step(dtime, send_recommended);
+			const u64 t1 = porting::getTimeNs();
+			if (obj->getType() == ACTIVEOBJECT_TYPE_LUAENTITY) {
+				auto *entity = static_cast<LuaEntitySAO *>(obj);
+				step_times[entity->getName()] += t1 - t0;
+				resting_count += entity->isResting() ? 1 : 0;
+			} else {
+				step_times[player_name] += t1 - t0;
+			}
 			// Read messages from object
 			obj->dumpAOMessagesToQueue(m_active_object_messages);
 		};
 		m_ao_manager.step(dtime, cb_state);
 
 		m_active_object_gauge->set(object_count);
+		g_profiler->avg("ServerEnv: SAOs at rest", resting_count);
+		for (const auto &it : step_times)
+			g_profiler->avg("SAO step: " + it.first + " [us]", it.second / 1000.0f);
 	}
 
 	/*
@@ -1155,6 +1362,23 @@ void ServerEnvironment::step(float dtime)
 	m_step_time_counter->increment(end_time - start_time);
 }
 
+bool ServerEnvironment::wereBlocksModified(v3s16 blockpos_min,
+	v3s16 blockpos_max) const
+{
+	const auto &current = m_sao_changes_receiver.modified_blocks;
+	if (current.empty() && m_sao_changes_previous.empty())
+		return false;
+
+	v3s16 p;
+	for (p.X = blockpos_min.X; p.X <= blockpos_max.X; p.X++)
+	for (p.Y = blockpos_min.Y; p.Y <= blockpos_max.Y; p.Y++)
+	for (p.Z = blockpos_min.Z; p.Z <= blockpos_max.Z; p.Z++) {
+		if (current.count(p) || m_sao_changes_previous.count(p))
+			return true;
+	}
+	return false;
+}
+
 ServerEnvironment::BlockStatus ServerEnvironment::getBlockStatus(v3s16 blockpos)
 {
 	if (m_active_blocks.contains(blockpos))
@@ -1230,12 +1454,12 @@ void ServerEnvironment::invalidateActiveObjectObserverCaches()
 }
 
 /*
-	Finds out what new objects have been added to
-	inside a radius around a position
+	Finds out what objects have come into and gone out of range of a player
 */
-void ServerEnvironment::getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
-	s16 player_radius,
-	const std::set<u16> &current_objects,
+void ServerEnvironment::getActiveObjectChanges(PlayerSAO *playersao, s16 radius,
+	s16 player_radius, server::ObjectsInRange &in_range,
+	const std::vector<u16> &current_objects,
+	std::vector<std::pair<bool /* gone? */, u16>> &removed_objects,
 	std::vector<u16> &added_objects)
 {
 	f32 radius_f = radius * BS;
@@ -1244,66 +1468,42 @@ void ServerEnvironment::getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
 	if (player_radius_f < 0.0f)
 		player_radius_f = 0.0f;
 
-	if (!playersao->isEffectivelyObservedBy(playersao->getPlayer()->getName()))
-		throw ModError("Player does not observe itself");
-
-	m_ao_manager.getAddedActiveObjectsAroundPos(
-		playersao->getBasePosition(), playersao->getPlayer()->getName(),
-		radius_f, player_radius_f,
-		current_objects, added_objects);
-}
-
-/*
-	Finds out what objects have been removed from
-	inside a radius around a position
-*/
-void ServerEnvironment::getRemovedActiveObjects(PlayerSAO *playersao, s16 radius,
-	s16 player_radius,
-	const std::set<u16> &current_objects,
-	std::vector<std::pair<bool /* gone? */, u16>> &removed_objects)
-{
-	f32 radius_f = radius * BS;
-	f32 player_radius_f = player_radius * BS;
-
-	if (player_radius_f < 0)
-		player_radius_f = 0;
-
 	const std::string &player_name = playersao->getPlayer()->getName();
 
 	if (!playersao->isEffectivelyObservedBy(player_name))
 		throw ModError("Player does not observe itself");
 
+	std::vector<u16> visible;
+	m_ao_manager.getActiveObjectsInRange(playersao->getBasePosition(),
+		player_name, radius_f, player_radius_f, in_range, visible);
+
 	/*
-		Go through current_objects; object is removed if:
-		- object is not found in m_active_objects (this is actually an
-		  error condition; objects should be removed only after all clients
-		  have been informed about removal), or
-		- object is to be removed or deactivated, or
-		- object is too far away, or
-		- object is marked as not observable by the client
+		Both lists are sorted, walk them side by side:
+		- objects only in current_objects have been removed, deactivated,
+		  gone out of range or are not observable by the client anymore,
+		- objects only in visible have been added.
 	*/
-	for (u16 id : current_objects) {
-		ServerActiveObject *object = getActiveObject(id);
-
-		if (!object) {
-			warningstream << FUNCTION_NAME << ": found NULL object id="
-				<< (int)id << std::endl;
-			removed_objects.emplace_back(true, id);
-			continue;
-		}
-
-		if (object->isGone()) {
-			removed_objects.emplace_back(true, id);
-			continue;
+	auto cur = current_objects.begin();
+	auto vis = visible.begin();
+	while (cur != current_objects.end() || vis != visible.end()) {
+		if (vis == visible.end() || (cur != current_objects.end() && *cur < *vis)) {
+			u16 id = *cur++;
+			ServerActiveObject *object = getActiveObject(id);
+			if (!object) {
+				// This is actually an error condition; objects should be removed
+				// only after all clients have been informed about removal
+				warningstream << FUNCTION_NAME << ": found NULL object id="
+					<< (int)id << std::endl;
+				removed_objects.emplace_back(true, id);
+			} else {
+				removed_objects.emplace_back(object->isGone(), id);
+			}
+		} else if (cur == current_objects.end() || *vis < *cur) {
+			added_objects.push_back(*vis++);
+		} else {
+			++cur;
+			++vis;
 		}
-
-		f32 distance_f = object->getBasePosition().getDistanceFrom(playersao->getBasePosition());
-		bool in_range = object->getType() == ACTIVEOBJECT_TYPE_PLAYER
-			? distance_f <= player_radius_f || player_radius_f == 0
-			: distance_f <= radius_f;
-
-		if (!in_range || !object->isEffectivelyObservedBy(player_name))
-			removed_objects.emplace_back(false, id); // out of range or not observed anymore
 	}
 }
 
@@ -7,16 +7,19 @@
 #include <memory> // std::unique_ptr
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility> // std::function
 #include <vector>
 
 #include "environment.h"
 #include "util/guid.h"
 #include "map.h" // MapEventReceiver
+#include "nodetimer.h"
 #include "server/activeobjectmgr.h"
 #include "server/blockmodifier.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
+#include "util/timerwheel.h"
 
 class AuthDatabase;
 class ActiveObject;
@@ -29,6 +32,7 @@ class ServerActiveObject;
 class ServerEnvironment;
 class ServerScripting;
 class Settings;
+class WorkerPool;
 struct ActiveObjectMessage;
 struct GameParams;
 struct StaticObject;
@@ -40,11 +44,27 @@ typedef u16 session_t;
 
 /*
 	List of active blocks, used by ServerEnvironment
+
+	Kept up to date incrementally: every block knows how many player spheres
+	and forceloads (or view cones) want it, and an update only looks at the
+	blocks whose count went from or to zero. A player that stays in the same
+	block costs nothing, one that moves costs the difference of the spheres.
 */
 
 class ActiveBlockList
 {
 public:
+	// What a player wants to be active
+	struct PlayerView {
+		u16 id = 0;
+		v3s16 blockpos;
+		// Blocks in sight up to this distance are active too, 0 = none
+		s16 cone_range = 0;
+		v3f camera_pos;
+		v3f camera_dir;
+		f32 fov = 0.0f;
+	};
+
 	void update(std::vector<PlayerSAO*> &active_players,
 		s16 active_block_range,
 		s16 active_object_range,
@@ -52,6 +72,12 @@ class ActiveBlockList
 		std::set<v3s16> &blocks_added,
 		std::set<v3s16> &extra_blocks_added);
 
+	void update(const std::vector<PlayerView> &players,
+		s16 active_block_range,
+		std::set<v3s16> &blocks_removed,
+		std::set<v3s16> &blocks_added,
+		std::set<v3s16> &extra_blocks_added);
+
 	bool contains(v3s16 p) const {
 		return (m_list.find(p) != m_list.end());
 	}
@@ -62,12 +88,20 @@ class ActiveBlockList
 
 	void clear() {
 		m_list.clear();
+		m_abm_list.clear();
+		m_refs.clear();
+		m_extra_refs.clear();
+		m_players.clear();
+		m_forceloaded_applied.clear();
+		m_touched.clear();
 	}
 
 	/// @return true if block was newly added
 	bool add(v3s16 p) {
 		if (m_list.insert(p).second) {
 			m_abm_list.insert(p);
+			// dropped again by the next update unless wanted
+			m_touched.insert(p);
 			return true;
 		}
 		return false;
@@ -76,15 +110,43 @@ class ActiveBlockList
 	void remove(v3s16 p) {
 		m_list.erase(p);
 		m_abm_list.erase(p);
+		// added again by the next update if still wanted
+		m_touched.insert(p);
 	}
 
 	// list of all active blocks
-	std::set<v3s16> m_list;
+	std::unordered_set<v3s16> m_list;
 	// list of blocks for ABM processing
 	// subset of `m_list` that does not contain view cone affected blocks
-	std::set<v3s16> m_abm_list;
+	std::unordered_set<v3s16> m_abm_list;
 	// list of blocks that are always active, not modified by this class
 	std::set<v3s16> m_forceloaded_list;
+
+private:
+	struct TrackedPlayer {
+		v3s16 blockpos;
+		s16 radius = -1;
+		PlayerView cone_view;
+		std::vector<v3s16> cone;
+		bool seen = false;
+	};
+
+	typedef std::unordered_map<v3s16, u32> RefMap;
+
+	void addRef(RefMap &refs, v3s16 p);
+	void removeRef(RefMap &refs, v3s16 p);
+	// Moves the sphere of a player, a negative radius means no sphere
+	void moveSphere(v3s16 c0, s16 r0, v3s16 c1, s16 r1);
+	void setCone(TrackedPlayer &player, const PlayerView &view);
+
+	// Number of spheres and forceloads that want a block
+	RefMap m_refs;
+	// Number of view cones that want a block
+	RefMap m_extra_refs;
+	std::unordered_map<u16, TrackedPlayer> m_players;
+	std::set<v3s16> m_forceloaded_applied;
+	// Blocks that may have to be added or removed on the next update
+	std::unordered_set<v3s16> m_touched;
 };
 
 /*
@@ -97,6 +159,35 @@ struct OnMapblocksChangedReceiver : public MapEventReceiver {
 	void onMapEditEvent(const MapEditEvent &event) override;
 };
 
+/*
+	Clock of the node timers of the active blocks, ticking once per
+	nodetimer_interval. Knows which blocks have timers due at each tick.
+*/
+class NodeTimerScheduler : public NodeTimerClock
+{
+public:
+	NodeTimerScheduler(double interval) : m_interval(interval) {}
+
+	double getTime() const override { return m_wheel.getTick() * m_interval; }
+
+	void schedule(v3s16 blockpos, double time) override
+	{
+		m_wheel.schedule(blockpos, (u64)std::ceil(time / m_interval));
+	}
+
+	/// Advances by one tick, appending the blocks with timers due.
+	void step(std::vector<v3s16> &due)
+	{
+		m_wheel.advance(m_wheel.getTick() + 1, due);
+	}
+
+	size_t size() const { return m_wheel.size(); }
+
+private:
+	const double m_interval;
+	TimerWheel<v3s16> m_wheel;
+};
+
 /*
 	Operation mode for ServerEnvironment::clearObjects()
 */
@@ -175,22 +266,21 @@ class ServerEnvironment final : public Environment
 	void invalidateActiveObjectObserverCaches();
 
 	/*
-		Find out what new objects have been added to
-		inside a radius around a position
+		Whether nodes in the given area of blocks may have changed since
+		the active objects were stepped the last time
 	*/
-	void getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
-		s16 player_radius,
-		const std::set<u16> &current_objects,
-		std::vector<u16> &added_objects);
+	bool wereBlocksModified(v3s16 blockpos_min, v3s16 blockpos_max) const;
 
 	/*
-		Find out what new objects have been removed from
-		inside a radius around a position
+		Find out what objects have come into and gone out of range of a
+		player. current_objects are the objects the client knows of, sorted.
+		in_range is carried over from the previous call for this player.
 	*/
-	void getRemovedActiveObjects(PlayerSAO *playersao, s16 radius,
-		s16 player_radius,
-		const std::set<u16> &current_objects,
-		std::vector<std::pair<bool /* gone? */, u16>> &removed_objects);
+	void getActiveObjectChanges(PlayerSAO *playersao, s16 radius,
+		s16 player_radius, server::ObjectsInRange &in_range,
+		const std::vector<u16> &current_objects,
+		std::vector<std::pair<bool /* gone? */, u16>> &removed_objects,
+		std::vector<u16> &added_objects);
 
 	/*
 		Get the next message emitted by some active object.
@@ -371,6 +461,10 @@ class ServerEnvironment final : public Environment
 	server::ActiveObjectMgr m_ao_manager;
 	// on_mapblocks_changed map event receiver
 	OnMapblocksChangedReceiver m_on_mapblocks_changed_receiver;
+	// Blocks modified during and since the previous step of the active
+	// objects, for the objects at rest
+	OnMapblocksChangedReceiver m_sao_changes_receiver;
+	std::unordered_set<v3s16> m_sao_changes_previous;
 	GUIDGenerator m_guid_generator;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
@@ -383,6 +477,8 @@ class ServerEnvironment final : public Environment
 	IntervalLimiter m_active_blocks_mgmt_interval;
 	IntervalLimiter m_active_block_modifier_interval;
 	IntervalLimiter m_active_blocks_nodemetadata_interval;
+	// Node timers of the active blocks are attached to this
+	std::unique_ptr<NodeTimerScheduler> m_node_timer_scheduler;
 	// Whether the variables below have been read from file yet
 	bool m_meta_loaded = false;
 	// Are we shutting down?
@@ -397,6 +493,8 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Finds the nodes to trigger ABMs on
+	std::unique_ptr<WorkerPool> m_abm_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
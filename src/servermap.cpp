@@ -28,6 +28,9 @@
 #include "database/database-dummy.h"
 #include "database/database-sqlite3.h"
 #include "script/scripting_server.h"
+#include "server/liquidtransform.h"
+#include "server/mapsavethread.h"
+#include "threading/worker_pool.h"
 #if USE_LEVELDB
 #include "database/database-leveldb.h"
 #endif
@@ -42,14 +45,32 @@
 	Helpers
 */
 
+// Snapshots waiting for the background saver, see MapSaveThread::enqueue()
+static constexpr size_t MAX_PENDING_SAVE_BYTES = 128 * 1024 * 1024;
+
 void MapDatabaseAccessor::loadBlock(v3s16 blockpos, std::string &ret)
 {
 	ret.clear();
+	// Data that is still pending is newer than what the database has
+	if (saver && saver->getBlock(blockpos, ret))
+		return;
 	dbase->loadBlock(blockpos, &ret);
 	if (ret.empty() && dbase_ro)
 		dbase_ro->loadBlock(blockpos, &ret);
 }
 
+void MapDatabaseAccessor::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> &ret)
+{
+	dbase->loadBlocks(pos, ret);
+	for (size_t i = 0; i < pos.size(); i++) {
+		if (saver && saver->getBlock(pos[i], ret[i]))
+			continue;
+		if (ret[i].empty() && dbase_ro)
+			dbase_ro->loadBlock(pos[i], &ret[i]);
+	}
+}
+
 /*
 	ServerMap
 */
@@ -94,11 +115,34 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 		"minetest_map_save_time", "Time spent saving blocks (in microseconds)");
 	m_save_count_counter = mb->addCounter(
 		"minetest_map_saved_blocks", "Number of blocks saved");
+	m_save_deferred_counter = mb->addCounter(
+		"minetest_map_deferred_saves",
+		"Number of block saves put off because the map saver was behind");
 	m_loaded_blocks_gauge = mb->addGauge(
 		"minetest_map_loaded_blocks", "Number of loaded blocks");
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
+	if (g_settings->getBool("server_map_save_async")) {
+		const unsigned int cores = Thread::getNumberOfProcessors();
+		// the writer thread itself compresses too
+		const unsigned int compress_threads =
+			std::min(4U, std::max(1U, cores / 4)) - 1;
+		m_saver = std::make_unique<MapSaveThread>(&m_db, m_map_compression_level,
+			compress_threads, MAX_PENDING_SAVE_BYTES, mb);
+		m_db.saver = m_saver.get();
+		m_saver->start();
+	}
+
+	{
+		s16 nthreads = g_settings->getS16("num_liquid_threads");
+		if (nthreads <= 0)
+			nthreads = std::min(4U, Thread::getNumberOfProcessors() / 2);
+		// the server thread also does work, so it is counted
+		nthreads = std::max<s16>(1, nthreads);
+		m_liquid_pool = std::make_unique<WorkerPool>("Liquid", nthreads - 1);
+	}
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -147,6 +191,7 @@ ServerMap::~ServerMap()
 	{
 		if (m_map_saving_enabled) {
 			// Save only changed parts
+			m_saving_at_shutdown = true;
 			save(MOD_STATE_WRITE_AT_UNLOAD);
 			infostream << "ServerMap: Saved map to " << m_savedir << std::endl;
 		} else {
@@ -159,6 +204,14 @@ ServerMap::~ServerMap()
 				 << ", exception: " << e.what() << std::endl;
 	}
 
+	if (m_saver) {
+		// Write out everything that is still queued
+		m_saver->finish();
+		MutexAutoLock dblock(m_db.mutex);
+		m_db.saver = nullptr;
+	}
+	m_saver.reset();
+
 	m_emerge->resetMap();
 
 	{
@@ -382,7 +435,7 @@ MapSector *ServerMap::createSector(v2s16 p2d)
 	/*
 		Insert to container
 	*/
-	m_sectors[p2d] = sector;
+	m_sectors.insert(p2d, sector);
 
 	return sector;
 }
@@ -534,6 +587,7 @@ void ServerMap::save(ModifiedState save_level)
 	Profiler modprofiler;
 
 	u32 block_count = 0;
+	u32 block_count_deferred = 0; // Refused by the saver, saved later
 	u32 block_count_all = 0; // Number of blocks in memory
 
 	// Don't do anything with sqlite unless something is really saved
@@ -555,10 +609,13 @@ void ServerMap::save(ModifiedState save_level)
 					save_started = true;
 				}
 
-				modprofiler.add(block->getModifiedReasonString(), 1);
-
-				saveBlock(block);
-				block_count++;
+				const std::string reason = block->getModifiedReasonString();
+				if (saveBlock(block)) {
+					modprofiler.add(reason, 1);
+					block_count++;
+				} else {
+					block_count_deferred++;
+				}
 			}
 		}
 	}
@@ -570,11 +627,16 @@ void ServerMap::save(ModifiedState save_level)
 		Only print if something happened or saved whole map
 	*/
 	if(save_level == MOD_STATE_CLEAN
-			|| block_count != 0) {
+			|| block_count != 0 || block_count_deferred != 0) {
 		infostream << "ServerMap: Written: "
 				<< block_count << " blocks"
 				<< ", " << block_count_all << " blocks in memory."
 				<< std::endl;
+		if (block_count_deferred != 0) {
+			infostream << "ServerMap: Map saver is behind, "
+					<< block_count_deferred << " blocks left for a later save."
+					<< std::endl;
+		}
 		PrintInfo(infostream); // ServerMap/ClientMap:
 		infostream<<"Blocks modified by: "<<std::endl;
 		modprofiler.print(infostream);
@@ -582,6 +644,7 @@ void ServerMap::save(ModifiedState save_level)
 
 	const auto end_time = porting::getTimeUs();
 	reportMetrics(end_time - start_time, block_count, block_count_all);
+	m_save_deferred_counter->increment(block_count_deferred);
 }
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
@@ -590,6 +653,13 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 	m_db.dbase->listAllLoadableBlocks(dst);
 	if (m_db.dbase_ro)
 		m_db.dbase_ro->listAllLoadableBlocks(dst);
+
+	if (m_saver && m_saver->getPendingCount() > 0) {
+		// pending blocks may or may not be in the database already
+		m_saver->listPending(dst);
+		std::sort(dst.begin(), dst.end());
+		dst.erase(std::unique(dst.begin(), dst.end()), dst.end());
+	}
 }
 
 void ServerMap::listAllLoadedBlocks(std::vector<v3s16> &dst)
@@ -671,24 +741,47 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	// the saver manages its own transactions
+	if (m_saver)
+		return;
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	if (m_saver)
+		return;
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
+	if (m_saver) {
+		// Only take a snapshot here, compressing and writing is done later.
+		// If the saver is behind the block stays modified and is saved by a
+		// later cycle, instead of stalling the server step.
+		std::ostringstream os(std::ios_base::binary);
+		block->serializeUncompressed(os, SER_FMT_VER_HIGHEST_WRITE, true);
+		if (!m_saver->enqueue(block->getPos(), os.str(), m_saving_at_shutdown))
+			return false;
+		m_db.write_counter++;
+		block->resetModified();
+		return true;
+	}
+
 	// FIXME: serialization happens under mutex
 	MutexAutoLock dblock(m_db.mutex);
-	return saveBlock(block, m_db.dbase, m_map_compression_level);
+	size_t size = 0;
+	bool ret = saveBlock(block, m_db.dbase, m_map_compression_level, &size);
+	m_db.write_counter++;
+	m_db.bytes_written += size;
+	return ret;
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level,
+	size_t *size)
 {
 	v3s16 p3d = block->getPos();
 
@@ -708,6 +801,8 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	if (ret) {
 		// We just wrote it to the disk so clear modified flag
 		block->resetModified();
+		if (size)
+			*size = o.tellp();
 	}
 	return ret;
 }
@@ -809,7 +904,11 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
 	MutexAutoLock dblock(m_db.mutex);
-	if (!m_db.dbase->deleteBlock(blockpos))
+	if (m_saver)
+		m_saver->discard(blockpos);
+	bool deleted = m_db.dbase->deleteBlock(blockpos);
+	m_db.write_counter++;
+	if (!deleted)
 		return false;
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
@@ -843,6 +942,12 @@ void ServerMap::step()
 	deleteDetachedBlocks();
 }
 
+void ServerMap::flushSaves()
+{
+	if (m_saver)
+		m_saver->flush();
+}
+
 void ServerMap::PrintInfo(std::ostream &out)
 {
 	out<<"ServerMap: ";
@@ -862,65 +967,6 @@ bool ServerMap::repairBlockLight(v3s16 blockpos,
 	Liquids
 */
 
-#define WATER_DROP_BOOST 4
-
-const static v3s16 liquid_6dirs[6] = {
-	// order: upper before same level before lower
-	v3s16( 0, 1, 0),
-	v3s16( 0, 0, 1),
-	v3s16( 1, 0, 0),
-	v3s16( 0, 0,-1),
-	v3s16(-1, 0, 0),
-	v3s16( 0,-1, 0)
-};
-
-enum NeighborType : u8 {
-	NEIGHBOR_UPPER,
-	NEIGHBOR_SAME_LEVEL,
-	NEIGHBOR_LOWER
-};
-
-struct NodeNeighbor {
-	MapNode n;
-	NeighborType t;
-	v3s16 p;
-
-	NodeNeighbor()
-		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
-	{ }
-
-	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
-		: n(node),
-		  t(n_type),
-		  p(pos)
-	{ }
-};
-
-static s8 get_max_liquid_level(NodeNeighbor nb, s8 current_max_node_level)
-{
-	s8 max_node_level = current_max_node_level;
-	u8 nb_liquid_level = (nb.n.param2 & LIQUID_LEVEL_MASK);
-	switch (nb.t) {
-		case NEIGHBOR_UPPER:
-			if (nb_liquid_level + WATER_DROP_BOOST > current_max_node_level) {
-				max_node_level = LIQUID_LEVEL_MAX;
-				if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-					max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-			} else if (nb_liquid_level > current_max_node_level) {
-				max_node_level = nb_liquid_level;
-			}
-			break;
-		case NEIGHBOR_LOWER:
-			break;
-		case NEIGHBOR_SAME_LEVEL:
-			if ((nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-					nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-				max_node_level = nb_liquid_level - 1;
-			break;
-	}
-	return max_node_level;
-}
-
 void ServerMap::transforming_liquid_add(v3s16 p)
 {
 	m_transforming_liquid.push_back(p);
@@ -929,261 +975,27 @@ void ServerMap::transforming_liquid_add(v3s16 p)
 void ServerMap::transformLiquidsLocal(std::map<v3s16, MapBlock*> &modified_blocks, UniqueQueue<v3s16> &liquid_queue,
 		ServerEnvironment *env, u32 liquid_loop_max)
 {
-	u32 loopcount = 0;
-
-	/*if(initial_size != 0)
-		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
-
-	// list of nodes that due to viscosity have not reached their max level height
-	std::vector<v3s16> must_reflow;
-
 	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
 
 	std::vector<v3s16> check_for_falling;
 
-	while (!liquid_queue.empty())
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= liquid_loop_max)
-			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = liquid_queue.front();
-		liquid_queue.pop_front();
-
-		MapNode n0 = getNode(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = cf.liquid_alternative_flowing_id;
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
-				break;
-			case LiquidType_END:
-				break;
-		}
-
-		/*
-			Collect information about the environment
-		 */
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		bool floating_node_above = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 0:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 5:
-					nt = NEIGHBOR_LOWER;
-					break;
-				default:
-					break;
-			}
-			v3s16 npos = p0 + liquid_6dirs[i];
-			NodeNeighbor nb(getNode(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			if (nt == NEIGHBOR_UPPER && cfnb.floats)
-				floating_node_above = true;
-			switch (cfnb.liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							liquid_queue.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = cfnb.liquid_alternative_flowing_id;
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(nt != NEIGHBOR_LOWER)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					if (nb.t != NEIGHBOR_SAME_LEVEL ||
-						(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
-						// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-						// but exclude falling liquids on the same level, they cannot flow here anyway
-
-						// used to determine if the neighbor can even flow into this node
-						s8 max_level_from_neighbor = get_max_liquid_level(nb, -1);
-						u8 range = m_nodedef->get(cfnb.liquid_alternative_flowing_id).liquid_range;
-
-						if (liquid_kind == CONTENT_AIR &&
-								max_level_from_neighbor >= (LIQUID_LEVEL_MAX + 1 - range))
-							liquid_kind = cfnb.liquid_alternative_flowing_id;
-					}
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-				case LiquidType_END:
-					break;
-			}
-		}
-
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->get(liquid_kind).liquid_alternative_source_id;
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighboring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				max_node_level = get_max_liquid_level(flows[i], max_node_level);
-			}
-
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
-
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-
-		}
+	LiquidTransformer transformer(m_nodedef, m_liquid_pool.get());
+	transformer.run(this, liquid_queue, liquid_loop_max, [&] (const LiquidUpdate &u) {
+		const v3s16 p0 = u.p;
+		const MapNode n00 = getNode(p0);
 
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
-			continue;
-
-		/*
-			check if there is a floating node above that needs to be updated.
-		 */
-		if (floating_node_above && new_node_content == CONTENT_AIR)
+		if (u.check_falling)
 			check_for_falling.push_back(p0);
 
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bits to 0
-			n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-
-		// change the node.
-		n0.setContent(new_node_content);
-
 		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
-			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
-				continue;
+		if (u.floods) {
+			MapNode n_flood = u.n_new;
+			n_flood.param1 = n00.param1;
+			if (env->getScriptIface()->node_on_flood(p0, n00, n_flood))
+				return false;
 		}
 
-		// Ignore light (because calling voxalgo::update_lighting_nodes)
-		ContentLightingFlags f0 = m_nodedef->getLightingFlags(n0);
-		n0.setLight(LIGHTBANK_DAY, 0, f0);
-		n0.setLight(LIGHTBANK_NIGHT, 0, f0);
+		const MapNode n0 = u.n_new;
 
 		// Find out whether there is a suspect for this action
 		std::string suspect;
@@ -1213,34 +1025,8 @@ void ServerMap::transformLiquidsLocal(std::map<v3s16, MapBlock*> &modified_block
 			modified_blocks[blockpos] =  block;
 			changed_nodes.emplace_back(p0, n00);
 		}
-
-		/*
-			enqueue neighbors for update if necessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						liquid_queue.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						liquid_queue.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					liquid_queue.push_back(flows[i].p);
-				break;
-			case LiquidType_END:
-				break;
-		}
-	}
-	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
-
-	for (const auto &iter : must_reflow)
-		liquid_queue.push_back(iter);
+		return true;
+	});
 
 	voxalgo::update_lighting_nodes(this, changed_nodes, modified_blocks);
 
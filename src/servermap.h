@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <memory>
 
@@ -18,6 +19,8 @@ class EmergeManager;
 class ServerEnvironment;
 struct BlockMakeData;
 class MetricsBackend;
+class MapSaveThread;
+class WorkerPool;
 
 // TODO: this could wrap all calls to MapDatabase, including locking
 struct MapDatabaseAccessor {
@@ -27,10 +30,20 @@ struct MapDatabaseAccessor {
 	MapDatabase *dbase = nullptr;
 	/// Fallback database for read operations
 	MapDatabase *dbase_ro = nullptr;
-
-	/// Load a block, taking dbase_ro into account.
+	/// Blocks not yet written by the background saver (optional)
+	MapSaveThread *saver = nullptr;
+	/// Incremented after any block was saved or deleted, so readers can tell
+	/// whether data they loaded earlier may be outdated.
+	std::atomic<u64> write_counter{0};
+	/// Total size of the block data handed to the database, for statistics
+	std::atomic<u64> bytes_written{0};
+
+	/// Load a block, taking the saver and dbase_ro into account.
 	/// @note call locked
 	void loadBlock(v3s16 blockpos, std::string &ret);
+	/// Same as loadBlock() for multiple blocks at once.
+	/// @note call locked
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &ret);
 };
 
 /*
@@ -116,7 +129,8 @@ class ServerMap : public Map
 	MapgenParams *getMapgenParams();
 
 	bool saveBlock(MapBlock *block) override;
-	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
+	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1,
+		size_t *size = nullptr);
 
 	// Load block in a synchronous fashion
 	MapBlock *loadBlock(v3s16 p);
@@ -137,6 +151,11 @@ class ServerMap : public Map
 
 	void step();
 
+	/// Waits until the background saver wrote all blocks saved so far.
+	void flushSaves();
+	/// @return size of the block data written to the database so far
+	u64 getBytesWritten() const { return m_db.bytes_written; }
+
 	void updateVManip(v3s16 pos);
 
 	// For debug printing
@@ -193,6 +212,8 @@ class ServerMap : public Map
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
 	bool m_queue_size_timer_started = false;
+	// Decides on the queued liquid nodes
+	std::unique_ptr<WorkerPool> m_liquid_pool;
 
 	/*
 		Metadata is re-written on disk only if this is true.
@@ -201,9 +222,14 @@ class ServerMap : public Map
 	bool m_map_metadata_changed = true;
 
 	MapDatabaseAccessor m_db;
+	// Writes blocks in the background if server_map_save_async is enabled
+	std::unique_ptr<MapSaveThread> m_saver;
+	// Set once nothing may be left unsaved, so that saving waits for the saver
+	bool m_saving_at_shutdown = false;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
 	MetricCounterPtr m_save_time_counter;
 	MetricCounterPtr m_save_count_counter;
+	MetricCounterPtr m_save_deferred_counter;
 };
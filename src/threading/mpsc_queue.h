@@ -0,0 +1,86 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include "util/basic_macros.h"
+
+/*
+	An unbounded lock-free queue with many producers and a single consumer.
+
+	push() is a single atomic exchange and may be called from any thread.
+	pop() and empty() must only ever be called from one thread at a time.
+	Items pushed by the same thread come out in the order they were pushed.
+
+	A push() that has not returned yet may not be visible to pop(), so if
+	the consumer sleeps when the queue is empty the producer has to wake it
+	up after pushing (e.g. by posting a semaphore).
+
+	T must be default-constructible and movable.
+*/
+template <typename T>
+class MPSCQueue
+{
+	struct Node {
+		std::atomic<Node*> next{nullptr};
+		T value;
+
+		Node() = default;
+		explicit Node(T &&v) : value(std::move(v)) {}
+	};
+
+public:
+	MPSCQueue()
+	{
+		// Starts out with a stub node which is never handed out
+		m_tail = new Node();
+		m_head.store(m_tail, std::memory_order_relaxed);
+	}
+
+	~MPSCQueue()
+	{
+		T t;
+		while (pop(t))
+			;
+		delete m_tail;
+	}
+
+	DISABLE_CLASS_COPY(MPSCQueue)
+
+	void push(T t)
+	{
+		Node *node = new Node(std::move(t));
+		Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+		// Between these two lines the consumer sees the queue ending at prev
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	/// @return false if the queue is empty
+	bool pop(T &ret)
+	{
+		Node *tail = m_tail;
+		Node *next = tail->next.load(std::memory_order_acquire);
+		if (!next)
+			return false;
+		// next becomes the new stub
+		ret = std::move(next->value);
+		next->value = T();
+		m_tail = next;
+		delete tail;
+		return true;
+	}
+
+	bool empty() const
+	{
+		return !m_tail->next.load(std::memory_order_acquire);
+	}
+
+private:
+	// Last pushed node, shared by all producers
+	alignas(64) std::atomic<Node*> m_head;
+	// Stub node before the first item, owned by the consumer
+	alignas(64) Node *m_tail;
+};
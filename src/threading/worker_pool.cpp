@@ -0,0 +1,123 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "threading/worker_pool.h"
+#include "threading/thread.h"
+
+class WorkerPool::WorkerThread : public Thread
+{
+public:
+	WorkerThread(const std::string &name, WorkerPool *pool) :
+		Thread(name), m_pool(pool)
+	{}
+
+private:
+	void *run() override;
+
+	WorkerPool *m_pool;
+};
+
+void *WorkerPool::WorkerThread::run()
+{
+	unsigned int seen_generation = 0;
+
+	while (true) {
+		const std::function<void(size_t)> *fn;
+		size_t count;
+		{
+			std::unique_lock lock(m_pool->m_mutex);
+			m_pool->m_work_cv.wait(lock, [&] {
+				return m_pool->m_stop || m_pool->m_generation != seen_generation;
+			});
+			if (m_pool->m_stop)
+				break;
+			seen_generation = m_pool->m_generation;
+			// m_fn is reset once a batch is done, so a late wakeup finds nothing
+			fn = m_pool->m_fn;
+			count = m_pool->m_count;
+			m_pool->m_busy++;
+		}
+
+		if (fn)
+			m_pool->work(fn, count);
+
+		std::unique_lock lock(m_pool->m_mutex);
+		if (--m_pool->m_busy == 0)
+			m_pool->m_done_cv.notify_all();
+	}
+
+	return nullptr;
+}
+
+WorkerPool::WorkerPool(const std::string &name, unsigned int num_threads)
+{
+	m_threads.reserve(num_threads);
+	for (unsigned int i = 0; i < num_threads; i++) {
+		m_threads.emplace_back(new WorkerThread(name, this));
+		m_threads.back()->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::unique_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_work_cv.notify_all();
+
+	for (auto &thread : m_threads)
+		thread->wait();
+}
+
+void WorkerPool::work(const std::function<void(size_t)> *fn, size_t count)
+{
+	while (true) {
+		size_t i = m_next.fetch_add(1, std::memory_order_relaxed);
+		if (i >= count)
+			break;
+		try {
+			(*fn)(i);
+		} catch (...) {
+			std::unique_lock lock(m_mutex);
+			if (!m_exptr)
+				m_exptr = std::current_exception();
+		}
+	}
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &fn)
+{
+	if (count == 0)
+		return;
+
+	// Not worth waking anyone up for a single item
+	const bool parallel = !m_threads.empty() && count > 1;
+
+	{
+		std::unique_lock lock(m_mutex);
+		m_next.store(0, std::memory_order_relaxed);
+		m_exptr = nullptr;
+		if (parallel) {
+			m_fn = &fn;
+			m_count = count;
+			m_generation++;
+		}
+	}
+	if (parallel)
+		m_work_cv.notify_all();
+
+	work(&fn, count);
+
+	std::exception_ptr exptr;
+	{
+		std::unique_lock lock(m_mutex);
+		m_done_cv.wait(lock, [&] { return m_busy == 0; });
+		m_fn = nullptr;
+		std::swap(exptr, m_exptr);
+	}
+
+	if (exptr)
+		std::rethrow_exception(exptr);
+}
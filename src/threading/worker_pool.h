@@ -0,0 +1,64 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "util/basic_macros.h"
+
+/*
+	A fixed set of threads that run the iterations of a loop in parallel.
+
+	The calling thread takes part in the work, so a pool without any threads
+	just runs everything inline. This is meant for short data-parallel bursts
+	(e.g. compressing a batch of blocks) and not for long-running tasks.
+*/
+class WorkerPool
+{
+public:
+	WorkerPool(const std::string &name, unsigned int num_threads);
+	~WorkerPool();
+
+	DISABLE_CLASS_COPY(WorkerPool)
+
+	unsigned int getThreadCount() const { return m_threads.size(); }
+
+	/**
+	 * Calls `fn(i)` for every `i` in [0, count) and waits until all calls
+	 * have returned. The order of calls is unspecified.
+	 * If a call throws, the first exception is re-thrown here once all other
+	 * calls have finished.
+	 * Must not be called from multiple threads at once.
+	 */
+	void run(size_t count, const std::function<void(size_t)> &fn);
+
+private:
+	class WorkerThread;
+
+	// Processes items of the current batch until none are left
+	void work(const std::function<void(size_t)> *fn, size_t count);
+
+	std::vector<std::unique_ptr<WorkerThread>> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_done_cv;
+
+	// Current batch (protected by m_mutex)
+	const std::function<void(size_t)> *m_fn = nullptr;
+	size_t m_count = 0;
+	unsigned int m_generation = 0;
+	unsigned int m_busy = 0;
+	bool m_stop = false;
+	std::exception_ptr m_exptr;
+
+	std::atomic<size_t> m_next{0};
+};
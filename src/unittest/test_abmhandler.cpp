@@ -0,0 +1,163 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "test.h"
+
+#include "mock_server.h"
+#include "emerge.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "serverenvironment.h"
+#include "servermap.h"
+#include "server/blockmodifier.h"
+
+class TestABMHandler : public TestBase
+{
+public:
+	TestABMHandler() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestABMHandler"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testRequiredNeighbors(ServerEnvironment *env);
+	void testWithoutNeighbors(ServerEnvironment *env);
+
+private:
+	content_t m_content_a, m_content_b;
+};
+
+static TestABMHandler g_test_instance;
+
+namespace {
+	// Replaces the node next to the one it triggers on, and records the calls
+	struct ReplacingABM : ActiveBlockModifier {
+		std::vector<std::string> trigger_contents, required, without;
+		MapNode replacement;
+		std::vector<v3s16> triggered;
+
+		const std::vector<std::string> &getTriggerContents() const override
+			{ return trigger_contents; }
+		const std::vector<std::string> &getRequiredNeighbors() const override
+			{ return required; }
+		const std::vector<std::string> &getWithoutNeighbors() const override
+			{ return without; }
+		float getTriggerInterval() override { return 1.0f; }
+		u32 getTriggerChance() override { return 1; }
+		bool getSimpleCatchUp() override { return false; }
+		s16 getMinY() override { return S16_MIN; }
+		s16 getMaxY() override { return S16_MAX; }
+
+		void trigger(ServerEnvironment *env, v3s16 p, MapNode n) override
+		{
+			triggered.push_back(p);
+			env->getMap().setNode(p + v3s16(1, 0, 0), replacement);
+		}
+	};
+}
+
+static void fill_air(MapBlock *block)
+{
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		block->setNodeNoCheck(x, y, z, MapNode(CONTENT_AIR));
+}
+
+void TestABMHandler::runTests(IGameDef *gamedef)
+{
+	MockServer server(getTestTempDirectory());
+	{
+		std::ofstream ofs(server.getWorldPath() + DIR_DELIM "world.mt",
+			std::ios::out | std::ios::binary);
+		ofs << "backend = dummy\n";
+	}
+
+	NodeDefManager *ndef = server.getWritableNodeDefManager();
+	ContentFeatures f;
+	f.name = "test:a";
+	m_content_a = ndef->set(f.name, f);
+	f.name = "test:b";
+	m_content_b = ndef->set(f.name, f);
+
+	MetricsBackend mb;
+	EmergeManager emerge(&server, &mb);
+	auto map = std::make_unique<ServerMap>(server.getWorldPath(), &server, &emerge, &mb);
+	ServerEnvironment env(std::move(map), &server, &mb);
+
+	TEST(testRequiredNeighbors, &env);
+	TEST(testWithoutNeighbors, &env);
+
+	env.deactivateBlocksAndObjects();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestABMHandler::testRequiredNeighbors(ServerEnvironment *env)
+{
+	const v3s16 bp(0, 10, 0);
+	MapBlock *block = env->getMap().emergeBlock(bp, true);
+	UASSERT(block);
+	fill_air(block);
+	// Both need the same neighbor, which the first takes away
+	block->setNodeNoCheck(v3s16(1, 1, 1), MapNode(m_content_a));
+	block->setNodeNoCheck(v3s16(2, 1, 1), MapNode(m_content_b));
+	block->setNodeNoCheck(v3s16(3, 1, 1), MapNode(m_content_a));
+
+	ReplacingABM abm;
+	abm.trigger_contents.emplace_back("test:a");
+	abm.required.emplace_back("test:b");
+	abm.replacement = MapNode(CONTENT_AIR);
+	std::vector<ABMWithState> abms;
+	abms.emplace_back(&abm);
+
+	ABMHandler handler(abms, 1.0f, env, false);
+	std::vector<ABMTrigger> triggers;
+	bool cached;
+	UASSERT(handler.findTriggers(block, 1, triggers, cached));
+	UASSERTEQ(size_t, triggers.size(), 2);
+
+	int abms_run = 0;
+	handler.runTriggers(block, triggers, abms_run);
+	UASSERTEQ(int, abms_run, 1);
+	UASSERTEQ(size_t, abm.triggered.size(), 1);
+	UASSERT(abm.triggered[0] == bp * MAP_BLOCKSIZE + v3s16(1, 1, 1));
+}
+
+void TestABMHandler::testWithoutNeighbors(ServerEnvironment *env)
+{
+	const v3s16 bp(0, 11, 0);
+	MapBlock *block = env->getMap().emergeBlock(bp, true);
+	UASSERT(block);
+	fill_air(block);
+	// The first puts the node next to the second that it must not have
+	block->setNodeNoCheck(v3s16(1, 1, 1), MapNode(m_content_a));
+	block->setNodeNoCheck(v3s16(3, 1, 1), MapNode(m_content_a));
+	// Across the block border, the neighbors are checked there too
+	block->setNodeNoCheck(v3s16(15, 5, 5), MapNode(m_content_a));
+
+	ReplacingABM abm;
+	abm.trigger_contents.emplace_back("test:a");
+	abm.without.emplace_back("test:b");
+	abm.replacement = MapNode(m_content_b);
+	std::vector<ABMWithState> abms;
+	abms.emplace_back(&abm);
+
+	ABMHandler handler(abms, 1.0f, env, false);
+	std::vector<ABMTrigger> triggers;
+	bool cached;
+	UASSERT(handler.findTriggers(block, 1, triggers, cached));
+	UASSERTEQ(size_t, triggers.size(), 3);
+
+	// Meanwhile something else was put next to the last
+	MapBlock *next = env->getMap().emergeBlock(bp + v3s16(1, 0, 0), true);
+	UASSERT(next);
+	fill_air(next);
+	next->setNodeNoCheck(v3s16(0, 6, 5), MapNode(m_content_b));
+
+	int abms_run = 0;
+	handler.runTriggers(block, triggers, abms_run);
+	UASSERTEQ(int, abms_run, 1);
+	UASSERTEQ(size_t, abm.triggered.size(), 1);
+	UASSERT(abm.triggered[0] == bp * MAP_BLOCKSIZE + v3s16(1, 1, 1));
+}
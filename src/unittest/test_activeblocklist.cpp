@@ -0,0 +1,180 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "test.h"
+
+#include "noise.h"
+#include "serverenvironment.h"
+
+class TestActiveBlockList : public TestBase
+{
+public:
+	TestActiveBlockList() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveBlockList"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMoving();
+	void testAddRemove();
+	void testViewCone();
+};
+
+static TestActiveBlockList g_test_instance;
+
+void TestActiveBlockList::runTests(IGameDef *gamedef)
+{
+	TEST(testMoving);
+	TEST(testAddRemove);
+	TEST(testViewCone);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+typedef ActiveBlockList::PlayerView PlayerView;
+
+// How the list used to be built from scratch
+std::set<v3s16> expected_blocks(const std::vector<PlayerView> &players, s16 r,
+	const std::set<v3s16> &forceloaded)
+{
+	std::set<v3s16> list = forceloaded;
+	for (const PlayerView &view : players) {
+		v3s16 p, p0 = view.blockpos;
+		for (p.X = p0.X - r; p.X <= p0.X + r; p.X++)
+		for (p.Y = p0.Y - r; p.Y <= p0.Y + r; p.Y++)
+		for (p.Z = p0.Z - r; p.Z <= p0.Z + r; p.Z++) {
+			if (p.getDistanceFrom(p0) <= r)
+				list.insert(p);
+		}
+	}
+	return list;
+}
+
+template <typename C>
+std::set<v3s16> to_set(const C &c)
+{
+	return std::set<v3s16>(c.begin(), c.end());
+}
+
+}
+
+void TestActiveBlockList::testMoving()
+{
+	ActiveBlockList list;
+	PseudoRandom pr(4711);
+	std::vector<PlayerView> players;
+	std::set<v3s16> previous;
+
+	for (int step = 0; step < 300; step++) {
+		const s16 r = step < 150 ? 3 : 5;
+
+		// Players join, leave, walk around and teleport
+		if (players.size() < 4 && pr.range(0, 9) == 0) {
+			PlayerView &view = players.emplace_back();
+			view.id = pr.range(1, 1000);
+			view.blockpos = v3s16(pr.range(-20, 20), pr.range(-5, 5), pr.range(-20, 20));
+		}
+		if (!players.empty() && pr.range(0, 29) == 0)
+			players.erase(players.begin() + pr.range(0, players.size() - 1));
+		for (PlayerView &view : players) {
+			if (pr.range(0, 49) == 0)
+				view.blockpos = v3s16(pr.range(-100, 100), 0, pr.range(-100, 100));
+			else
+				view.blockpos += v3s16(pr.range(-1, 1), pr.range(-1, 1), pr.range(-1, 1));
+		}
+		if (pr.range(0, 19) == 0) {
+			v3s16 p(pr.range(-3, 3), 0, pr.range(-3, 3));
+			if (!list.m_forceloaded_list.erase(p))
+				list.m_forceloaded_list.insert(p);
+		}
+
+		std::set<v3s16> removed, added, extra_added;
+		list.update(players, r, removed, added, extra_added);
+
+		std::set<v3s16> expected = expected_blocks(players, r, list.m_forceloaded_list);
+		UASSERT(to_set(list.m_list) == expected);
+		UASSERT(to_set(list.m_abm_list) == expected);
+		UASSERT(extra_added.empty());
+
+		std::set<v3s16> expected_added, expected_removed;
+		std::set_difference(expected.begin(), expected.end(),
+			previous.begin(), previous.end(),
+			std::inserter(expected_added, expected_added.end()));
+		std::set_difference(previous.begin(), previous.end(),
+			expected.begin(), expected.end(),
+			std::inserter(expected_removed, expected_removed.end()));
+		UASSERT(added == expected_added);
+		UASSERT(removed == expected_removed);
+		previous = std::move(expected);
+	}
+
+	players.clear();
+	list.m_forceloaded_list.clear();
+	std::set<v3s16> removed, added, extra_added;
+	list.update(players, 5, removed, added, extra_added);
+	UASSERT(removed == previous);
+	UASSERTEQ(size_t, list.size(), 0);
+}
+
+void TestActiveBlockList::testAddRemove()
+{
+	ActiveBlockList list;
+	std::vector<PlayerView> players(1);
+	std::set<v3s16> removed, added, extra_added;
+	list.update(players, 2, removed, added, extra_added);
+	UASSERT(list.contains(v3s16(0, 0, 2)));
+
+	// A block that could not be loaded is tried again
+	list.remove(v3s16(0, 0, 2));
+	UASSERT(!list.contains(v3s16(0, 0, 2)));
+	added.clear();
+	list.update(players, 2, removed, added, extra_added);
+	UASSERT(added == std::set<v3s16>({v3s16(0, 0, 2)}));
+	UASSERT(removed.empty());
+
+	// A block activated from outside is dropped if nobody wants it
+	UASSERT(list.add(v3s16(10, 0, 0)));
+	UASSERT(!list.add(v3s16(0, 0, 0)));
+	added.clear();
+	list.update(players, 2, removed, added, extra_added);
+	UASSERT(added.empty());
+	UASSERT(removed == std::set<v3s16>({v3s16(10, 0, 0)}));
+	UASSERT(list.contains(v3s16(0, 0, 0)));
+}
+
+void TestActiveBlockList::testViewCone()
+{
+	ActiveBlockList list;
+	std::vector<PlayerView> players(1);
+	PlayerView &view = players[0];
+	view.cone_range = 6;
+	view.camera_pos = v3f(0, 0, 0);
+	view.camera_dir = v3f(1, 0, 0);
+	view.fov = 1.0f;
+
+	std::set<v3s16> removed, added, extra_added;
+	list.update(players, 2, removed, added, extra_added);
+	UASSERT(!extra_added.empty());
+	for (v3s16 p : extra_added) {
+		UASSERT(added.count(p) == 0);
+		UASSERT(list.contains(p));
+		UASSERT(list.m_abm_list.count(p) == 0);
+	}
+	UASSERT(list.contains(v3s16(5, 0, 0)));
+	UASSERT(!list.contains(v3s16(-5, 0, 0)));
+
+	// Looking the other way
+	view.camera_dir = v3f(-1, 0, 0);
+	removed.clear();
+	added.clear();
+	std::set<v3s16> old_extra = std::move(extra_added);
+	extra_added.clear();
+	list.update(players, 2, removed, added, extra_added);
+	UASSERT(added.empty());
+	UASSERT(removed.count(v3s16(5, 0, 0)) == 1);
+	UASSERT(extra_added.count(v3s16(-5, 0, 0)) == 1);
+	for (v3s16 p : removed)
+		UASSERT(old_extra.count(p) == 1);
+}
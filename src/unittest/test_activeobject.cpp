@@ -5,6 +5,11 @@
 #include "test.h"
 
 #include "mock_activeobject.h"
+#include "constants.h"
+#include "network/objectpositions.h"
+#include "server/objectupdatethrottle.h"
+#include "util/serialize.h"
+#include <sstream>
 
 class TestActiveObject : public TestBase
 {
@@ -15,6 +20,8 @@ class TestActiveObject : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testAOAttributes();
+	void testObjectPositions();
+	void testObjectUpdateThrottle();
 };
 
 static TestActiveObject g_test_instance;
@@ -22,6 +29,8 @@ static TestActiveObject g_test_instance;
 void TestActiveObject::runTests(IGameDef *gamedef)
 {
 	TEST(testAOAttributes);
+	TEST(testObjectPositions);
+	TEST(testObjectUpdateThrottle);
 }
 
 void TestActiveObject::testAOAttributes()
@@ -32,3 +41,150 @@ void TestActiveObject::testAOAttributes()
 	ao.setId(558);
 	UASSERT(ao.getId() == 558);
 }
+
+void TestActiveObject::testObjectPositions()
+{
+	ObjectPositionUpdate update;
+	update.position = v3f(1000.3f, -25.0f, 3.5f);
+	update.velocity = v3f(20.0f, 0, 0);
+	update.acceleration = v3f(0, -98.1f, 0);
+	update.rotation = v3f(0, 90.0f, 0);
+	update.do_interpolate = true;
+	update.update_interval = 0.2f;
+
+	ObjectPositionUpdate parsed;
+	UASSERT(parsed.parse(update.toMessage()));
+	UASSERT(parsed.position == update.position);
+	UASSERT(!parsed.parse("\x01"));
+
+	ObjectPositionCodec server, client;
+	std::string reliable, unreliable;
+	auto receive = [&] (std::string &data, ObjectPositionUpdate &result) {
+		std::istringstream is(data, std::ios_base::binary);
+		u16 id = 0;
+		bool ok = client.read(is, id, result);
+		UASSERT(!canRead(is));
+		UASSERTEQ(u16, id, 7);
+		data.clear();
+		return ok;
+	};
+	auto check = [&] (const ObjectPositionUpdate &result) {
+		UASSERT(result.position.getDistanceFrom(update.position) < BS / 64);
+		UASSERT(result.velocity.getDistanceFrom(update.velocity) < BS / 64);
+		UASSERT(result.acceleration.getDistanceFrom(update.acceleration) < BS / 64);
+		UASSERT(result.rotation.getDistanceFrom(update.rotation) < 0.01f);
+		UASSERT(result.do_interpolate == update.do_interpolate);
+		UASSERT(result.is_movement_end == update.is_movement_end);
+		UASSERT(std::fabs(result.update_interval - update.update_interval) < 0.001f);
+	};
+
+	// The first update is a reliable keyframe
+	ObjectPositionUpdate result;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(!reliable.empty() && unreliable.empty());
+	UASSERT(receive(reliable, result));
+	check(result);
+
+	// Later ones are much smaller than AO_CMD_UPDATE_POSITION
+	update.position += v3f(4.0f, 0, 0);
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(reliable.empty());
+	UASSERT(unreliable.size() * 4 < update.toMessage().size());
+	UASSERT(receive(unreliable, result));
+	check(result);
+
+	update.rotation.Y = 180.0f;
+	update.is_movement_end = true;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(receive(unreliable, result));
+	check(result);
+
+	// Too far from the keyframe, start over
+	update.position.X += 600 * BS;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(!reliable.empty() && unreliable.empty());
+	std::string keyframe = reliable;
+	reliable.clear();
+
+	// Updates that overtake their keyframe are dropped
+	update.position.Y += 1.0f;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(!receive(unreliable, result));
+	UASSERT(receive(keyframe, result));
+	update.position.Y += 1.0f;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(receive(unreliable, result));
+	check(result);
+
+	// Keyframes of other objects do not make the sequence number wrap to
+	// that of the keyframe the client has
+	for (u16 id = 100; id < 355; id++) {
+		server.write(reliable, unreliable, id, update);
+		server.forget(id);
+	}
+	reliable.clear();
+	update.position.X -= 600 * BS;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(!reliable.empty());
+	reliable.clear();
+	update.position.Y += 1.0f;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(!receive(unreliable, result));
+
+	// An object removed from the client gets a new keyframe, which
+	// updates for the previous object with that id can not refer to
+	server.forget(7);
+	client.forget(7);
+	server.write(reliable, unreliable, 7, update);
+	keyframe = reliable;
+	reliable.clear();
+	UASSERT(receive(keyframe, result));
+	check(result);
+	server.forget(7);
+	server.write(reliable, unreliable, 7, update);
+	reliable.clear();
+	update.position.Y += 1.0f;
+	server.write(reliable, unreliable, 7, update);
+	UASSERT(!receive(unreliable, result));
+}
+
+void TestActiveObject::testObjectUpdateThrottle()
+{
+	ObjectUpdateThrottle throttle;
+	std::vector<std::pair<u16, ObjectPositionUpdate>> due;
+	ObjectPositionUpdate update;
+	update.update_interval = 0.1f;
+
+	// Near objects are never held back
+	UASSERT(throttle.push(1, 10.0, 0, update));
+	UASSERT(throttle.push(1, 10.1, 0, update));
+
+	// Far ones at most every 0.5s, keeping the latest update
+	UASSERT(throttle.push(2, 10.0, 0.5f, update));
+	update.position.X = 1.0f;
+	UASSERT(!throttle.push(2, 10.1, 0.5f, update));
+	update.position.X = 2.0f;
+	UASSERT(!throttle.push(2, 10.2, 0.5f, update));
+	throttle.popDue(10.3, due);
+	UASSERT(due.empty());
+	throttle.popDue(10.5, due);
+	UASSERTEQ(size_t, due.size(), 1);
+	UASSERTEQ(u16, due[0].first, 2);
+	UASSERT(due[0].second.position.X == 2.0f);
+	UASSERT(std::fabs(due[0].second.update_interval - 0.5f) < 0.001f);
+	due.clear();
+	throttle.popDue(11.5, due);
+	UASSERT(due.empty());
+
+	// A newer update that can be sent replaces the held back one
+	UASSERT(!throttle.push(2, 10.6, 0.5f, update));
+	UASSERT(throttle.push(2, 10.7, 0, update));
+	throttle.popDue(12.0, due);
+	UASSERT(due.empty());
+
+	// Forgotten objects are not sent
+	UASSERT(!throttle.push(2, 10.8, 0.5f, update));
+	throttle.forget(2);
+	throttle.popDue(12.0, due);
+	UASSERT(due.empty());
+}
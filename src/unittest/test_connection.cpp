@@ -28,6 +28,8 @@ class TestConnection : public TestBase {
 	void testNetworkPacketSerialize();
 	void testHelpers();
 	void testConnectSendReceive();
+	void testReceiveThreads();
+	void testBatchedSends();
 };
 
 static TestConnection g_test_instance;
@@ -37,6 +39,8 @@ void TestConnection::runTests(IGameDef *gamedef)
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
 	TEST(testConnectSendReceive);
+	TEST(testReceiveThreads);
+	TEST(testBatchedSends);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -66,6 +70,21 @@ struct Handler : public con::PeerHandler
 	const char *name;
 };
 
+// Changes a setting until the end of the scope, also if an assertion fails
+struct SettingOverride
+{
+	SettingOverride(const std::string &name, const std::string &value) :
+		name(name), old(g_settings->get(name))
+	{
+		g_settings->set(name, value);
+	}
+
+	~SettingOverride() { g_settings->set(name, old); }
+
+	const std::string name;
+	const std::string old;
+};
+
 void TestConnection::testNetworkPacketSerialize()
 {
 	const static u8 expected[] = {
@@ -126,20 +145,61 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p1->data[6]) == channel);
 	UASSERT(readU8(&p1->data[7]) == data1[0]);
 
-	//infostream<<"initial data1[0]="<<((u32)data1[0]&0xff)<<std::endl;
+	con::BufferedPacketPtr p2 = con::makePacket(a, con::PacketChunk(data1),
+			proto_id, peer_id, channel, true, seqnum);
 
-	SharedBuffer<u8> p2 = con::makeReliablePacket(data1, seqnum);
+	UASSERT(p2->size() == 7 + 3 + data1.getSize());
+	UASSERT(readU8(&p2->data[7]) == con::PACKET_TYPE_RELIABLE);
+	UASSERT(readU16(&p2->data[8]) == seqnum);
+	UASSERT(readU8(&p2->data[10]) == data1[0]);
 
-	/*infostream<<"p2.getSize()="<<p2.getSize()<<", data1.getSize()="
-			<<data1.getSize()<<std::endl;
-	infostream<<"readU8(&p2[3])="<<readU8(&p2[3])
-			<<" p2[3]="<<((u32)p2[3]&0xff)<<std::endl;
-	infostream<<"data1[0]="<<((u32)data1[0]&0xff)<<std::endl;*/
-
-	UASSERT(p2.getSize() == 3 + data1.getSize());
-	UASSERT(readU8(&p2[0]) == con::PACKET_TYPE_RELIABLE);
-	UASSERT(readU16(&p2[1]) == seqnum);
-	UASSERT(readU8(&p2[3]) == data1[0]);
+	/*
+		Split packets reference slices of the data, the first packet made
+		of all of it has its headers written in front of it.
+	*/
+	auto data2 = std::make_shared<con::PacketBuffer>(1000);
+	for (u32 i = 0; i < data2->size(); i++)
+		data2->data()[i] = i;
+
+	std::list<con::PacketChunk> chunks;
+	u16 split_seqnum = 7;
+	con::makeAutoSplitPacket(data2, 400, split_seqnum, &chunks);
+	UASSERT(split_seqnum == 8);
+	UASSERT(chunks.size() == 3);
+	u16 chunk_num = 0;
+	u32 offset = 0;
+	for (const auto &chunk : chunks) {
+		auto p = con::makePacket(a, chunk, proto_id, peer_id, channel,
+				true, seqnum + chunk_num);
+		UASSERT(p->headSize() == 7 + 3 + 7);
+		UASSERT(p->tail() == data2->data() + offset);
+		UASSERT(readU8(&p->data[10]) == con::PACKET_TYPE_SPLIT);
+		UASSERT(readU16(&p->data[11]) == 7);
+		UASSERT(readU16(&p->data[13]) == 3);
+		UASSERT(readU16(&p->data[15]) == chunk_num);
+		offset += p->tailSize();
+		chunk_num++;
+	}
+	UASSERT(offset == data2->size());
+
+	std::list<con::PacketChunk> originals;
+	auto data3 = std::make_shared<con::PacketBuffer>(100);
+	con::makeAutoSplitPacket(data3, 400, split_seqnum, &originals);
+	UASSERT(split_seqnum == 8);
+	UASSERT(originals.size() == 1);
+	auto p3 = con::makePacket(a, originals.front(), proto_id, peer_id, channel,
+			true, seqnum);
+	UASSERT(p3->size() == 7 + 3 + 1 + 100);
+	UASSERT(p3->tailSize() == 0);
+	UASSERT(p3->data + p3->headSize() == data3->data() + data3->size());
+	UASSERT(readU16(&p3->data[4]) == peer_id);
+	UASSERT(readU8(&p3->data[10]) == con::PACKET_TYPE_ORIGINAL);
+
+	// The headroom can only be used once
+	auto p4 = con::makePacket(a, originals.front(), proto_id, peer_id, channel);
+	UASSERT(p4->size() == 7 + 1 + 100);
+	UASSERT(p4->tail() == data3->data());
+	UASSERT(readU8(&p4->data[7]) == con::PACKET_TYPE_ORIGINAL);
 }
 
 
@@ -355,3 +415,125 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id >= 2);
 }
+
+void TestConnection::testReceiveThreads()
+{
+	// Clients spread among several sockets sharing the server port
+	SettingOverride receive_threads("server_receive_threads", "3");
+
+	const Address server_address(127, 0, 0, 1, 30002);
+	Handler hand_server("server");
+	con::Connection server(512, 5.0f, false, &hand_server);
+	server.Serve(server_address);
+	sleep_ms(50);
+
+	constexpr u32 num_clients = 6;
+	std::vector<std::unique_ptr<Handler>> hand_clients;
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (u32 i = 0; i < num_clients; i++) {
+		hand_clients.push_back(std::make_unique<Handler>("client"));
+		clients.push_back(std::make_unique<con::Connection>(512, 5.0f, false,
+				hand_clients.back().get()));
+		clients.back()->Connect(server_address);
+	}
+
+	// Each client says who it is, the server echoes it back
+	for (u32 i = 0; i < num_clients; i++) {
+		NetworkPacket pkt(0x4b, 0);
+		pkt << i;
+		clients[i]->Send(PEER_ID_SERVER, 0, &pkt, true);
+	}
+	std::vector<session_t> peer_ids(num_clients, PEER_ID_INEXISTENT);
+	u64 deadline = porting::getTimeMs() + 5000;
+	for (u32 n = 0; n < num_clients && porting::getTimeMs() < deadline;) {
+		NetworkPacket pkt;
+		if (!server.ReceiveTimeoutMs(&pkt, 50))
+			continue;
+		u32 i;
+		pkt >> i;
+		UASSERT(i < num_clients);
+		UASSERTEQ(session_t, peer_ids[i], PEER_ID_INEXISTENT);
+		peer_ids[i] = pkt.getPeerId();
+		n++;
+
+		NetworkPacket reply(0x4c, 0);
+		reply << i;
+		server.Send(peer_ids[i], 0, &reply, true);
+	}
+	UASSERTEQ(s32, hand_server.count, num_clients);
+	// Serving happened before the clients could be heard
+#ifdef __linux__
+	UASSERTEQ(u32, server.getReceiveSocketCount(), 3);
+#else
+	// Only Linux spreads the datagrams among the sockets
+	UASSERTEQ(u32, server.getReceiveSocketCount(), 1);
+#endif
+
+	for (u32 i = 0; i < num_clients; i++) {
+		UASSERT(peer_ids[i] != PEER_ID_INEXISTENT);
+		bool received = false;
+		deadline = porting::getTimeMs() + 5000;
+		while (!received && porting::getTimeMs() < deadline) {
+			NetworkPacket pkt;
+			if (!clients[i]->ReceiveTimeoutMs(&pkt, 50) || pkt.getCommand() != 0x4c)
+				continue;
+			u32 j;
+			pkt >> j;
+			UASSERTEQ(u32, j, i);
+			received = true;
+		}
+		UASSERT(received);
+	}
+
+}
+
+void TestConnection::testBatchedSends()
+{
+	const Address server_address(127, 0, 0, 1, 30004);
+	Handler hand_server("server");
+	con::Connection server(512, 5.0f, false, &hand_server);
+	server.Serve(server_address);
+	sleep_ms(50);
+
+	Handler hand_client("client");
+	con::Connection client(512, 5.0f, false, &hand_client);
+	client.Connect(server_address);
+
+	NetworkPacket hello(0x4b, 0);
+	client.Send(PEER_ID_SERVER, 0, &hello, true);
+	session_t peer_id = PEER_ID_INEXISTENT;
+	u64 deadline = porting::getTimeMs() + 5000;
+	while (peer_id == PEER_ID_INEXISTENT && porting::getTimeMs() < deadline) {
+		NetworkPacket pkt;
+		if (server.ReceiveTimeoutMs(&pkt, 50) && pkt.getCommand() == 0x4b)
+			peer_id = pkt.getPeerId();
+	}
+	UASSERT(peer_id != PEER_ID_INEXISTENT);
+
+	/*
+		Unreliable packets are only referenced by the send batch until they
+		were sent. Queue more than fit into one batch, so that it is also
+		flushed when full.
+	*/
+	constexpr u32 count = UDPSocket::BATCH_MAX * 2 + 6;
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x4c, 0);
+		pkt << i;
+		pkt.putRawString(std::string(100, 'a' + i % 26));
+		server.Send(peer_id, 0, &pkt, false);
+	}
+
+	u32 received = 0;
+	deadline = porting::getTimeMs() + 5000;
+	while (received < count && porting::getTimeMs() < deadline) {
+		NetworkPacket pkt;
+		if (!client.ReceiveTimeoutMs(&pkt, 50) || pkt.getCommand() != 0x4c)
+			continue;
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, received);
+		UASSERT(pkt.readRawString(pkt.getRemainingBytes()) == std::string(100, 'a' + i % 26));
+		received++;
+	}
+	UASSERTEQ(u32, received, count);
+}
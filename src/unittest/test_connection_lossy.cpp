@@ -0,0 +1,258 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "test.h"
+
+#include "log.h"
+#include "noise.h"
+#include "porting.h"
+#include "network/peerhandler.h"
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+#include "network/socket.h"
+#include "threading/thread.h"
+#include <atomic>
+
+class TestConnectionLossy : public TestBase {
+public:
+	TestConnectionLossy()
+	{
+		if (INTERNET_SIMULATOR == false)
+			TestManager::registerTestModule(this);
+	}
+
+	const char *getName() { return "TestConnectionLossy"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSendWindow();
+	void testLossyLink();
+
+	static const int server_port = 30005;
+	static const int link_port = 30006;
+};
+
+static TestConnectionLossy g_test_instance;
+
+void TestConnectionLossy::runTests(IGameDef *gamedef)
+{
+	TEST(testSendWindow);
+	TEST(testLossyLink);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+/*
+	Forwards the datagrams between a client and a server, losing and
+	reordering some of them once enabled.
+*/
+class LossyLink : public Thread
+{
+public:
+	LossyLink(const Address &bind, const Address &server) :
+		Thread("LossyLink"),
+		m_socket(false),
+		m_server(server)
+	{
+		m_socket.Bind(bind);
+		m_socket.setTimeoutMs(10);
+	}
+
+	// Per mille of the datagrams dropped and swapped with the next one
+	std::atomic<u32> loss{0};
+	std::atomic<u32> reorder{0};
+
+	std::atomic<u32> dropped{0};
+
+private:
+	void *run()
+	{
+		PcgRandom pr(42);
+		Address sender, client;
+		u8 data[1500];
+		// A datagram held back to be sent after the next one
+		Address held_to;
+		std::string held;
+
+		while (!stopRequested()) {
+			int size = m_socket.Receive(sender, data, sizeof(data));
+			if (size < 0)
+				continue;
+
+			Address to = m_server;
+			if (sender == m_server)
+				to = client;
+			else
+				client = sender;
+			if (to.getPort() == 0)
+				continue;
+
+			if ((u32)pr.range(0, 999) < loss) {
+				dropped++;
+				continue;
+			}
+			if (held.empty() && (u32)pr.range(0, 999) < reorder) {
+				held_to = to;
+				held.assign((char *)data, size);
+				continue;
+			}
+			m_socket.Send(to, data, size);
+			if (!held.empty()) {
+				m_socket.Send(held_to, held.data(), held.size());
+				held.clear();
+			}
+		}
+		return nullptr;
+	}
+
+	UDPSocket m_socket;
+	const Address m_server;
+};
+
+struct CountingHandler : public con::PeerHandler
+{
+	void peerAdded(con::IPeer *peer) { last_id = peer->id; count++; }
+	void deletingPeer(con::IPeer *peer, bool timeout) { count--; }
+
+	s32 count = 0;
+	session_t last_id = 0;
+};
+
+con::BufferedPacketPtr makeReliable(u16 seqnum)
+{
+	SharedBuffer<u8> data(1);
+	data[0] = 0;
+	return con::makePacket(Address(127, 0, 0, 1, 10), con::PacketChunk(data),
+			0, 1, 0, true, seqnum);
+}
+
+}
+
+void TestConnectionLossy::testSendWindow()
+{
+	con::ReliableSendWindow window;
+	std::vector<con::BufferedPacketPtr> acked;
+
+	// Over the wrap around of the seqnums
+	const u16 first = 65530;
+	for (u16 i = 0; i < 20; i++)
+		window.insert(makeReliable(first + i));
+	UASSERTEQ(u32, window.size(), 20);
+
+	u16 seqnum;
+	UASSERT(window.getFirstSeqnum(seqnum));
+	UASSERTEQ(u16, seqnum, first);
+
+	// 0 and 1 were received, 2 and 3 lost, 4..7 received and 8 lost
+	std::vector<std::pair<u16, u16>> ranges = {
+		{(u16)(first + 4), (u16)(first + 7)},
+	};
+	u32 marked = window.popAcked((u16)(first + 2), ranges, acked);
+	UASSERTEQ(size_t, acked.size(), 6);
+	UASSERTEQ(u32, window.size(), 14);
+	UASSERT(window.getFirstSeqnum(seqnum));
+	UASSERTEQ(u16, seqnum, (u16)(first + 2));
+
+	// The hole before the range is resent, but only once
+	UASSERTEQ(u32, marked, 2);
+	auto resend = window.getResend(10.0f, 100);
+	UASSERTEQ(size_t, resend.size(), 2);
+	UASSERTEQ(u16, resend[0]->getSeqnum(), (u16)(first + 2));
+	UASSERTEQ(u16, resend[1]->getSeqnum(), (u16)(first + 3));
+	UASSERTEQ(u32, window.popAcked((u16)(first + 2), ranges, acked), 0);
+	UASSERT(window.getResend(10.0f, 100).empty());
+
+	// Too few received after the hole
+	ranges = {{(u16)(first + 9), (u16)(first + 10)}};
+	UASSERTEQ(u32, window.popAcked((u16)(first + 8), ranges, acked), 0);
+	UASSERTEQ(u32, window.size(), 10);
+
+	// Outdated and bogus ranges are ignored
+	ranges = {{(u16)(first - 100), (u16)(first - 90)}, {(u16)(first + 19), (u16)(first + 11)}};
+	UASSERTEQ(u32, window.popAcked(first, ranges, acked), 0);
+	UASSERTEQ(u32, window.size(), 10);
+
+	window.popSeqnum((u16)(first + 8));
+	UASSERT(window.getFirstSeqnum(seqnum));
+	UASSERTEQ(u16, seqnum, (u16)(first + 11));
+	EXCEPTION_CHECK(con::NotFoundException, window.popSeqnum((u16)(first + 8)));
+
+	// Acknowledged before, by the cumulative part, a range or on its own
+	UASSERT(window.wasAcked(first));
+	UASSERT(window.wasAcked((u16)(first + 5)));
+	UASSERT(window.wasAcked((u16)(first + 8)));
+	// Still waiting, or never sent
+	UASSERT(!window.wasAcked((u16)(first + 12)));
+	UASSERT(!window.wasAcked((u16)(first + 20)));
+
+	acked.clear();
+	window.popAcked((u16)(first + 20), {}, acked);
+	UASSERTEQ(size_t, acked.size(), 9);
+	UASSERT(window.empty());
+}
+
+void TestConnectionLossy::testLossyLink()
+{
+	const Address server_address(127, 0, 0, 1, server_port);
+	LossyLink link(Address(127, 0, 0, 1, link_port), server_address);
+	link.start();
+
+	CountingHandler hand_server, hand_client;
+	con::Connection server(512, 10.0f, false, &hand_server);
+	server.Serve(server_address);
+	con::Connection client(512, 10.0f, false, &hand_client);
+	client.Connect(Address(127, 0, 0, 1, link_port));
+
+	u64 deadline = porting::getTimeMs() + 5000;
+	while (!client.Connected() && porting::getTimeMs() < deadline) {
+		NetworkPacket pkt;
+		client.ReceiveTimeoutMs(&pkt, 10);
+	}
+	UASSERT(client.Connected());
+
+	// The client has to send something for the server to accept it
+	{
+		NetworkPacket pkt(0x01, 0);
+		pkt << (u32)0;
+		client.Send(PEER_ID_SERVER, 0, &pkt, true);
+		NetworkPacket recv;
+		UASSERT(server.ReceiveTimeoutMs(&recv, 5000));
+	}
+	UASSERTEQ(s32, hand_server.count, 1);
+
+	// 10% loss in each direction, some reordering
+	link.loss = 100;
+	link.reorder = 20;
+
+	// Some packets big enough to be split
+	const u32 count = 400;
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x02, 0);
+		pkt << i;
+		if (i % 20 == 0)
+			pkt.putRawString(std::string(2000, 'x'));
+		server.Send(hand_server.last_id, 0, &pkt, true);
+	}
+
+	u32 next = 0;
+	deadline = porting::getTimeMs() + 20000;
+	while (next < count && porting::getTimeMs() < deadline) {
+		NetworkPacket pkt;
+		if (!client.ReceiveTimeoutMs(&pkt, 50))
+			continue;
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, next);
+		next++;
+	}
+	infostream << "TestConnectionLossy: received " << next << ", " << link.dropped << " datagrams dropped"
+		<< std::endl;
+	UASSERTEQ(u32, next, count);
+	UASSERT(link.dropped > 0);
+
+	link.stop();
+	link.wait();
+}
@@ -5,6 +5,10 @@
 #include "test.h"
 
 #include "util/container.h"
+#include "server/serializedblockcache.h"
+#include "emerge_queue.h"
+#include "nodetimer.h"
+#include "util/timerwheel.h"
 
 class TestDataStructures : public TestBase
 {
@@ -19,6 +23,11 @@ class TestDataStructures : public TestBase
 	void testMap3();
 	void testMap4();
 	void testMap5();
+
+	void testBlockCache();
+	void testEmergeQueue();
+	void testTimerWheel();
+	void testNodeTimerClock();
 };
 
 static TestDataStructures g_test_instance;
@@ -31,6 +40,16 @@ void TestDataStructures::runTests(IGameDef *gamedef)
 	TEST(testMap3);
 	TEST(testMap4);
 	TEST(testMap5);
+
+	rawstream << "-------- SerializedBlockCache" << std::endl;
+	TEST(testBlockCache);
+
+	rawstream << "-------- EmergeQueue" << std::endl;
+	TEST(testEmergeQueue);
+
+	rawstream << "-------- TimerWheel" << std::endl;
+	TEST(testTimerWheel);
+	TEST(testNodeTimerClock);
 }
 
 namespace {
@@ -168,3 +187,212 @@ void TestDataStructures::testMap5()
 		break;
 	}
 }
+
+void TestDataStructures::testBlockCache()
+{
+	MetricsBackend mb;
+	const auto data = [] (size_t n) {
+		return std::make_shared<const std::string>(n, 'x');
+	};
+
+	SerializedBlockCache cache(10000, &mb);
+	UASSERT(!cache.get({1, 2, 3}, 29, 1));
+
+	cache.put({1, 2, 3}, 29, 1, data(1000));
+	UASSERT(cache.get({1, 2, 3}, 29, 1));
+	// other format or outdated version
+	UASSERT(!cache.get({1, 2, 3}, 28, 1));
+	UASSERT(!cache.get({1, 2, 3}, 29, 2));
+	// outdated entries are dropped on lookup
+	UASSERTEQ(size_t, cache.size(), 0);
+	UASSERTEQ(size_t, cache.getMemoryUsage(), 0);
+
+	// only one version per block is kept
+	cache.put({1, 2, 3}, 29, 1, data(1000));
+	cache.put({1, 2, 3}, 29, 2, data(1000));
+	UASSERTEQ(size_t, cache.size(), 1);
+	UASSERT(cache.get({1, 2, 3}, 29, 2));
+
+	// least recently used entries are evicted when full
+	for (s16 i = 0; i < 20; i++) {
+		cache.put({i, 0, 0}, 29, 1, data(1000));
+		UASSERT(cache.get({1, 2, 3}, 29, 2));
+	}
+	UASSERT(cache.getMemoryUsage() <= 10000);
+	UASSERT(cache.get({1, 2, 3}, 29, 2));
+	UASSERT(cache.get({19, 0, 0}, 29, 1));
+	UASSERT(!cache.get({0, 0, 0}, 29, 1));
+
+	// too large to be cached at all
+	cache.put({5, 5, 5}, 29, 1, data(20000));
+	UASSERT(!cache.get({5, 5, 5}, 29, 1));
+
+	cache.clear();
+	UASSERTEQ(size_t, cache.size(), 0);
+	UASSERTEQ(size_t, cache.getMemoryUsage(), 0);
+}
+
+void TestDataStructures::testEmergeQueue()
+{
+	EmergeQueue queue;
+	queue.setQueueCount(2);
+	v3s16 pos;
+
+	UASSERT(!queue.pop(0, pos));
+
+	// Ordered by priority, then insertion order
+	UASSERT(queue.push({0, 0, 1}, 5, 0));
+	UASSERT(queue.push({0, 0, 2}, 3, 0));
+	UASSERT(queue.push({0, 0, 3}, 5, 0));
+	UASSERT(queue.push({0, 0, 4}, 3, 0));
+	UASSERTEQ(size_t, queue.size(), 4);
+	UASSERTEQ(size_t, queue.size(0), 4);
+
+	std::vector<v3s16> upcoming;
+	queue.peek(0, 3, upcoming);
+	UASSERTEQ(size_t, upcoming.size(), 3);
+	UASSERT(upcoming[0] == v3s16(0, 0, 2));
+	UASSERT(upcoming[1] == v3s16(0, 0, 4));
+	UASSERT(upcoming[2] == v3s16(0, 0, 1));
+
+	// Pushing again only raises the priority, the queue stays
+	UASSERT(!queue.push({0, 0, 3}, 1, 1));
+	UASSERT(!queue.push({0, 0, 2}, 9, 1));
+	UASSERTEQ(size_t, queue.size(0), 4);
+	UASSERTEQ(size_t, queue.size(1), 0);
+
+	UASSERT(queue.pop(0, pos) && pos == v3s16(0, 0, 3));
+	UASSERT(queue.pop(0, pos) && pos == v3s16(0, 0, 2));
+
+	// An empty queue steals from the busiest one
+	UASSERT(queue.push({1, 0, 0}, 0, 1));
+	UASSERT(queue.pop(1, pos) && pos == v3s16(1, 0, 0));
+	UASSERT(queue.pop(1, pos) && pos == v3s16(0, 0, 4));
+	UASSERTEQ(size_t, queue.size(0), 1);
+
+	std::vector<v3s16> removed;
+	queue.clear(0, removed);
+	UASSERTEQ(size_t, removed.size(), 1);
+	UASSERT(removed[0] == v3s16(0, 0, 1));
+	UASSERTEQ(size_t, queue.size(), 0);
+	UASSERT(!queue.pop(1, pos));
+
+	// Can be queued again after being removed
+	UASSERT(queue.push({0, 0, 1}, 0, 1));
+}
+
+void TestDataStructures::testTimerWheel()
+{
+	TimerWheel<int> wheel;
+	std::vector<int> due;
+
+	wheel.schedule(1, 3);
+	wheel.schedule(2, 100);     // second level
+	wheel.schedule(3, 70000);   // third level
+	wheel.schedule(4, 1 << 25); // beyond the top, goes around
+	wheel.schedule(5, 0);       // in the past, due next tick
+	UASSERTEQ(size_t, wheel.size(), 5);
+
+	wheel.advance(1, due);
+	UASSERT(due == std::vector<int>({5}));
+	due.clear();
+
+	wheel.advance(2, due);
+	UASSERT(due.empty());
+	wheel.advance(3, due);
+	UASSERT(due == std::vector<int>({1}));
+	due.clear();
+
+	// Earlier ticks win, later ones are ignored
+	wheel.schedule(2, 50);
+	wheel.schedule(2, 200);
+	wheel.advance(99, due);
+	UASSERT(due == std::vector<int>({2}));
+	due.clear();
+	wheel.advance(200, due);
+	UASSERT(due.empty());
+
+	wheel.unschedule(3);
+	wheel.advance(70000, due);
+	UASSERT(due.empty());
+
+	wheel.advance((1 << 25) - 1, due);
+	UASSERT(due.empty());
+	wheel.advance(1 << 25, due);
+	UASSERT(due == std::vector<int>({4}));
+	UASSERTEQ(size_t, wheel.size(), 0);
+	UASSERTEQ(u64, wheel.getTick(), 1 << 25);
+
+	// Every tick up to a level boundary and across it
+	due.clear();
+	for (int i = 1; i <= 5000; i++)
+		wheel.schedule(i, wheel.getTick() + i);
+	for (int i = 1; i <= 5000; i++) {
+		wheel.advance(wheel.getTick() + 1, due);
+		UASSERT(due.size() == 1 && due[0] == i);
+		due.clear();
+	}
+}
+
+namespace {
+
+struct TestClock : public NodeTimerClock {
+	double time = 0;
+	std::vector<std::pair<v3s16, double>> scheduled;
+
+	double getTime() const override { return time; }
+	void schedule(v3s16 blockpos, double t) override
+	{
+		scheduled.emplace_back(blockpos, t);
+	}
+};
+
+}
+
+void TestDataStructures::testNodeTimerClock()
+{
+	NodeTimerList list;
+	TestClock clock;
+	const v3s16 blockpos(1, 2, 3);
+
+	list.set(NodeTimer(5.0f, 0.0f, v3s16(1, 1, 1)));
+	list.set(NodeTimer(2.0f, 0.0f, v3s16(2, 2, 2)));
+	UASSERT(list.step(1.0f).empty());
+
+	// The time left is kept when attaching
+	clock.time = 100;
+	list.attach(&clock, blockpos);
+	UASSERT(list.isAttached(&clock));
+	UASSERTEQ(size_t, clock.scheduled.size(), 1);
+	UASSERT(clock.scheduled[0].first == blockpos);
+	UASSERTEQ(double, clock.scheduled[0].second, 101.0);
+	UASSERTEQ(f32, list.get(v3s16(1, 1, 1)).elapsed, 1.0f);
+
+	// Attached lists follow the clock
+	UASSERT(list.step(10.0f).empty());
+	clock.time = 101.5;
+	clock.scheduled.clear();
+	auto elapsed = list.step(0);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(2, 2, 2));
+	UASSERTEQ(f32, elapsed[0].elapsed, 2.5f);
+	// and tell it about the next trigger
+	UASSERTEQ(size_t, clock.scheduled.size(), 1);
+	UASSERTEQ(double, clock.scheduled[0].second, 104.0);
+
+	// Earlier timers are scheduled when set
+	clock.scheduled.clear();
+	list.set(NodeTimer(1.0f, 0.0f, v3s16(3, 3, 3)));
+	UASSERTEQ(size_t, clock.scheduled.size(), 1);
+	UASSERTEQ(double, clock.scheduled[0].second, 102.5);
+
+	// Detached lists go on from the time of the clock
+	list.detach();
+	UASSERT(!list.isAttached(&clock));
+	clock.time = 1000;
+	UASSERT(list.step(0.5f).empty());
+	elapsed = list.step(0.5f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(3, 3, 3));
+	UASSERTEQ(f32, list.get(v3s16(1, 1, 1)).elapsed, 3.5f);
+}
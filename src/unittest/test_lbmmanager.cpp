@@ -4,9 +4,11 @@
 
 #include "test.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "server/blockmodifier.h"
+#include "mapblock.h"
 
 class TestLBMManager : public TestBase
 {
@@ -19,6 +21,7 @@ class TestLBMManager : public TestBase
 	void testNew(IGameDef *gamedef);
 	void testExisting(IGameDef *gamedef);
 	void testDiscard(IGameDef *gamedef);
+	void testApply(IGameDef *gamedef);
 };
 
 static TestLBMManager g_test_instance;
@@ -28,6 +31,7 @@ void TestLBMManager::runTests(IGameDef *gamedef)
 	TEST(testNew, gamedef);
 	TEST(testExisting, gamedef);
 	TEST(testDiscard, gamedef);
+	TEST(testApply, gamedef);
 }
 
 namespace {
@@ -38,6 +42,21 @@ namespace {
 			trigger_contents.emplace_back("air");
 		}
 	};
+
+	struct RecordingLBM : LoadingBlockModifierDef {
+		std::vector<std::pair<std::string, size_t>> &calls;
+
+		RecordingLBM(const std::string &name, const std::string &node,
+				std::vector<std::pair<std::string, size_t>> &calls) : calls(calls) {
+			this->name = name;
+			trigger_contents.push_back(node);
+		}
+
+		void trigger(ServerEnvironment *env, MapBlock *block,
+				const std::unordered_set<v3s16> &positions, float dtime_s) override {
+			calls.emplace_back(name, positions.size());
+		}
+	};
 }
 
 void TestLBMManager::testNew(IGameDef *gamedef)
@@ -79,4 +98,47 @@ void TestLBMManager::testDiscard(IGameDef *gamedef)
 	UASSERTEQ(auto, str, "");
 }
 
-// We should also test LBMManager::applyLBMs in the future.
+void TestLBMManager::testApply(IGameDef *gamedef)
+{
+	std::vector<std::pair<std::string, size_t>> calls;
+	LBMManager mgr;
+
+	mgr.addLBMDef(new RecordingLBM("test:old", "default:stone", calls));
+	mgr.addLBMDef(new RecordingLBM("test:new", "default:stone", calls));
+	mgr.addLBMDef(new RecordingLBM("test:water", "default:water", calls));
+	mgr.loadIntroductionTimes("test:old~10;test:water~10;", gamedef, 20);
+
+	MapBlock block({}, gamedef);
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+		block.setNodeNoCheck(p, MapNode(CONTENT_AIR));
+	block.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE));
+	block.setNode({15, 15, 15}, MapNode(t_CONTENT_STONE));
+
+	// Both stone LBMs, oldest first; no water in the block
+	mgr.applyLBMs(nullptr, &block, 5, 0);
+	UASSERTEQ(size_t, calls.size(), 2);
+	UASSERTEQ(auto, calls[0].first, "test:old");
+	UASSERTEQ(auto, calls[1].first, "test:new");
+	UASSERTEQ(size_t, calls[1].second, 2);
+
+	// Only the LBM introduced since
+	calls.clear();
+	mgr.applyLBMs(nullptr, &block, 15, 0);
+	UASSERTEQ(size_t, calls.size(), 1);
+	UASSERTEQ(auto, calls[0].first, "test:new");
+
+	// Nothing introduced since
+	calls.clear();
+	mgr.applyLBMs(nullptr, &block, 25, 0);
+	UASSERT(calls.empty());
+
+	// Sees changed nodes
+	block.setNode({0, 0, 0}, MapNode(t_CONTENT_WATER));
+	mgr.applyLBMs(nullptr, &block, 10, 0);
+	UASSERTEQ(size_t, calls.size(), 3);
+	UASSERTEQ(size_t, std::count(calls.begin(), calls.end(),
+		std::make_pair(std::string("test:water"), size_t(1))), 1);
+}
@@ -0,0 +1,299 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "test.h"
+
+#include "mock_server.h"
+#include "emerge.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "serverenvironment.h"
+#include "servermap.h"
+#include "settings.h"
+
+/*
+ * Tests ServerMap::transformLiquidsLocal(), once on a map that updates one
+ * node at a time and once on one that decides on whole batches in parallel.
+ */
+
+class TestLiquidTransform : public TestBase
+{
+public:
+	TestLiquidTransform() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLiquidTransform"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSpread(ServerEnvironment *env, ServerMap *map);
+	void testFlood(ServerEnvironment *env, ServerMap *map);
+	void testChangedByCallback(ServerEnvironment *env);
+	void testOutdated(ServerEnvironment *env);
+	void testParallel(ServerEnvironment *env, ServerMap *serial);
+
+private:
+	void prepareArea(ServerMap *map);
+	void settle(ServerEnvironment *env, ServerMap *map, UniqueQueue<v3s16> &queue);
+	s8 levelAt(ServerMap *map, v3s16 p);
+
+	content_t m_stone, m_source, m_flowing, m_torch, m_plant, m_trap;
+};
+
+static TestLiquidTransform g_test_instance;
+
+const static char *helper_lua_src = R"(
+core.register_node(":test:stone", {})
+core.register_node(":test:water_source", {
+	drawtype = "liquid",
+	liquidtype = "source",
+	liquid_alternative_source = "test:water_source",
+	liquid_alternative_flowing = "test:water_flowing",
+})
+core.register_node(":test:water_flowing", {
+	drawtype = "flowingliquid",
+	liquidtype = "flowing",
+	paramtype2 = "flowingliquid",
+	liquid_alternative_source = "test:water_source",
+	liquid_alternative_flowing = "test:water_flowing",
+})
+
+core.register_node(":test:plant", {floodable = true})
+-- Stays, counting how often it was flooded in param2
+core.register_node(":test:torch", {
+	floodable = true,
+	on_flood = function(pos, oldnode)
+		oldnode.param2 = oldnode.param2 + 1
+		core.swap_node(pos, oldnode)
+		return true
+	end,
+})
+-- Stays, but turns the node behind it into stone
+core.register_node(":test:trap", {
+	floodable = true,
+	on_flood = function(pos)
+		core.set_node(vector.offset(pos, 0, 0, -1), {name = "test:stone"})
+		return true
+	end,
+})
+)";
+
+void TestLiquidTransform::runTests(IGameDef *gamedef)
+{
+	MockServer server(getTestTempDirectory());
+
+	const auto helper_lua = getTestTempFile();
+	{
+		std::ofstream ofs(helper_lua, std::ios::out | std::ios::binary);
+		ofs << helper_lua_src;
+		std::ofstream ofs2(server.getWorldPath() + DIR_DELIM "world.mt",
+			std::ios::out | std::ios::binary);
+		ofs2 << "backend = dummy\n";
+	}
+
+	server.createScripting();
+	try {
+		auto script = server.getScriptIface();
+		script->loadBuiltin();
+		script->loadMod(helper_lua, BUILTIN_MOD_NAME);
+	} catch (ModError &e) {
+		rawstream << e.what() << std::endl;
+		num_tests_failed = 1;
+		return;
+	}
+
+	NodeDefManager *ndef = server.getWritableNodeDefManager();
+	ndef->resolveCrossrefs();
+	m_stone = ndef->getId("test:stone");
+	m_source = ndef->getId("test:water_source");
+	m_flowing = ndef->getId("test:water_flowing");
+	m_torch = ndef->getId("test:torch");
+	m_plant = ndef->getId("test:plant");
+	m_trap = ndef->getId("test:trap");
+
+	MetricsBackend mb;
+	// Each map needs its own
+	EmergeManager emerge(&server, &mb), emerge2(&server, &mb);
+
+	// The environment, and so the callbacks, get the parallel one
+	const std::string old_threads = g_settings->get("num_liquid_threads");
+	g_settings->set("num_liquid_threads", "1");
+	auto serial = std::make_unique<ServerMap>(server.getWorldPath(), &server, &emerge2, &mb);
+	g_settings->set("num_liquid_threads", "4");
+	auto map = std::make_unique<ServerMap>(server.getWorldPath(), &server, &emerge, &mb);
+	g_settings->set("num_liquid_threads", old_threads);
+	ServerMap *parallel = map.get();
+	ServerEnvironment env(std::move(map), &server, &mb);
+	server.getScriptIface()->initializeEnvironment(&env);
+
+	TEST(testSpread, &env, serial.get());
+	TEST(testSpread, &env, parallel);
+	TEST(testFlood, &env, parallel);
+	TEST(testChangedByCallback, &env);
+	TEST(testOutdated, &env);
+	TEST(testParallel, &env, serial.get());
+
+	env.deactivateBlocksAndObjects();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stone floor below y = 0 in a 4x2x4 blocks area
+void TestLiquidTransform::prepareArea(ServerMap *map)
+{
+	v3s16 bp;
+	for (bp.Z = -2; bp.Z <= 1; bp.Z++)
+	for (bp.Y = -1; bp.Y <= 0; bp.Y++)
+	for (bp.X = -2; bp.X <= 1; bp.X++) {
+		MapBlock *block = map->emergeBlock(bp, true);
+		UASSERT(block);
+		const MapNode n(bp.Y < 0 ? m_stone : CONTENT_AIR);
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+			block->setNodeNoCheck(x, y, z, n);
+	}
+}
+
+// Runs the liquid queue until nothing changes anymore
+void TestLiquidTransform::settle(ServerEnvironment *env, ServerMap *map,
+	UniqueQueue<v3s16> &queue)
+{
+	std::map<v3s16, MapBlock *> modified_blocks;
+	for (int i = 0; i < 1000 && !queue.empty(); i++)
+		map->transformLiquidsLocal(modified_blocks, queue, env, U32_MAX);
+	UASSERT(queue.empty());
+}
+
+s8 TestLiquidTransform::levelAt(ServerMap *map, v3s16 p)
+{
+	MapNode n = map->getNode(p);
+	if (n.getContent() == m_source)
+		return LIQUID_LEVEL_SOURCE;
+	if (n.getContent() == m_flowing)
+		return n.param2 & LIQUID_LEVEL_MASK;
+	return -1;
+}
+
+void TestLiquidTransform::testSpread(ServerEnvironment *env, ServerMap *map)
+{
+	prepareArea(map);
+	UniqueQueue<v3s16> queue;
+
+	map->setNode(v3s16(0, 0, 0), MapNode(m_source));
+	queue.push_back(v3s16(0, 0, 0));
+	settle(env, map, queue);
+
+	// Flows out on the floor, losing a level per node
+	UASSERTEQ(int, levelAt(map, v3s16(0, 0, 0)), LIQUID_LEVEL_SOURCE);
+	for (s16 d = 1; d <= LIQUID_LEVEL_MAX + 1; d++) {
+		UASSERTEQ(int, levelAt(map, v3s16(d, 0, 0)), LIQUID_LEVEL_MAX + 1 - d);
+		UASSERTEQ(int, levelAt(map, v3s16(0, 0, -d)), LIQUID_LEVEL_MAX + 1 - d);
+	}
+	UASSERTEQ(int, levelAt(map, v3s16(LIQUID_LEVEL_MAX + 2, 0, 0)), -1);
+	UASSERTEQ(int, levelAt(map, v3s16(0, 1, 0)), -1);
+
+	// And dries up again without the source
+	map->setNode(v3s16(0, 0, 0), MapNode(CONTENT_AIR));
+	for (s16 d = -1; d <= 1; d += 2) {
+		queue.push_back(v3s16(d, 0, 0));
+		queue.push_back(v3s16(0, 0, d));
+	}
+	settle(env, map, queue);
+	for (s16 d = -LIQUID_LEVEL_MAX - 1; d <= LIQUID_LEVEL_MAX + 1; d++) {
+		UASSERTEQ(int, levelAt(map, v3s16(d, 0, 0)), -1);
+		UASSERTEQ(int, levelAt(map, v3s16(d, 0, 3)), -1);
+	}
+}
+
+void TestLiquidTransform::testFlood(ServerEnvironment *env, ServerMap *map)
+{
+	prepareArea(map);
+	UniqueQueue<v3s16> queue;
+	std::map<v3s16, MapBlock *> modified_blocks;
+
+	map->setNode(v3s16(0, 0, 0), MapNode(m_source));
+	map->setNode(v3s16(1, 0, 0), MapNode(m_plant));
+	map->setNode(v3s16(0, 0, 1), MapNode(m_torch));
+
+	// Queued several times, looked at once
+	for (int i = 0; i < 3; i++)
+		queue.push_back(v3s16(0, 0, 1));
+	map->transformLiquidsLocal(modified_blocks, queue, env, 1);
+	UASSERT(queue.empty());
+	UASSERT(map->getNode(v3s16(0, 0, 1)).getContent() == m_torch);
+	UASSERTEQ(int, map->getNode(v3s16(0, 0, 1)).param2, 1);
+
+	// Without on_flood the node is replaced
+	queue.push_back(v3s16(1, 0, 0));
+	map->transformLiquidsLocal(modified_blocks, queue, env, 1);
+	UASSERTEQ(int, levelAt(map, v3s16(1, 0, 0)), LIQUID_LEVEL_MAX);
+	UASSERT(modified_blocks.count(v3s16(0, 0, 0)) == 1);
+}
+
+void TestLiquidTransform::testChangedByCallback(ServerEnvironment *env)
+{
+	auto *map = &env->getServerMap();
+	prepareArea(map);
+	UniqueQueue<v3s16> queue;
+
+	// The trap is looked at before the plant in the same batch, and removes
+	// the source that both would be flooded from
+	map->setNode(v3s16(0, 0, 0), MapNode(m_source));
+	map->setNode(v3s16(0, 0, 1), MapNode(m_trap));
+	map->setNode(v3s16(1, 0, 0), MapNode(m_plant));
+	queue.push_back(v3s16(0, 0, 1));
+	queue.push_back(v3s16(1, 0, 0));
+	queue.push_back(v3s16(0, 0, -1));
+	settle(env, map, queue);
+
+	UASSERT(map->getNode(v3s16(0, 0, 0)).getContent() == m_stone);
+	UASSERT(map->getNode(v3s16(0, 0, 1)).getContent() == m_trap);
+	UASSERT(map->getNode(v3s16(1, 0, 0)).getContent() == m_plant);
+	UASSERTEQ(int, levelAt(map, v3s16(0, 0, -1)), -1);
+}
+
+void TestLiquidTransform::testOutdated(ServerEnvironment *env)
+{
+	auto *map = &env->getServerMap();
+	prepareArea(map);
+	UniqueQueue<v3s16> queue;
+
+	// The flowing node dries up, so the plant next to it must not be flooded
+	// by it, although both are decided on in the same batch
+	MapNode flowing(m_flowing, 0, LIQUID_LEVEL_MAX);
+	map->setNode(v3s16(1, 0, 0), flowing);
+	map->setNode(v3s16(2, 0, 0), MapNode(m_plant));
+	queue.push_back(v3s16(1, 0, 0));
+	queue.push_back(v3s16(2, 0, 0));
+	settle(env, map, queue);
+
+	UASSERTEQ(int, levelAt(map, v3s16(1, 0, 0)), -1);
+	UASSERT(map->getNode(v3s16(2, 0, 0)).getContent() == m_plant);
+}
+
+void TestLiquidTransform::testParallel(ServerEnvironment *env, ServerMap *serial)
+{
+	// Many sources so that the batches get big enough to be split up
+	auto *parallel = &env->getServerMap();
+	prepareArea(serial);
+	prepareArea(parallel);
+	UniqueQueue<v3s16> queue;
+	for (s16 z = -30; z < 32; z += 3)
+	for (s16 x = -30; x < 32; x += 4) {
+		v3s16 p(x, 0, z);
+		serial->setNode(p, MapNode(m_source));
+		parallel->setNode(p, MapNode(m_source));
+		queue.push_back(p);
+	}
+	UniqueQueue<v3s16> queue2 = queue;
+
+	settle(env, serial, queue);
+	settle(env, parallel, queue2);
+
+	for (s16 z = -32; z < 32; z++)
+	for (s16 x = -32; x < 32; x++) {
+		v3s16 p(x, 0, z);
+		MapNode a = serial->getNode(p), b = parallel->getNode(p);
+		UASSERT(a.getContent() == b.getContent() && a.param2 == b.param2);
+	}
+}
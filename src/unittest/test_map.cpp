@@ -22,7 +22,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <unordered_set>
 #include <unordered_map>
 #include "mapblock.h"
+#include "mapsector.h"
 #include "dummymap.h"
+#include "threading/thread.h"
 
 class TestMap : public TestBase
 {
@@ -36,6 +38,7 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testSectorTable(IGameDef *gamedef);
 };
 
 static TestMap g_test_instance;
@@ -46,6 +49,7 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testSectorTable, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +173,82 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+namespace {
+class BlockLookupThread : public Thread
+{
+public:
+	BlockLookupThread(const Map &map, v3s16 pos) :
+		Thread("BlockLookup"), m_map(map), m_pos(pos)
+	{}
+
+	u32 found = 0;
+	u32 generated = 0;
+
+private:
+	void *run() override
+	{
+		while (!stopRequested()) {
+			if (m_map.isBlockLoaded(m_pos))
+				found++;
+			if (m_map.isBlockGenerated(m_pos))
+				generated++;
+		}
+		return nullptr;
+	}
+
+	const Map &m_map;
+	v3s16 m_pos;
+};
+
+class SectorTestMap : public DummyMap
+{
+public:
+	using DummyMap::DummyMap;
+	using Map::m_sectors;
+};
+}
+
+void TestMap::testSectorTable(IGameDef *gamedef)
+{
+	// spans multiple regions, including negative ones
+	const v3s16 bpmin(-17, 0, -1), bpmax(17, 0, 1);
+	SectorTestMap map(gamedef, bpmin, bpmax);
+
+	size_t count = 0;
+	for (auto &it : map.m_sectors) {
+		UASSERT(it.second->getPos() == it.first);
+		count++;
+	}
+	UASSERTEQ(size_t, count, 35 * 3);
+	UASSERTEQ(size_t, map.m_sectors.size(), count);
+
+	UASSERT(map.isBlockLoaded({-17, 0, -1}));
+	UASSERT(map.isBlockLoaded({17, 0, 1}));
+	UASSERT(!map.isBlockLoaded({17, 1, 1}));
+	UASSERT(!map.isBlockLoaded({18, 0, 1}));
+	UASSERT(!map.isBlockGenerated({18, 0, 1}));
+
+	// Lookups from another thread while blocks come and go
+	const v3s16 p(16, 5, 0);
+	MapSector *sector = map.getSectorNoGenerate({p.X, p.Z});
+	UASSERT(sector);
+	BlockLookupThread thread(map, p);
+	thread.start();
+	for (int i = 0; i < 1000; i++) {
+		MapBlock *block = sector->createBlankBlock(p.Y);
+		UASSERT(map.isBlockLoaded(p));
+		UASSERT(!map.isBlockGenerated(p));
+		block->setGenerated(true);
+		UASSERT(map.isBlockGenerated(p));
+		sector->deleteBlock(block);
+		UASSERT(!map.isBlockLoaded(p));
+	}
+	thread.stop();
+	thread.wait();
+
+	map.deleteSectors({{-17, -1}, {0, 0}});
+	UASSERT(!map.isBlockLoaded({-17, 0, -1}));
+	UASSERT(!map.isBlockLoaded({0, 0, 0}));
+	UASSERTEQ(size_t, map.m_sectors.size(), 35 * 3 - 2);
+}
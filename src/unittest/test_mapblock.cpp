@@ -12,6 +12,7 @@
 #include "inventory.h"
 #include "util/serialize.h"
 #include "voxel.h"
+#include "server/blockmodifier.h"
 
 class TestMapBlock : public TestBase
 {
@@ -28,6 +29,13 @@ class TestMapBlock : public TestBase
 
 	void testSave29(IGameDef *gamedef);
 
+	// Tests that serializeUncompressed() matches serialize()
+	void testSaveUncompressed(IGameDef *gamedef);
+
+	void testContentVersion(IGameDef *gamedef);
+
+	void testABMIndex(IGameDef *gamedef);
+
 	void testLoad29(IGameDef *gamedef);
 
 	// Tests loading a MapBlock from Minetest-c55 0.3
@@ -47,6 +55,9 @@ void TestMapBlock::runTests(IGameDef *gamedef)
 	TEST(testSaveLoad, gamedef, SER_FMT_VER_HIGHEST_WRITE);
 	TEST(testSaveLoadLowest, gamedef);
 	TEST(testSave29, gamedef);
+	TEST(testSaveUncompressed, gamedef);
+	TEST(testContentVersion, gamedef);
+	TEST(testABMIndex, gamedef);
 	TEST(testLoad29, gamedef);
 	TEST(testLoad20, gamedef);
 	TEST(testLoadNonStd, gamedef);
@@ -192,6 +203,7 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 
 		// Check data
 		PcgRandom r(seed);
+		std::vector<content_t> contents;
 		for (s16 z=0; z < MAP_BLOCKSIZE; z++)
 		for (s16 y=0; y < MAP_BLOCKSIZE; y++)
 		for (s16 x=0; x < MAP_BLOCKSIZE; x++) {
@@ -199,8 +211,112 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 			auto expect =
 				MapNode(rval % max, (rval >> 16) & 0xff, (rval >> 24) & 0xff);
 			UASSERT(block.getNodeNoCheck(x, y, z) == expect);
+			contents.push_back(expect.getContent());
 		}
+
+		// The contents are known from loading
+		SORT_AND_UNIQUE(contents);
+		UASSERT(block.getContents() == contents);
+
+		block.setNode({0, 0, 0}, MapNode(max));
+		contents.clear();
+		for (u32 i = 0; i < MapBlock::nodecount; i++)
+			contents.push_back(block.data[i].getContent());
+		SORT_AND_UNIQUE(contents);
+		UASSERT(block.getContents() == contents);
+	}
+}
+
+void TestMapBlock::testSaveUncompressed(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	PcgRandom r(0xb10c);
+	for (s16 z=0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y=0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x=0; x < MAP_BLOCKSIZE; x++)
+		block.setNodeNoCheck(x, y, z, MapNode(r.range(0, 3), r.next() & 0xff, 0));
+
+	const u8 ver = SER_FMT_VER_HIGHEST_WRITE;
+	for (bool disk : {false, true}) {
+		std::ostringstream expected(std::ios_base::binary);
+		block.serialize(expected, ver, disk, -1);
+
+		std::ostringstream raw(std::ios_base::binary);
+		block.serializeUncompressed(raw, ver, disk);
+		std::ostringstream actual(std::ios_base::binary);
+		compress(raw.str(), actual, ver, -1);
+
+		UASSERT(actual.str() == expected.str());
 	}
+
+	std::ostringstream os(std::ios_base::binary);
+	EXCEPTION_CHECK(VersionMismatchException,
+		block.serializeUncompressed(os, 28, false));
+}
+
+void TestMapBlock::testContentVersion(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	MapBlock block2({}, gamedef);
+
+	const u64 v1 = block.getContentVersion();
+	UASSERT(v1 != 0);
+	UASSERTEQ(u64, block.getContentVersion(), v1);
+	// unique between blocks
+	UASSERT(block2.getContentVersion() != v1);
+
+	// modifications not visible to clients keep it
+	block.setTimestamp(1234);
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_STATIC_DATA_ADDED);
+	UASSERTEQ(u64, block.getContentVersion(), v1);
+
+	block.setNode({1, 2, 3}, MapNode(CONTENT_AIR));
+	const u64 v2 = block.getContentVersion();
+	UASSERT(v2 > v1);
+
+	block.raiseModified(MOD_STATE_WRITE_NEEDED);
+	UASSERT(block.getContentVersion() > v2);
+}
+
+void TestMapBlock::testABMIndex(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	block.expandNodesIfNeeded();
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.data[i] = MapNode(CONTENT_AIR);
+	block.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE));
+	block.setNode({15, 15, 15}, MapNode(t_CONTENT_STONE));
+	block.setNode({0, 0, 0}, MapNode(t_CONTENT_WATER));
+	block.setNode({4, 4, 4}, MapNode(t_CONTENT_LAVA));
+	UASSERT(!block.abm_index.valid);
+
+	std::vector<bool> wanted(std::max(t_CONTENT_STONE, t_CONTENT_WATER) + 1);
+	wanted[t_CONTENT_STONE] = wanted[t_CONTENT_WATER] = true;
+	ABMHandler::indexBlock(&block, wanted);
+
+	const auto &index = block.abm_index;
+	UASSERT(index.valid);
+	UASSERTEQ(size_t, index.contents.size(), 2);
+	UASSERTEQ(size_t, index.nodes.size(), 3);
+
+	// grouped by content, in node order within a content
+	const bool stone_first = t_CONTENT_STONE < t_CONTENT_WATER;
+	const size_t stone = stone_first ? 0 : 1;
+	const size_t stone_begin = index.contents[stone].second;
+	UASSERTEQ(content_t, index.contents[stone].first, t_CONTENT_STONE);
+	UASSERTEQ(u16, index.nodes[stone_begin], 3 * MapBlock::zstride + 2 * MapBlock::ystride + 1);
+	UASSERTEQ(u16, index.nodes[stone_begin + 1], MapBlock::nodecount - 1);
+	UASSERTEQ(content_t, index.contents[1 - stone].first, t_CONTENT_WATER);
+	UASSERTEQ(u16, index.nodes[index.contents[1 - stone].second], 0);
+
+	// only changes to the nodes invalidate it
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_STATIC_DATA_ADDED);
+	UASSERT(index.valid);
+	block.setNode({1, 2, 3}, MapNode(CONTENT_AIR));
+	UASSERT(!index.valid);
+
+	ABMHandler::indexBlock(&block, wanted);
+	UASSERTEQ(size_t, index.nodes.size(), 2);
 }
 
 #define SS2_CHECK() UASSERT(!ss2.fail())
@@ -11,6 +11,9 @@
 #include <optional>
 #include "database/database-dummy.h"
 #include "database/database-sqlite3.h"
+#include "serialization.h"
+#include "servermap.h"
+#include "server/mapsavethread.h"
 #if USE_LEVELDB
 #include "database/database-leveldb.h"
 #endif
@@ -72,7 +75,9 @@ class TestMapDatabase : public TestBase
 	void testLoad();
 	void testList(int expect);
 	void testRemove();
+	void testBatch();
 	void testPositionEncoding();
+	void testSaveThread();
 
 private:
 	MapDatabaseProvider *provider = nullptr;
@@ -92,6 +97,7 @@ void TestMapDatabase::runTests(IGameDef *gamedef)
 	sanity_check(!test_data.empty());
 
 	TEST(testPositionEncoding);
+	TEST(testSaveThread);
 
 	rawstream << "-------- Dummy" << std::endl;
 
@@ -145,6 +151,7 @@ void TestMapDatabase::runTestsForCurrentDB()
 	TEST(testList, 1);
 	TEST(testRemove);
 	TEST(testList, 0);
+	TEST(testBatch);
 }
 
 void TestMapDatabase::testSave()
@@ -197,6 +204,30 @@ void TestMapDatabase::testRemove()
 	//UASSERT(!db->deleteBlock({1, 2, 4}));
 }
 
+void TestMapDatabase::testBatch()
+{
+	auto *db = provider->get();
+
+	const std::vector<v3s16> pos{{1, 2, 3}, {-4, 5, -6}, {7, 8, 9}};
+	std::vector<std::pair<v3s16, std::string_view>> blocks;
+	for (v3s16 p : pos)
+		blocks.emplace_back(p, test_data);
+	blocks[1].second = "something else";
+	UASSERT(db->saveBlocks(blocks));
+
+	std::vector<std::string> dest;
+	db = provider->get();
+	db->loadBlocks({{7, 8, 9}, {0, 0, 0}, {-4, 5, -6}, {1, 2, 3}}, dest);
+	UASSERTEQ(size_t, dest.size(), 4);
+	UASSERT(dest[0] == test_data);
+	UASSERT(dest[1].empty());
+	UASSERT(dest[2] == "something else");
+	UASSERT(dest[3] == test_data);
+
+	for (v3s16 p : pos)
+		UASSERT(db->deleteBlock(p));
+}
+
 void TestMapDatabase::testPositionEncoding()
 {
 	auto db = std::make_unique<Database_Dummy>();
@@ -224,3 +255,68 @@ void TestMapDatabase::testPositionEncoding()
 	UASSERT(db->getIntegerAsBlock(-0x800800800) == v3s16(-2048, -2048, -2048))
 	UASSERT(db->getIntegerAsBlock(-0x314e3807b) == v3s16(-123, 456, -789))
 }
+
+static std::string decompressSaved(const std::string &blob)
+{
+	UASSERT(blob.size() > 1);
+	UASSERTEQ(int, (u8)blob[0], SER_FMT_VER_HIGHEST_WRITE);
+	std::istringstream is(blob.substr(1), std::ios_base::binary);
+	std::ostringstream os(std::ios_base::binary);
+	decompress(is, os, SER_FMT_VER_HIGHEST_WRITE);
+	return os.str();
+}
+
+void TestMapDatabase::testSaveThread()
+{
+	auto dummy_db = std::make_unique<Database_Dummy>();
+	MapDatabaseAccessor db;
+	db.dbase = dummy_db.get();
+	MetricsBackend mb;
+
+	std::string dest;
+	{
+		// tiny limit, so that the backpressure kicks in too
+		MapSaveThread saver(&db, -1, 1, 1024, &mb);
+		db.saver = &saver;
+
+		// nothing is written until the thread runs, but loads see the data
+		saver.enqueue({1, 2, 3}, "outdated");
+		saver.enqueue({1, 2, 3}, test_data);
+		saver.enqueue({4, 5, 6}, "deleted");
+		{
+			MutexAutoLock dblock(db.mutex);
+			db.loadBlock({1, 2, 3}, dest);
+			UASSERT(decompressSaved(dest) == test_data);
+			saver.discard({4, 5, 6});
+			db.loadBlock({4, 5, 6}, dest);
+			UASSERT(dest.empty());
+		}
+		UASSERTEQ(size_t, saver.getPendingCount(), 1);
+
+		// over the limit blocks are refused instead of waited for
+		UASSERT(saver.enqueue({7, 8, 9}, std::string(1024, 'x')));
+		UASSERT(!saver.enqueue({7, 8, 10}, "refused"));
+		saver.discard({7, 8, 9});
+
+		saver.start();
+		saver.flush();
+		UASSERTEQ(size_t, saver.getPendingCount(), 0);
+		dummy_db->loadBlock({1, 2, 3}, &dest);
+		UASSERT(decompressSaved(dest) == test_data);
+		// only what reached the database is counted
+		UASSERTEQ(u64, db.bytes_written, dest.size());
+		dummy_db->loadBlock({4, 5, 6}, &dest);
+		UASSERT(dest.empty());
+
+		// the destructor writes out everything that is left
+		for (s16 i = 0; i < 100; i++)
+			UASSERT(saver.enqueue({i, 0, 0}, std::string(100, (char)i), true));
+		db.saver = nullptr;
+	}
+
+	std::vector<v3s16> list;
+	dummy_db->listAllLoadableBlocks(list);
+	UASSERTEQ(size_t, list.size(), 101);
+	dummy_db->loadBlock({42, 0, 0}, &dest);
+	UASSERT(decompressSaved(dest) == std::string(100, (char)42));
+}
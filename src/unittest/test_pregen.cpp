@@ -0,0 +1,86 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "test.h"
+
+#include "constants.h"
+#include "server.h"
+
+class TestPregen : public TestBase
+{
+public:
+	TestPregen() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestPregen"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testParseRadius();
+	void testParseBox();
+	void testParseInvalid();
+};
+
+static TestPregen g_test_instance;
+
+void TestPregen::runTests(IGameDef *gamedef)
+{
+	TEST(testParseRadius);
+	TEST(testParseBox);
+	TEST(testParseInvalid);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestPregen::testParseRadius()
+{
+	v3s16 minp, maxp;
+	UASSERT(Server::parsePregenArea("100", minp, maxp));
+	UASSERT(minp == v3s16(-100, -100, -100));
+	UASSERT(maxp == v3s16(100, 100, 100));
+
+	UASSERT(Server::parsePregenArea("0", minp, maxp));
+	UASSERT(minp == v3s16(0, 0, 0) && maxp == v3s16(0, 0, 0));
+
+	// The value counts, not the length
+	UASSERT(Server::parsePregenArea("000100", minp, maxp));
+	UASSERT(maxp == v3s16(100, 100, 100));
+
+	// Limited to the map instead of overflowing
+	const s16 limit = MAX_MAP_GENERATION_LIMIT;
+	UASSERT(Server::parsePregenArea("40000", minp, maxp));
+	UASSERT(maxp == v3s16(limit, limit, limit));
+	UASSERT(Server::parsePregenArea("99999999999999999999", minp, maxp));
+	UASSERT(minp == v3s16(-limit, -limit, -limit));
+	UASSERT(maxp == v3s16(limit, limit, limit));
+}
+
+void TestPregen::testParseBox()
+{
+	v3s16 minp, maxp;
+	UASSERT(Server::parsePregenArea("(10,-20,30) (-40,50,-60)", minp, maxp));
+	UASSERT(minp == v3s16(-40, -20, -60));
+	UASSERT(maxp == v3s16(10, 50, 30));
+
+	UASSERT(Server::parsePregenArea("(1.4, 2, 3)(4, 5, 6)", minp, maxp));
+	UASSERT(minp == v3s16(1, 2, 3));
+	UASSERT(maxp == v3s16(4, 5, 6));
+
+	// Limited to the map instead of overflowing
+	const s16 limit = MAX_MAP_GENERATION_LIMIT;
+	UASSERT(Server::parsePregenArea("(-1e9,0,0) (100000,0,1e30)", minp, maxp));
+	UASSERT(minp == v3s16(-limit, 0, 0));
+	UASSERT(maxp == v3s16(limit, 0, limit));
+}
+
+void TestPregen::testParseInvalid()
+{
+	v3s16 minp, maxp;
+	UASSERT(!Server::parsePregenArea("", minp, maxp));
+	UASSERT(!Server::parsePregenArea("-5", minp, maxp));
+	UASSERT(!Server::parsePregenArea("abc", minp, maxp));
+	UASSERT(!Server::parsePregenArea("(1,2,3)", minp, maxp));
+	UASSERT(!Server::parsePregenArea("(1,2) (3,4)", minp, maxp));
+	UASSERT(!Server::parsePregenArea("(1,2,3) (4,5,x)", minp, maxp));
+	UASSERT(!Server::parsePregenArea("(nan,0,0) (0,0,0)", minp, maxp));
+	UASSERT(!Server::parsePregenArea("(inf,0,0) (0,0,0)", minp, maxp));
+}
@@ -0,0 +1,102 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#include "test.h"
+
+#include "constants.h"
+#include "settings.h"
+#include "server/clientiface.h"
+
+class TestRemoteClient : public TestBase
+{
+public:
+	TestRemoteClient() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestRemoteClient"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSendWindow();
+	void testSendQueue();
+};
+
+static TestRemoteClient g_test_instance;
+
+void TestRemoteClient::runTests(IGameDef *gamedef)
+{
+	TEST(testSendWindow);
+	TEST(testSendQueue);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestRemoteClient::testSendWindow()
+{
+	RemoteClient client;
+	const u16 initial = client.getSendWindow();
+	UASSERTEQ(u16, initial,
+		g_settings->getU16("max_simultaneous_block_sends_per_client"));
+
+	// Nothing is learned while the window is not the limit
+	client.updateSendWindow(1e5f, 0.1f, 1000.0f);
+	UASSERTEQ(u16, client.getSendWindow(), initial);
+
+	for (s16 i = 0; i < initial; i++)
+		client.SentBlock(v3s16(i, 0, 0));
+
+	// Nor from missing measurements
+	client.updateSendWindow(0.0f, 0.1f, 1000.0f);
+	client.updateSendWindow(1e5f, FLT_MAX, 1000.0f);
+	UASSERTEQ(u16, client.getSendWindow(), initial);
+
+	// 100 kB/s * 100 ms = 10 blocks of 1 kB on the wire, twice that
+	client.updateSendWindow(1e5f, 0.1f, 1000.0f);
+	UASSERTEQ(u16, client.getSendWindow(), 20);
+
+	// Only adapted again once it was the limit again
+	client.updateSendWindow(1e9f, 0.1f, 1000.0f);
+	UASSERTEQ(u16, client.getSendWindow(), 20);
+
+	client.SentBlock(v3s16(0, 1, 0));
+	client.updateSendWindow(1e9f, 0.1f, 1000.0f);
+	UASSERTEQ(u16, client.getSendWindow(), initial * BLOCK_SEND_WINDOW_MAX_FACTOR);
+
+	// Far from filling a window this large
+	client.SentBlock(v3s16(0, 2, 0));
+	UASSERT(!client.m_send_window_full);
+	client.m_send_window_full = true;
+	client.updateSendWindow(1.0f, 0.1f, 1000.0f);
+	UASSERTEQ(u16, client.getSendWindow(), BLOCK_SEND_WINDOW_MIN);
+}
+
+void TestRemoteClient::testSendQueue()
+{
+	RemoteClient client;
+	UASSERT(!client.peekQueuedBlock());
+
+	client.queueBlock(3.0f, v3s16(3, 0, 0));
+	client.queueBlock(1.0f, v3s16(1, 0, 0));
+	client.queueBlock(2.0f, v3s16(2, 0, 0));
+	client.queueBlock(4.0f, v3s16(4, 0, 0));
+	UASSERTEQ(u32, client.getQueuedCount(), 4);
+
+	// Most important first
+	UASSERT(client.peekQueuedBlock());
+	UASSERT(client.peekQueuedBlock()->pos == v3s16(1, 0, 0));
+	client.popQueuedBlock();
+
+	// Sent in the meantime, so skipped
+	client.SentBlock(v3s16(2, 0, 0));
+	UASSERT(client.peekQueuedBlock()->pos == v3s16(3, 0, 0));
+	UASSERTEQ(u32, client.getQueuedCount(), 2);
+
+	// Not sendable now, so the search has to find it again
+	client.m_nearest_unsent_d = 10;
+	client.popQueuedBlock(true);
+	UASSERTEQ(s16, client.m_nearest_unsent_d, 3);
+	UASSERT(client.m_blocks_queued.count(v3s16(3, 0, 0)) == 0);
+
+	client.restartBlockSearch();
+	UASSERT(!client.peekQueuedBlock());
+	UASSERTEQ(s16, client.m_nearest_unsent_d, 0);
+}
@@ -28,6 +28,7 @@ class TestSAO : public TestBase
 	void testActivate(ServerEnvironment *env);
 	void testStaticToFalse(ServerEnvironment *env);
 	void testStaticToTrue(ServerEnvironment *env);
+	void testResting(ServerEnvironment *env);
 
 private:
 	// enough for both removeRemovedObjects and deactivateFarObjects to be called
@@ -44,6 +45,13 @@ core.register_entity(":test:non_static", {
 		static_save = false,
 	}
 })
+core.register_entity(":test:physical", {
+	initial_properties = {
+		physical = true,
+		collide_with_objects = false,
+		static_save = false,
+	}
+})
 )";
 
 void TestSAO::runTests(IGameDef *gamedef)
@@ -87,6 +95,7 @@ void TestSAO::runTests(IGameDef *gamedef)
 	TEST(testActivate, &env);
 	TEST(testStaticToFalse, &env);
 	TEST(testStaticToTrue, &env);
+	TEST(testResting, &env);
 
 	env.deactivateBlocksAndObjects();
 }
@@ -300,3 +309,48 @@ void TestSAO::testStaticToTrue(ServerEnvironment *env)
 	UASSERTEQ(size_t, block->m_static_objects.getStoredSize(), 1);
 	UASSERTEQ(size_t, block->m_static_objects.getActiveSize(), 0);
 }
+
+void TestSAO::testResting(ServerEnvironment *env)
+{
+	Map &map = env->getMap();
+
+	const v3f testpos(0, 8 * BS, 300 * BS);
+	const v3s16 testblockpos = getNodeBlockPos(floatToInt(testpos, BS));
+	v3s16 bp;
+	for (bp.X = testblockpos.X - 1; bp.X <= testblockpos.X + 1; bp.X++)
+	for (bp.Y = testblockpos.Y - 1; bp.Y <= testblockpos.Y + 1; bp.Y++)
+	for (bp.Z = testblockpos.Z - 1; bp.Z <= testblockpos.Z + 1; bp.Z++)
+		UASSERT(map.emergeBlock(bp, true));
+
+	auto obj = add_entity(env, testpos, "test:physical");
+	UASSERT(obj);
+
+	// Nothing moves, so the physics are skipped from the second step on
+	env->step(0.05f);
+	UASSERT(!obj->isResting());
+	env->step(0.05f);
+	UASSERT(obj->isResting());
+	env->step(0.05f);
+	UASSERT(obj->isResting());
+	UASSERT(obj->getBasePosition() == testpos);
+
+	// Until a node close by is changed
+	UASSERT(env->setNode(floatToInt(testpos, BS) + v3s16(1, 0, 0), MapNode(CONTENT_AIR)));
+	env->step(0.05f);
+	UASSERT(!obj->isResting());
+	env->step(0.05f);
+	UASSERT(obj->isResting());
+
+	// Changes far away don't matter
+	env->setNode(floatToInt(testpos, BS) + v3s16(100, 0, 0), MapNode(CONTENT_AIR));
+	env->step(0.05f);
+	UASSERT(obj->isResting());
+
+	// Or until it is pushed
+	obj->setVelocity(v3f(0, BS, 0));
+	env->step(0.05f);
+	UASSERT(!obj->isResting());
+
+	obj->markForRemoval();
+	env->step(m_step_interval);
+}
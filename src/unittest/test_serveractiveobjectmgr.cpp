@@ -146,6 +146,19 @@ class TestServerActiveObjectMgr {
 		getObjectsInAreaNaive(box, expected);
 		compareObjects(actual, expected);
 	}
+
+	void compareObjectsInRange(const v3f &pos, float radius,
+			server::ObjectsInRange &state)
+	{
+		std::vector<u16> actual, expected;
+		saomgr.getActiveObjectsInRange(pos, "singleplayer", radius, 0, state, actual);
+		std::vector<ServerActiveObject *> objects;
+		getObjectsInsideRadiusNaive(pos, radius, objects);
+		for (auto *obj : objects)
+			expected.push_back(obj->getId());
+		std::sort(expected.begin(), expected.end());
+		CHECK(actual == expected);
+	}
 };
 
 
@@ -265,7 +278,7 @@ SECTION("get added active objects around pos") {
 	}
 
 	std::vector<u16> result;
-	std::set<u16> cur_objects;
+	std::vector<u16> cur_objects;
 	saomgr.getAddedActiveObjectsAroundPos(v3f(), "singleplayer", 100, 50, cur_objects, result);
 	CHECK(result.size() == 1);
 
@@ -299,6 +312,11 @@ SECTION("spatial index") {
 		}
 	};
 
+	// A player walking around, to cover the incremental updates of ObjectsInRange
+	server::ObjectsInRange in_range;
+	v3f player_pos;
+	std::uniform_real_distribution<f32> step(-20, 20);
+
 	const auto test_queries = [&]() {
 		std::uniform_real_distribution<f32> radius(0, 100);
 		saomgr.compareObjectsInsideRadius(random_pos(), radius(gen));
@@ -306,6 +324,9 @@ SECTION("spatial index") {
 		aabb3f box(random_pos(), random_pos());
 		box.repair();
 		saomgr.compareObjectsInArea(box);
+
+		player_pos += v3f(step(gen), step(gen), step(gen));
+		saomgr.compareObjectsInRange(player_pos, 400, in_range);
 	};
 
 	// Grow: Insertion twice as likely as deletion
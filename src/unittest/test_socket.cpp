@@ -6,10 +6,12 @@
 
 #include "constants.h"
 #include "log.h"
+#include "porting.h"
 #include "settings.h"
 #include "network/address.h"
 #include "network/networkexceptions.h"
 #include "network/socket.h"
+#include "util/serialize.h"
 
 class TestSocket : public TestBase {
 public:
@@ -25,6 +27,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatch();
 
 	static const int port = 30003;
 };
@@ -34,6 +37,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatch);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -135,3 +139,57 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatch()
+{
+	Address address(127, 0, 0, 1, port);
+	/*
+	 * Use the bind_address on systems with no localhost address,
+	 * like testIPv4Socket does
+	 */
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(g_settings->get("bind_address").c_str());
+		if (!bind_addr.isIPv6() && !bind_addr.isAny())
+			address = bind_addr;
+	} catch (ResolveError &e) {
+	}
+
+	UDPSocket socket(false);
+	socket.Bind(address);
+
+	// More than fit into one system call
+	constexpr int count = UDPSocket::BATCH_MAX + 6;
+	u8 sendbuffer[count][4];
+	UDPSocket::Datagram out[count];
+	for (int i = 0; i < count; i++) {
+		writeU32(sendbuffer[i], i);
+		out[i].address = address;
+		out[i].data = sendbuffer[i];
+		out[i].size = 4;
+	}
+	UASSERTEQ(int, socket.SendBatch(out, count), 0);
+
+	// Wait until all of them arrived, a fixed time may be too short
+	socket.setTimeoutMs(100);
+	u8 rcvbuffer[count][16];
+	UDPSocket::Datagram in[count];
+	int received = 0;
+	const u64 deadline = porting::getTimeMs() + 5000;
+	while (received < count && porting::getTimeMs() < deadline) {
+		for (int i = received; i < count; i++) {
+			in[i].data = rcvbuffer[i];
+			in[i].size = sizeof(rcvbuffer[i]);
+		}
+		int n = socket.ReceiveBatch(in + received, count - received);
+		UASSERT(n <= UDPSocket::BATCH_MAX);
+		received += n;
+	}
+
+	UASSERTEQ(int, received, count);
+	for (int i = 0; i < count; i++) {
+		UASSERTEQ(int, in[i].size, 4);
+		UASSERTEQ(u32, readU32(rcvbuffer[i]), i);
+		UASSERT(in[i].address == address);
+	}
+}
@@ -6,8 +6,12 @@
 
 #include <atomic>
 #include <iostream>
+#include <memory>
+#include "exceptions.h"
+#include "threading/mpsc_queue.h"
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "threading/worker_pool.h"
 
 
 class TestThreading : public TestBase {
@@ -19,6 +23,8 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
 	void testTLS();
+	void testWorkerPool();
+	void testMPSCQueue();
 };
 
 static TestThreading g_test_instance;
@@ -28,6 +34,8 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
 	TEST(testTLS);
+	TEST(testWorkerPool);
+	TEST(testMPSCQueue);
 }
 
 class SimpleTestThread : public Thread {
@@ -227,3 +235,108 @@ void TestThreading::testTLS()
 		}
 	}
 }
+
+
+void TestThreading::testWorkerPool()
+{
+	for (unsigned int num_threads : {0, 1, 4}) {
+		WorkerPool pool("TestPool", num_threads);
+		UASSERTEQ(unsigned int, pool.getThreadCount(), num_threads);
+
+		// Reuse the pool a couple times
+		for (size_t count : {0, 1, 7, 1000}) {
+			std::vector<u32> hits(count, 0);
+			pool.run(count, [&] (size_t i) {
+				hits[i]++;
+			});
+			for (u32 n : hits)
+				UASSERTEQ(u32, n, 1);
+		}
+
+		// Exceptions come through, but all work is still done
+		std::atomic<u32> done{0};
+		EXCEPTION_CHECK(BaseException, pool.run(100, [&] (size_t i) {
+			done++;
+			if (i == 50)
+				throw BaseException("test");
+		}));
+		UASSERTEQ(u32, done.load(), 100);
+	}
+}
+
+
+class QueueProducerThread : public Thread {
+public:
+	QueueProducerThread(MPSCQueue<std::pair<u32, u32>> &queue, u32 id,
+			Semaphore &trigger) :
+		Thread("QueueProducer"),
+		queue(queue),
+		id(id),
+		trigger(trigger)
+	{
+	}
+
+	static constexpr u32 COUNT = 20000;
+
+private:
+	void *run()
+	{
+		trigger.wait();
+		for (u32 i = 0; i < COUNT; i++)
+			queue.push({id, i});
+		return NULL;
+	}
+
+	MPSCQueue<std::pair<u32, u32>> &queue;
+	u32 id;
+	Semaphore &trigger;
+};
+
+
+void TestThreading::testMPSCQueue()
+{
+	{
+		MPSCQueue<std::unique_ptr<u32>> queue;
+		std::unique_ptr<u32> v;
+		UASSERT(queue.empty());
+		UASSERT(!queue.pop(v));
+		queue.push(std::make_unique<u32>(1));
+		queue.push(std::make_unique<u32>(2));
+		UASSERT(!queue.empty());
+		UASSERT(queue.pop(v) && *v == 1);
+		UASSERT(queue.pop(v) && *v == 2);
+		UASSERT(!queue.pop(v));
+		// left over items are freed by the destructor
+		queue.push(std::make_unique<u32>(3));
+	}
+
+	MPSCQueue<std::pair<u32, u32>> queue;
+	Semaphore trigger;
+	static const u32 num_threads = 4;
+
+	QueueProducerThread *threads[num_threads];
+	for (u32 i = 0; i < num_threads; i++) {
+		threads[i] = new QueueProducerThread(queue, i, trigger);
+		UASSERT(threads[i]->start());
+	}
+	trigger.post(num_threads);
+
+	// Everything arrives exactly once and in order per producer
+	u32 next[num_threads] = {};
+	u32 received = 0;
+	std::pair<u32, u32> item;
+	while (received < num_threads * QueueProducerThread::COUNT) {
+		if (!queue.pop(item))
+			continue;
+		UASSERT(item.first < num_threads);
+		UASSERTEQ(u32, item.second, next[item.first]);
+		next[item.first]++;
+		received++;
+	}
+
+	for (QueueProducerThread *thread : threads) {
+		thread->wait();
+		delete thread;
+	}
+	UASSERT(queue.empty());
+}
@@ -0,0 +1,125 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright (C) 2026 Luanti Contributors
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <unordered_map>
+#include <vector>
+
+/*
+	Hierarchical timer wheel: tells when keys become due, in ticks.
+
+	Level 0 has one slot per tick, every further level has slots SLOTS times
+	as wide as the one below. An entry is filed in the lowest level that
+	reaches its tick and moves down a level whenever the wheel turns past
+	the start of its slot, so advancing costs O(due entries) plus a small
+	constant per tick, no matter how many entries there are.
+	Entries beyond the reach of the top level go around it again.
+
+	Every key is due at most once. Scheduling a key that is scheduled for
+	an earlier (or the same) tick already does nothing.
+*/
+template <typename Key, typename Hash = std::hash<Key>>
+class TimerWheel
+{
+public:
+	u64 getTick() const { return m_now; }
+	size_t size() const { return m_scheduled.size(); }
+
+	/// Ticks that are not in the future become due with the next tick.
+	void schedule(const Key &key, u64 tick)
+	{
+		if (tick <= m_now)
+			tick = m_now + 1;
+		auto it = m_scheduled.find(key);
+		if (it != m_scheduled.end()) {
+			if (it->second <= tick)
+				return;
+			// the old entry stays behind and is skipped when reached
+			it->second = tick;
+		} else {
+			m_scheduled.emplace(key, tick);
+		}
+		insert(Entry{key, tick});
+	}
+
+	void unschedule(const Key &key)
+	{
+		m_scheduled.erase(key);
+	}
+
+	/// Moves forward to `tick`, appending the keys that became due.
+	void advance(u64 tick, std::vector<Key> &due)
+	{
+		while (m_now < tick) {
+			m_now++;
+			cascade();
+
+			auto &slot = m_slots[0][m_now & SLOT_MASK];
+			if (slot.empty())
+				continue;
+			std::vector<Entry> entries;
+			entries.swap(slot);
+			for (auto &e : entries) {
+				auto it = m_scheduled.find(e.key);
+				if (it == m_scheduled.end() || it->second != e.tick)
+					continue;
+				if (e.tick > m_now) {
+					insert(e);
+					continue;
+				}
+				m_scheduled.erase(it);
+				due.push_back(e.key);
+			}
+		}
+	}
+
+private:
+	static constexpr u32 LEVEL_BITS = 6;
+	static constexpr u32 SLOTS = 1 << LEVEL_BITS;
+	static constexpr u64 SLOT_MASK = SLOTS - 1;
+	static constexpr u32 LEVELS = 4;
+
+	struct Entry {
+		Key key;
+		u64 tick;
+	};
+
+	void insert(const Entry &e)
+	{
+		const u64 delta = e.tick > m_now ? e.tick - m_now : 0;
+		u32 level = 0;
+		while (level < LEVELS - 1 && delta >> (LEVEL_BITS * (level + 1)))
+			level++;
+		m_slots[level][(e.tick >> (LEVEL_BITS * level)) & SLOT_MASK].push_back(e);
+	}
+
+	// Moves the entries of the slots the wheel just reached down a level,
+	// starting at the top so they can fall through several levels.
+	void cascade()
+	{
+		u32 top = 0;
+		while (top < LEVELS - 1 &&
+				(m_now & ((u64(1) << (LEVEL_BITS * (top + 1))) - 1)) == 0)
+			top++;
+		for (u32 level = top; level > 0; level--) {
+			auto &slot = m_slots[level][(m_now >> (LEVEL_BITS * level)) & SLOT_MASK];
+			if (slot.empty())
+				continue;
+			std::vector<Entry> entries;
+			entries.swap(slot);
+			for (auto &e : entries) {
+				auto it = m_scheduled.find(e.key);
+				if (it != m_scheduled.end() && it->second == e.tick)
+					insert(e);
+			}
+		}
+	}
+
+	std::vector<Entry> m_slots[LEVELS][SLOTS];
+	// Current tick of every scheduled key
+	std::unordered_map<Key, u64, Hash> m_scheduled;
+	u64 m_now = 0;
+};